@@ -103,6 +103,9 @@ var (
 			"if true, TextColor and BackgroundColor of the document will be swapped"),
 		mkField("HideScrollbars", Bool, false,
 			"if true, hides the scrollbars but retains ability to scroll"),
+		mkField("RenderCacheSize", Int, 0,
+			"maximum amount of memory (in MB) used for caching rendered pages. "+
+				"if zero or negative, it's based on the amount of physical memory").setExpert().setVersion("3.6"),
 	}
 
 	comicBookUI = []*Field{
@@ -288,6 +291,9 @@ var (
 			"if true, we expose the SyncTeX inverse search command line in Settings -> Options"),
 		mkField("EscToExit", Bool, false,
 			"if true, Esc key closes SumatraPDF").setExpert(),
+		mkField("ExtractTextInBackground", Bool, false,
+			"if true, text of all pages is extracted in the background after a document is loaded, "+
+				"which makes searching the whole document faster").setExpert().setVersion("3.6"),
 		mkField("FullPathInTitle", Bool, false,
 			"if true, we show the full path to a file in the title bar").setExpert().setVersion("3.0"),
 		mkField("InverseSearchCmdLine", String, nil,
@@ -0,0 +1,142 @@
+// this file is compiled as part of mupdf library and ends up
+// in libmupdf.dll, to avoid issues related to crossing .dll boundaries
+// It measures text with the HarfBuzz and FreeType built into mupdf
+// (which libmupdf.dll doesn't export), for TextRenderMupdf
+#include "mupdf/fitz.h"
+
+#include "hb.h"
+#include "hb-ft.h"
+#include <ft2build.h>
+#include FT_FREETYPE_H
+
+// a HarfBuzz buffer that is re-used for shaping many strings
+typedef struct text_shaper {
+    hb_buffer_t* buf;
+} text_shaper;
+
+text_shaper* new_text_shaper(fz_context* ctx) {
+    text_shaper* shaper = fz_malloc_struct(ctx, text_shaper);
+    fz_hb_lock(ctx);
+    shaper->buf = hb_buffer_create();
+    fz_hb_unlock(ctx);
+    return shaper;
+}
+
+void drop_text_shaper(fz_context* ctx, text_shaper* shaper) {
+    if (!shaper) {
+        return;
+    }
+    fz_hb_lock(ctx);
+    hb_buffer_destroy(shaper->buf);
+    fz_hb_unlock(ctx);
+    fz_free(ctx, shaper);
+}
+
+static void destroy_hb_shaper_data(fz_context* ctx, void* handle) {
+    fz_hb_lock(ctx);
+    hb_font_destroy(handle);
+    fz_hb_unlock(ctx);
+}
+
+// must be called with fz_hb_lock() held. the HarfBuzz font is shared with
+// mupdf's html layout, which creates it the same way (see html-layout.c)
+static hb_font_t* get_hb_font(fz_context* ctx, fz_font* font, FT_Face face) {
+    fz_shaper_data_t* hb = fz_font_shaper_data(ctx, font);
+    if (!hb->shaper_handle) {
+        hb->destroy = destroy_hb_shaper_data;
+        hb->shaper_handle = hb_ft_font_create(face, NULL);
+    }
+    return hb->shaper_handle;
+}
+
+// returns the advance (in em) of the UTF-16 string s, which is shaped as a whole.
+// characters missing from font are measured in the fallback fonts mupdf uses for them
+float measure_text_shaped(fz_context* ctx, text_shaper* shaper, fz_font* font, const unsigned short* s, int len) {
+    FT_Face face = fz_font_ft_face(ctx, font);
+    hb_glyph_info_t* info = NULL;
+    hb_glyph_position_t* pos = NULL;
+    unsigned int n = 0;
+    unsigned int i;
+    int scale = 1;
+    int x = 0;
+    float dx = 0;
+    int fterr;
+
+    if (!face || len <= 0) {
+        return 0;
+    }
+
+    fz_hb_lock(ctx);
+    fz_try(ctx) {
+        // so that HarfBuzz positions are in font units
+        scale = face->units_per_EM;
+        fterr = FT_Set_Char_Size(face, scale, scale, 72, 72);
+        if (fterr) {
+            fz_throw(ctx, FZ_ERROR_LIBRARY, "freetype setting character size: %d", fterr);
+        }
+        hb_buffer_clear_contents(shaper->buf);
+        hb_buffer_set_cluster_level(shaper->buf, HB_BUFFER_CLUSTER_LEVEL_CHARACTERS);
+        hb_buffer_add_utf16(shaper->buf, s, len, 0, len);
+        hb_buffer_guess_segment_properties(shaper->buf);
+        hb_shape(get_hb_font(ctx, font, face), shaper->buf, NULL, 0);
+        info = hb_buffer_get_glyph_infos(shaper->buf, &n);
+        pos = hb_buffer_get_glyph_positions(shaper->buf, NULL);
+        for (i = 0; i < n; i++) {
+            if (info[i].codepoint != 0) {
+                x += pos[i].x_advance;
+            }
+        }
+    }
+    fz_always(ctx) {
+        fz_hb_unlock(ctx);
+    }
+    fz_catch(ctx) {
+        fz_rethrow(ctx);
+    }
+    dx = (float)x / scale;
+
+    // fz_encode_character_with_fallback() might have to load fonts, so this
+    // can't be done while holding the lock
+    for (i = 0; i < n; i++) {
+        unsigned int cluster = info[i].cluster;
+        int c;
+        int gid;
+        fz_font* fallback = font;
+        if (info[i].codepoint != 0 || cluster >= (unsigned int)len) {
+            continue;
+        }
+        c = s[cluster];
+        if (c >= 0xd800 && c < 0xdc00 && cluster + 1 < (unsigned int)len && s[cluster + 1] >= 0xdc00 &&
+            s[cluster + 1] < 0xe000) {
+            c = 0x10000 + ((c - 0xd800) << 10) + (s[cluster + 1] - 0xdc00);
+        }
+        gid = fz_encode_character_with_fallback(ctx, font, c, 0, 0, &fallback);
+        dx += fz_advance_glyph(ctx, fallback, gid, 0);
+    }
+    return dx;
+}
+
+// returns the kerning (in em) between the glyphs for characters c1 and c2
+// from the 'kern' table (fonts with OpenType tables have to be shaped instead)
+float measure_kerning(fz_context* ctx, fz_font* font, int c1, int c2) {
+    FT_Face face = fz_font_ft_face(ctx, font);
+    FT_Vector kern = {0, 0};
+    int gid1, gid2;
+    int fterr;
+
+    if (!face || !FT_HAS_KERNING(face)) {
+        return 0;
+    }
+    gid1 = fz_encode_character(ctx, font, c1);
+    gid2 = fz_encode_character(ctx, font, c2);
+    if (!gid1 || !gid2) {
+        return 0;
+    }
+    fz_ft_lock(ctx);
+    fterr = FT_Get_Kerning(face, gid1, gid2, FT_KERNING_UNSCALED, &kern);
+    fz_ft_unlock(ctx);
+    if (fterr) {
+        return 0;
+    }
+    return (float)kern.x / face->units_per_EM;
+}
@@ -559,6 +559,10 @@ typedef struct {
     synctex_io_mode_t io_mode;
 } synctex_open_s;
 
+/*  SumatraPDF: defined in PdfSync.cpp so that the UTF-8 path can be opened on Windows
+ *  (gzopen only understands paths in the ANSI code page) */
+gzFile _synctex_gzopen(const char * path, const char * mode);
+
 /*	This functions opens the file at the "output" given location.
  *  It manages the problem of quoted filenames that appear with pdftex and filenames containing the space character.
  *  In TeXLive 2008, the synctex file created with pdftex did contain unexpected quotes.
@@ -614,7 +618,7 @@ static synctex_open_s __synctex_open_v2(const char * output, synctex_io_mode_t i
         free(quoteless_synctex_name);
         quoteless_synctex_name = NULL;
     }
-    if (NULL == (open.file = gzopen(open.synctex,mode))) {
+    if (NULL == (open.file = _synctex_gzopen(open.synctex,mode))) {
         /*  Could not open this file */
         if (errno != ENOENT) {
             /*  The file does exist, this is a lower level error, I can't do anything. */
@@ -633,7 +637,7 @@ static synctex_open_s __synctex_open_v2(const char * output, synctex_io_mode_t i
             free(quoteless_synctex_name);
             quoteless_synctex_name = NULL;
         }
-        if (NULL == (open.file = gzopen(open.synctex,mode))) {
+        if (NULL == (open.file = _synctex_gzopen(open.synctex,mode))) {
             /*  Could not open this file */
             if (errno != ENOENT) {
                 /*  The file does exist, this is a lower level error, I can't do anything. */
@@ -649,7 +653,7 @@ static synctex_open_s __synctex_open_v2(const char * output, synctex_io_mode_t i
         if (rename(open.synctex,quoteless_synctex_name)) {
             _synctex_error("Could not rename %s to %s, error %i\n",open.synctex,quoteless_synctex_name,errno);
             /*	We could not rename, reopen the file with the quoted name. */
-            if (NULL == (open.file = gzopen(open.synctex,mode))) {
+            if (NULL == (open.file = _synctex_gzopen(open.synctex,mode))) {
                 /*  No luck, could not re open this file, something has happened meanwhile */
                 if (errno != ENOENT) {
                     /*  The file does not exist any more, it has certainly be removed somehow
@@ -660,7 +664,7 @@ static synctex_open_s __synctex_open_v2(const char * output, synctex_io_mode_t i
             }
         } else {
             /*  The file has been successfully renamed */
-            if (NULL == (open.file = gzopen(quoteless_synctex_name,mode))) {
+            if (NULL == (open.file = _synctex_gzopen(quoteless_synctex_name,mode))) {
                 /*  Could not open this file */
                 if (errno != ENOENT) {
                     /*  The file does exist, this is a lower level error, I can't do anything. */
@@ -139,4 +139,11 @@ fz_image *fz_new_image_from_display_list(fz_context *ctx, float w, float h, fz_d
 */
 int fz_display_list_is_empty(fz_context *ctx, const fz_display_list *list);
 
+/**
+	SumatraPDF: Return the amount of memory used by the drawing
+	commands of a display list (not including the resources, like
+	images and fonts, that they reference).
+*/
+size_t fz_display_list_size(fz_context *ctx, const fz_display_list *list);
+
 #endif
@@ -779,6 +779,7 @@ function utils_files()
     "StrUtil.*",
     "StrVec.*",
     "StrQueue.*",
+    "StrSearch.*",
     "TempAllocator.*",
     "ThreadUtil.*",
     "TgaReader.*",
@@ -790,6 +791,7 @@ function utils_files()
     "WebpReader.*",
     "WinDynCalls.*",
     "WinUtil.*",
+    "WordIndex.*",
     "ZipUtil.*",
   })
   filter {"configurations:Debug or DebugFull"}
@@ -833,6 +835,7 @@ function engines_files()
     "MobiDoc.*",
     "PdfCreator.*",
     "PalmDbReader.*",
+    "StyleSheet.*",
   })
 end
 
@@ -844,7 +847,7 @@ function chm_files()
 end
 
 function mupdf_files()
-  files { "ext/mupdf_load_system_font.c" }
+  files { "ext/mupdf_load_system_font.c", "ext/mupdf_measure_text.c" }
 
   files_in_dir("mupdf/source/cbz", {
     "mucbz.c",
@@ -1196,6 +1199,7 @@ function test_util_files()
     "StrUtil.*",
     "StrVec.*",
     "StrQueue.*",
+    "StrSearch.*",
     "SquareTreeParser.*",
     "TrivialHtmlParser.*",
     "TempAllocator.*",
@@ -1203,6 +1207,7 @@ function test_util_files()
     "Vec.*",
     "WinUtil.*",
     "WinDynCalls.*",
+    "WordIndex.*",
     "tests/*"
   })
   files_in_dir("src", {
@@ -1214,6 +1219,7 @@ function test_util_files()
     "Flags.*",
     "SumatraConfig.*",
     "SettingsStructs.*",
+    "StyleSheet.*",
     "SumatraUnitTests.cpp",
     "tools/test_util.cpp"
   })
@@ -1256,6 +1262,7 @@ function pdf_preview_files()
     "MUPDF_Exports.cpp",
     "PalmDbReader.*",
     "PdfCreator.*",
+    "StyleSheet.*",
     "SumatraConfig.*",
   })
 end
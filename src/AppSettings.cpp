@@ -19,6 +19,7 @@
 #include "EngineAll.h"
 #include "SumatraConfig.h"
 #include "DisplayModel.h"
+#include "RenderCache.h"
 #include "FileHistory.h"
 #include "GlobalPrefs.h"
 #include "ProgressUpdateUI.h"
@@ -462,6 +463,7 @@ static void ReloadSettings() {
         UpdateControlsColors(win);
     }
 
+    gRenderCache->SetMaxCacheSize(gGlobalPrefs->fixedPageUI.renderCacheSize);
     UpdateDocumentColors();
     UpdateFixedPageScrollbarsVisibility();
 }
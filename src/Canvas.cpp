@@ -991,8 +991,10 @@ static bool DrawDocument(MainWindow* win, HDC hdc, RECT* rcArea) {
     Rect screen(Point(), dm->GetViewPort().Size());
 
     bool isRtl = IsUIRtl();
-    for (int pageNo = 1; pageNo <= dm->PageCount(); ++pageNo) {
-        PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+    // only pages between the first and the last visible page can be visible
+    int lastVisiblePageNo = dm->LastVisiblePageNo();
+    for (int pageNo = dm->FirstVisiblePageNo(); pageNo > 0 && pageNo <= lastVisiblePageNo; ++pageNo) {
+        PageInfo* pageInfo = dm->GetPageInfoOnScreen(pageNo);
         if (!pageInfo || 0.0f == pageInfo->visibleRatio) {
             continue;
         }
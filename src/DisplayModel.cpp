@@ -252,8 +252,21 @@ SizeF DisplayModel::PageSizeAfterRotation(int pageNo, bool fitToContent) const {
         }
     }
 
-    RectF box = fitToContent ? pageInfo->contentBox : pageInfo->page;
-    return engine->Transform(box, pageNo, 1.0, rotation).Size();
+    if (fitToContent) {
+        return engine->Transform(pageInfo->contentBox, pageNo, 1.0, rotation).Size();
+    }
+
+    // Relayout() needs the sizes of all pages, so don't ask the engine every time
+    int nPages = PageCount();
+    if (rotatedPageSizes.Size() != nPages || rotatedPageSizesRotation != rotation) {
+        rotatedPageSizes.SetSize(nPages);
+        rotatedPageSizesRotation = rotation;
+    }
+    SizeF& size = rotatedPageSizes[pageNo - 1];
+    if (size.IsEmpty()) {
+        size = engine->Transform(pageInfo->page, pageNo, 1.0, rotation).Size();
+    }
+    return size;
 }
 
 /* given 'columns' and an absolute 'pageNo', return the number of the first
@@ -309,6 +322,10 @@ DisplayModel::DisplayModel(EngineBase* engine, DocControllerCallback* cb) : DocC
     textCache = new DocumentTextCache(engine);
     textSelection = new TextSelection(engine, textCache);
     textSearch = new TextSearch(engine, textCache);
+    textSearchCounter = new TextSearch(engine, textCache);
+    if (gGlobalPrefs->extractTextInBackground) {
+        textCache->StartExtractingAll();
+    }
 }
 
 DisplayModel::~DisplayModel() {
@@ -317,6 +334,7 @@ DisplayModel::~DisplayModel() {
 
     delete pdfSync;
     delete textSearch;
+    delete textSearchCounter;
     delete textSelection;
     delete textCache;
     SafeEngineRelease(&engine);
@@ -331,12 +349,26 @@ PageInfo* DisplayModel::GetPageInfo(int pageNo) const {
     return &(pagesInfo[pageNo - 1]);
 }
 
+PageInfo* DisplayModel::GetPageInfoOnScreen(int pageNo) const {
+    PageInfo* pageInfo = GetPageInfo(pageNo);
+    if (pageInfo && pageInfo->pageOnScreenGen != pageOnScreenGen) {
+        // RecalcVisibleParts() only updates the visible pages
+        pageInfo->pageOnScreen = pageInfo->pos;
+        pageInfo->pageOnScreen.Offset(-pageOnScreenOrigin.x, -pageOnScreenOrigin.y);
+        pageInfo->pageOnScreenGen = pageOnScreenGen;
+    }
+    return pageInfo;
+}
+
 // Call this before the first Relayout
 void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newStartPage, Size viewPort, int screenDPI) {
     totalViewPortSize = viewPort;
     dpiFactor = 1.0f * screenDPI / engine->GetFileDPI();
     if (ValidPageNo(newStartPage)) {
         startPage = newStartPage;
+    } else if (engine->IsPageCountProvisional()) {
+        // go there once the page has been layed out (see ReloadPages())
+        deferredStartPage = newStartPage;
     }
 
     displayMode = newDisplayMode;
@@ -368,10 +400,85 @@ void DisplayModel::SetInitialViewSettings(DisplayMode newDisplayMode, int newSta
     BuildPagesInfo();
 }
 
+// rebuilds page info and text caches after the engine's pages have changed
+// (e.g. for a different encoding or after all pages of an ebook have been layed out)
+void DisplayModel::ReloadPages() {
+    delete textSearch;
+    delete textSearchCounter;
+    delete textSelection;
+    delete textCache;
+    engine->UpdatePageCount();
+
+    free(pagesInfo);
+    pagesInfo = nullptr;
+    BuildPagesInfo();
+
+    textCache = new DocumentTextCache(engine);
+    textSelection = new TextSelection(engine, textCache);
+    textSearch = new TextSearch(engine, textCache);
+    textSearchCounter = new TextSearch(engine, textCache);
+    if (gGlobalPrefs->extractTextInBackground) {
+        textCache->StartExtractingAll();
+    }
+
+    Relayout(zoomVirtual, rotation);
+    if (ValidPageNo(deferredStartPage)) {
+        GoToPage(deferredStartPage, false);
+    }
+    deferredStartPage = 0;
+}
+
+// layout pages with an empty mediabox as A4 size (resp. letter size)
+static RectF DefaultPageRect(EngineBase* engine) {
+    float fileDPI = engine->GetFileDPI();
+    if (0 == GetMeasurementSystem()) {
+        return RectF(0, 0, 21.0 / 2.54 * fileDPI, 29.7 / 2.54 * fileDPI);
+    }
+    return RectF(0, 0, 8.5 * fileDPI, 11 * fileDPI);
+}
+
+// re-reads the page sizes for engines which only guess some of them at
+// first (see EngineMupdf::ResolvePageSizes()) and relayouts if any changed
+// returns false if no page size changed
+bool DisplayModel::UpdatePageSizes() {
+    RectF defaultRect = DefaultPageRect(engine);
+    int pageCount = PageCount();
+    Vec<RectF> pageSizes;
+    int nChanged = 0;
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        RectF page = engine->PageMediabox(pageNo);
+        if (page.IsEmpty()) {
+            page = defaultRect;
+        }
+        pageSizes.Append(page);
+        if (page != GetPageInfo(pageNo)->page) {
+            nChanged++;
+        }
+    }
+    if (nChanged == 0) {
+        return false;
+    }
+    logf("DisplayModel::UpdatePageSizes: %d pages changed size\n", nChanged);
+
+    // stay at the same position in the current page
+    ScrollState ss = GetScrollState();
+    for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
+        GetPageInfo(pageNo)->page = pageSizes[pageNo - 1];
+    }
+    rotatedPageSizes.Reset();
+    Relayout(zoomVirtual, rotation);
+    SetScrollState(ss);
+    return true;
+}
+
 void DisplayModel::BuildPagesInfo() {
     ReportIf(pagesInfo);
     int pageCount = PageCount();
     pagesInfo = AllocArray<PageInfo>(pageCount);
+    rows.Reset();
+    firstVisiblePageNo = kInvalidPageNo;
+    lastVisiblePageNo = kInvalidPageNo;
+    rotatedPageSizes.Reset();
 
     log("DisplayModel::BuildPagesInfo started\n");
     auto timeStart = TimeGet();
@@ -380,13 +487,7 @@ void DisplayModel::BuildPagesInfo() {
         logf("DisplayModel::BuildPagesInfo took %.2f ms\n", dur);
     };
 
-    RectF defaultRect;
-    float fileDPI = engine->GetFileDPI();
-    if (0 == GetMeasurementSystem()) {
-        defaultRect = RectF(0, 0, 21.0 / 2.54 * fileDPI, 29.7 / 2.54 * fileDPI);
-    } else {
-        defaultRect = RectF(0, 0, 8.5 * fileDPI, 11 * fileDPI);
-    }
+    RectF defaultRect = DefaultPageRect(engine);
 
     int columns = ColumnsFromDisplayMode(displayMode);
     int newStartPage = startPage;
@@ -397,7 +498,6 @@ void DisplayModel::BuildPagesInfo() {
     for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         pageInfo->page = engine->PageMediabox(pageNo);
-        // layout pages with an empty mediabox as A4 size (resp. letter size)
         if (pageInfo->page.IsEmpty()) {
             pageInfo->page = defaultRect;
         }
@@ -539,16 +639,15 @@ int DisplayModel::FirstVisiblePageNo() const {
     if (!pagesInfo) {
         return kInvalidPageNo;
     }
+    return firstVisiblePageNo;
+}
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0) {
-            return pageNo;
-        }
+int DisplayModel::LastVisiblePageNo() const {
+    ReportIf(!pagesInfo);
+    if (!pagesInfo) {
+        return kInvalidPageNo;
     }
-
-    /* If no pages are visible */
-    return kInvalidPageNo;
+    return lastVisiblePageNo;
 }
 
 // we consider the most visible page the current one
@@ -566,7 +665,7 @@ int DisplayModel::CurrentPageNo() const {
     int mostVisiblePage = kInvalidPageNo;
     float ratio = 0;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
+    for (int pageNo = firstVisiblePageNo; ValidPageNo(pageNo) && pageNo <= lastVisiblePageNo; pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (pageInfo->visibleRatio > ratio) {
             mostVisiblePage = pageNo;
@@ -673,6 +772,7 @@ void DisplayModel::Relayout(float newZoomVirtual, int newRotation) {
 
 RestartLayout:
     int currPosY = windowMargin.top;
+    rows.Clear();
     float currZoomReal = zoomReal;
     CalcZoomReal(newZoomVirtual);
 
@@ -688,6 +788,7 @@ RestartLayout:
     int columnMaxWidth[2] = {0, 0};
     int pageInARow = 0;
     int rowMaxPageDy = 0;
+    LayoutRow row;
     for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (!pageInfo->shown) {
@@ -736,9 +837,17 @@ RestartLayout:
 
         pageInfo->pos = pos;
 
+        if (0 == row.firstPageNo) {
+            row.firstPageNo = pageNo;
+        }
+        row.lastPageNo = pageNo;
         pageInARow++;
         ReportIf(pageInARow > columns);
         if (pageInARow == columns) {
+            row.y = currPosY;
+            row.dy = rowMaxPageDy;
+            rows.Append(row);
+            row = LayoutRow();
             /* starting next row */
             currPosY += rowMaxPageDy + pageSpacing.dy;
             rowMaxPageDy = 0;
@@ -748,6 +857,9 @@ RestartLayout:
 
     if (pageInARow != 0) {
         /* this is a partial row */
+        row.y = currPosY;
+        row.dy = rowMaxPageDy;
+        rows.Append(row);
         currPosY += rowMaxPageDy + pageSpacing.dy;
     }
     // restart the layout if we detect we need to show scrollbars
@@ -849,6 +961,9 @@ RestartLayout:
             }
             pageInfo->pos.y += offY;
         }
+        for (LayoutRow& r : rows) {
+            r.y += offY;
+        }
     }
 
     canvasSize = Size(std::max(canvasDx, viewPort.dx), std::max(canvasDy, viewPort.dy));
@@ -863,6 +978,7 @@ void DisplayModel::ChangeStartPage(int newStartPage) {
     if (IsBookView(GetDisplayMode()) && newStartPage == 1 && columns > 1) {
         newStartPage--;
     }
+    ResetVisibleParts();
     for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
         PageInfo* pageInfo = GetPageInfo(pageNo);
         if (IsContinuous(GetDisplayMode())) {
@@ -873,7 +989,6 @@ void DisplayModel::ChangeStartPage(int newStartPage) {
         } else {
             pageInfo->shown = false;
         }
-        pageInfo->visibleRatio = 0.0;
     }
     Relayout(zoomVirtual, rotation);
 }
@@ -881,32 +996,72 @@ void DisplayModel::ChangeStartPage(int newStartPage) {
 /* Given positions of each page in a large sheet that is continuous view and
    coordinates of a current view into that large sheet, calculate which
    parts of each page is visible on the screen.
-   Needs to be recalucated after scrolling the view. */
+   Needs to be recalucated after scrolling the view.
+   Only looks at the rows overlapping the view port, so that scrolling
+   doesn't get slower with the number of pages. */
 void DisplayModel::RecalcVisibleParts() const {
     ReportIf(!pagesInfo);
     if (!pagesInfo) {
         return;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (!pageInfo->shown) {
-            ReportIf(0.0 != pageInfo->visibleRatio);
-            continue;
-        }
-
-        Rect pageRect = pageInfo->pos;
-        Rect visiblePart = pageRect.Intersect(viewPort);
+    ResetVisibleParts();
+    // invalidates pageOnScreen of all pages (see GetPageInfoOnScreen())
+    pageOnScreenGen++;
+    pageOnScreenOrigin = viewPort.TL();
 
-        pageInfo->visibleRatio = 0.0;
-        if (!visiblePart.IsEmpty()) {
+    int nRows = rows.Size();
+    for (int rowNo = FindRowNo(viewPort.y); rowNo < nRows && rows[rowNo].y < viewPort.y + viewPort.dy; rowNo++) {
+        LayoutRow& row = rows[rowNo];
+        for (int pageNo = row.firstPageNo; pageNo <= row.lastPageNo; pageNo++) {
+            PageInfo* pageInfo = GetPageInfo(pageNo);
+            ReportIf(!pageInfo->shown);
+            // the rendering threads only look at pageOnScreen of visible pages
+            pageInfo->pageOnScreen = pageInfo->pos;
+            pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
+            pageInfo->pageOnScreenGen = pageOnScreenGen;
+
+            Rect pageRect = pageInfo->pos;
+            Rect visiblePart = pageRect.Intersect(viewPort);
+            if (visiblePart.IsEmpty()) {
+                continue;
+            }
             ReportIf(pageRect.dx <= 0 || pageRect.dy <= 0);
             // calculate with floating point precision to prevent an integer overflow
             pageInfo->visibleRatio = 1.0f * visiblePart.dx * visiblePart.dy / ((float)pageRect.dx * pageRect.dy);
+            if (kInvalidPageNo == firstVisiblePageNo) {
+                firstVisiblePageNo = pageNo;
+            }
+            lastVisiblePageNo = pageNo;
+        }
+    }
+}
+
+// sets visibleRatio of all pages visible after the last RecalcVisibleParts() to 0
+void DisplayModel::ResetVisibleParts() const {
+    if (kInvalidPageNo != firstVisiblePageNo) {
+        for (int pageNo = firstVisiblePageNo; pageNo <= lastVisiblePageNo; pageNo++) {
+            pagesInfo[pageNo - 1].visibleRatio = 0.0;
         }
-        pageInfo->pageOnScreen = pageRect;
-        pageInfo->pageOnScreen.Offset(-viewPort.x, -viewPort.y);
     }
+    firstVisiblePageNo = kInvalidPageNo;
+    lastVisiblePageNo = kInvalidPageNo;
+}
+
+// returns the index of the first row which ends below y on the
+// canvas (or the number of rows if all rows end above y)
+int DisplayModel::FindRowNo(int y) const {
+    int lo = 0;
+    int hi = rows.Size();
+    while (lo < hi) {
+        int mid = (lo + hi) / 2;
+        if (rows[mid].y + rows[mid].dy <= y) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
 }
 
 int DisplayModel::GetPageNoByPoint(Point pt) const {
@@ -915,13 +1070,15 @@ int DisplayModel::GetPageNoByPoint(Point pt) const {
         return -1;
     }
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        ReportIf(!(0.0 == pageInfo->visibleRatio || pageInfo->shown));
-        if (!pageInfo->shown) {
-            continue;
-        }
-
+    // pt is relative to the view port for which pageOnScreen was calculated
+    int rowNo = FindRowNo(pt.y + pageOnScreenOrigin.y);
+    if (rowNo >= rows.Size()) {
+        return -1;
+    }
+    LayoutRow& row = rows[rowNo];
+    for (int pageNo = row.firstPageNo; pageNo <= row.lastPageNo; pageNo++) {
+        PageInfo* pageInfo = GetPageInfoOnScreen(pageNo);
+        ReportIf(!pageInfo->shown);
         if (pageInfo->pageOnScreen.Contains(pt)) {
             return pageNo;
         }
@@ -938,22 +1095,25 @@ int DisplayModel::GetPageNextToPoint(Point pt) const {
     unsigned int maxDist = UINT_MAX;
     int closest = startPage;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        ReportIf(0.0 != pageInfo->visibleRatio && !pageInfo->shown);
-        if (!pageInfo->shown) {
-            continue;
-        }
+    // the closest page is in the row at pt or in one of its neighbors
+    int nRows = rows.Size();
+    int rowNo = std::min(FindRowNo(pt.y + pageOnScreenOrigin.y), nRows - 1);
+    for (int i = std::max(rowNo - 1, 0); i <= rowNo + 1 && i < nRows; i++) {
+        LayoutRow& row = rows[i];
+        for (int pageNo = row.firstPageNo; pageNo <= row.lastPageNo; pageNo++) {
+            PageInfo* pageInfo = GetPageInfoOnScreen(pageNo);
+            ReportIf(!pageInfo->shown);
 
-        if (pageInfo->pageOnScreen.Contains(pt)) {
-            return pageNo;
-        }
+            if (pageInfo->pageOnScreen.Contains(pt)) {
+                return pageNo;
+            }
 
-        Rect r = pageInfo->pageOnScreen;
-        unsigned int dist = distSq(pt.x - r.x - r.dx / 2, pt.y - r.y - r.dy / 2);
-        if (dist < maxDist) {
-            closest = pageNo;
-            maxDist = dist;
+            Rect r = pageInfo->pageOnScreen;
+            unsigned int dist = distSq(pt.x - r.x - r.dx / 2, pt.y - r.y - r.dy / 2);
+            if (dist < maxDist) {
+                closest = pageNo;
+                maxDist = dist;
+            }
         }
     }
 
@@ -986,7 +1146,7 @@ static float getZoomSafe(DisplayModel* dm, int pageNo, const PageInfo* pageInfo)
 }
 
 Point DisplayModel::CvtToScreen(int pageNo, PointF pt) {
-    PageInfo* pageInfo = GetPageInfo(pageNo);
+    PageInfo* pageInfo = GetPageInfoOnScreen(pageNo);
     if (!pageInfo) {
         const char* isValid = ValidPageNo(pageNo) ? "yes" : "no";
         logf("DisplayModel::CvtToScreen: GetPageInfo(%d) failed, is valid page: %s\n", pageNo, isValid);
@@ -1016,7 +1176,7 @@ PointF DisplayModel::CvtFromScreen(Point pt, int pageNo) {
         pageNo = GetPageNextToPoint(pt);
     }
 
-    const PageInfo* pageInfo = GetPageInfo(pageNo);
+    const PageInfo* pageInfo = GetPageInfoOnScreen(pageNo);
     ReportIf(!pageInfo);
     if (!pageInfo) {
         return PointF();
@@ -1095,28 +1255,19 @@ bool DisplayModel::IsOverText(Point pt) {
 }
 
 void DisplayModel::RenderVisibleParts() {
-    int firstVisiblePage = 0;
-    int lastVisiblePage = 0;
+    int firstVisiblePage = firstVisiblePageNo;
+    int lastVisiblePage = lastVisiblePageNo;
 
-    for (int pageNo = 1; pageNo <= PageCount(); ++pageNo) {
-        PageInfo* pageInfo = GetPageInfo(pageNo);
-        if (pageInfo->visibleRatio > 0.0) {
-            ReportIf(!pageInfo->shown);
-            if (0 == firstVisiblePage) {
-                firstVisiblePage = pageNo;
-            }
-            lastVisiblePage = pageNo;
-        }
-    }
     // no page is visible if e.g. the window is resized
     // vertically until only the title bar remains visible
-    if (0 == firstVisiblePage) {
+    if (kInvalidPageNo == firstVisiblePage) {
         return;
     }
 
-    // rendering happens LIFO except if the queue is currently
-    // empty, so request the visible pages first and last to
-    // make sure they're rendered before the predicted pages
+    // visible tiles are rendered first, then predicted pages
+    // (closest first, in scrolling direction first), so request
+    // the visible pages first and last to make sure they're
+    // not dropped from the queue by the predicted pages
     for (int pageNo = firstVisiblePage; pageNo <= lastVisiblePage; pageNo++) {
         cb->RequestRendering(pageNo);
     }
@@ -1212,6 +1363,11 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
         AddNavPoint();
     }
 
+    int currPageNo = CurrentPageNo();
+    if (pageNo != currPageNo) {
+        scrollDirection = pageNo > currPageNo ? 1 : -1;
+    }
+
     /* in facing mode only start at odd pages (odd because page
        numbering starts with 1, so odd is really an even page) */
     bool scrollToNextPage = false;
@@ -1228,9 +1384,10 @@ void DisplayModel::GoToPage(int pageNo, int scrollY, bool addNavPt, int scrollX)
     } else if (kZoomFitContent == zoomVirtual) {
         // make sure that CalcZoomReal uses the correct page to calculate
         // the zoom level for (visibility will be recalculated below anyway)
-        for (int i = PageCount(); i > 0; i--) {
-            GetPageInfo(i)->visibleRatio = (i == pageNo ? 1.0f : 0);
-        }
+        ResetVisibleParts();
+        GetPageInfo(pageNo)->visibleRatio = 1.0f;
+        firstVisiblePageNo = pageNo;
+        lastVisiblePageNo = pageNo;
         Relayout(zoomVirtual, rotation);
     }
     // lf("DisplayModel::GoToPage(pageNo=%d, scrollY=%d)", pageNo, scrollY);
@@ -1315,10 +1472,10 @@ void DisplayModel::SetDisplayMode(DisplayMode newDisplayMode, bool keepContinuou
         /* mark all pages as shown but not yet visible. The equivalent code
            for non-continuous mode is in DisplayModel::changeStartPage() called
            from DisplayModel::GoToPage() */
+        ResetVisibleParts();
         for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
             PageInfo* pageInfo = &(pagesInfo[pageNo - 1]);
             pageInfo->shown = true;
-            pageInfo->visibleRatio = 0.0;
         }
         Relayout(zoomVirtual, rotation);
     }
@@ -1386,7 +1543,7 @@ bool DisplayModel::GoToPrevPage(int scrollY) {
         top = GetContentStart(currPageNo);
     }
 
-    PageInfo* pageInfo = GetPageInfo(currPageNo);
+    PageInfo* pageInfo = GetPageInfoOnScreen(currPageNo);
     if (zoomVirtual == kZoomFitContent && -pageInfo->pageOnScreen.y <= top.y) {
         scrollY = 0; // continue, even though the current page isn't fully visible
     } else if (std::max(-pageInfo->pageOnScreen.y, 0) > scrollY && IsContinuous(GetDisplayMode())) {
@@ -1402,7 +1559,7 @@ bool DisplayModel::GoToPrevPage(int scrollY) {
 
     // scroll to the bottom of the page
     if (-1 == scrollY) {
-        scrollY = GetPageInfo(firstPageInNewRow)->pageOnScreen.dy;
+        scrollY = GetPageInfoOnScreen(firstPageInNewRow)->pageOnScreen.dy;
     }
 
     GoToPage(firstPageInNewRow, scrollY);
@@ -1463,6 +1620,9 @@ void DisplayModel::ScrollXBy(int dx) {
 
 void DisplayModel::ScrollYTo(int yOff) {
     int currPageNo = CurrentPageNo();
+    if (yOff != viewPort.y) {
+        scrollDirection = yOff > viewPort.y ? 1 : -1;
+    }
     viewPort.y = yOff;
     RecalcVisibleParts();
     RenderVisibleParts();
@@ -1760,7 +1920,7 @@ bool DisplayModel::ScrollScreenToRect(int pageNo, Rect extremes) {
         return false;
     }
 
-    PageInfo* pageInfo = GetPageInfo(pageNo);
+    PageInfo* pageInfo = GetPageInfoOnScreen(pageNo);
     int sx = 0, sy = 0;
 
     // vertically, we try to position the search result between 40%
@@ -1803,7 +1963,7 @@ ScrollState DisplayModel::GetScrollState() {
         ReportIf(!ValidPageNo(state.page));
     }
 
-    PageInfo* pageInfo = GetPageInfo(state.page);
+    PageInfo* pageInfo = GetPageInfoOnScreen(state.page);
     // Shortcut: don't calculate precise positions, if the
     // page wasn't scrolled right/down at all
     if (!pageInfo || pageInfo->pageOnScreen.x > 0 && pageInfo->pageOnScreen.y > 0) {
@@ -1979,7 +2139,7 @@ void DisplayModel::ScrollTo(int pageNo, RectF rect, float zoom) {
             scroll.x = -1;
         }
         if (DEST_USE_DEFAULT == rect.y) {
-            PageInfo* pageInfo = GetPageInfo(CurrentPageNo());
+            PageInfo* pageInfo = GetPageInfoOnScreen(CurrentPageNo());
             scroll.y = -(pageInfo->pageOnScreen.y - windowMargin.top);
         }
         // logf("DisplayModel::ScrollToLink /XYZ END [zoom] real=%f virtual=%f\n", zoomReal, zoomVirtual);
@@ -25,8 +25,11 @@ struct PageInfo {
 
     /* data that changes due to scrolling. Calculated in DisplayModel::RecalcVisibleParts() */
     float visibleRatio; /* (0.0 = invisible, 1.0 = fully visible) */
-    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y) */
+    /* position of page relative to visible view port: pos.Offset(-viewPort.x, -viewPort.y)
+       only calculated for visible pages in RecalcVisibleParts(), for the others
+       it's calculated on access in DisplayModel::GetPageInfoOnScreen() */
     Rect pageOnScreen{};
+    int pageOnScreenGen = 0;
 
     // when zoomVirtual in DisplayMode is kZoomFitPage, kZoomFitWidth
     // or kZoomFitContent, this is per-page zoom level
@@ -37,6 +40,16 @@ struct PageInfo {
     bool shown = false;
 };
 
+/* A row of shown pages on the canvas. Rows are ordered by y which allows
+   finding the pages at a given position with a binary search */
+struct LayoutRow {
+    int firstPageNo = 0;
+    int lastPageNo = 0;
+    /* vertical extent of the row, i.e. of its tallest page */
+    int y = 0;
+    int dy = 0;
+};
+
 /* The current scroll state (needed for saving/restoring the scroll position) */
 /* coordinates are in user space units (per page) */
 struct ScrollState {
@@ -131,13 +144,23 @@ struct DisplayModel : DocController {
     TextSelection* textSelection = nullptr;
     // access only from Search thread
     TextSearch* textSearch = nullptr;
+    // counts the matches of a new search (after textSearch has found the first one),
+    // also only accessed from Search thread
+    TextSearch* textSearchCounter = nullptr;
 
+    // doesn't modify the PageInfo, so it can also be called from the rendering threads
+    // (pageOnScreen is only up to date for the visible pages)
     PageInfo* GetPageInfo(int pageNo) const;
+    // like GetPageInfo() but also updates pageOnScreen of pages that aren't visible
+    // only call from the UI thread
+    PageInfo* GetPageInfoOnScreen(int pageNo) const;
 
     /* current rotation selected by user */
     int GetRotation() const;
     float GetZoomReal(int pageNo) const;
     void Relayout(float zoomVirtual, int rotation);
+    void ReloadPages();
+    bool UpdatePageSizes();
 
     Rect GetViewPort() const;
     bool IsHScrollbarVisible() const;
@@ -154,6 +177,7 @@ struct DisplayModel : DocController {
     bool PageVisible(int pageNo) const;
     bool PageVisibleNearby(int pageNo) const;
     int FirstVisiblePageNo() const;
+    int LastVisiblePageNo() const;
     bool FirstBookPageVisible() const;
     bool LastBookPageVisible() const;
 
@@ -204,6 +228,8 @@ struct DisplayModel : DocController {
     void ChangeStartPage(int startPage);
     Point GetContentStart(int pageNo) const;
     void RecalcVisibleParts() const;
+    void ResetVisibleParts() const;
+    int FindRowNo(int y) const;
     void RenderVisibleParts();
     void AddNavPoint();
     RectF GetContentBox(int pageNo) const;
@@ -216,12 +242,29 @@ struct DisplayModel : DocController {
 
     /* an array of PageInfo, len of array is pageCount */
     PageInfo* pagesInfo = nullptr;
+    /* rows of shown pages. Calculated in DisplayModel::Relayout() */
+    Vec<LayoutRow> rows;
+    /* the range of pages with visibleRatio > 0 (or kInvalidPageNo if no page
+       is visible). Calculated in DisplayModel::RecalcVisibleParts() */
+    mutable int firstVisiblePageNo = kInvalidPageNo;
+    mutable int lastVisiblePageNo = kInvalidPageNo;
+    /* incremented by every RecalcVisibleParts(), so that PageInfo::pageOnScreen
+       of pages that weren't visible can be updated when they're accessed */
+    mutable int pageOnScreenGen = 0;
+    /* viewPort.TL() at the time of the last RecalcVisibleParts() */
+    mutable Point pageOnScreenOrigin;
+    /* page sizes after applying rotation (but no zoom) as used by Relayout(),
+       cached because getting them from the engine can be slow */
+    mutable Vec<SizeF> rotatedPageSizes;
+    mutable int rotatedPageSizesRotation = 0;
 
     DisplayMode displayMode{DisplayMode::Automatic};
     /* In non-continuous mode is the first page from a file that we're
        displaying.
        No meaning in continuous mode. */
     int startPage = 1;
+    // start page beyond the provisional page count of an ebook still being layed out
+    int deferredStartPage = 0;
 
     /* size of virtual canvas containing all rendered pages. */
     Size canvasSize;
@@ -261,6 +304,10 @@ struct DisplayModel : DocController {
 
     /* allow resizing a window without triggering a new rendering (needed for window destruction) */
     bool pauseRendering = false;
+
+    /* 1 if the last scroll or page change went towards the end of the document,
+       -1 if towards the beginning (used for prioritizing predictive rendering) */
+    int scrollDirection = 1;
 };
 
 extern bool gPredictiveRender;
@@ -497,6 +497,7 @@ bool EpubDoc::Load() {
         // an anchor with the file name at the top (for internal links)
         ReportIf(str::FindChar(fullPath, '"'));
         str::TransCharsInPlace(fullPath, "\"", "'");
+        sectionStarts.Append((int)htmlData.size());
         htmlData.AppendFmt("<pagebreak page_path=\"%s\" page_marker />", fullPath);
         htmlData.Append(decoded);
     }
@@ -567,6 +568,11 @@ ByteSlice EpubDoc::GetHtmlData() const {
     return htmlData.AsByteSlice();
 }
 
+// each document starts with a page break and can be layed out on its own
+const Vec<int>& EpubDoc::GetSectionStarts() const {
+    return sectionStarts;
+}
+
 ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
     ScopedCritSec scope(&zipAccess);
 
@@ -623,6 +629,46 @@ ByteSlice* EpubDoc::GetImageData(const char* fileName, const char* pagePath) {
     return nullptr;
 }
 
+// images are identified by their id in the archive which (unlike their index
+// in images) doesn't depend on the order in which they've been loaded.
+// returns -1 if data isn't the data of one of the images
+int EpubDoc::GetImageId(const u8* data) {
+    ScopedCritSec scope(&zipAccess);
+    for (ImageData& img : images) {
+        if (!img.base.empty() && img.base.data() == data) {
+            return (int)img.fileId;
+        }
+    }
+    return -1;
+}
+
+ByteSlice* EpubDoc::GetImageDataById(int fileId) {
+    ScopedCritSec scope(&zipAccess);
+    for (ImageData& img : images) {
+        if (img.fileId == (size_t)fileId) {
+            if (img.base.empty()) {
+                img.base = zip->GetFileDataById(img.fileId);
+            }
+            return img.base.empty() ? nullptr : &img.base;
+        }
+    }
+
+    // an image which isn't registered in the manifest
+    auto& fileInfos = zip->GetFileInfos();
+    if (fileId < 0 || fileId >= fileInfos.Size()) {
+        return nullptr;
+    }
+    ImageData data;
+    data.fileId = (size_t)fileId;
+    data.base = zip->GetFileDataById(data.fileId);
+    if (data.base.empty()) {
+        return nullptr;
+    }
+    data.fileName = str::Dup(fileInfos.at(fileId)->name);
+    images.Append(data);
+    return &images.Last().base;
+}
+
 ByteSlice EpubDoc::GetFileData(const char* relPath, const char* pagePath) {
     if (!pagePath) {
         ReportIf(true);
@@ -1039,6 +1085,23 @@ ByteSlice* Fb2Doc::GetImageData(const char* fileName) const {
     return nullptr;
 }
 
+// returns -1 if data isn't the data of one of the images
+int Fb2Doc::GetImageId(const u8* data) const {
+    for (int i = 0; i < images.Size(); i++) {
+        if (!images.at(i).base.empty() && images.at(i).base.data() == data) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+ByteSlice* Fb2Doc::GetImageDataById(int id) const {
+    if (id < 0 || id >= images.Size() || images.at(id).base.empty()) {
+        return nullptr;
+    }
+    return &images.at(id).base;
+}
+
 ByteSlice* Fb2Doc::GetCoverImage() const {
     if (!coverImage) {
         return nullptr;
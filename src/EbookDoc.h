@@ -23,6 +23,8 @@ class EpubDoc {
     CRITICAL_SECTION zipAccess;
 
     str::Str htmlData;
+    // offsets in htmlData at which the spine's documents start
+    Vec<int> sectionStarts;
     Vec<ImageData> images;
     AutoFreeStr tocPath;
     AutoFreeStr fileName;
@@ -41,8 +43,11 @@ class EpubDoc {
     ~EpubDoc();
 
     ByteSlice GetHtmlData() const;
+    const Vec<int>& GetSectionStarts() const;
 
     ByteSlice* GetImageData(const char* fileName, const char* pagePath);
+    int GetImageId(const u8* data);
+    ByteSlice* GetImageDataById(int fileId);
     ByteSlice GetFileData(const char* relPath, const char* pagePath);
 
     TempStr GetPropertyTemp(const char* name) const;
@@ -84,6 +89,8 @@ class Fb2Doc {
     ByteSlice GetXmlData() const;
 
     ByteSlice* GetImageData(const char* fileName) const;
+    int GetImageId(const u8* data) const;
+    ByteSlice* GetImageDataById(int id) const;
     ByteSlice* GetCoverImage() const;
 
     TempStr GetPropertyTemp(const char* name) const;
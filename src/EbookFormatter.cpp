@@ -19,6 +19,7 @@
 #include "EbookDoc.h"
 #include "PalmDbReader.h"
 #include "MobiDoc.h"
+#include "StyleSheet.h"
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
 
@@ -166,7 +167,7 @@ void EpubFormatter::HandleTagPagebreak(HtmlToken* t) {
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::Dup(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        styleSheet.Reset();
     }
 }
 
@@ -192,7 +193,7 @@ void EpubFormatter::HandleTagLink(HtmlToken* t) {
     url::DecodeInPlace(src);
     ByteSlice data = epubDoc->GetFileData(src, pagePath);
     if (data) {
-        ParseStyleSheet(data, data.size());
+        styleSheet.Parse(data, data.size());
         data.Free();
     }
 }
@@ -377,7 +378,7 @@ void HtmlFileFormatter::HandleTagLink(HtmlToken* t) {
     url::DecodeInPlace(src);
     ByteSlice data = htmlDoc->GetFileData(src);
     if (data) {
-        ParseStyleSheet(data, data.size());
+        styleSheet.Parse(data, data.size());
     }
     data.Free();
 }
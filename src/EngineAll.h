@@ -14,11 +14,11 @@ EngineBase* CreateEngineDjVuFromFile(const char* path);
 EngineBase* CreateEngineDjVuFromStream(IStream* stream);
 
 /* EngineEbook.cpp */
-EngineBase* CreateEngineEpubFromFile(const char* fileName);
+EngineBase* CreateEngineEpubFromFile(const char* fileName, bool layoutInBackground = false);
 EngineBase* CreateEngineEpubFromStream(IStream* stream);
-EngineBase* CreateEngineFb2FromFile(const char* fileName);
+EngineBase* CreateEngineFb2FromFile(const char* fileName, bool layoutInBackground = false);
 EngineBase* CreateEngineFb2FromStream(IStream* stream);
-EngineBase* CreateEngineMobiFromFile(const char* fileName);
+EngineBase* CreateEngineMobiFromFile(const char* fileName, bool layoutInBackground = false);
 EngineBase* CreateEngineMobiFromStream(IStream* stream);
 EngineBase* CreateEnginePdbFromFile(const char* fileName);
 EngineBase* CreateEngineChmFromFile(const char* fileName);
@@ -26,6 +26,8 @@ EngineBase* CreateEngineHtmlFromFile(const char* fileName);
 EngineBase* CreateEngineTxtFromFile(const char* fileName);
 
 void SetDefaultEbookFont(const char* name, float size);
+void SetEbookLayoutCacheDir(const char* dir);
+TempStr GetEbookLayoutCachePathTemp(const char* filePath);
 void EngineEbookCleanup();
 
 /* EngineImages.cpp */
@@ -45,6 +47,7 @@ EngineBase* CreateEngineCbxFromStream(IStream* stream);
 
 using ShowErrorCb = Func1<const char*>;
 
+void InitializeEngineMupdf();
 bool IsEngineMupdfSupportedFileType(Kind);
 EngineBase* CreateEngineMupdfFromFile(const char* path, Kind kind, int displayDPI, PasswordUI* pwdUI = nullptr);
 EngineBase* CreateEngineMupdfFromStream(IStream* stream, const char* nameHint, PasswordUI* pwdUI = nullptr);
@@ -69,7 +72,10 @@ EngineBase* CreateEnginePsFromFile(const char* fileName);
 
 bool IsSupportedFileType(Kind kind, bool enableEngineEbooks);
 
-EngineBase* CreateEngineFromFile(const char* filePath, PasswordUI* pwdUI, bool enableChmEngine);
+// with ebookLayoutInBackground, flowed ebooks are returned with only their first pages
+// layed out (see EngineBase::IsPageCountProvisional())
+EngineBase* CreateEngineFromFile(const char* filePath, PasswordUI* pwdUI, bool enableChmEngine,
+                                 bool ebookLayoutInBackground = false);
 
 bool EngineSupportsAnnotations(EngineBase*);
 bool EngineGetAnnotations(EngineBase*, Vec<Annotation*>&);
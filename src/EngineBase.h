@@ -391,6 +391,8 @@ struct RenderPageArgs {
     RectF* pageRect = nullptr;
     RenderTarget target = RenderTarget::View;
     AbortCookie** cookie_out = nullptr;
+    // trade quality for speed (e.g. no anti-aliasing) for quick previews
+    bool fastRender = false;
 
     RenderPageArgs(int pageNo, float zoom, int rotation, RectF* pageRect = nullptr,
                    RenderTarget target = RenderTarget::View, AbortCookie** cookie_out = nullptr);
@@ -552,6 +554,33 @@ class EngineBase {
         return Vec<uint>();
     }
 
+    // engines which lay out pages in the background (flowed ebooks) only report
+    // the pages layed out so far until UpdatePageCount() is called
+    virtual bool IsPageCountProvisional() {
+        return false;
+    }
+
+    // onFinished is called (usually on a background thread) once all pages
+    // have been layed out and their sizes are known (or right away, if they already are)
+    virtual void SetOnLayoutFinished(const Func0& onFinished) {
+        onFinished.Call();
+    }
+
+    // makes PageCount() include all pages layed out so far
+    // (must be called from the thread using the engine)
+    virtual void UpdatePageCount() {
+        // no-op for engines that know the page count after loading
+    }
+
+    // the pages of reflowed documents (ebooks) also depend on settings such as the
+    // font and page size. sets key to a fingerprint of those settings (all zeroes
+    // for engines without any), so that data cached across sessions can be validated.
+    // returns false if the pages depend on settings that can't be fingerprinted
+    virtual bool GetLayoutKey(u8 key[16]) {
+        memset(key, 0, 16);
+        return true;
+    }
+
     // protected:
     void SetFilePath(const char* s);
 
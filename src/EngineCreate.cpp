@@ -58,7 +58,8 @@ bool IsSupportedFileType(Kind kind, bool enableEngineEbooks) {
     return false;
 }
 
-static EngineBase* CreateEngineForKind(Kind kind, const char* path, PasswordUI* pwdUI, bool enableChmEngine) {
+static EngineBase* CreateEngineForKind(Kind kind, const char* path, PasswordUI* pwdUI, bool enableChmEngine,
+                                       bool ebookLayoutInBackground) {
     if (!kind) {
         return nullptr;
     }
@@ -111,15 +112,15 @@ static EngineBase* CreateEngineForKind(Kind kind, const char* path, PasswordUI*
     }
 
     if (kind == kindFileEpub) {
-        engine = CreateEngineEpubFromFile(path);
+        engine = CreateEngineEpubFromFile(path, ebookLayoutInBackground);
         return engine;
     }
     if (kind == kindFileFb2 || kind == kindFileFb2z) {
-        engine = CreateEngineFb2FromFile(path);
+        engine = CreateEngineFb2FromFile(path, ebookLayoutInBackground);
         return engine;
     }
     if (kind == kindFileMobi) {
-        engine = CreateEngineMobiFromFile(path);
+        engine = CreateEngineMobiFromFile(path, ebookLayoutInBackground);
         return engine;
     }
     if (kind == kindFilePalmDoc) {
@@ -133,20 +134,21 @@ static EngineBase* CreateEngineForKind(Kind kind, const char* path, PasswordUI*
     return nullptr;
 }
 
-EngineBase* CreateEngineFromFile(const char* path, PasswordUI* pwdUI, bool enableChmEngine) {
+EngineBase* CreateEngineFromFile(const char* path, PasswordUI* pwdUI, bool enableChmEngine,
+                                 bool ebookLayoutInBackground) {
     ReportIf(!path);
 
     // try to open with the engine guess from file name
     // if that fails, try to guess the file type based on content
     Kind kind = GuessFileTypeFromName(path);
-    EngineBase* engine = CreateEngineForKind(kind, path, pwdUI, enableChmEngine);
+    EngineBase* engine = CreateEngineForKind(kind, path, pwdUI, enableChmEngine, ebookLayoutInBackground);
     if (engine) {
         return engine;
     }
 
     Kind newKind = GuessFileTypeFromContent(path);
     if (kind != newKind) {
-        engine = CreateEngineForKind(newKind, path, pwdUI, enableChmEngine);
+        engine = CreateEngineForKind(newKind, path, pwdUI, enableChmEngine, ebookLayoutInBackground);
     }
     return engine;
 }
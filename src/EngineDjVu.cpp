@@ -123,35 +123,36 @@ static TocItem* NewDjVuTocItem(TocItem* parent, const char* title, const char* l
     return res;
 }
 
+// libdjvu's minilisp (used for outlines, annotations and text) has a global
+// garbage collector and symbol table and isn't thread-safe, so all access to
+// miniexp_t values is serialized across documents. Also protects creating
+// contexts, which initializes global state of libdjvu.
+// must be taken after DjVuContext::lock
+static CRITICAL_SECTION* DjVuGlobalLock() {
+    static CRITICAL_SECTION* cs = [] {
+        auto res = new CRITICAL_SECTION;
+        InitializeCriticalSection(res);
+        return res;
+    }();
+    return cs;
+}
+
+// every document has its own context so that documents can be decoded and
+// rendered in parallel. The lock protects the context, its message queue
+// and the document opened in it
 struct DjVuContext {
     ddjvu_context_t* ctx = nullptr;
-    int refCount = 1;
     CRITICAL_SECTION lock;
 
     DjVuContext() {
         InitializeCriticalSection(&lock);
+        ScopedCritSec scope(DjVuGlobalLock());
         ctx = ddjvu_context_create("DjVuEngine");
         // reset the locale to "C" as most other code expects
         setlocale(LC_ALL, "C");
         ReportIf(!ctx);
     }
 
-    int AddRef() {
-        EnterCriticalSection(&lock);
-        ++refCount;
-        int res = refCount;
-        LeaveCriticalSection(&lock);
-        return res;
-    }
-
-    int Release() {
-        EnterCriticalSection(&lock);
-        ReportIf(refCount <= 0);
-        --refCount;
-        LeaveCriticalSection(&lock);
-        return refCount;
-    }
-
     ~DjVuContext() {
         EnterCriticalSection(&lock);
         if (ctx) {
@@ -198,36 +199,20 @@ struct DjVuContext {
     }
 };
 
-// TODO: make it non-static because it accesses other static state
-// in djvu which got deleted first
-static DjVuContext* gDjVuContext;
-
-static DjVuContext* GetDjVuContext() {
-    if (!gDjVuContext) {
-        gDjVuContext = new DjVuContext();
-    } else {
-        gDjVuContext->AddRef();
-    }
-    return gDjVuContext;
-}
-
-static void ReleaseDjVuContext() {
-    ReportIf(!gDjVuContext);
-    int refCount = gDjVuContext->Release();
-    if (refCount != 0) {
-        return;
-    }
-}
-
 void CleanupEngineDjVu() {
-    if (gDjVuContext) {
-        ReportIf(gDjVuContext->refCount != 0);
-        delete gDjVuContext;
-        gDjVuContext = nullptr;
-    }
     minilisp_finish();
 }
 
+// decoding a page (its JB2 and IW44 layers) takes much longer than rendering it,
+// so the most recently used decoded pages are kept for rendering them again
+// (as more tiles, at a different zoom level or for the content box)
+constexpr int kMaxDecodedPages = 4;
+
+struct DjVuDecodedPage {
+    int pageNo = 0;
+    ddjvu_page_t* page = nullptr;
+};
+
 struct DjVuPageInfo {
     RectF mediabox;
     Vec<IPageElement*> allElements;
@@ -274,8 +259,11 @@ class EngineDjVu : public EngineBase {
 
   protected:
     IStream* stream = nullptr;
+    DjVuContext* djvu = nullptr;
 
     Vec<DjVuPageInfo*> pages;
+    // most recently used first, protected by djvu->lock
+    Vec<DjVuDecodedPage> decodedPages;
 
     ddjvu_document_t* doc = nullptr;
     miniexp_t outline = miniexp_nil;
@@ -289,6 +277,9 @@ class EngineDjVu : public EngineBase {
     TocItem* BuildTocTree(TocItem* parent, miniexp_t entry, int& idCounter);
     bool FinishLoading();
     bool LoadMediaboxes();
+    ddjvu_page_t* GetDecodedPage(int pageNo);
+    void StartDecodingPage(int pageNo);
+    void AddDecodedPage(int idx, int pageNo, ddjvu_page_t* page);
 };
 
 EngineDjVu::EngineDjVu() {
@@ -296,32 +287,42 @@ EngineDjVu::EngineDjVu() {
     str::ReplaceWithCopy(&defaultExt, ".djvu");
     // DPI isn't constant for all pages and thus premultiplied
     fileDPI = 300.0f;
-    GetDjVuContext();
+    djvu = new DjVuContext();
 }
 
 EngineDjVu::~EngineDjVu() {
-    ScopedCritSec scope(&gDjVuContext->lock);
+    {
+        ScopedCritSec scope(&djvu->lock);
 
-    delete tocTree;
+        delete tocTree;
 
-    for (auto pi : pages) {
-        if (pi->annos && pi->annos != miniexp_dummy) {
-            ddjvu_miniexp_release(doc, pi->annos);
-            pi->annos = nullptr;
+        for (auto& dp : decodedPages) {
+            ddjvu_page_release(dp.page);
         }
-    }
-    DeleteVecMembers(pages);
+        decodedPages.Reset();
+
+        {
+            ScopedCritSec scopeGlobal(DjVuGlobalLock());
+            for (auto pi : pages) {
+                if (pi->annos && pi->annos != miniexp_dummy) {
+                    ddjvu_miniexp_release(doc, pi->annos);
+                    pi->annos = nullptr;
+                }
+            }
+            if (outline != miniexp_nil) {
+                ddjvu_miniexp_release(doc, outline);
+            }
+        }
+        DeleteVecMembers(pages);
 
-    if (outline != miniexp_nil) {
-        ddjvu_miniexp_release(doc, outline);
-    }
-    if (doc) {
-        ddjvu_document_release(doc);
-    }
-    if (stream) {
-        stream->Release();
+        if (doc) {
+            ddjvu_document_release(doc);
+        }
+        if (stream) {
+            stream->Release();
+        }
     }
-    ReleaseDjVuContext();
+    delete djvu;
 }
 
 EngineBase* EngineDjVu::Clone() {
@@ -446,12 +447,12 @@ bool EngineDjVu::LoadMediaboxes() {
 
 bool EngineDjVu::Load(const char* fileName) {
     SetFilePath(fileName);
-    doc = gDjVuContext->OpenFile(fileName);
+    doc = djvu->OpenFile(fileName);
     return FinishLoading();
 }
 
 bool EngineDjVu::Load(IStream* stream) {
-    doc = gDjVuContext->OpenStream(stream);
+    doc = djvu->OpenStream(stream);
     return FinishLoading();
 }
 
@@ -460,10 +461,10 @@ bool EngineDjVu::FinishLoading() {
         return false;
     }
 
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     while (!ddjvu_document_decoding_done(doc)) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
 
     if (ddjvu_document_decoding_error(doc)) {
@@ -485,7 +486,7 @@ bool EngineDjVu::FinishLoading() {
             ddjvu_status_t status;
             ddjvu_pageinfo_t info;
             while ((status = ddjvu_document_get_pageinfo(doc, i, &info)) < DDJVU_JOB_OK) {
-                gDjVuContext->SpinMessageLoop();
+                djvu->SpinMessageLoop();
             }
             if (DDJVU_JOB_OK == status) {
                 DjVuPageInfo* pi = pages[i];
@@ -497,12 +498,15 @@ bool EngineDjVu::FinishLoading() {
         }
     }
 
-    while ((outline = ddjvu_document_get_outline(doc)) == miniexp_dummy) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (!miniexp_consp(outline) || miniexp_car(outline) != miniexp_symbol("bookmarks")) {
-        ddjvu_miniexp_release(doc, outline);
-        outline = miniexp_nil;
+    {
+        ScopedCritSec scopeGlobal(DjVuGlobalLock());
+        while ((outline = ddjvu_document_get_outline(doc)) == miniexp_dummy) {
+            djvu->SpinMessageLoop();
+        }
+        if (!miniexp_consp(outline) || miniexp_car(outline) != miniexp_symbol("bookmarks")) {
+            ddjvu_miniexp_release(doc, outline);
+            outline = miniexp_nil;
+        }
     }
 
     int fileCount = ddjvu_document_get_filenum(doc);
@@ -510,7 +514,7 @@ bool EngineDjVu::FinishLoading() {
         ddjvu_status_t status;
         ddjvu_fileinfo_s info;
         while ((status = ddjvu_document_get_fileinfo(doc, i, &info)) < DDJVU_JOB_OK) {
-            gDjVuContext->SpinMessageLoop();
+            djvu->SpinMessageLoop();
         }
         if (DDJVU_JOB_OK == status && info.type == 'P' && info.pageno >= 0) {
             fileInfos.Append(info);
@@ -557,8 +561,70 @@ RenderedBitmap* EngineDjVu::CreateRenderedBitmap(const char* bmpData, Size size,
     return new RenderedBitmap(hbmp, size, hMap);
 }
 
+// inserts page at position idx in the cache of decoded pages
+// and releases the least recently used page if the cache is full
+void EngineDjVu::AddDecodedPage(int idx, int pageNo, ddjvu_page_t* page) {
+    decodedPages.InsertAt(idx, {pageNo, page});
+    if (decodedPages.Size() > kMaxDecodedPages) {
+        ddjvu_page_release(decodedPages.Last().page);
+        decodedPages.RemoveLast();
+    }
+}
+
+// returns the page once it has been decoded or nullptr if it couldn't be.
+// the page is owned by the cache and is only valid while holding djvu->lock
+ddjvu_page_t* EngineDjVu::GetDecodedPage(int pageNo) {
+    ddjvu_page_t* page = nullptr;
+    int n = decodedPages.Size();
+    for (int i = 0; i < n; i++) {
+        if (decodedPages[i].pageNo == pageNo) {
+            page = decodedPages[i].page;
+            decodedPages.RemoveAt(i);
+            decodedPages.InsertAt(0, {pageNo, page});
+            break;
+        }
+    }
+    if (!page) {
+        page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+        if (!page) {
+            return nullptr;
+        }
+        AddDecodedPage(0, pageNo, page);
+    }
+
+    // the page might still be decoding if it was started by StartDecodingPage()
+    while (!ddjvu_page_decoding_done(page)) {
+        djvu->SpinMessageLoop();
+    }
+    if (ddjvu_page_decoding_error(page)) {
+        // don't keep pages that failed to decode
+        decodedPages.RemoveAt(0);
+        ddjvu_page_release(page);
+        return nullptr;
+    }
+    return page;
+}
+
+// libdjvu decodes pages in its own threads, so this returns immediately.
+// The page is added behind the most recently used one so that it doesn't
+// push out the page that is currently being rendered
+void EngineDjVu::StartDecodingPage(int pageNo) {
+    if (pageNo < 1 || pageNo > pageCount) {
+        return;
+    }
+    for (auto& dp : decodedPages) {
+        if (dp.pageNo == pageNo) {
+            return;
+        }
+    }
+    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    if (page) {
+        AddDecodedPage(std::min(1, decodedPages.Size()), pageNo, page);
+    }
+}
+
 RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
     auto pageRect = args.pageRect;
     auto zoom = args.zoom;
     auto pageNo = args.pageNo;
@@ -568,16 +634,13 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
     Rect full = Transform(PageMediabox(pageNo), pageNo, zoom, rotation).Round();
     screen = full.Intersect(screen);
 
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    ddjvu_page_t* page = GetDecodedPage(pageNo);
     if (!page) {
         return nullptr;
     }
-    while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (ddjvu_page_decoding_error(page)) {
-        return nullptr;
-    }
+    // pages are usually viewed in order, so have libdjvu decode the next page
+    // in its own thread while this one is rendered
+    StartDecodingPage(pageNo + 1);
 
     ddjvu_page_rotation_t rot = DDJVU_ROTATE_0;
     switch (rotation) {
@@ -607,7 +670,6 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     int topToBottom = TRUE;
@@ -639,20 +701,13 @@ RenderedBitmap* EngineDjVu::RenderPage(RenderPageArgs& args) {
 }
 
 RectF EngineDjVu::PageContentBox(int pageNo, RenderTarget) {
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     RectF pageRc = PageMediabox(pageNo);
-    ddjvu_page_t* page = ddjvu_page_create_by_pageno(doc, pageNo - 1);
+    ddjvu_page_t* page = GetDecodedPage(pageNo);
     if (!page) {
         return pageRc;
     }
-
-    while (!ddjvu_page_decoding_done(page)) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (ddjvu_page_decoding_error(page)) {
-        return pageRc;
-    }
     ddjvu_page_set_rotation(page, DDJVU_ROTATE_0);
 
     // render the page in 8-bit grayscale up to 250x250 px in size
@@ -660,7 +715,6 @@ RectF EngineDjVu::PageContentBox(int pageNo, RenderTarget) {
 
     defer {
         ddjvu_format_release(fmt);
-        ddjvu_page_release(page);
     };
 
     ddjvu_format_set_row_order(fmt, /* top_to_bottom */ TRUE);
@@ -850,20 +904,23 @@ bool EngineDjVu::ExtractPageText(miniexp_t item, str::WStr& extracted, Vec<Rect>
 
 PageText EngineDjVu::ExtractPageText(int pageNo) {
     const WCHAR* lineSep = L"\n";
-    ScopedCritSec scope(&gDjVuContext->lock);
-
-    miniexp_t pagetext;
-    while ((pagetext = ddjvu_document_get_pagetext(doc, pageNo - 1, nullptr)) == miniexp_dummy) {
-        gDjVuContext->SpinMessageLoop();
-    }
-    if (miniexp_nil == pagetext) {
-        return {};
-    }
+    ScopedCritSec scope(&djvu->lock);
 
     str::WStr extracted;
     Vec<Rect> coords;
-    bool success = ExtractPageText(pagetext, extracted, coords);
-    ddjvu_miniexp_release(doc, pagetext);
+    bool success;
+    {
+        ScopedCritSec scopeGlobal(DjVuGlobalLock());
+        miniexp_t pagetext;
+        while ((pagetext = ddjvu_document_get_pagetext(doc, pageNo - 1, nullptr)) == miniexp_dummy) {
+            djvu->SpinMessageLoop();
+        }
+        if (miniexp_nil == pagetext) {
+            return {};
+        }
+        success = ExtractPageText(pagetext, extracted, coords);
+        ddjvu_miniexp_release(doc, pagetext);
+    }
     if (!success) {
         return {};
     }
@@ -877,7 +934,7 @@ PageText EngineDjVu::ExtractPageText(int pageNo) {
     ddjvu_status_t status;
     ddjvu_pageinfo_t info;
     while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     float dpiFactor = 1.0;
     if (DDJVU_JOB_OK == status) {
@@ -916,11 +973,12 @@ Vec<IPageElement*> EngineDjVu::GetElements(int pageNo) {
     auto& els = pi->allElements;
 
     if (pi->annos == miniexp_dummy) {
-        ScopedCritSec scope(&gDjVuContext->lock);
+        ScopedCritSec scope(&djvu->lock);
+        ScopedCritSec scopeGlobal(DjVuGlobalLock());
         while (pi->annos == miniexp_dummy) {
             pi->annos = ddjvu_document_get_pageanno(doc, pageNo - 1);
             if (pi->annos == miniexp_dummy) {
-                gDjVuContext->SpinMessageLoop();
+                djvu->SpinMessageLoop();
             }
         }
     }
@@ -929,20 +987,21 @@ Vec<IPageElement*> EngineDjVu::GetElements(int pageNo) {
         return els;
     }
 
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
 
     Rect page = PageMediabox(pageNo).Round();
 
     ddjvu_status_t status;
     ddjvu_pageinfo_t info;
     while ((status = ddjvu_document_get_pageinfo(doc, pageNo - 1, &info)) < DDJVU_JOB_OK) {
-        gDjVuContext->SpinMessageLoop();
+        djvu->SpinMessageLoop();
     }
     float dpiFactor = 1.0;
     if (DDJVU_JOB_OK == status) {
         dpiFactor = GetFileDPI() / info.dpi;
     }
 
+    ScopedCritSec scopeGlobal(DjVuGlobalLock());
     miniexp_t* links = ddjvu_anno_get_hyperlinks(pi->annos);
     for (int i = 0; links[i]; i++) {
         miniexp_t anno = miniexp_cdr(links[i]);
@@ -1159,7 +1218,8 @@ TocTree* EngineDjVu::GetToc() {
     if (tocTree) {
         return tocTree;
     }
-    ScopedCritSec scope(&gDjVuContext->lock);
+    ScopedCritSec scope(&djvu->lock);
+    ScopedCritSec scopeGlobal(DjVuGlobalLock());
     int idCounter = 0;
     TocItem* root = BuildTocTree(nullptr, outline, idCounter);
     if (!root) {
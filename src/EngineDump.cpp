@@ -2,12 +2,21 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+
+#include <psapi.h>
+
 #include "utils/ScopedWin.h"
 #include "utils/CmdLineArgsIter.h"
+#include "utils/DirIter.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/GuessFileType.h"
+#include "utils/HtmlParserLookup.h"
+#include "utils/JsonParser.h"
 #include "mui/Mui.h"
 #include "utils/TgaReader.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
 
 #include "wingui/UIModels.h"
@@ -18,8 +27,16 @@
 #include "DocController.h"
 #include "EngineBase.h"
 #include "EngineAll.h"
+#include "EbookBase.h"
+#include "StyleSheet.h"
+#include "HtmlFormatter.h"
+#include "DisplayMode.h"
+#include "DisplayModel.h"
+#include "GlobalPrefs.h"
 #include "PdfCreator.h"
 
+#include "utils/Log.h"
+
 #define Out(msg, ...) printf(msg, __VA_ARGS__)
 
 static void Out1(const char* msg) {
@@ -510,70 +527,930 @@ class PasswordHolder : public PasswordUI {
     }
 };
 
-void EngineDump(const Flags& flags) {
-#if 0
-    setlocale(LC_ALL, "C");
-    DisableDataExecution();
+static void Usage() {
+    ErrOut1("Usage:");
+    ErrOut1("  GurupiaReader.exe -engine-dump [-pwd <password>][-quick][-loadonly][-render [<zoom>%] <path-%d.tga>]");
+    ErrOut1("      <filename>");
+    ErrOut1("  GurupiaReader.exe -engine-dump -bench <dir> [-zoom 50,100,200][-rotation 0,90][-threads 1,4]");
+    ErrOut1("      [-engine auto,mupdf,ebook][-pages <n>][-out <results.json|results.csv>]");
+    ErrOut1("      [-baseline <results.json>][-threshold <percent>]");
+    ErrOut1("  GurupiaReader.exe -engine-dump -bench-layout [<pages>]");
+    ErrOut1("  GurupiaReader.exe -engine-dump -bench-html [<file.html>]");
+    ErrOut1("      [-text-render gdi,gdiplus,gdiplusquick,hdc,mupdf]");
+}
+
+// -engine-dump -bench renders every supported document in a directory (recursively)
+// with every combination of zoom, rotation, number of threads and engine and reports
+// render latency, throughput and memory use per document and combination.
+// results can be compared against results of a previous run (-baseline) in which case
+// the exit code is 1 if there were regressions
+
+constexpr int kMaxBenchThreads = 64;
+// regressions smaller than this are considered noise, even if above threshold
+constexpr double kBenchMinRegressionMs = 2.0;
+
+struct BenchOptions {
+    const char* dir = nullptr;
+    Vec<float> zooms; // in percent
+    Vec<int> rotations;
+    Vec<int> threadCounts;
+    StrVec engines;
+    // if > 0, only renders the first maxPages pages of each document
+    int maxPages = 0;
+    const char* outPath = nullptr;
+    const char* baselinePath = nullptr;
+    float threshold = 10.f; // in percent
+};
+
+struct BenchResult {
+    // relative to the benchmarked directory and with '/' as path separator
+    // so that results can be compared between machines
+    AutoFreeStr file;
+    AutoFreeStr engine;
+    float zoom = 100.f;
+    int rotation = 0;
+    int threads = 1;
+    int pages = 0;
+    int failedPages = 0;
+    double loadMs = 0;
+    double p50Ms = 0;
+    double p95Ms = 0;
+    double maxMs = 0;
+    double pagesPerSec = 0;
+    int peakRssKb = 0;
+};
+
+struct BenchRenderThread {
+    EngineBase* engine = nullptr;
+    float zoom = 1.f;
+    int rotation = 0;
+    int nPages = 0;
+    AtomicInt* nextPage = nullptr;
+
+    Vec<double> pageMs;
+    int nFailed = 0;
+    int peakRssKb = 0;
+};
+
+static int GetWorkingSetKb() {
+    PROCESS_MEMORY_COUNTERS pmc{};
+    pmc.cb = sizeof(pmc);
+    if (!GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        return 0;
+    }
+    return (int)(pmc.WorkingSetSize / 1024);
+}
+
+static bool ParseBenchList(const char* s, Vec<float>& v) {
+    StrVec parts;
+    Split(&parts, s, ",", true);
+    for (char* part : parts) {
+        float n;
+        if (!str::Parse(part, "%f%?%%$", &n) || n <= 0.f) {
+            return false;
+        }
+        v.Append(n);
+    }
+    return v.size() > 0;
+}
+
+static bool ParseBenchList(const char* s, Vec<int>& v) {
+    StrVec parts;
+    Split(&parts, s, ",", true);
+    for (char* part : parts) {
+        int n;
+        if (!str::Parse(part, "%d%$", &n) || n < 0) {
+            return false;
+        }
+        v.Append(n);
+    }
+    return v.size() > 0;
+}
+
+static bool IsValidBenchEngine(const char* engineName) {
+    return str::Eq(engineName, "auto") || str::Eq(engineName, "mupdf") || str::Eq(engineName, "ebook");
+}
+
+// "auto" is the engine GurupiaReader would pick, "mupdf" and "ebook" force
+// EngineMupdf resp. our own ebook engines, which are only used for some file types
+static bool BenchEngineSupportsKind(const char* engineName, Kind kind) {
+    if (str::Eq(engineName, "mupdf")) {
+        return IsEngineMupdfSupportedFileType(kind);
+    }
+    if (str::Eq(engineName, "ebook")) {
+        return kind == kindFileEpub || kind == kindFileFb2 || kind == kindFileFb2z || kind == kindFileMobi ||
+               kind == kindFilePalmDoc;
+    }
+    return true;
+}
+
+static EngineBase* CreateBenchEngine(const char* path, Kind kind, const char* engineName) {
+    if (str::Eq(engineName, "mupdf")) {
+        return CreateEngineMupdfFromFile(path, kind, USER_DEFAULT_SCREEN_DPI);
+    }
+    if (str::Eq(engineName, "ebook")) {
+        if (kind == kindFileEpub) {
+            return CreateEngineEpubFromFile(path);
+        }
+        if (kind == kindFileFb2 || kind == kindFileFb2z) {
+            return CreateEngineFb2FromFile(path);
+        }
+        if (kind == kindFileMobi) {
+            return CreateEngineMobiFromFile(path);
+        }
+        return CreateEnginePdbFromFile(path);
+    }
+    return CreateEngineFromFile(path, nullptr, true);
+}
+
+static void BenchRenderPages(BenchRenderThread* t) {
+    while (true) {
+        int pageNo = t->nextPage->Inc();
+        if (pageNo > t->nPages) {
+            return;
+        }
+        auto timeStart = TimeGet();
+        RenderPageArgs args(pageNo, t->zoom, t->rotation);
+        RenderedBitmap* bmp = t->engine->RenderPage(args);
+        double timeMs = TimeSinceInMs(timeStart);
+        if (!bmp) {
+            t->nFailed++;
+            continue;
+        }
+        t->pageMs.Append(timeMs);
+        // sampled while the bitmap is still alive
+        t->peakRssKb = std::max(t->peakRssKb, GetWorkingSetKb());
+        delete bmp;
+    }
+}
+
+static int CmpDouble(const double* a, const double* b) {
+    if (*a < *b) {
+        return -1;
+    }
+    return *a > *b ? 1 : 0;
+}
+
+// nearest-rank percentile of sorted values
+static double Percentile(const Vec<double>& sorted, int pct) {
+    int n = (int)sorted.size();
+    if (n == 0) {
+        return 0;
+    }
+    int idx = (n * pct + 99) / 100 - 1;
+    return sorted[limitValue(idx, 0, n - 1)];
+}
+
+static BenchResult* BenchRender(const char* path, Kind kind, const char* engineName, float zoom, int rotation,
+                                int nThreads, int maxPages) {
+    int rssKb = GetWorkingSetKb();
+    auto timeStart = TimeGet();
+    EngineBase* engine = CreateBenchEngine(path, kind, engineName);
+    if (!engine) {
+        ErrOut("Error: Couldn't create an engine '%s' for %s!", engineName, path);
+        return nullptr;
+    }
+    double loadMs = TimeSinceInMs(timeStart);
+    rssKb = std::max(rssKb, GetWorkingSetKb());
+
+    int nPages = engine->PageCount();
+    if (maxPages > 0) {
+        nPages = std::min(nPages, maxPages);
+    }
+    nThreads = limitValue(nThreads, 1, kMaxBenchThreads);
+
+    AtomicInt nextPage;
+    BenchRenderThread threads[kMaxBenchThreads];
+    HANDLE handles[kMaxBenchThreads] = {};
+    timeStart = TimeGet();
+    for (int i = 0; i < nThreads; i++) {
+        BenchRenderThread& t = threads[i];
+        t.engine = engine;
+        t.zoom = zoom / 100.f;
+        t.rotation = rotation;
+        t.nPages = nPages;
+        t.nextPage = &nextPage;
+        if (i > 0) {
+            auto fn = MkFunc0<BenchRenderThread>(BenchRenderPages, &t);
+            handles[i] = StartThread(fn, "BenchRenderThread");
+        }
+    }
+    // the first thread is this one
+    BenchRenderPages(&threads[0]);
+    for (int i = 1; i < nThreads; i++) {
+        if (handles[i]) {
+            WaitForSingleObject(handles[i], INFINITE);
+            CloseHandle(handles[i]);
+        }
+    }
+    double totalMs = TimeSinceInMs(timeStart);
+    SafeEngineRelease(&engine);
 
-    CmdLineArgsIter argList(GetCommandLine());
-    int nArgs = argList.nArgs;
+    auto res = new BenchResult();
+    res->engine.SetCopy(engineName);
+    res->zoom = zoom;
+    res->rotation = rotation;
+    res->threads = nThreads;
+    res->loadMs = loadMs;
+    Vec<double> pageMs;
+    for (int i = 0; i < nThreads; i++) {
+        BenchRenderThread& t = threads[i];
+        pageMs.Append(t.pageMs.LendData(), t.pageMs.size());
+        res->failedPages += t.nFailed;
+        rssKb = std::max(rssKb, t.peakRssKb);
+    }
+    pageMs.SortTyped(CmpDouble);
+    res->pages = (int)pageMs.size();
+    res->p50Ms = Percentile(pageMs, 50);
+    res->p95Ms = Percentile(pageMs, 95);
+    res->maxMs = Percentile(pageMs, 100);
+    if (totalMs > 0) {
+        res->pagesPerSec = (double)res->pages * 1000.0 / totalMs;
+    }
+    res->peakRssKb = rssKb;
+    return res;
+}
+
+static TempStr BenchResultDescTemp(BenchResult* r) {
+    return str::FormatTemp("%s (engine: %s, zoom: %g%%, rotation: %d, threads: %d)", r->file.Get(), r->engine.Get(),
+                           r->zoom, r->rotation, r->threads);
+}
+
+static void AppendJsonStr(str::Str& s, const char* v) {
+    s.AppendChar('"');
+    for (const char* c = v; c && *c; c++) {
+        if (*c == '"' || *c == '\\') {
+            s.AppendChar('\\');
+        }
+        s.AppendChar(*c);
+    }
+    s.AppendChar('"');
+}
+
+static void AppendCsvStr(str::Str& s, const char* v) {
+    if (!str::FindChar(v, ',') && !str::FindChar(v, '"')) {
+        s.Append(v);
+        return;
+    }
+    s.AppendChar('"');
+    for (const char* c = v; *c; c++) {
+        if (*c == '"') {
+            s.AppendChar('"');
+        }
+        s.AppendChar(*c);
+    }
+    s.AppendChar('"');
+}
+
+static void FormatBenchResultsJson(Vec<BenchResult*>& results, str::Str& s) {
+    s.Append("{\n  \"results\": [\n");
+    int n = (int)results.size();
+    for (int i = 0; i < n; i++) {
+        BenchResult* r = results[i];
+        s.Append("    {\"file\": ");
+        AppendJsonStr(s, r->file);
+        s.Append(", \"engine\": ");
+        AppendJsonStr(s, r->engine);
+        s.AppendFmt(", \"zoom\": %g, \"rotation\": %d, \"threads\": %d, \"pages\": %d, \"failedPages\": %d", r->zoom,
+                    r->rotation, r->threads, r->pages, r->failedPages);
+        s.AppendFmt(", \"loadMs\": %.2f, \"p50Ms\": %.2f, \"p95Ms\": %.2f, \"maxMs\": %.2f", r->loadMs, r->p50Ms,
+                    r->p95Ms, r->maxMs);
+        s.AppendFmt(", \"pagesPerSec\": %.2f, \"peakRssKb\": %d}%s\n", r->pagesPerSec, r->peakRssKb,
+                    i + 1 < n ? "," : "");
+    }
+    s.Append("  ]\n}\n");
+}
+
+static void FormatBenchResultsCsv(Vec<BenchResult*>& results, str::Str& s) {
+    s.Append("file,engine,zoom,rotation,threads,pages,failed_pages,load_ms,p50_ms,p95_ms,max_ms,pages_per_sec,"
+             "peak_rss_kb\n");
+    for (BenchResult* r : results) {
+        AppendCsvStr(s, r->file);
+        s.AppendFmt(",%s,%g,%d,%d,%d,%d", r->engine.Get(), r->zoom, r->rotation, r->threads, r->pages,
+                    r->failedPages);
+        s.AppendFmt(",%.2f,%.2f,%.2f,%.2f,%.2f,%d\n", r->loadMs, r->p50Ms, r->p95Ms, r->maxMs, r->pagesPerSec,
+                    r->peakRssKb);
+    }
+}
+
+// reads results written with FormatBenchResultsJson()
+struct BenchBaselineVisitor : json::ValueVisitor {
+    Vec<BenchResult*>* results = nullptr;
+
+    bool Visit(const char* path, const char* value, json::Type type) override;
+};
+
+bool BenchBaselineVisitor::Visit(const char* path, const char* value, json::Type) {
+    int idx;
+    AutoFreeStr field;
+    if (!str::Parse(path, "/results[%d]/%S", &idx, &field) || idx < 0) {
+        return true;
+    }
+    while ((int)results->size() <= idx) {
+        results->Append(new BenchResult());
+    }
+    BenchResult* r = results->at(idx);
+    if (str::Eq(field, "file")) {
+        r->file.SetCopy(value);
+    } else if (str::Eq(field, "engine")) {
+        r->engine.SetCopy(value);
+    } else if (str::Eq(field, "zoom")) {
+        r->zoom = (float)atof(value);
+    } else if (str::Eq(field, "rotation")) {
+        r->rotation = atoi(value);
+    } else if (str::Eq(field, "threads")) {
+        r->threads = atoi(value);
+    } else if (str::Eq(field, "pages")) {
+        r->pages = atoi(value);
+    } else if (str::Eq(field, "failedPages")) {
+        r->failedPages = atoi(value);
+    } else if (str::Eq(field, "p95Ms")) {
+        r->p95Ms = atof(value);
+    } else if (str::Eq(field, "pagesPerSec")) {
+        r->pagesPerSec = atof(value);
+    }
+    return true;
+}
+
+static bool IsSameBenchRun(BenchResult* r1, BenchResult* r2) {
+    return str::Eq(r1->file, r2->file) && str::Eq(r1->engine, r2->engine) && fabs(r1->zoom - r2->zoom) < 0.01f &&
+           r1->rotation == r2->rotation && r1->threads == r2->threads;
+}
 
-    if (nArgs < 2) {
-    Usage:
-        ErrOut("%s [-pwd <password>][-quick][-render <path-%%d.tga>] <filename>",
-               path::GetBaseNameTemp(argList.args[0]));
+// returns the number of regressions compared to results in baselinePath
+// only compares runs that were part of this benchmark, so that a baseline
+// can be shared by runs over different parts of the matrix
+static int CompareBenchResults(Vec<BenchResult*>& results, const BenchOptions& opts, const StrVec& files) {
+    ByteSlice data = file::ReadFile(opts.baselinePath);
+    if (data.empty()) {
+        ErrOut("Error: Couldn't read baseline %s!", opts.baselinePath);
+        return 1;
+    }
+    Vec<BenchResult*> baseline;
+    BenchBaselineVisitor visitor;
+    visitor.results = &baseline;
+    bool ok = json::Parse((const char*)data.data(), &visitor);
+    data.Free();
+    if (!ok) {
+        ErrOut("Error: Couldn't parse baseline %s!", opts.baselinePath);
+        DeleteVecMembers(baseline);
+        return 1;
+    }
+
+    double factor = 1.0 + opts.threshold / 100.0;
+    int nRegressions = 0;
+    for (BenchResult* b : baseline) {
+        if (!b->file || !b->engine) {
+            continue;
+        }
+        bool inMatrix = files.Contains(b->file) && opts.engines.Contains(b->engine) &&
+                        opts.rotations.Contains(b->rotation) && opts.threadCounts.Contains(b->threads);
+        bool zoomInMatrix = false;
+        for (float zoom : opts.zooms) {
+            zoomInMatrix |= fabs(zoom - b->zoom) < 0.01f;
+        }
+        if (!inMatrix || !zoomInMatrix) {
+            continue;
+        }
+        BenchResult* r = nullptr;
+        for (BenchResult* r2 : results) {
+            if (IsSameBenchRun(r2, b)) {
+                r = r2;
+                break;
+            }
+        }
+        TempStr desc = BenchResultDescTemp(b);
+        if (!r) {
+            ErrOut("Regression: %s failed to load", desc);
+            nRegressions++;
+            continue;
+        }
+        if (r->pages < b->pages || r->failedPages > b->failedPages) {
+            ErrOut("Regression: %s rendered %d pages (%d failed), was %d pages (%d failed)", desc, r->pages,
+                   r->failedPages, b->pages, b->failedPages);
+            nRegressions++;
+        }
+        if (r->p95Ms > b->p95Ms * factor && r->p95Ms - b->p95Ms > kBenchMinRegressionMs) {
+            ErrOut("Regression: %s p95 is %.2f ms, was %.2f ms", desc, r->p95Ms, b->p95Ms);
+            nRegressions++;
+        }
+        if (r->pagesPerSec * factor < b->pagesPerSec) {
+            ErrOut("Regression: %s renders %.2f pages/sec, was %.2f pages/sec", desc, r->pagesPerSec,
+                   b->pagesPerSec);
+            nRegressions++;
+        }
+    }
+    ErrOut("%d regressions compared to %s (threshold: %g%%)", nRegressions, opts.baselinePath, opts.threshold);
+    DeleteVecMembers(baseline);
+    return nRegressions;
+}
+
+static void CollectFilesToBench(const char* dir, StrVec& files) {
+    DirIter di{dir};
+    di.recurse = true;
+    for (DirIterEntry* de : di) {
+        Kind kind = GuessFileType(de->filePath, true);
+        if (IsSupportedFileType(kind, true)) {
+            files.Append(de->filePath);
+        }
+    }
+    // results are in a stable order, which makes them easier to diff
+    SortNatural(&files);
+}
+
+static int RunBenchmark(const BenchOptions& opts) {
+    if (!dir::Exists(opts.dir)) {
+        ErrOut("Error: directory %s doesn't exist!", opts.dir);
         return 2;
     }
+    StrVec files;
+    CollectFilesToBench(opts.dir, files);
+    if (files.Size() == 0) {
+        ErrOut("Error: no supported documents in %s!", opts.dir);
+        return 2;
+    }
+
+    StrVec relFiles;
+    size_t dirLen = str::Len(opts.dir);
+    for (char* path : files) {
+        const char* rel = path + dirLen;
+        while (path::IsSep(*rel)) {
+            rel++;
+        }
+        char* relFile = relFiles.Append(rel);
+        str::TransCharsInPlace(relFile, "\\", "/");
+    }
+
+    Vec<BenchResult*> results;
+    for (int i = 0; i < files.Size(); i++) {
+        char* path = files.At(i);
+        Kind kind = GuessFileType(path, true);
+        for (char* engineName : opts.engines) {
+            if (!BenchEngineSupportsKind(engineName, kind)) {
+                continue;
+            }
+            for (float zoom : opts.zooms) {
+                for (int rotation : opts.rotations) {
+                    for (int nThreads : opts.threadCounts) {
+                        BenchResult* r =
+                            BenchRender(path, kind, engineName, zoom, rotation, nThreads, opts.maxPages);
+                        if (!r) {
+                            continue;
+                        }
+                        r->file.SetCopy(relFiles.At(i));
+                        logf("bench: %s: %d pages, p50: %.2f ms, p95: %.2f ms, %.2f pages/sec\n",
+                             BenchResultDescTemp(r), r->pages, r->p50Ms, r->p95Ms, r->pagesPerSec);
+                        results.Append(r);
+                    }
+                }
+            }
+        }
+    }
+
+    str::Str s;
+    bool asCsv = str::EndsWithI(opts.outPath, ".csv");
+    if (asCsv) {
+        FormatBenchResultsCsv(results, s);
+    } else {
+        FormatBenchResultsJson(results, s);
+    }
+    int exitCode = 0;
+    if (!opts.outPath) {
+        Out1(s.CStr());
+    } else if (!file::WriteFile(opts.outPath, s.AsByteSlice())) {
+        ErrOut("Error: Couldn't write results to %s!", opts.outPath);
+        exitCode = 2;
+    }
+
+    if (opts.baselinePath && CompareBenchResults(results, opts, relFiles) > 0) {
+        exitCode = 1;
+    }
+    DeleteVecMembers(results);
+    return exitCode;
+}
+
+// -engine-dump -bench-layout measures how the layout of DisplayModel scales with
+// the number of pages (relayout after zooming and rotating, scrolling, hit-testing)
+// using a synthetic document so that no (huge) file is needed
+
+constexpr int kBenchLayoutDefaultPages = 100000;
+constexpr int kBenchLayoutSteps = 2000;
+
+static Kind kindEngineSyntheticPages = "engineSyntheticPages";
+
+// a document whose pages have different sizes but no content
+class EngineSyntheticPages : public EngineBase {
+  public:
+    explicit EngineSyntheticPages(int nPages) {
+        kind = kindEngineSyntheticPages;
+        defaultExt = str::Dup(".pdf");
+        pageCount = nPages;
+        fileDPI = 72.0f;
+    }
+
+    EngineBase* Clone() override {
+        return new EngineSyntheticPages(pageCount);
+    }
+
+    // mostly letter and A4 pages with a landscape page every now and then
+    RectF PageMediabox(int pageNo) override {
+        if (pageNo % 17 == 0) {
+            return RectF(0, 0, 792, 612);
+        }
+        if (pageNo % 3 == 0) {
+            return RectF(0, 0, 595, 842);
+        }
+        return RectF(0, 0, 612, 792);
+    }
+
+    RenderedBitmap* RenderPage(RenderPageArgs&) override {
+        return nullptr;
+    }
+
+    RectF Transform(const RectF& rect, int pageNo, float zoom, int rotation, bool inverse) override {
+        Gdiplus::PointF pts[2] = {Gdiplus::PointF(rect.x, rect.y), Gdiplus::PointF(rect.x + rect.dx, rect.y + rect.dy)};
+        Gdiplus::Matrix m;
+        GetBaseTransform(m, ToGdipRectF(PageMediabox(pageNo)), zoom, rotation);
+        if (inverse) {
+            m.Invert();
+        }
+        m.TransformPoints(pts, 2);
+        return RectF::FromXY(pts[0].X, pts[0].Y, pts[1].X, pts[1].Y);
+    }
+
+    ByteSlice GetFileData() override {
+        return {};
+    }
+    bool SaveFileAs(const char*) override {
+        return false;
+    }
+    PageText ExtractPageText(int) override {
+        return {};
+    }
+    bool HasClipOptimizations(int) override {
+        return false;
+    }
+    TempStr GetPropertyTemp(const char*) override {
+        return nullptr;
+    }
+    Vec<IPageElement*> GetElements(int) override {
+        return {};
+    }
+    IPageElement* GetElementAtPos(int, PointF) override {
+        return nullptr;
+    }
+    bool BenchLoadPage(int) override {
+        return true;
+    }
+};
+
+struct BenchLayoutCallback : DocControllerCallback {
+    int nRenderRequests = 0;
+
+    void PageNoChanged(DocController*, int) override {
+    }
+    void ZoomChanged(DocController*, float) override {
+    }
+    void GotoLink(IPageDestination*) override {
+    }
+    void Repaint() override {
+    }
+    void UpdateScrollbars(Size) override {
+    }
+    void RequestRendering(int) override {
+        nRenderRequests++;
+    }
+    void CleanUp(DisplayModel*) override {
+    }
+    void RenderThumbnail(DisplayModel*, Size, const OnBitmapRendered*) override {
+    }
+    void FocusFrame(bool) override {
+    }
+    void SaveDownload(const char*, const ByteSlice&) override {
+    }
+};
+
+static void BenchLayoutZoom(DisplayModel* dm, float zoom, const char* desc) {
+    auto timeStart = TimeGet();
+    dm->SetZoomVirtual(zoom, nullptr);
+    double dur = TimeSinceInMs(timeStart);
+    Out("  zoom %-10s %8.2f ms (canvas: %d x %d)\n", desc, dur, dm->GetCanvasSize().dx, dm->GetCanvasSize().dy);
+}
+
+static void BenchLayoutScrolling(DisplayModel* dm, BenchLayoutCallback* cb) {
+    int maxY = std::max(dm->GetCanvasSize().dy - dm->GetViewPort().dy, 0);
+    cb->nRenderRequests = 0;
+
+    // jumping around (e.g. when dragging the scrollbar)
+    auto timeStart = TimeGet();
+    for (int i = 0; i < kBenchLayoutSteps; i++) {
+        int y = (int)(((i64)i * 7919) % kBenchLayoutSteps * maxY / kBenchLayoutSteps);
+        dm->ScrollYTo(y);
+    }
+    double dur = TimeSinceInMs(timeStart);
+    Out("  scroll to    %8.4f ms per step\n", dur / kBenchLayoutSteps);
+
+    // scrolling with mouse wheel or arrow keys
+    dm->ScrollYTo(maxY / 2);
+    timeStart = TimeGet();
+    for (int i = 0; i < kBenchLayoutSteps; i++) {
+        dm->ScrollYBy(i % 2 == 0 ? 40 : -20, false);
+    }
+    dur = TimeSinceInMs(timeStart);
+    Out("  scroll by    %8.4f ms per step\n", dur / kBenchLayoutSteps);
 
-    char* filePath = nullptr;
-    char* password = nullptr;
+    Size size = dm->GetViewPort().Size();
+    int nFound = 0;
+    timeStart = TimeGet();
+    for (int i = 0; i < kBenchLayoutSteps; i++) {
+        Point pt(i * 31 % std::max(size.dx, 1), i * 17 % std::max(size.dy, 1));
+        if (dm->GetPageNoByPoint(pt) > 0) {
+            nFound++;
+        }
+    }
+    dur = TimeSinceInMs(timeStart);
+    Out("  hit-test     %8.4f ms per point (%d of %d on a page)\n", dur / kBenchLayoutSteps, nFound,
+        kBenchLayoutSteps);
+    logf("bench-layout: %d render requests\n", cb->nRenderRequests);
+}
+
+static int RunLayoutBenchmark(int nPages) {
+    // DisplayModel needs the preferences which aren't loaded for -engine-dump
+    ReportIf(gGlobalPrefs);
+    gGlobalPrefs = NewGlobalPrefs(nullptr);
+    gGlobalPrefs->extractTextInBackground = false;
+
+    BenchLayoutCallback cb;
+    EngineBase* engine = new EngineSyntheticPages(nPages);
+    DisplayModel* dm = new DisplayModel(engine, &cb);
+
+    DisplayMode modes[] = {DisplayMode::Continuous, DisplayMode::ContinuousFacing};
+    for (DisplayMode mode : modes) {
+        Out("%s, %d pages:\n", DisplayModeToString(mode), nPages);
+        auto timeStart = TimeGet();
+        if (mode == modes[0]) {
+            dm->SetInitialViewSettings(mode, 1, Size(1280, 1024), 96);
+            dm->Relayout(100.f, 0);
+            dm->GoToPage(1, false);
+        } else {
+            dm->SetDisplayMode(mode);
+        }
+        double dur = TimeSinceInMs(timeStart);
+        Out("  initial      %8.2f ms\n", dur);
+
+        BenchLayoutZoom(dm, kZoomFitWidth, "fit width");
+        BenchLayoutZoom(dm, kZoomFitPage, "fit page");
+        BenchLayoutZoom(dm, 50.f, "50%");
+        BenchLayoutZoom(dm, 200.f, "200%");
+        BenchLayoutZoom(dm, 100.f, "100%");
+
+        timeStart = TimeGet();
+        dm->RotateBy(90);
+        dur = TimeSinceInMs(timeStart);
+        Out("  rotate       %8.2f ms\n", dur);
+        dm->RotateBy(-90);
+
+        BenchLayoutScrolling(dm, &cb);
+    }
+
+    delete dm;
+    DeleteGlobalPrefs(gGlobalPrefs);
+    gGlobalPrefs = nullptr;
+    return 0;
+}
+
+// -engine-dump -bench-html lays out html with HtmlFormatter (the way ebooks are laid out)
+// with each of the ways to measure text and reports how long it took.
+// without a file, a synthetic book is laid out
+
+struct BenchTextRender {
+    const char* name;
+    mui::TextRenderMethod method;
+};
+
+static BenchTextRender gBenchTextRenders[] = {
+    {"gdi", mui::TextRenderMethod::Gdi},
+    {"gdiplus", mui::TextRenderMethod::Gdiplus},
+    {"gdiplusquick", mui::TextRenderMethod::GdiplusQuick},
+    {"hdc", mui::TextRenderMethod::Hdc},
+    {"mupdf", mui::TextRenderMethod::Mupdf},
+};
+
+static BenchTextRender* FindBenchTextRender(const char* name) {
+    for (BenchTextRender& tr : gBenchTextRenders) {
+        if (str::EqI(name, tr.name)) {
+            return &tr;
+        }
+    }
+    return nullptr;
+}
+
+// paragraphs with styles, kerning pairs ("AV", "To") and text that has to be shaped
+static ByteSlice BenchHtmlSynthetic() {
+    static const char* sentences[] = {
+        "AVATAR WAVES Toward the Yard, the Lady Tyra watched every wave fall away. ",
+        "It was <i>the best of times</i>, it was the worst of times, it was the age of wisdom. ",
+        "Flying officers affirmed the <b>efficient</b> offices of the fjord&#39;s ferry. ",
+        "Typography: kerning &amp; ligatures (fi, fl, ffi) make text look &quot;right&quot;. ",
+        "\xce\x97 \xce\xb3\xce\xbb\xcf\x8e\xcf\x83\xcf\x83\xce\xb1 \xd0\xb8 "
+        "\xd1\x8f\xd0\xb7\xd1\x8b\xd0\xba \xd7\xa9\xd7\x9c\xd7\x95\xd7\x9d "
+        "\xd8\xb3\xd9\x84\xd8\xa7\xd9\x85 \xe0\xa4\xa8\xe0\xa4\xae\xe0\xa4\xb8\xe0\xa5\x8d"
+        "\xe0\xa4\xa4\xe0\xa5\x87. ",
+    };
+    str::Str html;
+    html.Append("<html><body>");
+    for (int i = 0; i < 2000; i++) {
+        if (i % 50 == 0) {
+            html.AppendFmt("<h2>Chapter %d</h2>", i / 50 + 1);
+        }
+        html.Append("<p>");
+        for (int j = 0; j < 5; j++) {
+            html.Append(sentences[(i * 7 + j * 3) % dimof(sentences)]);
+        }
+        html.Append("</p>");
+    }
+    html.Append("</body></html>");
+    return html.StealAsByteSlice();
+}
+
+// returns the number of pages or -1 if laying out failed
+static int BenchHtmlLayout(ByteSlice html, mui::TextRenderMethod method) {
+    PoolAllocator textAllocator;
+    HtmlFormatterArgs* args = CreateFormatterDefaultArgs(820, 920, &textAllocator);
+    args->htmlStr = html;
+    args->textRenderMethod = method;
+    HtmlFormatter* formatter = new HtmlFormatter(args);
+    Vec<HtmlPage*>* pages = formatter->FormatAllPages(false);
+    int nPages = pages ? pages->Size() : -1;
+    if (pages) {
+        DeleteVecMembers(*pages);
+        delete pages;
+    }
+    delete formatter;
+    delete args;
+    return nPages;
+}
+
+static int RunHtmlBenchmark(const char* filePath, const StrVec& textRenders) {
+    ByteSlice html = filePath ? file::ReadFile(filePath) : BenchHtmlSynthetic();
+    if (html.empty()) {
+        ErrOut("Error: couldn't read '%s'", filePath);
+        return 1;
+    }
+    Out("%s, %d bytes of html:\n", filePath ? filePath : "synthetic", (int)html.size());
+
+    Vec<BenchTextRender*> toBench;
+    for (char* name : textRenders) {
+        toBench.Append(FindBenchTextRender(name));
+    }
+    if (toBench.size() == 0) {
+        for (BenchTextRender& tr : gBenchTextRenders) {
+            toBench.Append(&tr);
+        }
+    }
+
+    int exitCode = 0;
+    for (BenchTextRender* tr : toBench) {
+        auto timeStart = TimeGet();
+        int nPages = BenchHtmlLayout(html, tr->method);
+        double dur = TimeSinceInMs(timeStart);
+        Out("  %-13s %8.2f ms, %d pages\n", tr->name, dur, nPages);
+        if (nPages <= 0) {
+            exitCode = 1;
+        }
+    }
+    html.Free();
+    return exitCode;
+}
+
+// returns the exit code: 0 on success, 1 if dumping failed or there
+// were benchmark regressions and 2 for invalid arguments
+int EngineDump(const Flags& flags) {
+    const StrVec& args = flags.engineDumpArgs;
+    int nArgs = args.Size();
+
+    const char* filePath = nullptr;
+    const char* password = nullptr;
     bool fullDump = true;
-    char* renderPath = nullptr;
+    const char* renderPath = nullptr;
     float renderZoom = 1.f;
-    bool loadOnly = false, silent = false;
+    bool loadOnly = false;
+    bool silent = flags.silent;
+    BenchOptions bench;
+    int benchLayoutPages = 0;
+    bool benchHtml = false;
+    StrVec benchTextRenders;
 
-    for (int i = 1; i < nArgs; i++) {
-        if (str::Eq(argList.at(i), "-pwd") && i + 1 < nArgs && !password) {
-            password = argList.at(++i);
-        } else if (str::Eq(argList.at(i), "-quick")) {
+    for (int i = 0; i < nArgs; i++) {
+        const char* arg = args.At(i);
+        const char* param = i + 1 < nArgs ? args.At(i + 1) : nullptr;
+        if (str::Eq(arg, "-pwd") && param && !password) {
+            password = args.At(++i);
+        } else if (str::Eq(arg, "-quick")) {
             fullDump = false;
-        } else if (str::Eq(argList.at(i), "-render") && i + 1 < nArgs && !renderPath) {
+        } else if (str::Eq(arg, "-render") && param && !renderPath) {
             // optional zoom argument (e.g. -render 50% file.pdf)
             float zoom;
-            if (i + 2 < nArgs && str::Parse(argList.at(i + 1), "%f%%%$", &zoom) && zoom > 0.f) {
+            if (i + 2 < nArgs && str::Parse(param, "%f%%%$", &zoom) && zoom > 0.f) {
                 renderZoom = zoom / 100.f;
                 i++;
             }
-            renderPath = argList.at(++i);
-        } else if (str::Eq(argList.at(i), "-loadonly")) {
+            renderPath = args.At(++i);
+        } else if (str::Eq(arg, "-loadonly")) {
             // -loadonly and -silent are only meant for profiling
             loadOnly = true;
-        } else if (str::Eq(argList.at(i), "-silent")) {
+        } else if (str::Eq(arg, "-silent")) {
             silent = true;
-        } else if (str::Eq(argList.at(i), "-full")) {
+        } else if (str::Eq(arg, "-full")) {
             // -full is for backward compatibility
             fullDump = true;
+        } else if (str::Eq(arg, "-bench") && param && !bench.dir) {
+            bench.dir = args.At(++i);
+        } else if (str::Eq(arg, "-bench-layout")) {
+            benchLayoutPages = kBenchLayoutDefaultPages;
+            int n;
+            if (param && str::Parse(param, "%d%$", &n) && n > 0) {
+                benchLayoutPages = n;
+                i++;
+            }
+        } else if (str::Eq(arg, "-bench-html")) {
+            benchHtml = true;
+        } else if (str::Eq(arg, "-text-render") && param) {
+            Split(&benchTextRenders, args.At(++i), ",", true);
+        } else if (str::Eq(arg, "-zoom") && param && ParseBenchList(param, bench.zooms)) {
+            i++;
+        } else if (str::Eq(arg, "-rotation") && param && ParseBenchList(param, bench.rotations)) {
+            i++;
+        } else if (str::Eq(arg, "-threads") && param && ParseBenchList(param, bench.threadCounts)) {
+            i++;
+        } else if (str::Eq(arg, "-engine") && param) {
+            Split(&bench.engines, args.At(++i), ",", true);
+        } else if (str::Eq(arg, "-pages") && param) {
+            bench.maxPages = atoi(args.At(++i));
+        } else if (str::Eq(arg, "-out") && param) {
+            bench.outPath = args.At(++i);
+        } else if (str::Eq(arg, "-baseline") && param) {
+            bench.baselinePath = args.At(++i);
+        } else if (str::Eq(arg, "-threshold") && param && str::Parse(param, "%f%?%%$", &bench.threshold)) {
+            i++;
         } else if (!filePath) {
-            filePath = argList.at(i);
+            filePath = arg;
         } else {
-            goto Usage;
+            Usage();
+            return 2;
         }
     }
-    if (!filePath) {
-        goto Usage;
+    if (!filePath && !bench.dir && !benchLayoutPages && !benchHtml) {
+        Usage();
+        return 2;
     }
-#endif
-    if (flags.silent) {
+
+    if (silent) {
         FILE* nul;
         freopen_s(&nul, "NUL", "w", stdout);
         freopen_s(&nul, "NUL", "w", stderr);
     }
 
-#if 0
-    ScopedGdiPlus gdiPlus;
-    ScopedMui miniMui;
+    if (benchLayoutPages > 0) {
+        return RunLayoutBenchmark(benchLayoutPages);
+    }
+
+    if (benchHtml) {
+        for (char* name : benchTextRenders) {
+            if (!FindBenchTextRender(name)) {
+                ErrOut("Error: unknown text render '%s', must be one of gdi, gdiplus, gdiplusquick, hdc or mupdf",
+                       name);
+                return 2;
+            }
+        }
+        return RunHtmlBenchmark(filePath, benchTextRenders);
+    }
+
+    InitializeEngineMupdf();
+
+    if (bench.dir) {
+        if (bench.zooms.size() == 0) {
+            bench.zooms.Append(100.f);
+        }
+        if (bench.rotations.size() == 0) {
+            bench.rotations.Append(0);
+        }
+        if (bench.threadCounts.size() == 0) {
+            bench.threadCounts.Append(1);
+        }
+        if (bench.engines.Size() == 0) {
+            bench.engines.Append("auto");
+        }
+        for (char* engineName : bench.engines) {
+            if (!IsValidBenchEngine(engineName)) {
+                ErrOut("Error: unknown engine '%s', must be one of auto, mupdf or ebook", engineName);
+                return 2;
+            }
+        }
+        return RunBenchmark(bench);
+    }
 
-    WIN32_FIND_DATA fdata;
+    WIN32_FIND_DATAW fdata;
     WCHAR* pathW = ToWStrTemp(filePath);
     HANDLE hfind = FindFirstFileW(pathW, &fdata);
     // embedded documents are referred to by an invalid path
@@ -594,9 +1471,10 @@ void EngineDump(const Flags& flags) {
     if (!loadOnly) {
         DumpData(engine, fullDump);
     }
+    bool ok = true;
     if (renderPath) {
-        RenderDocument(engine, renderPath, renderZoom, flags.silent);
+        ok = RenderDocument(engine, renderPath, renderZoom, silent);
     }
     SafeEngineRelease(&engine);
-#endif
+    return ok ? 0 : 1;
 }
@@ -7,9 +7,12 @@
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
 #include "utils/Archive.h"
+#include "utils/CryptoUtil.h"
 #include "utils/Dpi.h"
 #include "utils/FileUtil.h"
 #include "utils/GdiPlusUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "mui/Mui.h"
@@ -28,6 +31,7 @@
 #include "EbookBase.h"
 #include "PalmDbReader.h"
 #include "EbookDoc.h"
+#include "StyleSheet.h"
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
 
@@ -72,14 +76,112 @@ void SetDefaultEbookFont(const char* name, float size) {
     gDefaultFontSize = size * 0.8f;
 }
 
+static AutoFreeStr gLayoutCacheDir;
+
+// EPUB, FB2 and Mobi engines save their layout in this directory (if set)
+void SetEbookLayoutCacheDir(const char* dir) {
+    gLayoutCacheDir.SetCopy(dir);
+}
+
+// the layout must match the content of the file (same as for the text cache)
+TempStr GetEbookLayoutCachePathTemp(const char* filePath) {
+    return GetCachePathForFileTemp(filePath, gLayoutCacheDir, ".layoutcache");
+}
+
 /* common classes for EPUB, FictionBook2, Mobi, PalmDOC, CHM, HTML and TXT engines */
 
+// copied out of the page's DrawInstr so that anchors can be looked up
+// without going through the instructions of all pages
 struct PageAnchor {
-    DrawInstr* instr;
-    int pageNo;
+    const char* s = nullptr;
+    size_t len = 0;
+    float y = 0;
+    int pageNo = -1;
+};
 
-    explicit PageAnchor(DrawInstr* instr = nullptr, int pageNo = -1) : instr(instr), pageNo(pageNo) {
-    }
+// pages are layed out incrementally: FinishLoading() only lays out the first few pages
+// and (if layoutInBackground is set) the remaining ones are layed out on a background
+// thread. All pages keep their instructions (laying a page out again from its reparseIdx
+// wouldn't restore the styling in effect there, see HtmlPage)
+constexpr int kInitialLayoutPages = 4;
+constexpr int kMaxLayoutThreads = 8;
+
+// once all pages have been layed out, the pages are saved so that opening the
+// document again with the same font and page size doesn't have to lay it out again:
+// LayoutCacheFileHeader
+// LayoutCacheFilePage[nPages]
+// LayoutCacheFileInstr[nInstrs] (the instructions of all pages in page order)
+// LayoutCacheFileAnchor[nAnchors]
+// LayoutCacheFileFont[nFonts]
+// char strings[stringsSize] (anchor names, UTF-8 font names and text not found in the html)
+constexpr u32 kLayoutCacheFileMagic = 0x54594c53; // 'SLYT'
+constexpr u32 kLayoutCacheFileVersion = 2;
+// don't bother caching the layout of huge documents
+constexpr u64 kMaxLayoutCacheFileSize = 64 * 1024 * 1024;
+
+struct LayoutCacheFileHeader {
+    u32 magic;
+    u32 version;
+    // fingerprint of the layout options (see EngineEbook::GetLayoutCacheKey())
+    u8 layoutKey[16];
+    u32 nPages;
+    u32 nInstrs;
+    u32 nAnchors;
+    u32 nFonts;
+    u32 stringsSize;
+};
+
+struct LayoutCacheFilePage {
+    i32 reparseIdx;
+    i32 baseAnchor;
+    u32 nInstrs;
+};
+
+// what LayoutCacheFileInstr::idx refers to
+enum class LayoutCacheRef : u8 {
+    None = 0,
+    // offset of str in the html
+    Html,
+    // offset of str in strings
+    Strings,
+    // index of font in LayoutCacheFileFont[]
+    Font,
+    // id of the image (see EngineEbook::GetImageId())
+    Image,
+};
+
+struct LayoutCacheFileInstr {
+    u8 type; // DrawInstrType
+    LayoutCacheRef ref;
+    u16 unused;
+    u32 idx;
+    u32 len;
+    float x, y, dx, dy;
+};
+
+struct LayoutCacheFileAnchor {
+    u32 offset;
+    u32 len;
+    float y;
+    i32 pageNo;
+};
+
+struct LayoutCacheFileFont {
+    u32 offset;
+    u32 len;
+    float sizePt;
+    i32 style;
+};
+
+// part of a document which can be layed out independently of the others
+// (e.g. an EPUB spine document, which always starts on a new page)
+struct EbookLayoutChunk {
+    int start = 0;
+    int end = 0;
+    // set once the chunk has been layed out
+    Vec<HtmlPage*>* pages = nullptr;
+    // for text the chunk's formatter allocates (PoolAllocator isn't thread-safe)
+    PoolAllocator* allocator = nullptr;
 };
 
 class EbookAbortCookie : public AbortCookie {
@@ -130,26 +232,90 @@ class EngineEbook : public EngineBase {
 
     bool BenchLoadPage(int pageNo) override;
 
+    bool IsPageCountProvisional() override;
+    void SetOnLayoutFinished(const Func0& onFinished) override;
+    void UpdatePageCount() override;
+    bool GetLayoutKey(u8 key[16]) override;
+
+    void LayoutRemainingPages();
+    void LayoutChunks();
+
   protected:
+    // all pages layed out so far (can be more than pageCount)
     Vec<HtmlPage*>* pages = nullptr;
     Vec<PageAnchor> anchors;
-    // contains for each page the last anchor indicating
-    // a break between two merged documents
-    Vec<DrawInstr*> baseAnchors;
+    // contains for each page the index in anchors of the last anchor
+    // indicating a break between two merged documents (or -1)
+    Vec<int> baseAnchors;
+    // fonts used by all pages (collected while laying them out)
+    Vec<mui::CachedFont*> pageFonts;
     // needed so that memory allocated by ResolveHtmlEntities isn't leaked
     PoolAllocator allocator;
-    // TODO: still needed?
+    // protects pages (and everything derived from them) against
+    // concurrent access from the layout and rendering threads
     CRITICAL_SECTION pagesAccess;
     // page dimensions can vary between filetypes
     RectF pageRect;
     float pageBorder;
 
+    // set by engines which support incremental layout (see CreateFormatter())
+    HtmlFormatterArgs* layoutArgs = nullptr;
+    bool layoutSkipEmptyPages = false;
+    bool layoutInBackground = false;
+    // formats the pages after the ones in pages (nullptr once all are layed out)
+    HtmlFormatter* formatter = nullptr;
+    HANDLE layoutThread = nullptr;
+    bool abortLayout = false;
+    Func0 onLayoutFinished;
+    // if set, formatter only lays out chunks[0] and the others are layed out
+    // in parallel by layoutChunkThreads and appended to pages in order
+    Vec<EbookLayoutChunk> chunks;
+    int nChunksAdded = 0;
+    AtomicInt nextChunk;
+    HANDLE layoutChunkThreads[kMaxLayoutThreads] = {};
+    int layoutChunkThreadsCount = 0;
+    // set once HandleLayoutFinished() has run (or the layout was loaded from the cache)
+    bool layoutFinished = false;
+    AutoFreeStr layoutCachePath;
+    // ToCs built before all pages had been layed out (kept alive because
+    // the UI might still reference them)
+    Vec<TocTree*> outdatedTocs;
+    bool tocIsProvisional = false;
+
     void GetTransform(Matrix& m, float zoom, int rotation);
     bool ExtractPageAnchors();
+    void AddPageInfo(int pageNo);
     TempStr ExtractFontListTemp();
 
     virtual IPageElement* CreatePageLink(DrawInstr* link, Rect rect, int pageNo);
 
+    // engines which return a formatter here can lay out pages incrementally
+    virtual HtmlFormatter* CreateFormatter(HtmlFormatterArgs*) {
+        return nullptr;
+    }
+    // an id identifying an image of the document across sessions (or -1)
+    // needed for saving the layout of pages with images
+    virtual int GetImageId(const ByteSlice&) {
+        return -1;
+    }
+    virtual ByteSlice* GetImageById(int) {
+        return nullptr;
+    }
+    bool StartLayout();
+    bool LayoutNextPage();
+    void StopLayout();
+    void SetLayoutChunks(const Vec<int>& starts);
+    HtmlFormatter* CreateChunkFormatter(int chunk, Allocator* textAllocator);
+    void StartLayoutChunks();
+    void AddLayedOutChunks();
+    bool IsLayoutFinished() const;
+    void HandleLayoutFinished();
+    void GetLayoutCacheKey(u8 key[16]);
+    bool SerializeLayout(str::Str& data);
+    bool LoadLayoutCache();
+    bool RestoreLayout(const ByteSlice& data);
+    void RetireOutdatedToc(TocTree** tocTree);
+
     Vec<DrawInstr>* GetHtmlPage(int pageNo);
     HtmlPage* GetHtmlPage2(int pageNo);
 };
@@ -204,6 +370,7 @@ EngineEbook::EngineEbook() {
 }
 
 EngineEbook::~EngineEbook() {
+    StopLayout();
     EnterCriticalSection(&pagesAccess);
 
     if (pages) {
@@ -213,6 +380,12 @@ EngineEbook::~EngineEbook() {
         DeleteVecMembers(*pages);
     }
     delete pages;
+    // after the pages whose strings they contain
+    for (EbookLayoutChunk& chunk : chunks) {
+        delete chunk.allocator;
+    }
+    delete layoutArgs;
+    DeleteVecMembers(outdatedTocs);
 
     LeaveCriticalSection(&pagesAccess);
     DeleteCriticalSection(&pagesAccess);
@@ -258,12 +431,13 @@ void EngineEbook::GetTransform(Matrix& m, float zoom, int rotation) {
     GetBaseTransform(m, ToGdipRectF(pageRect), zoom, rotation);
 }
 
+// the returned instructions are only valid as long as the caller holds pagesAccess
 Vec<DrawInstr>* EngineEbook::GetHtmlPage(int pageNo) {
-    ReportIf(pageNo < 1 || PageCount() < pageNo);
-    if (pageNo < 1 || PageCount() < pageNo) {
+    HtmlPage* page = GetHtmlPage2(pageNo);
+    if (!page) {
         return nullptr;
     }
-    return &pages->at(pageNo - 1)->instructions;
+    return &page->instructions;
 }
 
 HtmlPage* EngineEbook::GetHtmlPage2(int pageNo) {
@@ -271,36 +445,562 @@ HtmlPage* EngineEbook::GetHtmlPage2(int pageNo) {
     if (pageNo < 1 || PageCount() < pageNo) {
         return nullptr;
     }
+    ScopedCritSec scope(&pagesAccess);
     return pages->at(pageNo - 1);
 }
 
+// for engines which format all pages at once
 bool EngineEbook::ExtractPageAnchors() {
     ScopedCritSec scope(&pagesAccess);
 
-    DrawInstr* baseAnchor = nullptr;
     for (int pageNo = 1; pageNo <= pageCount; pageNo++) {
-        Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
-        if (!pageInstrs) {
-            return false;
+        AddPageInfo(pageNo);
+    }
+
+    ReportIf(baseAnchors.size() != pages->size());
+    return true;
+}
+
+// collects anchors and fonts of a newly layed out page
+// must be called inside pagesAccess
+void EngineEbook::AddPageInfo(int pageNo) {
+    int baseAnchor = baseAnchors.size() > 0 ? baseAnchors.Last() : -1;
+    Vec<DrawInstr>& pageInstrs = pages->at(pageNo - 1)->instructions;
+    for (size_t k = 0; k < pageInstrs.size(); k++) {
+        DrawInstr& i = pageInstrs.at(k);
+        if (DrawInstrType::SetFont == i.type && !pageFonts.Contains(i.font)) {
+            pageFonts.Append(i.font);
+            continue;
         }
+        if (DrawInstrType::Anchor != i.type) {
+            continue;
+        }
+        if (k < 2 && str::StartsWith(i.str.s + i.str.len, "\" page_marker />")) {
+            baseAnchor = anchors.Size();
+        }
+        anchors.Append({i.str.s, i.str.len, i.bbox.y, pageNo});
+    }
+    baseAnchors.Append(baseAnchor);
+}
 
-        for (size_t k = 0; k < pageInstrs->size(); k++) {
-            DrawInstr* i = &pageInstrs->at(k);
-            if (DrawInstrType::Anchor != i->type) {
-                continue;
+static void LayoutPagesThread(EngineEbook* engine) {
+    engine->LayoutRemainingPages();
+}
+
+static void LayoutChunksThread(EngineEbook* engine) {
+    engine->LayoutChunks();
+}
+
+// restores the pages from the layout cache or lays out the first pages and the remaining ones either
+// right away or (if layoutInBackground) on a background thread
+bool EngineEbook::StartLayout() {
+    auto timeStart = TimeGet();
+    EnterCriticalSection(&pagesAccess);
+    pages = new Vec<HtmlPage*>();
+    layoutCachePath.SetCopy(GetEbookLayoutCachePathTemp(FilePath()));
+    if (LoadLayoutCache()) {
+        pageCount = pages->Size();
+        LeaveCriticalSection(&pagesAccess);
+        logf("EngineEbook::StartLayout: %d pages from '%s' in %.2f ms\n", pageCount, layoutCachePath.Get(),
+             TimeSinceInMs(timeStart));
+        return pageCount > 0;
+    }
+    StartLayoutChunks();
+    if (chunks.size() > 0) {
+        formatter = CreateChunkFormatter(0, &allocator);
+    } else {
+        formatter = CreateFormatter(layoutArgs);
+    }
+    int nPages = layoutInBackground ? kInitialLayoutPages : INT_MAX;
+    while (pages->Size() < nPages && LayoutNextPage()) {
+        // layout until the first pages are ready
+    }
+    pageCount = pages->Size();
+    LeaveCriticalSection(&pagesAccess);
+
+    if (formatter && layoutInBackground) {
+        auto fn = MkFunc0<EngineEbook>(LayoutPagesThread, this);
+        layoutThread = StartThread(fn, "EbookLayoutThread");
+    }
+    if (!layoutInBackground || (formatter && !layoutThread)) {
+        if (formatter) {
+            LayoutRemainingPages();
+        }
+        if (layoutChunkThreadsCount > 0) {
+            WaitForMultipleObjects((DWORD)layoutChunkThreadsCount, layoutChunkThreads, TRUE, INFINITE);
+        }
+        UpdatePageCount();
+    }
+    HandleLayoutFinished();
+    logf("EngineEbook::StartLayout: %d pages in %.2f ms (%d chunks, %d threads)%s\n", pageCount,
+         TimeSinceInMs(timeStart), chunks.Size(), layoutChunkThreadsCount,
+         IsPageCountProvisional() ? ", more in the background" : "");
+    return pageCount > 0;
+}
+
+// returns false once all pages have been layed out
+// must be called inside pagesAccess
+bool EngineEbook::LayoutNextPage() {
+    if (!formatter) {
+        return false;
+    }
+    HtmlPage* page = formatter->Next(layoutSkipEmptyPages);
+    if (!page) {
+        delete formatter;
+        formatter = nullptr;
+        AddLayedOutChunks();
+        return false;
+    }
+    pages->Append(page);
+    AddPageInfo(pages->Size());
+    return true;
+}
+
+void EngineEbook::LayoutRemainingPages() {
+    auto timeStart = TimeGet();
+    while (!abortLayout) {
+        ScopedCritSec scope(&pagesAccess);
+        if (!LayoutNextPage()) {
+            break;
+        }
+    }
+
+    logf("EngineEbook::LayoutRemainingPages: %d pages in %.2f ms\n", pages->Size(), TimeSinceInMs(timeStart));
+    // unless aborted or the layout of other chunks is still going on
+    HandleLayoutFinished();
+}
+
+// splits the document at the given offsets into chunks to be layed out in parallel
+// the formatter's state must not carry over from one chunk to the next
+void EngineEbook::SetLayoutChunks(const Vec<int>& starts) {
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    if (starts.size() < 2 || si.dwNumberOfProcessors < 2) {
+        return;
+    }
+    int htmlLen = (int)layoutArgs->htmlStr.size();
+    for (int i = 0; i < starts.Size(); i++) {
+        EbookLayoutChunk chunk;
+        chunk.start = i == 0 ? 0 : starts.at(i);
+        chunk.end = i + 1 < starts.Size() ? starts.at(i + 1) : htmlLen;
+        chunks.Append(chunk);
+    }
+}
+
+HtmlFormatter* EngineEbook::CreateChunkFormatter(int chunk, Allocator* textAllocator) {
+    HtmlFormatterArgs args;
+    // page's reparseIdx are relative to the start of the whole document
+    args.htmlStr = {layoutArgs->htmlStr.data(), (size_t)chunks.at(chunk).end};
+    args.reparseIdx = chunks.at(chunk).start;
+    args.pageDx = layoutArgs->pageDx;
+    args.pageDy = layoutArgs->pageDy;
+    args.SetFontName(layoutArgs->GetFontName());
+    args.fontSize = layoutArgs->fontSize;
+    args.textAllocator = textAllocator;
+    args.textRenderMethod = layoutArgs->textRenderMethod;
+    return CreateFormatter(&args);
+}
+
+// starts the threads laying out chunks[1..] (chunks[0] is layed out by formatter)
+// must be called inside pagesAccess
+void EngineEbook::StartLayoutChunks() {
+    if (chunks.size() == 0) {
+        return;
+    }
+    nChunksAdded = 1;
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nThreads = limitValue((int)si.dwNumberOfProcessors - 1, 1, kMaxLayoutThreads);
+    nThreads = std::min(nThreads, chunks.Size() - 1);
+    for (int i = 0; i < nThreads; i++) {
+        auto fn = MkFunc0<EngineEbook>(LayoutChunksThread, this);
+        HANDLE h = StartThread(fn, "EbookLayoutChunksThread");
+        if (!h) {
+            break;
+        }
+        layoutChunkThreads[layoutChunkThreadsCount++] = h;
+    }
+    if (layoutChunkThreadsCount == 0) {
+        // lay out everything with a single formatter
+        chunks.Reset();
+        nChunksAdded = 0;
+    }
+}
+
+void EngineEbook::LayoutChunks() {
+    // the threads take pagesAccess and shouldn't starve rendering threads waiting for it
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+    for (;;) {
+        int chunk = nextChunk.Inc();
+        if (abortLayout || chunk >= chunks.Size()) {
+            break;
+        }
+        auto chunkAllocator = new PoolAllocator();
+        HtmlFormatter* f = CreateChunkFormatter(chunk, chunkAllocator);
+        auto chunkPages = new Vec<HtmlPage*>();
+        while (!abortLayout) {
+            HtmlPage* page = f->Next(layoutSkipEmptyPages);
+            if (!page) {
+                break;
             }
-            anchors.Append(PageAnchor(i, pageNo));
-            if (k < 2 && str::StartsWith(i->str.s + i->str.len, "\" page_marker />")) {
-                baseAnchor = i;
+            chunkPages->Append(page);
+        }
+        delete f;
+
+        {
+            ScopedCritSec scope(&pagesAccess);
+            chunks.at(chunk).pages = chunkPages;
+            chunks.at(chunk).allocator = chunkAllocator;
+            AddLayedOutChunks();
+        }
+        HandleLayoutFinished();
+    }
+}
+
+// appends the pages of chunks layed out so far (in document order), which also
+// assigns their page numbers and collects their anchors and base anchors
+// must be called inside pagesAccess
+void EngineEbook::AddLayedOutChunks() {
+    if (formatter || abortLayout) {
+        // chunks[0] is still being layed out
+        return;
+    }
+    while (nChunksAdded < chunks.Size() && chunks.at(nChunksAdded).pages) {
+        EbookLayoutChunk& chunk = chunks.at(nChunksAdded);
+        for (HtmlPage* page : *chunk.pages) {
+            pages->Append(page);
+            AddPageInfo(pages->Size());
+        }
+        delete chunk.pages;
+        chunk.pages = nullptr;
+        nChunksAdded++;
+    }
+}
+
+// must be called inside pagesAccess
+bool EngineEbook::IsLayoutFinished() const {
+    return !formatter && nChunksAdded >= chunks.Size();
+}
+
+// saves the layout cache and calls onLayoutFinished, once all pages have been layed out
+// called by whichever thread completes the layout (does nothing if called again)
+void EngineEbook::HandleLayoutFinished() {
+    Func0 onFinished;
+    str::Str cacheData;
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (abortLayout || layoutFinished || !IsLayoutFinished()) {
+            return;
+        }
+        layoutFinished = true;
+        onFinished = onLayoutFinished;
+        onLayoutFinished = {};
+        if (layoutCachePath && !SerializeLayout(cacheData)) {
+            cacheData.Reset();
+        }
+    }
+    if (cacheData.size() > 0 && dir::CreateForFile(layoutCachePath)) {
+        bool ok = file::WriteFile(layoutCachePath, cacheData.AsByteSlice());
+        logf("EngineEbook: saving layout of %d pages to '%s' %s\n", pages->Size(), layoutCachePath.Get(),
+             ok ? "ok" : "failed");
+    }
+    onFinished.Call();
+}
+
+// engines which lay out all pages at once don't keep their layout options
+bool EngineEbook::GetLayoutKey(u8 key[16]) {
+    if (!layoutArgs) {
+        return false;
+    }
+    GetLayoutCacheKey(key);
+    return true;
+}
+
+// everything that affects the layout (the file itself is identified by the cache file's name)
+void EngineEbook::GetLayoutCacheKey(u8 key[16]) {
+    TempStr fontName = ToUtf8Temp(layoutArgs->GetFontName());
+    TempStr s = str::FormatTemp("%s|%s|%.3f|%.3f|%.3f|%d|%d|%d", kind, fontName, layoutArgs->fontSize,
+                                layoutArgs->pageDx, layoutArgs->pageDy, (int)layoutArgs->textRenderMethod,
+                                (int)layoutSkipEmptyPages, (int)layoutArgs->htmlStr.size());
+    CalcMD5Digest((u8*)s, str::Leni(s), key);
+}
+
+// returns false if the layout can't be saved (e.g. because of an image without an id)
+// must be called inside pagesAccess
+bool EngineEbook::SerializeLayout(str::Str& data) {
+    LayoutCacheFileHeader hdr{kLayoutCacheFileMagic, kLayoutCacheFileVersion};
+    GetLayoutCacheKey(hdr.layoutKey);
+    hdr.nPages = (u32)pages->Size();
+    hdr.nAnchors = (u32)anchors.Size();
+    hdr.nFonts = (u32)pageFonts.Size();
+
+    str::Str fileInstrs;
+    str::Str fileAnchors;
+    str::Str fileFonts;
+    str::Str strings;
+    for (PageAnchor& anchor : anchors) {
+        LayoutCacheFileAnchor fileAnchor{(u32)strings.size(), (u32)anchor.len, anchor.y, anchor.pageNo};
+        fileAnchors.Append((const u8*)&fileAnchor, sizeof(fileAnchor));
+        strings.Append(anchor.s, anchor.len);
+    }
+    for (mui::CachedFont* font : pageFonts) {
+        TempStr name = ToUtf8Temp(font->name);
+        LayoutCacheFileFont fileFont{(u32)strings.size(), (u32)str::Len(name), font->sizePt, (i32)font->style};
+        fileFonts.Append((const u8*)&fileFont, sizeof(fileFont));
+        strings.Append(name);
+    }
+
+    const char* html = layoutArgs->htmlStr.data();
+    size_t htmlLen = layoutArgs->htmlStr.size();
+    data.Append((const u8*)&hdr, sizeof(hdr));
+    for (int i = 0; i < pages->Size(); i++) {
+        Vec<DrawInstr>& pageInstrs = pages->at(i)->instructions;
+        LayoutCacheFilePage page{pages->at(i)->reparseIdx, baseAnchors.at(i), (u32)pageInstrs.Size()};
+        data.Append((const u8*)&page, sizeof(page));
+
+        for (DrawInstr& instr : pageInstrs) {
+            LayoutCacheFileInstr fileInstr{(u8)instr.type, LayoutCacheRef::None};
+            fileInstr.x = instr.bbox.x;
+            fileInstr.y = instr.bbox.y;
+            fileInstr.dx = instr.bbox.dx;
+            fileInstr.dy = instr.bbox.dy;
+            if (DrawInstrType::SetFont == instr.type) {
+                fileInstr.ref = LayoutCacheRef::Font;
+                fileInstr.idx = (u32)pageFonts.Find(instr.font);
+                ReportIf((int)fileInstr.idx < 0);
+            } else if (DrawInstrType::Image == instr.type) {
+                int id = GetImageId(instr.GetImage());
+                if (id < 0) {
+                    logf("EngineEbook::SerializeLayout: unknown image on page %d\n", i + 1);
+                    return false;
+                }
+                fileInstr.ref = LayoutCacheRef::Image;
+                fileInstr.idx = (u32)id;
+            } else if (instr.str.s && html <= instr.str.s && instr.str.s + instr.str.len <= html + htmlLen) {
+                fileInstr.ref = LayoutCacheRef::Html;
+                fileInstr.idx = (u32)(instr.str.s - html);
+                fileInstr.len = (u32)instr.str.len;
+            } else if (instr.str.s) {
+                // e.g. text with resolved entities
+                fileInstr.ref = LayoutCacheRef::Strings;
+                fileInstr.idx = (u32)strings.size();
+                fileInstr.len = (u32)instr.str.len;
+                strings.Append(instr.str.s, instr.str.len);
             }
+            fileInstrs.Append((const u8*)&fileInstr, sizeof(fileInstr));
+            hdr.nInstrs++;
+        }
+        if (data.size() + fileInstrs.size() + strings.size() > kMaxLayoutCacheFileSize) {
+            logf("EngineEbook::SerializeLayout: layout too large to cache\n");
+            return false;
         }
-        baseAnchors.Append(baseAnchor);
     }
+    hdr.stringsSize = (u32)strings.size();
+    memcpy(data.LendData(), &hdr, sizeof(hdr));
+    data.Append(fileInstrs);
+    data.Append(fileAnchors);
+    data.Append(fileFonts);
+    data.Append(strings);
+    return true;
+}
 
-    ReportIf(baseAnchors.size() != pages->size());
+// restores pages, anchors and fonts saved by HandleLayoutFinished() in an earlier session
+// must be called inside pagesAccess
+bool EngineEbook::LoadLayoutCache() {
+    if (!layoutCachePath || !file::Exists(layoutCachePath)) {
+        return false;
+    }
+    ByteSlice data = file::ReadFile(layoutCachePath);
+    bool ok = RestoreLayout(data);
+    data.Free();
+    return ok;
+}
+
+// must be called inside pagesAccess
+bool EngineEbook::RestoreLayout(const ByteSlice& data) {
+    if (data.size() < sizeof(LayoutCacheFileHeader)) {
+        return false;
+    }
+    auto hdr = (const LayoutCacheFileHeader*)data.data();
+    u8 key[16]{};
+    GetLayoutCacheKey(key);
+    u64 size = sizeof(LayoutCacheFileHeader) + (u64)hdr->nPages * sizeof(LayoutCacheFilePage) +
+               (u64)hdr->nInstrs * sizeof(LayoutCacheFileInstr) + (u64)hdr->nAnchors * sizeof(LayoutCacheFileAnchor) +
+               (u64)hdr->nFonts * sizeof(LayoutCacheFileFont) + hdr->stringsSize;
+    bool ok = hdr->magic == kLayoutCacheFileMagic && hdr->version == kLayoutCacheFileVersion && hdr->nPages > 0 &&
+              size == data.size();
+    if (!ok || memcmp(hdr->layoutKey, key, sizeof(key)) != 0) {
+        // layout options changed since the file was saved
+        return false;
+    }
+
+    auto filePages = (const LayoutCacheFilePage*)(hdr + 1);
+    auto fileInstrs = (const LayoutCacheFileInstr*)(filePages + hdr->nPages);
+    auto fileAnchors = (const LayoutCacheFileAnchor*)(fileInstrs + hdr->nInstrs);
+    auto fileFonts = (const LayoutCacheFileFont*)(fileAnchors + hdr->nAnchors);
+    auto strings = (const char*)(fileFonts + hdr->nFonts);
+    int htmlLen = (int)layoutArgs->htmlStr.size();
+    u64 nInstrs = 0;
+    for (u32 i = 0; i < hdr->nPages; i++) {
+        ok &= 0 <= filePages[i].reparseIdx && filePages[i].reparseIdx < htmlLen;
+        ok &= -1 <= filePages[i].baseAnchor && filePages[i].baseAnchor < (int)hdr->nAnchors;
+        nInstrs += filePages[i].nInstrs;
+    }
+    ok &= nInstrs == hdr->nInstrs;
+    for (u32 i = 0; i < hdr->nAnchors; i++) {
+        ok &= (u64)fileAnchors[i].offset + fileAnchors[i].len <= hdr->stringsSize;
+        ok &= 1 <= fileAnchors[i].pageNo && fileAnchors[i].pageNo <= (int)hdr->nPages;
+    }
+    // fonts are referred to by their index in fileFonts
+    Vec<mui::CachedFont*> fonts;
+    for (u32 i = 0; ok && i < hdr->nFonts; i++) {
+        const LayoutCacheFileFont& f = fileFonts[i];
+        ok &= (u64)f.offset + f.len <= hdr->stringsSize;
+        if (ok) {
+            TempWStr name = ToWStrTemp(strings + f.offset, f.len);
+            mui::CachedFont* font = mui::GetCachedFont(name, f.sizePt, (Gdiplus::FontStyle)f.style);
+            ok &= font != nullptr;
+            fonts.Append(font);
+        }
+    }
+    for (u32 i = 0; ok && i < hdr->nInstrs; i++) {
+        const LayoutCacheFileInstr& fi = fileInstrs[i];
+        ok &= fi.type <= (u8)DrawInstrType::RtlString;
+        switch (fi.ref) {
+            case LayoutCacheRef::None:
+            case LayoutCacheRef::Image:
+                break;
+            case LayoutCacheRef::Html:
+                ok &= (u64)fi.idx + fi.len <= (u64)htmlLen;
+                break;
+            case LayoutCacheRef::Strings:
+                ok &= (u64)fi.idx + fi.len <= hdr->stringsSize;
+                break;
+            case LayoutCacheRef::Font:
+                ok &= fi.idx < hdr->nFonts;
+                break;
+            default:
+                ok = false;
+        }
+    }
+    if (!ok) {
+        logf("EngineEbook: ignoring invalid '%s'\n", layoutCachePath.Get());
+        return false;
+    }
+
+    Vec<HtmlPage*> restored;
+    const LayoutCacheFileInstr* fi = fileInstrs;
+    for (u32 i = 0; ok && i < hdr->nPages; i++) {
+        auto page = new HtmlPage(filePages[i].reparseIdx);
+        restored.Append(page);
+        for (u32 k = 0; ok && k < filePages[i].nInstrs; k++, fi++) {
+            DrawInstr instr((DrawInstrType)fi->type, RectF(fi->x, fi->y, fi->dx, fi->dy));
+            if (LayoutCacheRef::Html == fi->ref) {
+                instr.str.s = layoutArgs->htmlStr.data() + fi->idx;
+                instr.str.len = fi->len;
+            } else if (LayoutCacheRef::Strings == fi->ref) {
+                instr.str.s = str::Dup(&allocator, strings + fi->idx, fi->len);
+                instr.str.len = fi->len;
+            } else if (LayoutCacheRef::Font == fi->ref) {
+                instr.font = fonts.at(fi->idx);
+            } else if (LayoutCacheRef::Image == fi->ref) {
+                ByteSlice* img = GetImageById((int)fi->idx);
+                // the document must have changed (in a way that didn't change its size)
+                ok = img != nullptr;
+                if (img) {
+                    instr.str.s = (const char*)img->data();
+                    instr.str.len = img->size();
+                }
+            }
+            page->instructions.Append(instr);
+        }
+    }
+    if (!ok) {
+        logf("EngineEbook: ignoring '%s' with unknown images\n", layoutCachePath.Get());
+        DeleteVecMembers(restored);
+        return false;
+    }
+
+    for (u32 i = 0; i < hdr->nPages; i++) {
+        pages->Append(restored.at(i));
+        baseAnchors.Append(filePages[i].baseAnchor);
+    }
+    for (u32 i = 0; i < hdr->nAnchors; i++) {
+        const LayoutCacheFileAnchor& a = fileAnchors[i];
+        char* s = str::Dup(&allocator, strings + a.offset, a.len);
+        anchors.Append({s, a.len, a.y, a.pageNo});
+    }
+    for (mui::CachedFont* font : fonts) {
+        if (!pageFonts.Contains(font)) {
+            pageFonts.Append(font);
+        }
+    }
+    chunks.Reset();
+    layoutFinished = true;
     return true;
 }
 
+// must be called before deleting the document the formatters read from
+void EngineEbook::StopLayout() {
+    abortLayout = true;
+    if (layoutThread) {
+        WaitForSingleObject(layoutThread, INFINITE);
+        CloseHandle(layoutThread);
+        layoutThread = nullptr;
+    }
+    if (layoutChunkThreadsCount > 0) {
+        WaitForMultipleObjects((DWORD)layoutChunkThreadsCount, layoutChunkThreads, TRUE, INFINITE);
+        for (int i = 0; i < layoutChunkThreadsCount; i++) {
+            CloseHandle(layoutChunkThreads[i]);
+            layoutChunkThreads[i] = nullptr;
+        }
+        layoutChunkThreadsCount = 0;
+    }
+    delete formatter;
+    formatter = nullptr;
+    for (EbookLayoutChunk& chunk : chunks) {
+        if (chunk.pages) {
+            DeleteVecMembers(*chunk.pages);
+            delete chunk.pages;
+            chunk.pages = nullptr;
+        }
+    }
+}
+
+bool EngineEbook::IsPageCountProvisional() {
+    ScopedCritSec scope(&pagesAccess);
+    return !IsLayoutFinished() || (pages && pageCount < pages->Size());
+}
+
+void EngineEbook::SetOnLayoutFinished(const Func0& onFinished) {
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (!IsLayoutFinished()) {
+            onLayoutFinished = onFinished;
+            return;
+        }
+    }
+    onFinished.Call();
+}
+
+void EngineEbook::UpdatePageCount() {
+    ScopedCritSec scope(&pagesAccess);
+    if (pages) {
+        pageCount = pages->Size();
+    }
+}
+
+// ToCs built while pages were still being layed out miss the destinations
+// on later pages, so they're built again once layout is done
+void EngineEbook::RetireOutdatedToc(TocTree** tocTree) {
+    if (!*tocTree || !tocIsProvisional || IsPageCountProvisional()) {
+        return;
+    }
+    outdatedTocs.Append(*tocTree);
+    *tocTree = nullptr;
+    tocIsProvisional = false;
+}
+
 RectF EngineEbook::Transform(const RectF& rect, int, float zoom, int rotation, bool inverse) {
     RectF rcF = rect; // TODO: un-needed conversion
     auto p1 = Gdiplus::PointF(rcF.x, rcF.y);
@@ -463,9 +1163,10 @@ IPageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo
         return NewEbookLink(link, rect, nullptr, pageNo);
     }
 
-    DrawInstr* baseAnchor = baseAnchors.at(pageNo - 1);
-    if (baseAnchor) {
-        char* basePath = str::DupTemp(baseAnchor->str.s, baseAnchor->str.len);
+    ScopedCritSec scope(&pagesAccess);
+    int baseAnchor = baseAnchors.at(pageNo - 1);
+    if (baseAnchor >= 0) {
+        char* basePath = str::DupTemp(anchors.at(baseAnchor).s, anchors.at(baseAnchor).len);
         TempStr relPath = ResolveHtmlEntitiesTemp(link->str.s, link->str.len);
         AutoFreeStr absPath = NormalizeURL(relPath, basePath);
         url = str::DupTemp(absPath.Get());
@@ -479,6 +1180,7 @@ IPageElement* EngineEbook::CreatePageLink(DrawInstr* link, Rect rect, int pageNo
 }
 
 Vec<IPageElement*> EngineEbook::GetElements(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
     HtmlPage* pi = GetHtmlPage2(pageNo);
     if (pi->gotElements) {
         return pi->elements;
@@ -522,6 +1224,7 @@ RenderedBitmap* EngineEbook::GetImageForPageElement(IPageElement* iel) {
     PageElementImage* el = (PageElementImage*)iel;
     int pageNo = el->pageNo;
     int idx = el->imageID;
+    ScopedCritSec scope(&pagesAccess);
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
     auto&& i = pageInstrs->at(idx);
     ReportIf(i.type != DrawInstrType::Image);
@@ -550,32 +1253,31 @@ IPageDestination* EngineEbook::GetNamedDest(const char* name) {
     // try to first skip to the page with the desired
     // path before looking for the ID to allow
     // for the same ID to be reused on different pages
-    DrawInstr* baseAnchor = nullptr;
+    ScopedCritSec scope(&pagesAccess);
+    int baseAnchor = -1;
     int basePageNo = 0;
     if (id > name + 1) {
         size_t base_len = id - name - 1;
-        for (size_t i = 0; i < baseAnchors.size(); i++) {
-            DrawInstr* anchor = baseAnchors.at(i);
-            if (anchor && base_len == anchor->str.len && str::EqNI(name, anchor->str.s, base_len)) {
-                baseAnchor = anchor;
-                basePageNo = (int)i + 1;
+        for (int i = 0; i < baseAnchors.Size(); i++) {
+            int idx = baseAnchors.at(i);
+            if (idx < 0) {
+                continue;
+            }
+            PageAnchor& anchor = anchors.at(idx);
+            if (base_len == anchor.len && str::EqNI(name, anchor.s, base_len)) {
+                baseAnchor = idx;
+                basePageNo = i + 1;
                 break;
             }
         }
     }
 
     size_t id_len = str::Len(id);
-    for (size_t i = 0; i < anchors.size(); i++) {
+    for (int i = baseAnchor + 1; i < anchors.Size(); i++) {
         PageAnchor* anchor = &anchors.at(i);
-        if (baseAnchor) {
-            if (anchor->instr == baseAnchor) {
-                baseAnchor = nullptr;
-            }
-            continue;
-        }
         // note: at least CHM treats URLs as case-independent
-        if (id_len == anchor->instr->str.len && str::EqNI(id, anchor->instr->str.s, id_len)) {
-            RectF rect(0, anchor->instr->bbox.y + pageBorder, pageRect.dx, 10);
+        if (id_len == anchor->len && str::EqNI(id, anchor->s, id_len)) {
+            RectF rect(0, anchor->y + pageBorder, pageRect.dx, 10);
             rect.Inflate(-pageBorder, 0);
             return NewSimpleDest(anchor->pageNo, rect);
         }
@@ -594,39 +1296,31 @@ IPageDestination* EngineEbook::GetNamedDest(const char* name) {
 TempStr EngineEbook::ExtractFontListTemp() {
     ScopedCritSec scope(&pagesAccess);
 
-    Vec<mui::CachedFont*> seenFonts;
     StrVec fonts;
 
-    for (int pageNo = 1; pageNo <= PageCount(); pageNo++) {
-        Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
-        if (!pageInstrs) {
+    for (mui::CachedFont* pageFont : pageFonts) {
+        // pageFont might be in use by a thread laying out pages
+        mui::CachedFont* font = mui::GetCachedFont(pageFont->name, pageFont->sizePt, pageFont->GetStyle());
+        if (!font) {
             continue;
         }
-
-        for (DrawInstr& i : *pageInstrs) {
-            if (DrawInstrType::SetFont != i.type || seenFonts.Contains(i.font)) {
-                continue;
-            }
-            seenFonts.Append(i.font);
-
-            FontFamily family;
-            if (!i.font->font) {
-                // TODO: handle gdi
-                ReportIf(!i.font->GetHFont());
-                continue;
-            }
-            Status ok = i.font->font->GetFamily(&family);
-            if (ok != Ok) {
-                continue;
-            }
-            WCHAR fontNameW[LF_FACESIZE];
-            ok = family.GetFamilyName(fontNameW);
-            if (ok != Ok) {
-                continue;
-            }
-            char* fontName = ToUtf8Temp(fontNameW);
-            AppendIfNotExists(&fonts, fontName);
+        FontFamily family;
+        if (!font->font) {
+            // TODO: handle gdi
+            ReportIf(!font->GetHFont());
+            continue;
+        }
+        Status ok = font->font->GetFamily(&family);
+        if (ok != Ok) {
+            continue;
         }
+        WCHAR fontNameW[LF_FACESIZE];
+        ok = family.GetFamilyName(fontNameW);
+        if (ok != Ok) {
+            continue;
+        }
+        char* fontName = ToUtf8Temp(fontNameW);
+        AppendIfNotExists(&fonts, fontName);
     }
     if (fonts.Size() == 0) {
         return nullptr;
@@ -723,7 +1417,7 @@ class EngineEpub : public EngineEbook {
 
     TocTree* GetToc() override;
 
-    static EngineBase* CreateFromFile(const char* fileName);
+    static EngineBase* CreateFromFile(const char* fileName, bool layoutInBackground = false);
     static EngineBase* CreateFromStream(IStream* stream);
 
   protected:
@@ -734,6 +1428,15 @@ class EngineEpub : public EngineEbook {
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new EpubFormatter(args, doc);
+    }
+    int GetImageId(const ByteSlice& img) override {
+        return doc->GetImageId(img.data());
+    }
+    ByteSlice* GetImageById(int id) override {
+        return doc->GetImageDataById(id);
+    }
 };
 
 EngineEpub::EngineEpub() : EngineEbook() {
@@ -742,6 +1445,7 @@ EngineEpub::EngineEpub() : EngineEbook() {
 }
 
 EngineEpub::~EngineEpub() {
+    StopLayout();
     delete doc;
     delete tocTree;
     if (stream) {
@@ -786,20 +1490,18 @@ bool EngineEpub::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args{};
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
-
-    pages = EpubFormatter(&args, doc).FormatAllPages(false);
+    layoutArgs = new HtmlFormatterArgs();
+    layoutArgs->htmlStr = doc->GetHtmlData();
+    layoutArgs->pageDx = (float)pageRect.dx - 2 * pageBorder;
+    layoutArgs->pageDy = (float)pageRect.dy - 2 * pageBorder;
+    layoutArgs->SetFontName(GetDefaultFontName());
+    layoutArgs->fontSize = GetDefaultFontSize();
+    layoutArgs->textAllocator = &allocator;
+    layoutArgs->textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    layoutSkipEmptyPages = false;
+    SetLayoutChunks(doc->GetSectionStarts());
 
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
+    if (!StartLayout()) {
         return false;
     }
 
@@ -833,9 +1535,11 @@ bool EngineEpub::SaveFileAs(const char* dstPath) {
 }
 
 TocTree* EngineEpub::GetToc() {
+    RetireOutdatedToc(&tocTree);
     if (tocTree) {
         return tocTree;
     }
+    bool provisional = IsPageCountProvisional();
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     TocItem* root = builder.GetRoot();
@@ -845,11 +1549,13 @@ TocTree* EngineEpub::GetToc() {
     auto realRoot = new TocItem();
     realRoot->child = root;
     tocTree = new TocTree(realRoot);
+    tocIsProvisional = provisional;
     return tocTree;
 }
 
-EngineBase* EngineEpub::CreateFromFile(const char* fileName) {
+EngineBase* EngineEpub::CreateFromFile(const char* fileName, bool layoutInBackground) {
     EngineEpub* engine = new EngineEpub();
+    engine->layoutInBackground = layoutInBackground;
     if (!engine->Load(fileName)) {
         SafeEngineRelease(&engine);
         return nullptr;
@@ -866,8 +1572,8 @@ EngineBase* EngineEpub::CreateFromStream(IStream* stream) {
     return engine;
 }
 
-EngineBase* CreateEngineEpubFromFile(const char* fileName) {
-    return EngineEpub::CreateFromFile(fileName);
+EngineBase* CreateEngineEpubFromFile(const char* fileName, bool layoutInBackground) {
+    return EngineEpub::CreateFromFile(fileName, layoutInBackground);
 }
 
 EngineBase* CreateEngineEpubFromStream(IStream* stream) {
@@ -883,6 +1589,7 @@ class EngineFb2 : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".fb2");
     }
     ~EngineFb2() override {
+        StopLayout();
         delete tocTree;
         delete doc;
     }
@@ -903,7 +1610,7 @@ class EngineFb2 : public EngineEbook {
 
     TocTree* GetToc() override;
 
-    static EngineBase* CreateFromFile(const char* fileName);
+    static EngineBase* CreateFromFile(const char* fileName, bool layoutInBackground = false);
     static EngineBase* CreateFromStream(IStream* stream);
 
   protected:
@@ -913,6 +1620,15 @@ class EngineFb2 : public EngineEbook {
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new Fb2Formatter(args, doc);
+    }
+    int GetImageId(const ByteSlice& img) override {
+        return doc->GetImageId(img.data());
+    }
+    ByteSlice* GetImageById(int id) override {
+        return doc->GetImageDataById(id);
+    }
 };
 
 bool EngineFb2::Load(const char* fileName) {
@@ -931,32 +1647,29 @@ bool EngineFb2::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetXmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    layoutArgs = new HtmlFormatterArgs();
+    layoutArgs->htmlStr = doc->GetXmlData();
+    layoutArgs->pageDx = (float)pageRect.dx - 2 * pageBorder;
+    layoutArgs->pageDy = (float)pageRect.dy - 2 * pageBorder;
+    layoutArgs->SetFontName(GetDefaultFontName());
+    layoutArgs->fontSize = GetDefaultFontSize();
+    layoutArgs->textAllocator = &allocator;
+    layoutArgs->textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    layoutSkipEmptyPages = false;
 
     if (doc->IsZipped()) {
         str::ReplaceWithCopy(&defaultExt, ".fb2z");
     }
 
-    pages = Fb2Formatter(&args, doc).FormatAllPages(false);
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
-    return pageCount > 0;
+    return StartLayout();
 }
 
 TocTree* EngineFb2::GetToc() {
+    RetireOutdatedToc(&tocTree);
     if (tocTree) {
         return tocTree;
     }
+    bool provisional = IsPageCountProvisional();
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     TocItem* root = builder.GetRoot();
@@ -966,11 +1679,13 @@ TocTree* EngineFb2::GetToc() {
     auto realRoot = new TocItem();
     realRoot->child = root;
     tocTree = new TocTree(realRoot);
+    tocIsProvisional = provisional;
     return tocTree;
 }
 
-EngineBase* EngineFb2::CreateFromFile(const char* fileName) {
+EngineBase* EngineFb2::CreateFromFile(const char* fileName, bool layoutInBackground) {
     EngineFb2* engine = new EngineFb2();
+    engine->layoutInBackground = layoutInBackground;
     if (!engine->Load(fileName)) {
         SafeEngineRelease(&engine);
         return nullptr;
@@ -987,8 +1702,8 @@ EngineBase* EngineFb2::CreateFromStream(IStream* stream) {
     return engine;
 }
 
-EngineBase* CreateEngineFb2FromFile(const char* fileName) {
-    return EngineFb2::CreateFromFile(fileName);
+EngineBase* CreateEngineFb2FromFile(const char* fileName, bool layoutInBackground) {
+    return EngineFb2::CreateFromFile(fileName, layoutInBackground);
 }
 
 EngineBase* CreateEngineFb2FromStream(IStream* stream) {
@@ -1006,6 +1721,7 @@ class EngineMobi : public EngineEbook {
         str::ReplaceWithCopy(&defaultExt, ".mobi");
     }
     ~EngineMobi() override {
+        StopLayout();
         delete tocTree;
         delete doc;
     }
@@ -1027,7 +1743,7 @@ class EngineMobi : public EngineEbook {
     IPageDestination* GetNamedDest(const char* name) override;
     TocTree* GetToc() override;
 
-    static EngineBase* CreateFromFile(const char* fileName);
+    static EngineBase* CreateFromFile(const char* fileName, bool layoutInBackground = false);
     static EngineBase* CreateFromStream(IStream* stream);
 
   protected:
@@ -1037,6 +1753,15 @@ class EngineMobi : public EngineEbook {
     bool Load(const char* fileName);
     bool Load(IStream* stream);
     bool FinishLoading();
+    HtmlFormatter* CreateFormatter(HtmlFormatterArgs* args) override {
+        return new MobiFormatter(args, doc);
+    }
+    int GetImageId(const ByteSlice& img) override {
+        return doc->GetImageId(img.data());
+    }
+    ByteSlice* GetImageById(int id) override {
+        return doc->GetImageById(id);
+    }
 };
 
 bool EngineMobi::Load(const char* fileName) {
@@ -1055,22 +1780,17 @@ bool EngineMobi::FinishLoading() {
         return false;
     }
 
-    HtmlFormatterArgs args;
-    args.htmlStr = doc->GetHtmlData();
-    args.pageDx = (float)pageRect.dx - 2 * pageBorder;
-    args.pageDy = (float)pageRect.dy - 2 * pageBorder;
-    args.SetFontName(GetDefaultFontName());
-    args.fontSize = GetDefaultFontSize();
-    args.textAllocator = &allocator;
-    args.textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    layoutArgs = new HtmlFormatterArgs();
+    layoutArgs->htmlStr = doc->GetHtmlData();
+    layoutArgs->pageDx = (float)pageRect.dx - 2 * pageBorder;
+    layoutArgs->pageDy = (float)pageRect.dy - 2 * pageBorder;
+    layoutArgs->SetFontName(GetDefaultFontName());
+    layoutArgs->fontSize = GetDefaultFontSize();
+    layoutArgs->textAllocator = &allocator;
+    layoutArgs->textRenderMethod = mui::TextRenderMethod::GdiplusQuick;
+    layoutSkipEmptyPages = true;
 
-    pages = MobiFormatter(&args, doc).FormatAllPages();
-    // must set pageCount before ExtractPageAnchors
-    pageCount = (int)pages->size();
-    if (!ExtractPageAnchors()) {
-        return false;
-    }
-    return pageCount > 0;
+    return StartLayout();
 }
 
 IPageDestination* EngineMobi::GetNamedDest(const char* name) {
@@ -1078,6 +1798,7 @@ IPageDestination* EngineMobi::GetNamedDest(const char* name) {
     if (filePos < 0 || 0 == filePos && *name != '0') {
         return nullptr;
     }
+    ScopedCritSec scope(&pagesAccess);
     int pageNo;
     for (pageNo = 1; pageNo < PageCount(); pageNo++) {
         if (pages->at(pageNo)->reparseIdx > filePos) {
@@ -1093,7 +1814,6 @@ IPageDestination* EngineMobi::GetNamedDest(const char* name) {
         return nullptr;
     }
 
-    ScopedCritSec scope(&pagesAccess);
     Vec<DrawInstr>* pageInstrs = GetHtmlPage(pageNo);
     // link to the bottom of the page, if filePos points
     // beyond the last visible DrawInstr of a page
@@ -1111,9 +1831,11 @@ IPageDestination* EngineMobi::GetNamedDest(const char* name) {
 }
 
 TocTree* EngineMobi::GetToc() {
+    RetireOutdatedToc(&tocTree);
     if (tocTree) {
         return tocTree;
     }
+    bool provisional = IsPageCountProvisional();
     EbookTocBuilder builder(this);
     doc->ParseToc(&builder);
     TocItem* root = builder.GetRoot();
@@ -1123,11 +1845,13 @@ TocTree* EngineMobi::GetToc() {
     auto realRoot = new TocItem();
     realRoot->child = root;
     tocTree = new TocTree(realRoot);
+    tocIsProvisional = provisional;
     return tocTree;
 }
 
-EngineBase* EngineMobi::CreateFromFile(const char* fileName) {
+EngineBase* EngineMobi::CreateFromFile(const char* fileName, bool layoutInBackground) {
     EngineMobi* engine = new EngineMobi();
+    engine->layoutInBackground = layoutInBackground;
     if (!engine->Load(fileName)) {
         SafeEngineRelease(&engine);
         return nullptr;
@@ -1144,8 +1868,8 @@ EngineBase* EngineMobi::CreateFromStream(IStream* stream) {
     return engine;
 }
 
-EngineBase* CreateEngineMobiFromFile(const char* fileName) {
-    return EngineMobi::CreateFromFile(fileName);
+EngineBase* CreateEngineMobiFromFile(const char* fileName, bool layoutInBackground) {
+    return EngineMobi::CreateFromFile(fileName, layoutInBackground);
 }
 
 EngineBase* CreateEngineMobiFromStream(IStream* stream) {
@@ -1340,7 +2064,7 @@ void ChmFormatter::HandleTagPagebreak(HtmlToken* t) {
         currPage->instructions.Append(DrawInstr::Anchor(attr->val, attr->valLen, bbox));
         pagePath.Set(str::Dup(attr->val, attr->valLen));
         // reset CSS style rules for the new document
-        styleRules.Reset();
+        styleSheet.Reset();
     }
 }
 
@@ -1366,7 +2090,7 @@ void ChmFormatter::HandleTagLink(HtmlToken* t) {
     url::DecodeInPlace(src);
     ByteSlice data = chmDoc->GetFileData(src, pagePath);
     if (data.Get()) {
-        ParseStyleSheet(data, data.size());
+        styleSheet.Parse(data, data.size());
     }
     data.Free();
 }
@@ -1602,8 +2326,11 @@ IPageElement* EngineChm::CreatePageLink(DrawInstr* link, Rect rect, int pageNo)
         return linkEl;
     }
 
-    DrawInstr* baseAnchor = baseAnchors.at(pageNo - 1);
-    AutoFreeStr basePath = str::Dup(baseAnchor->str.s, baseAnchor->str.len);
+    int baseAnchor = baseAnchors.at(pageNo - 1);
+    if (baseAnchor < 0) {
+        return nullptr;
+    }
+    AutoFreeStr basePath = str::Dup(anchors.at(baseAnchor).s, anchors.at(baseAnchor).len);
     AutoFreeStr url = str::Dup(link->str.s, link->str.len);
     url.Set(NormalizeURL(url, basePath));
     if (!doc->HasData(url)) {
@@ -1719,6 +2446,7 @@ void EngineHtml::SetEncoding(uint codepage) {
     }
     anchors.Reset();
     baseAnchors.Reset();
+    pageFonts.Reset();
     allocator.FreeAll();
 
     // Re-format pages
@@ -1891,6 +2619,7 @@ void EngineTxt::SetEncoding(uint codepage) {
     }
     anchors.Reset();
     baseAnchors.Reset();
+    pageFonts.Reset();
     allocator.FreeAll(); // Clear allocated text memory
 
     // Re-format pages
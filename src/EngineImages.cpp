@@ -13,6 +13,7 @@
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
 #include "utils/DirIter.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/UIModels.h"
 
@@ -49,8 +50,21 @@ Kind kindEngineImage = "engineImage";
 Kind kindEngineImageDir = "engineImageDir";
 Kind kindEngineComicBooks = "engineComicBooks";
 
-// number of decoded bitmaps to cache for quicker rendering
-#define MAX_IMAGE_PAGE_CACHE 10
+// decoded bitmaps are cached for quicker rendering, up to this many bytes
+// (pages that are currently in use are never dropped)
+constexpr size_t kImagePageCacheBudget = sizeof(void*) == 8 ? (size_t)512 << 20 : (size_t)128 << 20;
+// and at most this many pages (which limits the number of cached pages that failed to load)
+constexpr int kMaxImagePageCache = 64;
+// number of pages decoded ahead of time in the reading direction
+// (and in the opposite direction, one page)
+constexpr int kPrefetchPagesCount = 3;
+
+// page sizes are read from the beginning of the image data. most image headers fit
+// into the first size, JPEGs with large EXIF data or color profiles need the second
+static const size_t gImageHeaderSizes[] = {1024, 64 * 1024};
+// for reading the page sizes of .zip files in parallel
+constexpr int kMaxPageSizesThreads = 4;
+constexpr int kMinPagesPerThread = 64;
 
 ///// EngineImages methods apply to all types of engines handling full-page images /////
 
@@ -59,10 +73,22 @@ struct ImagePage {
     Bitmap* bmp = nullptr;
     bool ownBmp = true;
     int refs = 1;
+    // size of the decoded bitmap, if we own it
+    size_t nBytes = 0;
+    // value of EngineImages::pageCacheClock when the page was last used
+    u64 lastUsed = 0;
+    bool inCache = true;
+    // GDI+ objects aren't thread-safe and a cached page is shared
+    // by all render threads, so bmp must only be used while holding this
+    CRITICAL_SECTION bmpAccess;
 
     ImagePage(int pageNo, Bitmap* bmp) {
         this->pageNo = pageNo;
         this->bmp = bmp;
+        InitializeCriticalSection(&bmpAccess);
+    }
+    ~ImagePage() {
+        DeleteCriticalSection(&bmpAccess);
     }
 };
 
@@ -70,6 +96,8 @@ struct ImagePageInfo {
     Vec<IPageElement*> allElements;
     RectF mediabox{};
     bool hasMediaBox = false;
+    // in EngineImages::pageCache, if decoded
+    ImagePage* cachedPage = nullptr;
     ImagePageInfo() = default;
 };
 
@@ -109,9 +137,23 @@ class EngineImages : public EngineBase {
     ScopedComPtr<IStream> fileStream;
 
     CRITICAL_SECTION cacheAccess;
+    // serializes LoadBitmapForPage() calls, which are made without holding cacheAccess
+    CRITICAL_SECTION loadAccess;
     Vec<ImagePage*> pageCache;
+    // total nBytes of pages in pageCache
+    size_t pageCacheBytes = 0;
+    u64 pageCacheClock = 0;
     Vec<ImagePageInfo*> pages;
 
+    // if set, pages next to the last rendered one are decoded ahead of time by prefetchThread
+    bool prefetchPages = false;
+    HANDLE prefetchThread = nullptr;
+    HANDLE prefetchEvent = nullptr;
+    bool abortPrefetch = false;
+    int prefetchPageNo = 0;
+    // 1 when reading forward, -1 when reading backward
+    int prefetchDir = 1;
+
     void GetTransform(Matrix& m, int pageNo, float zoom, int rotation);
 
     virtual Bitmap* LoadBitmapForPage(int pageNo, bool& deleteAfterUse) = 0;
@@ -119,6 +161,14 @@ class EngineImages : public EngineBase {
 
     ImagePage* GetPage(int pageNo, bool tryOnly = false);
     void DropPage(ImagePage* page, bool forceRemove);
+    ImagePage* UsePage(ImagePage* page);
+    void RemoveFromCache(ImagePage* page);
+    void PurgePageCache(ImagePage* keep);
+    bool IsPageCacheFull();
+
+    void StartPrefetch(int pageNo);
+    void PrefetchPages();
+    void StopPrefetching();
 
     RectF PageContentBox(int pageNo, RenderTarget) override;
 };
@@ -131,9 +181,11 @@ EngineImages::EngineImages() {
     isImageCollection = true;
 
     InitializeCriticalSection(&cacheAccess);
+    InitializeCriticalSection(&loadAccess);
 }
 
 EngineImages::~EngineImages() {
+    StopPrefetching();
     EnterCriticalSection(&cacheAccess);
     while (pageCache.size() > 0) {
         ImagePage* lastPage = pageCache.Last();
@@ -143,6 +195,7 @@ EngineImages::~EngineImages() {
     DeleteVecMembers(pages);
     LeaveCriticalSection(&cacheAccess);
     DeleteCriticalSection(&cacheAccess);
+    DeleteCriticalSection(&loadAccess);
 }
 
 RectF EngineImages::PageMediabox(int pageNo) {
@@ -167,6 +220,7 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     if (!page) {
         return nullptr;
     }
+    StartPrefetch(pageNo);
 
     auto timeStart = TimeGet();
     defer {
@@ -206,8 +260,12 @@ RenderedBitmap* EngineImages::RenderPage(RenderPageArgs& args) {
     Rect pageRcI = PageMediabox(pageNo).Round();
     ImageAttributes imgAttrs;
     imgAttrs.SetWrapMode(WrapModeTileFlipXY);
-    Status ok =
-        g.DrawImage(page->bmp, ToGdipRect(pageRcI), pageRcI.x, pageRcI.y, pageRcI.dx, pageRcI.dy, UnitPixel, &imgAttrs);
+    Status ok;
+    {
+        ScopedCritSec scope(&page->bmpAccess);
+        ok = g.DrawImage(page->bmp, ToGdipRect(pageRcI), pageRcI.x, pageRcI.y, pageRcI.dx, pageRcI.dy, UnitPixel,
+                         &imgAttrs);
+    }
 
     DropPage(page, false);
     DeleteDC(hDC);
@@ -290,11 +348,14 @@ RenderedBitmap* EngineImages::GetImageForPageElement(IPageElement* pel) {
     }
 
     HBITMAP hbmp;
-    auto bmp = page->bmp;
-    int dx = bmp->GetWidth();
-    int dy = bmp->GetHeight();
-    Size s{dx, dy};
-    auto status = bmp->GetHBITMAP((ARGB)Color::White, &hbmp);
+    Size s;
+    Status status;
+    {
+        ScopedCritSec scope(&page->bmpAccess);
+        auto bmp = page->bmp;
+        s = Size(bmp->GetWidth(), bmp->GetHeight());
+        status = bmp->GetHBITMAP((ARGB)Color::White, &hbmp);
+    }
     DropPage(page, false);
     if (status != Ok) {
         return nullptr;
@@ -321,45 +382,97 @@ bool EngineImages::SaveFileAs(const char* dstPath) {
     return file::WriteFile(dstPath, d);
 }
 
-ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
-    ScopedCritSec scope(&cacheAccess);
+static size_t BitmapBytes(Bitmap* bmp) {
+    if (!bmp) {
+        return 0;
+    }
+    size_t bpp = Gdiplus::GetPixelFormatSize(bmp->GetPixelFormat());
+    return (size_t)bmp->GetWidth() * (size_t)bmp->GetHeight() * bpp / 8;
+}
 
-    ImagePage* result = nullptr;
+ImagePage* EngineImages::GetPage(int pageNo, bool tryOnly) {
+    ReportIf(pageNo < 1 || pageNo > pages.Size());
+    {
+        ScopedCritSec scope(&cacheAccess);
+        ImagePage* result = pages[pageNo - 1]->cachedPage;
+        if (result || tryOnly) {
+            return UsePage(result);
+        }
+    }
 
-    for (size_t i = 0; i < pageCache.size(); i++) {
-        if (pageCache.at(i)->pageNo == pageNo) {
-            result = pageCache.at(i);
-            break;
+    // decoding can take a while, in the meantime already decoded pages can still be used
+    ScopedCritSec scopeLoad(&loadAccess);
+    {
+        ScopedCritSec scope(&cacheAccess);
+        // the page might have been loaded (e.g. prefetched) while we waited for loadAccess
+        ImagePage* result = pages[pageNo - 1]->cachedPage;
+        if (result) {
+            return UsePage(result);
         }
     }
-    if (!result && tryOnly) {
-        return nullptr;
+    auto result = new ImagePage(pageNo, nullptr);
+    result->bmp = LoadBitmapForPage(pageNo, result->ownBmp);
+    if (result->ownBmp) {
+        result->nBytes = BitmapBytes(result->bmp);
     }
 
-    if (!result) {
-        // TODO: drop most memory intensive pages first
-        if (pageCache.size() >= MAX_IMAGE_PAGE_CACHE) {
-            ReportIf(pageCache.size() != MAX_IMAGE_PAGE_CACHE);
-            DropPage(pageCache.Last(), true);
-        }
-        result = new ImagePage(pageNo, nullptr);
-        result->bmp = LoadBitmapForPage(pageNo, result->ownBmp);
-        pageCache.InsertAt(0, result);
-    } else if (result != pageCache.at(0)) {
-        // keep the list Most Recently Used first
-        pageCache.Remove(result);
-        pageCache.InsertAt(0, result);
+    ScopedCritSec scope(&cacheAccess);
+    pages[pageNo - 1]->cachedPage = result;
+    pageCache.Append(result);
+    pageCacheBytes += result->nBytes;
+    PurgePageCache(result);
+    return UsePage(result);
+}
+
+// caller must hold cacheAccess
+ImagePage* EngineImages::UsePage(ImagePage* page) {
+    if (!page) {
+        return nullptr;
     }
+    page->lastUsed = ++pageCacheClock;
     // return nullptr if a page failed to load
-    if (result && !result->bmp) {
+    if (!page->bmp) {
         return nullptr;
     }
-    if (!result) {
-        return nullptr;
+    page->refs++;
+    return page;
+}
+
+// drops the least recently used pages until the cache is within its budget,
+// skipping keep and pages that are currently in use
+void EngineImages::PurgePageCache(ImagePage* keep) {
+    ScopedCritSec scope(&cacheAccess);
+    while (pageCacheBytes > kImagePageCacheBudget || pageCache.Size() > kMaxImagePageCache) {
+        ImagePage* lru = nullptr;
+        for (ImagePage* page : pageCache) {
+            if (page != keep && page->refs == 1 && (!lru || page->lastUsed < lru->lastUsed)) {
+                lru = page;
+            }
+        }
+        if (!lru) {
+            break;
+        }
+        DropPage(lru, true);
     }
+}
 
-    result->refs++;
-    return result;
+bool EngineImages::IsPageCacheFull() {
+    ScopedCritSec scope(&cacheAccess);
+    return pageCacheBytes >= kImagePageCacheBudget || pageCache.Size() >= kMaxImagePageCache;
+}
+
+void EngineImages::RemoveFromCache(ImagePage* page) {
+    ScopedCritSec scope(&cacheAccess);
+    if (!page->inCache) {
+        return;
+    }
+    page->inCache = false;
+    pageCache.Remove(page);
+    pageCacheBytes -= page->nBytes;
+    ImagePageInfo* pi = pages[page->pageNo - 1];
+    if (pi->cachedPage == page) {
+        pi->cachedPage = nullptr;
+    }
 }
 
 void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
@@ -368,7 +481,7 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     ReportIf(page->refs < 0);
 
     if (0 == page->refs || forceRemove) {
-        pageCache.Remove(page);
+        RemoveFromCache(page);
     }
 
     if (0 == page->refs) {
@@ -379,6 +492,89 @@ void EngineImages::DropPage(ImagePage* page, bool forceRemove) {
     }
 }
 
+static void PrefetchPagesThread(EngineImages* engine) {
+    engine->PrefetchPages();
+}
+
+// when reading comics, decoding the next page can take long enough to be noticeable,
+// so we decode the pages following pageNo (in reading direction) in the background
+void EngineImages::StartPrefetch(int pageNo) {
+    if (!prefetchPages) {
+        return;
+    }
+    ScopedCritSec scope(&cacheAccess);
+    if (abortPrefetch || pageNo == prefetchPageNo) {
+        return;
+    }
+    if (prefetchPageNo != 0) {
+        prefetchDir = pageNo < prefetchPageNo ? -1 : 1;
+    }
+    prefetchPageNo = pageNo;
+    if (!prefetchThread) {
+        prefetchEvent = CreateEvent(nullptr, FALSE, FALSE, nullptr);
+        auto fn = MkFunc0<EngineImages>(PrefetchPagesThread, this);
+        prefetchThread = StartThread(fn, "ImagePrefetchThread");
+        if (!prefetchThread) {
+            prefetchPages = false;
+            return;
+        }
+    }
+    SetEvent(prefetchEvent);
+}
+
+void EngineImages::PrefetchPages() {
+    // decoding shouldn't slow down rendering of the current page
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+    for (;;) {
+        WaitForSingleObject(prefetchEvent, INFINITE);
+        int startPageNo, dir;
+        {
+            ScopedCritSec scope(&cacheAccess);
+            startPageNo = prefetchPageNo;
+            dir = prefetchDir;
+        }
+        // pages in reading direction first, then the one we came from
+        for (int i = 1; i <= kPrefetchPagesCount + 1; i++) {
+            int pageNo = i <= kPrefetchPagesCount ? startPageNo + i * dir : startPageNo - dir;
+            {
+                ScopedCritSec scope(&cacheAccess);
+                if (abortPrefetch) {
+                    return;
+                }
+                if (prefetchPageNo != startPageNo) {
+                    // the user moved on, start over from the new page
+                    break;
+                }
+            }
+            if (pageNo < 1 || pageNo > PageCount()) {
+                continue;
+            }
+            ImagePage* page = GetPage(pageNo);
+            if (page) {
+                DropPage(page, false);
+            }
+        }
+    }
+}
+
+// must be called from the destructor of classes implementing LoadBitmapForPage(),
+// before the prefetch thread could call it on a partially destroyed object
+void EngineImages::StopPrefetching() {
+    {
+        ScopedCritSec scope(&cacheAccess);
+        abortPrefetch = true;
+        if (!prefetchThread) {
+            return;
+        }
+    }
+    SetEvent(prefetchEvent);
+    WaitForSingleObject(prefetchThread, INFINITE);
+    CloseHandle(prefetchThread);
+    CloseHandle(prefetchEvent);
+    prefetchThread = nullptr;
+    prefetchEvent = nullptr;
+}
+
 // Get content box for image by cropping out margins of similar color
 RectF EngineImages::PageContentBox(int pageNo, RenderTarget target) {
     // try to load bitmap for the image
@@ -389,6 +585,7 @@ RectF EngineImages::PageContentBox(int pageNo, RenderTarget target) {
         DropPage(page, false);
     };
 
+    ScopedCritSec scope(&page->bmpAccess);
     auto bmp = page->bmp;
     if (!bmp)
         return RectF{};
@@ -726,9 +923,11 @@ RectF EngineImage::LoadMediabox(int pageNo) {
     }
 
     // fill the cache to prevent the first few frames from being unpacked twice
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
+        EnterCriticalSection(&page->bmpAccess);
         RectF mbox(0, 0, (float)page->bmp->GetWidth(), (float)page->bmp->GetHeight());
+        LeaveCriticalSection(&page->bmpAccess);
         DropPage(page, false);
         return mbox;
     }
@@ -803,9 +1002,11 @@ class EngineImageDir : public EngineImages {
         // TODO: is there a better place to expose pageFileNames
         // than through page labels?
         hasPageLabels = true;
+        prefetchPages = true;
     }
 
     ~EngineImageDir() override {
+        StopPrefetching();
         delete tocTree;
     }
 
@@ -871,7 +1072,9 @@ static bool LoadImageDir(EngineImageDir* e, const char* dir) {
     // TODO: better handle the case where images have different resolutions
     ImagePage* page = e->GetPage(1);
     if (page) {
+        EnterCriticalSection(&page->bmpAccess);
         e->fileDPI = page->bmp->GetHorizontalResolution();
+        LeaveCriticalSection(&page->bmpAccess);
         e->DropPage(page, false);
     }
     return true;
@@ -1119,8 +1322,15 @@ class EngineCbx : public EngineImages {
     bool FinishLoading();
 
     ByteSlice GetImageData(int pageNo);
+    bool PageSizeFromHeader(MultiFormatArchive* arch, int pageNo, RectF& mbox);
+    void ReadPageSizes();
+
+  public:
+    void ReadPageSizes(MultiFormatArchive* arch, AtomicInt* nextPageNo);
 
-    // access to cbxFile must be protected after initialization (with cacheAccess)
+  protected:
+    // access to cbxFile must be protected after initialization (with archiveAccess)
+    CRITICAL_SECTION archiveAccess;
     MultiFormatArchive* cbxFile = nullptr;
     Vec<MultiFormatArchive::FileInfo*> files;
     TocTree* tocTree = nullptr;
@@ -1132,11 +1342,15 @@ class EngineCbx : public EngineImages {
 EngineCbx::EngineCbx(MultiFormatArchive* arch) {
     cbxFile = arch;
     kind = kindEngineComicBooks;
+    prefetchPages = true;
+    InitializeCriticalSection(&archiveAccess);
 }
 
 EngineCbx::~EngineCbx() {
+    StopPrefetching();
     delete tocTree;
     delete cbxFile;
+    DeleteCriticalSection(&archiveAccess);
 }
 
 EngineBase* EngineCbx::Clone() {
@@ -1263,6 +1477,7 @@ bool EngineCbx::FinishLoading() {
     }
     files = std::move(pageFiles);
     pageCount = nFiles;
+    ReadPageSizes();
 
     TocItem* root = nullptr;
     TocItem* curr = nullptr;
@@ -1295,6 +1510,7 @@ TocTree* EngineCbx::GetToc() {
 ByteSlice EngineCbx::GetImageData(int pageNo) {
     ReportIf((pageNo < 1) || (pageNo > PageCount()));
     size_t fileId = files[pageNo - 1]->fileId;
+    ScopedCritSec scope(&archiveAccess);
     ByteSlice d = cbxFile->GetFileDataById(fileId);
     return d;
 }
@@ -1345,7 +1561,121 @@ Bitmap* EngineCbx::LoadBitmapForPage(int pageNo, bool& deleteAfterUse) {
     return res;
 }
 
+// reads the page size from just the header of the page's image, which
+// (unlike decompressing the whole image) is cheap
+// only for .zip and .tar files: entries of (solid) .rar and .7z files can't be
+// decompressed partially without decompressing all the entries before them,
+// so reading the headers of all pages would take O(n^2)
+bool EngineCbx::PageSizeFromHeader(MultiFormatArchive* arch, int pageNo, RectF& mbox) {
+    if (MultiFormatArchive::Format::Zip != arch->format && MultiFormatArchive::Format::Tar != arch->format) {
+        return false;
+    }
+    size_t fileId = files[pageNo - 1]->fileId;
+    size_t fileSize = files[pageNo - 1]->fileSizeUncompressed;
+    for (size_t hdrSize : gImageHeaderSizes) {
+        ByteSlice hdr = arch->GetFileDataPrefixById(fileId, hdrSize);
+        Size size;
+        bool ok = BitmapSizeFromHeader(hdr, size);
+        hdr.Free();
+        if (ok) {
+            mbox = RectF(0, 0, (float)size.dx, (float)size.dy);
+            return true;
+        }
+        if (hdr.empty() || hdrSize >= fileSize) {
+            break;
+        }
+    }
+    return false;
+}
+
+struct PageSizesThreadData {
+    EngineCbx* engine = nullptr;
+    // a separate handle to the archive for this thread
+    MultiFormatArchive* arch = nullptr;
+    AtomicInt* nextPageNo = nullptr;
+};
+
+static void ReadPageSizesThread(PageSizesThreadData* data) {
+    data->engine->ReadPageSizes(data->arch, data->nextPageNo);
+}
+
+void EngineCbx::ReadPageSizes(MultiFormatArchive* arch, AtomicInt* nextPageNo) {
+    for (;;) {
+        int pageNo = nextPageNo->Inc();
+        if (pageNo > pageCount) {
+            break;
+        }
+        RectF mbox;
+        if (PageSizeFromHeader(arch, pageNo, mbox)) {
+            ImagePageInfo* pi = pages[pageNo - 1];
+            pi->mediabox = mbox;
+            pi->hasMediaBox = true;
+        }
+    }
+}
+
+// the sizes of all pages are needed for the layout so we read them up front
+// from the image headers. entries of .zip files can be decompressed independently,
+// so for larger .zip files several threads do that, each with its own handle
+// to the archive. entries of other archive types are usually compressed
+// together (solid) which would make reading them out of order expensive,
+// so their sizes are read on demand from the whole image in LoadMediabox()
+void EngineCbx::ReadPageSizes() {
+    bool canReadAll = MultiFormatArchive::Format::Zip == cbxFile->format ||
+                      MultiFormatArchive::Format::Tar == cbxFile->format;
+    if (!canReadAll) {
+        return;
+    }
+
+    int nThreads = 1;
+    const char* path = FilePath();
+    if (path && MultiFormatArchive::Format::Zip == cbxFile->format) {
+        SYSTEM_INFO si{};
+        GetSystemInfo(&si);
+        nThreads = limitValue((int)si.dwNumberOfProcessors, 1, kMaxPageSizesThreads);
+        nThreads = std::min(nThreads, pageCount / kMinPagesPerThread);
+    }
+
+    AtomicInt nextPageNo;
+    PageSizesThreadData threadData[kMaxPageSizesThreads];
+    HANDLE threads[kMaxPageSizesThreads] = {};
+    int nStarted = 0;
+    for (int i = 1; i < nThreads; i++) {
+        MultiFormatArchive* arch = OpenZipArchive(path, false);
+        if (!arch) {
+            break;
+        }
+        PageSizesThreadData& data = threadData[nStarted];
+        data.engine = this;
+        data.arch = arch;
+        data.nextPageNo = &nextPageNo;
+        auto fn = MkFunc0<PageSizesThreadData>(ReadPageSizesThread, &data);
+        threads[nStarted] = StartThread(fn, "CbxPageSizesThread");
+        if (!threads[nStarted]) {
+            delete arch;
+            break;
+        }
+        nStarted++;
+    }
+    ReadPageSizes(cbxFile, &nextPageNo);
+    if (nStarted > 0) {
+        WaitForMultipleObjects((DWORD)nStarted, threads, TRUE, INFINITE);
+    }
+    for (int i = 0; i < nStarted; i++) {
+        CloseHandle(threads[i]);
+        delete threadData[i].arch;
+    }
+}
+
 RectF EngineCbx::LoadMediabox(int pageNo) {
+    RectF mbox;
+    {
+        ScopedCritSec scope(&archiveAccess);
+        if (PageSizeFromHeader(cbxFile, pageNo, mbox)) {
+            return mbox;
+        }
+    }
+
     ByteSlice img = GetImageData(pageNo);
     if (!img.empty()) {
         Size size = BitmapSizeFromData(img);
@@ -1358,9 +1688,11 @@ RectF EngineCbx::LoadMediabox(int pageNo) {
     }
     img.Free();
 
-    ImagePage* page = GetPage(pageNo, MAX_IMAGE_PAGE_CACHE == pageCache.size());
+    ImagePage* page = GetPage(pageNo, IsPageCacheFull());
     if (page) {
-        RectF mbox(0, 0, (float)page->bmp->GetWidth(), (float)page->bmp->GetHeight());
+        EnterCriticalSection(&page->bmpAccess);
+        mbox = RectF(0, 0, (float)page->bmp->GetWidth(), (float)page->bmp->GetHeight());
+        LeaveCriticalSection(&page->bmpAccess);
         DropPage(page, false);
         return mbox;
     }
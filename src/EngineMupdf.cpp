@@ -18,7 +18,9 @@ extern "C" {
 #include "utils/HtmlPullParser.h"
 #include "utils/TrivialHtmlParser.h"
 #include "utils/WinUtil.h"
+#include "utils/WinDynCalls.h"
 #include "utils/ZipUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/Timer.h"
 #include "utils/EncodingDetector.h"
 
@@ -404,6 +406,220 @@ static fz_stream* FzOpenIStream(fz_context* ctx, IStream* stream) {
     return stm;
 }
 
+// large local files are memory mapped so that they can be parsed without copying
+// and without a read() call for every few kB. Only a window of the file is mapped
+// at a time so that this also works for files larger than the address space of
+// 32-bit builds
+constexpr i64 kMappedFileWindowSize = 16 * 1024 * 1024;
+// after seeking (e.g. to an xref table or an object stream) this much is
+// prefetched so that parsing doesn't page fault for every 4 kB
+constexpr i64 kMappedFileReadAhead = 512 * 1024;
+// the view is unmapped if it hasn't been read from for this long so that
+// the file can be overwritten while it's displayed (see FzReleaseMappedFileIfIdle())
+constexpr DWORD kMappedFileIdleMs = 1000;
+
+struct mapped_file_filter {
+    HANDLE hFile;
+    // offset in the file at which the stream starts
+    i64 start;
+    // size and last write time of the file when it was opened
+    i64 fileSize;
+    FILETIME lastWriteTime;
+    // currently mapped window of the file (or nullptr)
+    u8* view;
+    i64 viewOffset;
+    i64 viewSize;
+    // part of the file that was last prefetched
+    i64 prefetchOffset;
+    i64 prefetchEnd;
+    ULONGLONG lastAccess;
+};
+
+static void UnmapMappedFileView(mapped_file_filter* state) {
+    if (state->view) {
+        UnmapViewOfFile(state->view);
+    }
+    state->view = nullptr;
+    state->viewOffset = 0;
+    state->viewSize = 0;
+}
+
+static bool MappedFileChanged(mapped_file_filter* state) {
+    BY_HANDLE_FILE_INFORMATION fi;
+    if (!GetFileInformationByHandle(state->hFile, &fi)) {
+        return true;
+    }
+    i64 size = ((i64)fi.nFileSizeHigh << 32) | fi.nFileSizeLow;
+    return size != state->fileSize || CompareFileTime(&fi.ftLastWriteTime, &state->lastWriteTime) != 0;
+}
+
+// maps the window of the file that contains offset
+static void MapMappedFileView(fz_context* ctx, mapped_file_filter* state, i64 offset) {
+    UnmapMappedFileView(state);
+    // mupdf would parse garbage if the file was overwritten after it was opened.
+    // The changed file will be reloaded, so just fail until then
+    if (MappedFileChanged(state)) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "file has changed since it was opened");
+    }
+
+    static DWORD granularity = 0;
+    if (!granularity) {
+        SYSTEM_INFO si;
+        GetSystemInfo(&si);
+        granularity = si.dwAllocationGranularity;
+    }
+    i64 viewOffset = offset - offset % granularity;
+    i64 viewSize = std::min(kMappedFileWindowSize, state->fileSize - viewOffset);
+    // the view keeps the mapping alive. Not keeping a handle to the mapping means
+    // that nothing prevents truncating the file once the view has been unmapped
+    HANDLE hMap = CreateFileMappingW(state->hFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!hMap) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "CreateFileMapping failed: %d", (int)GetLastError());
+    }
+    void* view = MapViewOfFile(hMap, FILE_MAP_READ, (DWORD)(viewOffset >> 32), (DWORD)viewOffset, (SIZE_T)viewSize);
+    CloseHandle(hMap);
+    if (!view) {
+        fz_throw(ctx, FZ_ERROR_GENERIC, "MapViewOfFile failed: %d", (int)GetLastError());
+    }
+    state->view = (u8*)view;
+    state->viewOffset = viewOffset;
+    state->viewSize = viewSize;
+}
+
+// tells the OS to read the part of the window starting at offset
+// in one go instead of page by page as it is accessed
+static void PrefetchMappedFile(mapped_file_filter* state, i64 offset) {
+    if (offset >= state->prefetchOffset && offset < state->prefetchEnd) {
+        return;
+    }
+    i64 end = std::min(offset + kMappedFileReadAhead, state->viewOffset + state->viewSize);
+    state->prefetchOffset = offset;
+    state->prefetchEnd = end;
+    if (!DynPrefetchVirtualMemory || end <= offset) {
+        return;
+    }
+    WIN32_MEMORY_RANGE_ENTRY range;
+    range.VirtualAddress = state->view + (offset - state->viewOffset);
+    range.NumberOfBytes = (SIZE_T)(end - offset);
+    DynPrefetchVirtualMemory(GetCurrentProcess(), 1, &range, 0);
+}
+
+extern "C" int next_mapped_file(fz_context* ctx, fz_stream* stm, size_t) {
+    mapped_file_filter* state = (mapped_file_filter*)stm->state;
+    state->lastAccess = GetTickCount64();
+    // stm->pos is relative to the start of the stream
+    i64 offset = state->start + stm->pos;
+    if (offset >= state->fileSize) {
+        return EOF;
+    }
+    if (!state->view || offset < state->viewOffset || offset >= state->viewOffset + state->viewSize) {
+        MapMappedFileView(ctx, state, offset);
+        PrefetchMappedFile(state, offset);
+    }
+    // return the rest of the window without copying
+    stm->rp = state->view + (offset - state->viewOffset);
+    stm->wp = state->view + state->viewSize;
+    stm->pos += stm->wp - stm->rp;
+    return *stm->rp++;
+}
+
+extern "C" void seek_mapped_file(fz_context*, fz_stream* stm, i64 offset, int whence) {
+    mapped_file_filter* state = (mapped_file_filter*)stm->state;
+    state->lastAccess = GetTickCount64();
+    i64 size = state->fileSize - state->start;
+    if (whence == SEEK_END) {
+        offset += size;
+    }
+    offset = limitValue(offset, (i64)0, size);
+    i64 fileOffset = state->start + offset;
+    if (state->view && fileOffset >= state->viewOffset && fileOffset < state->viewOffset + state->viewSize) {
+        // seeking within the mapped window
+        stm->rp = state->view + (fileOffset - state->viewOffset);
+        stm->wp = state->view + state->viewSize;
+        stm->pos = offset + (stm->wp - stm->rp);
+        PrefetchMappedFile(state, fileOffset);
+        return;
+    }
+    // next_mapped_file() maps the window
+    stm->rp = stm->wp = state->view;
+    stm->pos = offset;
+}
+
+extern "C" void drop_mapped_file(fz_context* ctx, void* state_) {
+    mapped_file_filter* state = (mapped_file_filter*)state_;
+    UnmapMappedFileView(state);
+    CloseHandle(state->hFile);
+    fz_free(ctx, state);
+}
+
+// opens the part of a file starting at offset start as a memory mapped stream.
+// only local files are mapped because accessing the view of a file on a network
+// drive that has become unavailable would crash
+static fz_stream* FzOpenMappedFile(fz_context* ctx, const char* path, i64 start = 0) {
+    if (!path::IsOnFixedDrive(path)) {
+        return nullptr;
+    }
+    WCHAR* pathW = ToWStrTemp(path);
+    // allow others to overwrite, rename and delete the file
+    DWORD share = FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE;
+    HANDLE h = CreateFileW(pathW, GENERIC_READ, share, nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (h == INVALID_HANDLE_VALUE) {
+        return nullptr;
+    }
+    BY_HANDLE_FILE_INFORMATION fi;
+    if (!GetFileInformationByHandle(h, &fi)) {
+        CloseHandle(h);
+        return nullptr;
+    }
+    i64 fileSize = ((i64)fi.nFileSizeHigh << 32) | fi.nFileSizeLow;
+    if (start < 0 || start >= fileSize) {
+        CloseHandle(h);
+        return nullptr;
+    }
+
+    mapped_file_filter* state = nullptr;
+    fz_stream* stm = nullptr;
+    fz_var(state);
+    fz_try(ctx) {
+        state = fz_malloc_struct(ctx, mapped_file_filter);
+        state->hFile = h;
+        state->start = start;
+        state->fileSize = fileSize;
+        state->lastWriteTime = fi.ftLastWriteTime;
+        stm = fz_new_stream(ctx, state, next_mapped_file, drop_mapped_file);
+        stm->seek = seek_mapped_file;
+    }
+    fz_catch(ctx) {
+        // fz_new_stream() calls drop_mapped_file() if it fails
+        if (!state) {
+            CloseHandle(h);
+        }
+        fz_report_error(ctx);
+        return nullptr;
+    }
+    return stm;
+}
+
+static bool FzIsMappedFile(fz_stream* stm) {
+    return stm && stm->next == next_mapped_file;
+}
+
+// unmaps the view of a stream opened with FzOpenMappedFile() if it hasn't been
+// read from for a while, so that the file can be overwritten (it's mapped again
+// if needed). Buffered data is dropped, so this must only be called while
+// nothing is reading from the stream
+static void FzReleaseMappedFileIfIdle(fz_stream* stm) {
+    mapped_file_filter* state = (mapped_file_filter*)stm->state;
+    if (!state->view || GetTickCount64() - state->lastAccess < kMappedFileIdleMs) {
+        return;
+    }
+    stm->pos -= stm->wp - stm->rp;
+    stm->rp = stm->wp = nullptr;
+    UnmapMappedFileView(state);
+    state->prefetchOffset = 0;
+    state->prefetchEnd = 0;
+}
+
 static void* FzMemdup(fz_context* ctx, void* p, size_t size) {
     void* res = fz_malloc_no_throw(ctx, size);
     if (!res) {
@@ -486,6 +702,14 @@ static fz_stream* FzReadMaybeFixPDF(fz_context* ctx, const char* path) {
         return nullptr;
     }
 
+    // large files are mapped starting after the garbage instead of copied
+    if (file::GetSize(path) >= kMaxMemoryFileSize) {
+        stm = FzOpenMappedFile(ctx, path, n);
+        if (stm) {
+            return stm;
+        }
+    }
+
     ByteSlice d = file::ReadFile(path);
     if (d.empty()) {
         // failed to read
@@ -505,6 +729,10 @@ static fz_stream* FzOpenOrReadFile(fz_context* ctx, const char* path) {
     if (stm) {
         return stm;
     }
+    stm = FzOpenMappedFile(ctx, path);
+    if (stm) {
+        return stm;
+    }
     WCHAR* pathW = ToWStrTemp(path);
     fz_try(ctx) {
         stm = fz_open_file_w(ctx, pathW);
@@ -517,14 +745,20 @@ static fz_stream* FzOpenOrReadFile(fz_context* ctx, const char* path) {
 }
 
 static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16]) {
-    i64 fileLen = -1;
-    fz_buffer* buf = nullptr;
-
+    fz_md5 md5;
+    fz_md5_init(&md5);
+    // hash the data as it's read instead of reading the whole file into memory
+    // (for memory mapped files this doesn't copy anything)
     fz_try(ctx) {
-        fz_seek(ctx, stm, 0, 2);
-        fileLen = fz_tell(ctx, stm);
         fz_seek(ctx, stm, 0, 0);
-        buf = fz_read_all(ctx, stm, fileLen);
+        for (;;) {
+            size_t n = fz_available(ctx, stm, 64 * 1024);
+            if (n == 0) {
+                break;
+            }
+            fz_md5_update(&md5, stm->rp, n);
+            stm->rp += n;
+        }
     }
     fz_catch(ctx) {
         fz_warn(ctx, "couldn't read stream data, using a nullptr fingerprint instead");
@@ -532,15 +766,6 @@ static void FzStreamFingerprint(fz_context* ctx, fz_stream* stm, u8 digest[16])
         fz_report_error(ctx);
         return;
     }
-    ReportIf(nullptr == buf);
-    u8* data;
-    size_t size = fz_buffer_extract(ctx, buf, &data);
-    ReportIf((size_t)fileLen != size);
-    fz_drop_buffer(ctx, buf);
-
-    fz_md5 md5;
-    fz_md5_init(&md5);
-    fz_md5_update(&md5, data, size);
     fz_md5_final(&md5, digest);
 }
 
@@ -1150,19 +1375,13 @@ static void BuildElementsInfo(FzPageInfo* pageInfo) {
     els.Reverse();
 }
 
-static void FzLinkifyPageText(FzPageInfo* pageInfo, fz_stext_page* stext) {
-    if (!pageInfo || !stext) {
+static void FzLinkifyPageText(FzPageInfo* pageInfo) {
+    PageText& pageText = pageInfo->text;
+    if (!pageText.text) {
         return;
     }
 
-    Rect* coords;
-    WCHAR* pageText = FzTextPageToStr(stext, &coords);
-    if (!pageText) {
-        return;
-    }
-
-    LinkRectList* list = LinkifyText(pageText, coords);
-    free(pageText);
+    LinkRectList* list = LinkifyText(pageText.text, pageText.coords);
 
     for (int i = 0; i < list->links.Size(); i++) {
         fz_rect bbox = list->coords.at(i);
@@ -1186,7 +1405,6 @@ static void FzLinkifyPageText(FzPageInfo* pageInfo, fz_stext_page* stext) {
         pageInfo->autoLinks.Append(pel);
     }
     delete list;
-    free(coords);
 }
 
 static void FzFindImagePositions(fz_context* ctx, int pageNo, Vec<FitzPageImageInfo*>& images, fz_stext_page* stext) {
@@ -1586,7 +1804,11 @@ void InitializeEngineMupdf() {
     gPerThreadContexts = new Vec<ContextThreadID>();
 }
 
+// returns nullptr if InitializeEngineMupdf() wasn't called
 fz_context* GetOrClonePerThreadContext(EngineMupdf* engine, fz_context* ctx) {
+    if (!gPerThreadContexts) {
+        return nullptr;
+    }
     DWORD threadID = GetCurrentThreadId();
     ScopedCritSec cs(&gPerThreadContextsCs);
     for (auto& el : *gPerThreadContexts) {
@@ -1595,6 +1817,10 @@ fz_context* GetOrClonePerThreadContext(EngineMupdf* engine, fz_context* ctx) {
         }
     }
     auto newCtx = fz_clone_context(ctx);
+    if (!newCtx) {
+        return nullptr;
+    }
+    InstallFitzErrorCallbacks(newCtx);
     ContextThreadID el{engine, newCtx, threadID};
     gPerThreadContexts->Append(el);
     return newCtx;
@@ -1615,6 +1841,22 @@ void ReleasePerThreadContext(EngineMupdf* engine) {
     }
 }
 
+// contexts cloned by other threads must be dropped before the original context
+static void ReleaseAllPerThreadContexts(EngineMupdf* engine) {
+    if (!gPerThreadContexts) {
+        return;
+    }
+    ScopedCritSec cs(&gPerThreadContextsCs);
+    int n = gPerThreadContexts->Size();
+    for (int i = n - 1; i >= 0; i--) {
+        auto& el = gPerThreadContexts->at(i);
+        if (el.engine == engine) {
+            fz_drop_context(el.ctx);
+            gPerThreadContexts->RemoveAtFast(i);
+        }
+    }
+}
+
 EngineMupdf::EngineMupdf() {
     kind = kindEngineMupdf;
     defaultExt = str::Dup(".pdf");
@@ -1641,14 +1883,23 @@ fz_context* EngineMupdf::Ctx() const {
 }
 
 EngineMupdf::~EngineMupdf() {
+    StopResolvingPageSizes();
+    StopLoadingPageElements();
+    if (releaseMappedFileTimer) {
+        // waits for a running callback to finish
+        DeleteTimerQueueTimer(nullptr, releaseMappedFileTimer, INVALID_HANDLE_VALUE);
+        releaseMappedFileTimer = nullptr;
+    }
     EnterCriticalSection(&pagesAccess);
 
     auto ctx = Ctx();
     for (FzPageInfo* pi : pages) {
+        fz_drop_display_list(ctx, pi->displayList);
         DeleteVecMembers(pi->links);
         DeleteVecMembers(pi->autoLinks);
         DeleteVecMembers(pi->comments);
         DeleteVecMembers(pi->images);
+        FreePageText(&pi->text);
         if (pi->retainedLinks) {
             fz_drop_link(ctx, pi->retainedLinks);
         }
@@ -1669,6 +1920,8 @@ EngineMupdf::~EngineMupdf() {
     }
 
     fz_drop_document(ctx, _doc);
+    fz_drop_stream(ctx, mappedFile);
+    ReleaseAllPerThreadContexts(this);
     fz_drop_context(ctx);
 
     delete pageLabels;
@@ -1943,6 +2196,7 @@ bool EngineMupdf::Load(const char* path, PasswordUI* pwdUI) {
     }
 
     fz_stream* file = FzOpenOrReadFile(ctx, fnCopy);
+    KeepMappedFile(file);
     ok = LoadFromStream(file, FilePath(), pwdUI);
     if (!ok) {
         return false;
@@ -1959,6 +2213,7 @@ bool EngineMupdf::Load(const char* path, PasswordUI* pwdUI) {
         if (!file) {
             return false;
         }
+        KeepMappedFile(file);
         ok = LoadFromStream(file, FilePath(), pwdUI);
         if (!ok) {
             return false;
@@ -2273,6 +2528,244 @@ static void FinishNonPDFLoading(EngineMupdf* e) {
     }
 }
 
+// for documents with many pages, FinishLoading() only reads the sizes of the first pages
+// and of a sample of the others. The remaining pages start out with the most common
+// sampled size and get their real size on a background thread
+constexpr int kMinPagesForLazyPageSizes = 1024;
+constexpr int kInitialPageSizes = 32;
+constexpr int kPageSizeSamples = 32;
+// number of page sizes resolved per ctxAccess lock
+constexpr int kPageSizesPerChunk = 256;
+
+// Note: make sure to only call with ctxAccess
+static RectF LoadPdfPageMediabox(fz_context* ctx, pdf_document* doc, int pageIdx) {
+    pdf_obj* pageref = nullptr;
+    fz_rect mbox{};
+    fz_matrix page_ctm{};
+    fz_var(pageref);
+    fz_var(mbox);
+    fz_try(ctx) {
+        // note: don't pdf_drop_obj() this
+        pageref = pdf_lookup_page_obj(ctx, doc, pageIdx);
+        pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
+        mbox = fz_transform_rect(mbox, page_ctm);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        mbox = {};
+    }
+    if (fz_is_empty_rect(mbox)) {
+        logfa("cannot find page size for page %d", pageIdx);
+        mbox.x0 = 0;
+        mbox.y0 = 0;
+        mbox.x1 = 612;
+        mbox.y1 = 792;
+    }
+    return ToRectF(mbox);
+}
+
+// reads the sizes of a sample of the pages after the first nInitial ones and uses
+// the most common size of all pages read so far for the others. That's right for
+// most large documents (e.g. scans) and ResolvePageSizes() corrects it for the rest
+// Note: make sure to only call with ctxAccess
+void EngineMupdf::GuessPageSizes(int nInitial) {
+    auto ctx = Ctx();
+    int nRest = pageCount - nInitial;
+    for (int i = 0; i < kPageSizeSamples; i++) {
+        int pageIdx = nInitial + (int)((i64)nRest * i / kPageSizeSamples);
+        pages[pageIdx]->mediabox = LoadPdfPageMediabox(ctx, pdfdoc, pageIdx);
+    }
+
+    Vec<RectF> sizes;
+    for (FzPageInfo* pi : pages) {
+        if (!pi->mediabox.IsEmpty()) {
+            sizes.Append(pi->mediabox);
+        }
+    }
+    RectF guess = sizes[0];
+    int guessCount = 0;
+    for (RectF& size : sizes) {
+        int count = 0;
+        for (RectF& size2 : sizes) {
+            count += size == size2 ? 1 : 0;
+        }
+        if (count > guessCount) {
+            guess = size;
+            guessCount = count;
+        }
+    }
+    for (FzPageInfo* pi : pages) {
+        if (pi->mediabox.IsEmpty()) {
+            pi->mediabox = guess;
+            pi->mediaboxIsGuess = true;
+        }
+    }
+}
+
+// reads the real size of pages which only have a guessed mediabox, a chunk of pages
+// at a time so that rendering isn't blocked for long, then calls onPageSizesResolved
+void EngineMupdf::ResolvePageSizes() {
+    auto timeStart = TimeGet();
+    auto ctx = Ctx();
+    int nChanged = 0;
+    for (int start = 0; start < pageCount; start += kPageSizesPerChunk) {
+        ScopedCritSec scope(ctxAccess);
+        if (abortResolvingPageSizes) {
+            return;
+        }
+        int end = std::min(start + kPageSizesPerChunk, pageCount);
+        for (int pageIdx = start; pageIdx < end; pageIdx++) {
+            FzPageInfo* pi = pages[pageIdx];
+            if (!pi->mediaboxIsGuess) {
+                continue;
+            }
+            RectF mediabox = LoadPdfPageMediabox(ctx, pdfdoc, pageIdx);
+            if (mediabox != pi->mediabox) {
+                nChanged++;
+            }
+            pi->mediabox = mediabox;
+            pi->mediaboxIsGuess = false;
+        }
+    }
+    logf("EngineMupdf::ResolvePageSizes: %d pages in %.2f ms, %d differ from the guessed size\n", pageCount,
+         TimeSinceInMs(timeStart), nChanged);
+
+    Func0 onFinished;
+    {
+        ScopedCritSec scope(ctxAccess);
+        pageSizesResolved = true;
+        onFinished = onPageSizesResolved;
+        onPageSizesResolved = {};
+    }
+    onFinished.Call();
+}
+
+static void ResolvePageSizesThread(EngineMupdf* engine) {
+    engine->ResolvePageSizes();
+}
+
+void EngineMupdf::StopResolvingPageSizes() {
+    if (!pageSizesThread) {
+        return;
+    }
+    {
+        ScopedCritSec scope(ctxAccess);
+        abortResolvingPageSizes = true;
+    }
+    WaitForSingleObject(pageSizesThread, INFINITE);
+    SafeCloseHandle(&pageSizesThread);
+}
+
+static void LoadPageElementsThread(EngineMupdf* engine) {
+    engine->LoadScheduledPageElements();
+}
+
+// loads the text, images and auto-detected links of pageNo on a background thread
+// (most recently scheduled pages first), so that they can be hit-tested without
+// loading them on the UI thread. must not be called with ctxAccess held
+void EngineMupdf::ScheduleLoadPageElements(int pageNo) {
+    ScopedCritSec scope(&pagesAccess);
+    FzPageInfo* pi = pages[pageNo - 1];
+    if ((pi->imagesLoaded && pi->autoLinksLoaded) || pageElementsCookie.abort) {
+        return;
+    }
+    if (pageElementsToLoad.Contains(pageNo)) {
+        return;
+    }
+    pageElementsToLoad.Append(pageNo);
+    if (pageElementsThreadRunning) {
+        return;
+    }
+    SafeCloseHandle(&pageElementsThread);
+    auto fn = MkFunc0<EngineMupdf>(LoadPageElementsThread, this);
+    pageElementsThread = StartThread(fn, "MupdfPageElementsThread");
+    pageElementsThreadRunning = pageElementsThread != nullptr;
+    if (!pageElementsThreadRunning) {
+        // try again when the next page is scheduled
+        pageElementsToLoad.Reset();
+    }
+}
+
+void EngineMupdf::LoadScheduledPageElements() {
+    for (;;) {
+        int pageNo;
+        {
+            ScopedCritSec scope(&pagesAccess);
+            if (pageElementsToLoad.Size() == 0 || pageElementsCookie.abort) {
+                pageElementsThreadRunning = false;
+                return;
+            }
+            pageNo = pageElementsToLoad.Pop();
+        }
+        FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
+        if (!pageInfo) {
+            continue;
+        }
+        // extracting the text also finds the images
+        LoadPageText(pageInfo, &pageElementsCookie);
+        LoadPageImages(pageInfo, &pageElementsCookie);
+        LoadPageAutoLinks(pageInfo, &pageElementsCookie);
+    }
+}
+
+void EngineMupdf::StopLoadingPageElements() {
+    {
+        ScopedCritSec scope(&pagesAccess);
+        pageElementsCookie.abort = 1;
+    }
+    if (pageElementsThread) {
+        WaitForSingleObject(pageElementsThread, INFINITE);
+        SafeCloseHandle(&pageElementsThread);
+    }
+}
+
+static void CALLBACK ReleaseMappedFileTimerProc(void* param, BOOLEAN) {
+    EngineMupdf* engine = (EngineMupdf*)param;
+    // don't wait for a render or text extraction to finish, the file isn't idle then anyway
+    if (!TryEnterCriticalSection(engine->ctxAccess)) {
+        return;
+    }
+    FzReleaseMappedFileIfIdle(engine->mappedFile);
+    LeaveCriticalSection(engine->ctxAccess);
+}
+
+// keeps a reference to the file if it's memory mapped and periodically releases
+// its view while the document isn't being read from. The view is only released
+// under ctxAccess, when nothing can be in the middle of reading the file
+void EngineMupdf::KeepMappedFile(fz_stream* file) {
+    if (!FzIsMappedFile(file)) {
+        return;
+    }
+    auto ctx = Ctx();
+    {
+        ScopedCritSec scope(ctxAccess);
+        fz_drop_stream(ctx, mappedFile);
+        mappedFile = fz_keep_stream(ctx, file);
+    }
+    if (releaseMappedFileTimer) {
+        return;
+    }
+    BOOL ok = CreateTimerQueueTimer(&releaseMappedFileTimer, nullptr, ReleaseMappedFileTimerProc, this,
+                                    kMappedFileIdleMs, kMappedFileIdleMs, WT_EXECUTEDEFAULT);
+    if (!ok) {
+        logf("EngineMupdf::KeepMappedFile: CreateTimerQueueTimer failed\n");
+        releaseMappedFileTimer = nullptr;
+    }
+}
+
+// onFinished is called once all page sizes are known, so that
+// the layout can be corrected for pages with a wrongly guessed size
+void EngineMupdf::SetOnLayoutFinished(const Func0& onFinished) {
+    {
+        ScopedCritSec scope(ctxAccess);
+        if (!pageSizesResolved) {
+            onPageSizesResolved = onFinished;
+            return;
+        }
+    }
+    onFinished.Call();
+}
+
 bool EngineMupdf::FinishLoading() {
     auto ctx = Ctx();
     pdfdoc = pdf_specifics(ctx, _doc);
@@ -2298,6 +2791,7 @@ bool EngineMupdf::FinishLoading() {
 
     for (int i = 0; i < pageCount; i++) {
         auto pi = new FzPageInfo();
+        pi->pageNo = i + 1;
         pages.Append(pi);
     }
     if (!pdfdoc) {
@@ -2307,32 +2801,19 @@ bool EngineMupdf::FinishLoading() {
 
     ScopedCritSec scope(ctxAccess);
 
-    for (int pageNo = 0; pageNo < pageCount; pageNo++) {
-        pdf_obj* pageref = nullptr;
-        fz_rect mbox{};
-        fz_matrix page_ctm{};
-        fz_var(pageref);
-        fz_var(mbox);
-        fz_try(ctx) {
-            // note: don't pdf_drop_obj() this
-            pageref = pdf_lookup_page_obj(ctx, pdfdoc, pageNo);
-            pdf_page_obj_transform(ctx, pageref, &mbox, &page_ctm);
-            mbox = fz_transform_rect(mbox, page_ctm);
-        }
-        fz_catch(ctx) {
-            fz_report_error(ctx);
-            mbox = {};
-        }
-        if (fz_is_empty_rect(mbox)) {
-            logfa("cannot find page size for page %d", pageNo);
-            mbox.x0 = 0;
-            mbox.y0 = 0;
-            mbox.x1 = 612;
-            mbox.y1 = 792;
+    bool lazyPageSizes = pageCount >= kMinPagesForLazyPageSizes;
+    int nInitial = lazyPageSizes ? kInitialPageSizes : pageCount;
+    for (int pageIdx = 0; pageIdx < nInitial; pageIdx++) {
+        pages[pageIdx]->mediabox = LoadPdfPageMediabox(ctx, pdfdoc, pageIdx);
+    }
+    if (lazyPageSizes) {
+        GuessPageSizes(nInitial);
+        pageSizesResolved = false;
+        auto fn = MkFunc0<EngineMupdf>(ResolvePageSizesThread, this);
+        pageSizesThread = StartThread(fn, "MupdfPageSizesThread");
+        if (!pageSizesThread) {
+            ResolvePageSizes();
         }
-        FzPageInfo* pageInfo = pages[pageNo];
-        pageInfo->mediabox = ToRectF(mbox);
-        pageInfo->pageNo = pageNo + 1;
     }
 
     fz_try(ctx) {
@@ -2608,17 +3089,6 @@ IPageDestination* EngineMupdf::GetNamedDest(const char* name) {
 }
 #endif
 
-// return a page but only if is fully loaded
-FzPageInfo* EngineMupdf::GetFzPageInfoFast(int pageNo) {
-    ScopedCritSec scope(&pagesAccess);
-    ReportIf(pageNo < 1 || pageNo > pageCount);
-    FzPageInfo* pageInfo = pages[pageNo - 1];
-    if (!pageInfo->page || !pageInfo->fullyLoaded) {
-        return nullptr;
-    }
-    return pageInfo;
-}
-
 static IPageElement* NewFzComment(const char* comment, int pageNo, RectF rect) {
     auto res = new PageElementComment(comment);
     res->pageNo = pageNo;
@@ -2735,9 +3205,9 @@ static void RebuildCommentsFromAnnotations(fz_context* ctx, FzPageInfo* pageInfo
 // prevents blocking main thread due to render thread keeping the lock
 // https://github.com/GurupiaReaderreader/GurupiaReader/issues/4145
 // https://github.com/GurupiaReaderreader/GurupiaReader/issues/4187
-FzPageInfo* EngineMupdf::GetFzPageInfoCanFail(int pageNo) {
+FzPageInfo* EngineMupdf::GetFzPageInfoCanFail(int pageNo, bool loadQuick) {
 #if 0
-    return GetFzPageInfo(pageNo, true);
+    return GetFzPageInfo(pageNo, loadQuick);
 #else
     FzPageInfo* res = nullptr;
     if (!TryEnterCriticalSection(&pagesAccess)) {
@@ -2745,7 +3215,7 @@ FzPageInfo* EngineMupdf::GetFzPageInfoCanFail(int pageNo) {
     }
     if (TryEnterCriticalSection(ctxAccess)) {
         // CRITICAL_SECTION locking is recursive
-        res = GetFzPageInfo(pageNo, true);
+        res = GetFzPageInfo(pageNo, loadQuick);
         LeaveCriticalSection(ctxAccess);
     }
     LeaveCriticalSection(&pagesAccess);
@@ -2783,11 +3253,11 @@ fz_stext_page* fz_new_stext_page_from_page2(fz_context* ctx, fz_page* page, cons
 
 // Maybe: handle FZ_ERROR_TRYLATER, which can happen when parsing from network.
 // (I don't think we read from network now).
-// Maybe: when loading fully, cache extracted text in FzPageInfo
-// so that we don't have to re-do fz_new_stext_page_from_page() when doing search
+// loadQuick only loads the page and its annotations, which is all that's
+// needed for rendering. Otherwise also loads links, auto-detected links,
+// images and text (each of which can also be loaded separately)
 FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie) {
     auto ctx = Ctx();
-    // TODO: minimize time spent under pagesAccess when fully loading
     ScopedCritSec scope(&pagesAccess);
 
     ReportIf(pageNo < 1 || pageNo > pageCount);
@@ -2809,6 +3279,12 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* co
         return nullptr;
     }
 
+    if (pageInfo->mediaboxIsGuess && pdfdoc) {
+        // don't wait for ResolvePageSizes() for pages that are being used
+        pageInfo->mediabox = LoadPdfPageMediabox(ctx, pdfdoc, pageIdx);
+        pageInfo->mediaboxIsGuess = false;
+    }
+
     // build annotations info on first access
     if (pdfdoc && pageInfo->annotations.Size() == 0) {
         fz_try(ctx) {
@@ -2828,44 +3304,181 @@ FzPageInfo* EngineMupdf::GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* co
         RebuildCommentsFromAnnotations(ctx, pageInfo);
     }
 
-    if (loadQuick || pageInfo->fullyLoaded) {
+    if (loadQuick) {
         return pageInfo;
     }
 
     ReportIf(pageInfo->pageNo != pageNo);
 
-    pageInfo->fullyLoaded = true;
+    LoadPageLinks(pageInfo);
+    // loading images also extracts the text needed for auto-detecting links
+    LoadPageImages(pageInfo, cookie);
+    LoadPageAutoLinks(pageInfo, cookie);
+    return pageInfo;
+}
 
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_stext_options opts{};
-    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
+static fz_display_list* NewDisplayListForPage(fz_context* ctx, fz_page* page, bool isPdf, const char* usage,
+                                              fz_cookie* cookie);
+
+// the LoadPage*() functions must be called with a page loaded by GetFzPageInfo()
+// and cache the result so they are cheap to call repeatedly
+// (images and text are only marked as loaded once they've been extracted successfully)
+void EngineMupdf::LoadPageLinks(FzPageInfo* pageInfo) {
+    ScopedCritSec scope(&pagesAccess);
+    if (pageInfo->linksLoaded) {
+        return;
+    }
+    pageInfo->linksLoaded = true;
+
+    auto ctx = Ctx();
+    ScopedCritSec ctxScope(ctxAccess);
+    fz_link* link = nullptr;
+    fz_var(link);
     fz_try(ctx) {
-        stext = fz_new_stext_page_from_page2(ctx, page, &opts, cookie);
+        link = fz_load_links(ctx, pageInfo->page);
     }
     fz_catch(ctx) {
         fz_report_error(ctx);
     }
-
-    fz_link* link = fz_load_links(ctx, page);
     link = FixupPageLinks(link); // TOOD: is this necessary?
     pageInfo->retainedLinks = link;
     while (link) {
-        auto pel = NewLinkDestination(pageNo, ctx, _doc, link, nullptr);
+        auto pel = NewLinkDestination(pageInfo->pageNo, ctx, _doc, link, nullptr);
         pageInfo->links.Append(pel);
         link = link->next;
     }
+    pageInfo->elementsNeedRebuilding = true;
+}
 
-    if (!stext) {
-        return pageInfo;
+void EngineMupdf::LoadPageAutoLinks(FzPageInfo* pageInfo, fz_cookie* cookie) {
+    ScopedCritSec scope(&pagesAccess);
+    if (pageInfo->autoLinksLoaded) {
+        return;
+    }
+
+    // links detected in text that overlap real links are skipped
+    LoadPageLinks(pageInfo);
+    LoadPageText(pageInfo, cookie);
+    if (!pageInfo->textLoaded) {
+        return;
+    }
+    FzLinkifyPageText(pageInfo);
+    pageInfo->autoLinksLoaded = true;
+    pageInfo->elementsNeedRebuilding = true;
+}
+
+void EngineMupdf::LoadPageImages(FzPageInfo* pageInfo, fz_cookie* cookie) {
+    ScopedCritSec scope(&pagesAccess);
+    if (pageInfo->imagesLoaded) {
+        return;
+    }
+
+    auto ctx = Ctx();
+    ScopedCritSec ctxScope(ctxAccess);
+    fz_stext_page* stext = nullptr;
+    fz_var(stext);
+    fz_stext_options opts{};
+    opts.flags = FZ_STEXT_PRESERVE_IMAGES;
+    fz_try(ctx) {
+        stext = fz_new_stext_page_from_page2(ctx, pageInfo->page, &opts, cookie);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+    }
+    if (!stext || (cookie && cookie->abort)) {
+        // try again next time
+        fz_drop_stext_page(ctx, stext);
+        return;
     }
 
-    FzLinkifyPageText(pageInfo, stext);
-    FzFindImagePositions(ctx, pageNo, pageInfo->images, stext);
+    FzFindImagePositions(ctx, pageInfo->pageNo, pageInfo->images, stext);
+    pageInfo->imagesLoaded = true;
+    pageInfo->elementsNeedRebuilding = true;
+    // image blocks are skipped when converting to text so we get the text for free
+    if (!pageInfo->textLoaded) {
+        PageText& text = pageInfo->text;
+        text.text = FzTextPageToStr(stext, &text.coords);
+        text.len = (int)str::Len(text.text);
+        pageInfo->textLoaded = true;
+    }
     fz_drop_stext_page(ctx, stext);
-    return pageInfo;
 }
 
+// only recording the page content needs ctxAccess. Text is then extracted
+// from the recording on a per-thread context, so that text of several pages
+// can be extracted in parallel
+void EngineMupdf::LoadPageText(FzPageInfo* pageInfo, fz_cookie* cookie) {
+    {
+        ScopedCritSec scope(&pagesAccess);
+        if (pageInfo->textLoaded) {
+            return;
+        }
+    }
+
+    auto ctx = Ctx();
+    fz_display_list* list = nullptr;
+    {
+        ScopedCritSec ctxScope(ctxAccess);
+        list = NewDisplayListForPage(ctx, pageInfo->page, false, nullptr, cookie);
+    }
+
+    PageText text;
+    Vec<FitzPageImageInfo*> images;
+    bool ok = false;
+    if (list) {
+        fz_context* rctx = GetOrClonePerThreadContext(this, ctx);
+        bool needsLock = !rctx;
+        if (needsLock) {
+            rctx = ctx;
+            EnterCriticalSection(ctxAccess);
+        }
+        fz_stext_page* stext = nullptr;
+        fz_var(stext);
+        fz_stext_options opts{};
+        // image blocks are skipped when converting to text so we get the images for free
+        opts.flags = FZ_STEXT_PRESERVE_IMAGES;
+        fz_try(rctx) {
+            stext = fz_new_stext_page_from_display_list(rctx, list, &opts);
+        }
+        fz_catch(rctx) {
+            fz_report_error(rctx);
+        }
+        if (stext) {
+            FzFindImagePositions(rctx, pageInfo->pageNo, images, stext);
+            text.text = FzTextPageToStr(stext, &text.coords);
+            text.len = (int)str::Len(text.text);
+            ok = true;
+        }
+        fz_drop_stext_page(rctx, stext);
+        fz_drop_display_list(rctx, list);
+        if (needsLock) {
+            LeaveCriticalSection(ctxAccess);
+        }
+    }
+    if (!ok) {
+        // try again next time
+        return;
+    }
+
+    ScopedCritSec scope(&pagesAccess);
+    if (pageInfo->imagesLoaded) {
+        DeleteVecMembers(images);
+    } else {
+        pageInfo->images = images;
+        pageInfo->imagesLoaded = true;
+        pageInfo->elementsNeedRebuilding = true;
+    }
+    if (pageInfo->textLoaded) {
+        // another thread was faster
+        FreePageText(&text);
+        return;
+    }
+    pageInfo->text = text;
+    pageInfo->textLoaded = true;
+}
+
+// doesn't take ctxAccess so that layout isn't blocked by rendering. For pages
+// whose size is still being resolved this might return the guessed size
 RectF EngineMupdf::PageMediabox(int pageNo) {
     FzPageInfo* pi = pages[pageNo - 1];
     return pi->mediabox;
@@ -2874,7 +3487,7 @@ RectF EngineMupdf::PageMediabox(int pageNo) {
 RectF EngineMupdf::PageContentBox(int pageNo, RenderTarget target) {
     auto ctx = Ctx();
 
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo) {
         // maybe should return a dummy size. not sure how this
         // will play with layout. The page should fail to render
@@ -2897,7 +3510,7 @@ RectF EngineMupdf::PageContentBox(int pageNo, RenderTarget target) {
     RectF mediabox = pageInfo->mediabox;
 
     fz_try(ctx) {
-        list = fz_new_display_list_from_page(ctx, pageInfo->page);
+        list = GetDisplayList(pageInfo, "View", nullptr);
         if (list) {
             dev = fz_new_bbox_device(ctx, &rect);
             fz_run_display_list(ctx, list, dev, fz_identity, pagerect, &fzcookie);
@@ -2948,6 +3561,92 @@ RectF EngineMupdf::Transform(const RectF& rect, int pageNo, float zoom, int rota
     return ToRectF(rect2);
 }
 
+// records the content of the page so that it can be rasterized without
+// holding ctxAccess. returns nullptr on error or if aborted through cookie
+// Note: make sure to only call with ctxAccess
+static fz_display_list* NewDisplayListForPage(fz_context* ctx, fz_page* page, bool isPdf, const char* usage,
+                                              fz_cookie* cookie) {
+    fz_display_list* list = nullptr;
+    fz_device* dev = nullptr;
+    fz_var(list);
+    fz_var(dev);
+    fz_try(ctx) {
+        list = fz_new_display_list(ctx, fz_bound_page(ctx, page));
+        dev = fz_new_list_device(ctx, list);
+        if (isPdf) {
+            // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
+            // or "Print". "Export" is not used
+            pdf_page* pdfpage = pdf_page_from_fz_page(ctx, page);
+            pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, cookie);
+        } else {
+            fz_run_page_contents(ctx, page, dev, fz_identity, cookie);
+        }
+        fz_close_device(ctx, dev);
+    }
+    fz_always(ctx) {
+        fz_drop_device(ctx, dev);
+    }
+    fz_catch(ctx) {
+        fz_report_error(ctx);
+        fz_drop_display_list(ctx, list);
+        return nullptr;
+    }
+    if (cookie && cookie->abort) {
+        // the list is incomplete
+        fz_drop_display_list(ctx, list);
+        return nullptr;
+    }
+    return list;
+}
+
+// interpreting the content stream is the most expensive part of rendering
+// complex vector pages so we keep display lists of recently rendered pages
+// TODO: make it depend on the amount of available memory?
+constexpr size_t kMaxDisplayListCacheSize = 64 * 1024 * 1024;
+
+// returns a display list for the page, the caller must fz_drop_display_list() it
+// Note: make sure to only call with ctxAccess
+fz_display_list* EngineMupdf::GetDisplayList(FzPageInfo* pageInfo, const char* usage, fz_cookie* cookie) {
+    auto ctx = Ctx();
+    // printing is rare enough to not be worth caching
+    bool canCache = str::Eq(usage, "View");
+    if (canCache && pageInfo->displayList) {
+        displayListCache.Remove(pageInfo);
+        displayListCache.Append(pageInfo);
+        return fz_keep_display_list(ctx, pageInfo->displayList);
+    }
+
+    fz_display_list* list = NewDisplayListForPage(ctx, pageInfo->page, pdfdoc != nullptr, usage, cookie);
+    if (!list || !canCache) {
+        return list;
+    }
+    size_t size = fz_display_list_size(ctx, list);
+    if (size > kMaxDisplayListCacheSize / 4) {
+        return list;
+    }
+    while (displayListCache.size() > 0 && displayListCacheSize + size > kMaxDisplayListCacheSize) {
+        DropCachedDisplayList(displayListCache[0]);
+    }
+    pageInfo->displayList = fz_keep_display_list(ctx, list);
+    pageInfo->displayListSize = size;
+    displayListCache.Append(pageInfo);
+    displayListCacheSize += size;
+    return list;
+}
+
+// Note: make sure to only call with ctxAccess
+void EngineMupdf::DropCachedDisplayList(FzPageInfo* pageInfo) {
+    if (!pageInfo->displayList) {
+        return;
+    }
+    fz_drop_display_list(Ctx(), pageInfo->displayList);
+    pageInfo->displayList = nullptr;
+    displayListCache.Remove(pageInfo);
+    ReportIf(displayListCacheSize < pageInfo->displayListSize);
+    displayListCacheSize -= pageInfo->displayListSize;
+    pageInfo->displayListSize = 0;
+}
+
 RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
     auto ctx = Ctx();
     auto pageNo = args.pageNo;
@@ -2960,29 +3659,51 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
         fzcookie = (fz_cookie*)cookie->GetData();
     }
 
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false, fzcookie);
+    // links, images and text are not needed for rendering
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo || !pageInfo->page) {
         return nullptr;
     }
     fz_page* page = pageInfo->page;
 
-    ScopedCritSec cs(ctxAccess);
+    const char* usage = "View";
+    switch (args.target) {
+        case RenderTarget::Print:
+            usage = "Print";
+            break;
+    }
 
-    auto pageRect = args.pageRect;
-    auto zoom = args.zoom;
-    auto rotation = args.rotation;
-    fz_rect pRect;
-    if (pageRect) {
-        pRect = ToFzRect(*pageRect);
-    } else {
-        // TODO(port): use pageInfo->mediabox?
-        pRect = fz_bound_page(ctx, page);
+    fz_matrix ctm;
+    fz_irect bbox;
+    fz_display_list* list = nullptr;
+    {
+        ScopedCritSec cs(ctxAccess);
+
+        auto pageRect = args.pageRect;
+        fz_rect pRect;
+        if (pageRect) {
+            pRect = ToFzRect(*pageRect);
+        } else {
+            // TODO(port): use pageInfo->mediabox?
+            pRect = fz_bound_page(ctx, page);
+        }
+        ctm = viewctm(page, args.zoom, args.rotation);
+        bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
+        list = GetDisplayList(pageInfo, usage, fzcookie);
+    }
+    if (!list) {
+        return nullptr;
     }
-    fz_matrix ctm = viewctm(page, zoom, rotation);
-    fz_irect bbox = fz_round_rect(fz_transform_rect(pRect, ctm));
 
-    fz_colorspace* csRgb = fz_device_rgb(ctx);
-    fz_irect ibounds = bbox;
+    // rasterizing the display list on a per-thread clone of the context
+    // doesn't need ctxAccess so that several pages (or tiles of the same page)
+    // of this document can be rendered at the same time
+    fz_context* rctx = GetOrClonePerThreadContext(this, ctx);
+    bool needsLock = !rctx;
+    if (needsLock) {
+        rctx = ctx;
+        EnterCriticalSection(ctxAccess);
+    }
 
     fz_pixmap* pix = nullptr;
     fz_device* dev = nullptr;
@@ -2992,75 +3713,68 @@ RenderedBitmap* EngineMupdf::RenderPage(RenderPageArgs& args) {
     fz_var(pix);
     fz_var(bitmap);
 
-    const char* usage = "View";
-    switch (args.target) {
-        case RenderTarget::Print:
-            usage = "Print";
-            break;
+    // anti-aliasing level is per-context so this doesn't affect other threads
+    int aaLevel = fz_aa_level(rctx);
+    if (args.fastRender) {
+        fz_set_aa_level(rctx, 0);
+    }
+
+    fz_try(rctx) {
+        fz_colorspace* csRgb = fz_device_rgb(rctx);
+        pix = fz_new_pixmap_with_bbox(rctx, csRgb, bbox, nullptr, 1);
+        // TODO: for ebooks, to have uniform background needs to set custom css
+        // background-color and clear pixmap with the same color
+        fz_clear_pixmap_with_value(rctx, pix, 0xff);
+        dev = fz_new_draw_device(rctx, fz_identity, pix);
+        fz_run_display_list(rctx, list, dev, ctm, fz_rect_from_irect(bbox), fzcookie);
+        fz_close_device(rctx, dev);
+        bitmap = NewRenderedFzPixmap(rctx, pix);
+    }
+    fz_always(rctx) {
+        fz_drop_device(rctx, dev);
+        fz_drop_pixmap(rctx, pix);
+        fz_drop_display_list(rctx, list);
+        fz_set_aa_level(rctx, aaLevel);
+    }
+    fz_catch(rctx) {
+        fz_report_error(rctx);
+        delete bitmap;
+        bitmap = nullptr;
+    }
+    if (needsLock) {
+        LeaveCriticalSection(ctxAccess);
     }
-
-    pdf_page* pdfpage = nullptr;
-    fz_var(pdfpage);
-    if (pdfdoc) {
-        fz_try(ctx) {
-            pdfpage = pdf_page_from_fz_page(ctx, page);
-            pix = fz_new_pixmap_with_bbox(ctx, csRgb, ibounds, nullptr, 1);
-            fz_clear_pixmap_with_value(ctx, pix, 0xff);
-            // TODO: in printing different style. old code use pdf_run_page_with_usage(), with usage ="View"
-            // or "Print". "Export" is not used
-            dev = fz_new_draw_device(ctx, ctm, pix);
-            pdf_run_page_with_usage(ctx, pdfpage, dev, fz_identity, usage, fzcookie);
-            bitmap = NewRenderedFzPixmap(ctx, pix);
-            fz_close_device(ctx, dev);
-        }
-        fz_always(ctx) {
-            if (dev) {
-                fz_drop_device(ctx, dev);
-            }
-            fz_drop_pixmap(ctx, pix);
-        }
-        fz_catch(ctx) {
-            fz_report_error(ctx);
-            delete bitmap;
-            return nullptr;
-        }
-    } else {
-        fz_try(ctx) {
-            pix = fz_new_pixmap_with_bbox(ctx, csRgb, ibounds, nullptr, 1);
-            // TODO: to have uniform background needs to set custom css
-            // background-color and clear pixmap with the same color
-            fz_clear_pixmap_with_value(ctx, pix, 0xff);
-            // fz_clear_pixmap(ctx, pix);
-            // fz_fill_pixmap_with_color(ctx, pix, )
-            dev = fz_new_draw_device(ctx, ctm, pix);
-            fz_run_page_contents(ctx, page, dev, fz_identity, NULL);
-            fz_close_device(ctx, dev);
-            fz_drop_device(ctx, dev);
-            bitmap = NewRenderedFzPixmap(ctx, pix);
-        }
-        fz_always(ctx) {
-            fz_drop_pixmap(ctx, pix);
-        }
-        fz_catch(ctx) {
-            fz_report_error(ctx);
-            delete bitmap;
-            return nullptr;
-        }
+    if (bitmap && args.target == RenderTarget::View) {
+        ScheduleLoadPageElements(pageNo);
     }
-
     return bitmap;
 }
 
 // don't delete the result
+// this is called on every mouse move, so it only loads the page's links and
+// detects links in the page's text if that's already loaded. images and the text
+// are loaded in the background once the page has been rendered
 IPageElement* EngineMupdf::GetElementAtPos(int pageNo, PointF pt) {
-    FzPageInfo* pageInfo = GetFzPageInfoCanFail(pageNo);
-    return FzGetElementAtPos(pageInfo, pt);
+    FzPageInfo* pageInfo = GetFzPageInfoCanFail(pageNo, true);
+    if (!pageInfo || !TryEnterCriticalSection(&pagesAccess)) {
+        return nullptr;
+    }
+    if (TryEnterCriticalSection(ctxAccess)) {
+        LoadPageLinks(pageInfo);
+        if (pageInfo->textLoaded) {
+            LoadPageAutoLinks(pageInfo);
+        }
+        LeaveCriticalSection(ctxAccess);
+    }
+    IPageElement* res = FzGetElementAtPos(pageInfo, pt);
+    LeaveCriticalSection(&pagesAccess);
+    return res;
 }
 
 // TOOD: optimize by returning reference or pointer so that
 // we don't have to re-create the Vec every time
 Vec<IPageElement*> EngineMupdf::GetElements(int pageNo) {
-    auto pageInfo = GetFzPageInfoFast(pageNo);
+    auto pageInfo = GetFzPageInfo(pageNo, false);
     if (!pageInfo) {
         return Vec<IPageElement*>();
     }
@@ -3168,10 +3882,11 @@ fz_matrix EngineMupdf::viewctm(fz_page* page, float zoom, int rotation) const {
 RenderedBitmap* EngineMupdf::GetPageImage(int pageNo, RectF rect, int imageIdx) {
     auto ctx = Ctx();
 
-    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, false);
-    if (!pageInfo->page) {
+    FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
+    if (!pageInfo) {
         return nullptr;
     }
+    LoadPageImages(pageInfo);
     const auto& images = pageInfo->images;
     bool outOfBounds = imageIdx >= images.Size();
     fz_rect imgRect = images.at(imageIdx)->rect;
@@ -3212,33 +3927,22 @@ RenderedBitmap* EngineMupdf::GetPageImage(int pageNo, RectF rect, int imageIdx)
 }
 
 PageText EngineMupdf::ExtractPageText(int pageNo) {
-    auto ctx = Ctx();
-
     FzPageInfo* pageInfo = GetFzPageInfo(pageNo, true);
     if (!pageInfo) {
         return {};
     }
+    LoadPageText(pageInfo);
 
-    ScopedCritSec scope(ctxAccess);
-
-    fz_stext_page* stext = nullptr;
-    fz_var(stext);
-    fz_stext_options opts{};
-    fz_try(ctx) {
-        stext = fz_new_stext_page_from_page(ctx, pageInfo->page, &opts);
-    }
-    fz_catch(ctx) {
-        fz_report_error(ctx);
-    }
-    if (!stext) {
+    // the caller owns the result, the cached text stays with the page
+    ScopedCritSec scope(&pagesAccess);
+    const PageText& text = pageInfo->text;
+    if (!text.text) {
         return {};
     }
     PageText res;
-    // TODO: convert to return PageText
-    WCHAR* text = FzTextPageToStr(stext, &res.coords);
-    fz_drop_stext_page(ctx, stext);
-    res.text = text;
-    res.len = (int)str::Len(text);
+    res.len = text.len;
+    res.text = str::Dup(text.text, (size_t)text.len);
+    res.coords = (Rect*)memdup(text.coords, (size_t)text.len * sizeof(Rect));
     return res;
 }
 
@@ -3273,7 +3977,7 @@ TempStr EngineMupdf::ExtractFontListTemp() {
     // collect all fonts from all page objects
     int nPages = PageCount();
     for (int i = 1; i <= nPages; i++) {
-        auto pageInfo = GetFzPageInfo(i, false);
+        auto pageInfo = GetFzPageInfo(i, true);
         if (!pageInfo) {
             continue;
         }
@@ -3637,25 +4341,49 @@ bool EngineMupdfSaveUpdated(EngineBase* engine, const char* path, const ShowErro
     return ok;
 }
 
+// reflowable documents (EPUB, FB2 etc.) are layed out with the ebook
+// settings in effect when they were loaded, which we don't keep track of
+bool EngineMupdf::GetLayoutKey(u8 key[16]) {
+    bool isReflowable = false;
+    {
+        ScopedCritSec ctxScope(ctxAccess);
+        isReflowable = _doc && fz_is_document_reflowable(Ctx(), _doc);
+    }
+    if (isReflowable) {
+        return false;
+    }
+    return EngineBase::GetLayoutKey(key);
+}
+
 bool EngineMupdf::HasClipOptimizations(int pageNo) {
     if (!pdfdoc) {
         return false;
     }
 
-    FzPageInfo* pageInfo = GetFzPageInfoFast(pageNo);
-    if (!pageInfo || !pageInfo->page) {
+    // this is called on the UI thread, so it must neither load the page's images
+    // (which extracts its text) nor wait for a rendering thread. until the images
+    // have been loaded in the background, we assume that there are no large ones
+    FzPageInfo* pageInfo = pages[pageNo - 1];
+    if (!TryEnterCriticalSection(&pagesAccess)) {
         return false;
     }
-
+    if (!pageInfo->imagesLoaded) {
+        // pagesAccess is re-entrant, so this doesn't block
+        ScheduleLoadPageElements(pageNo);
+        LeaveCriticalSection(&pagesAccess);
+        return true;
+    }
+    bool res = true;
     fz_rect mbox = ToFzRect(PageMediabox(pageNo));
     // check if any image covers at least 90% of the page
-    for (auto& img : pageInfo->images) {
-        fz_rect ir = img->rect;
+    for (int i = 0; res && i < pageInfo->images.Size(); i++) {
+        fz_rect ir = pageInfo->images.at(i)->rect;
         if (FzRectOverlap(mbox, ir) >= 0.9f) {
-            return false;
+            res = false;
         }
     }
-    return true;
+    LeaveCriticalSection(&pagesAccess);
+    return res;
 }
 
 TempStr EngineMupdf::GetPageLabeTemp(int pageNo) const {
@@ -3791,7 +4519,7 @@ void EngineMupdfGetAnnotations(EngineBase* engine, Vec<Annotation*>& annotsOut)
     }
     ScopedCritSec scope(&e->pagesAccess);
     for (int i = 1; i <= e->pageCount; i++) {
-        FzPageInfo* pi = e->GetFzPageInfo(i, false);
+        FzPageInfo* pi = e->GetFzPageInfo(i, true);
         if (!pi) {
             continue;
         }
@@ -3955,6 +4683,10 @@ NO_INLINE void MarkNotificationAsModified(EngineMupdf* e, Annotation* annot, Ann
     auto ctx = e->Ctx();
     RebuildCommentsFromAnnotations(ctx, pageInfo);
     pageInfo->elementsNeedRebuilding = true;
+
+    // the page has to be re-recorded with the changed annotation
+    ScopedCritSec ctxScope(e->ctxAccess);
+    e->DropCachedDisplayList(pageInfo);
 }
 
 // creates Annotation wrapper around pdf_annot
@@ -31,11 +31,27 @@ struct FzPageInfo {
     bool elementsNeedRebuilding = true;
 
     RectF mediabox{};
+    // mediabox is the most common size of the sampled pages until the
+    // page's real size has been read (see EngineMupdf::ResolvePageSizes())
+    bool mediaboxIsGuess = false;
     Vec<FitzPageImageInfo*> images;
 
-    // if false, only loaded page (fast)
-    // if true, loaded expensive info (extracted text etc.)
-    bool fullyLoaded = false;
+    // extracted text of the page, used for auto-detecting links and search
+    PageText text;
+
+    // recorded content of the page for RenderTarget::View, replayed
+    // when re-rendering at a different zoom or rotation or other tiles.
+    // protected by ctxAccess, see EngineMupdf::GetDisplayList()
+    fz_display_list* displayList = nullptr;
+    size_t displayListSize = 0;
+
+    // expensive info is loaded lazily, each part only when first needed
+    // (never for rendering), see EngineMupdf::LoadPage*(). rendered pages
+    // get it loaded in the background, see EngineMupdf::ScheduleLoadPageElements()
+    bool linksLoaded = false;
+    bool autoLinksLoaded = false;
+    bool imagesLoaded = false;
+    bool textLoaded = false;
 };
 
 class EngineMupdf : public EngineBase {
@@ -56,6 +72,7 @@ class EngineMupdf : public EngineBase {
     PageText ExtractPageText(int pageNo) override;
 
     bool HasClipOptimizations(int pageNo) override;
+    bool GetLayoutKey(u8 key[16]) override;
     TempStr GetPropertyTemp(const char* name) override;
 
     bool BenchLoadPage(int pageNo) override;
@@ -69,6 +86,8 @@ class EngineMupdf : public EngineBase {
     IPageDestination* GetNamedDest(const char* name) override;
     TocTree* GetToc() override;
 
+    void SetOnLayoutFinished(const Func0& onFinished) override;
+
     TempStr GetPageLabeTemp(int pageNo) const override;
     int GetPageByLabel(const char* label) const override;
 
@@ -87,6 +106,9 @@ class EngineMupdf : public EngineBase {
     fz_document* _doc = nullptr;
     pdf_document* pdfdoc = nullptr;
     Vec<FzPageInfo*> pages;
+    // pages with cached display lists, least recently used first
+    Vec<FzPageInfo*> displayListCache;
+    size_t displayListCacheSize = 0;
     fz_outline* outline = nullptr;
     fz_outline* attachments = nullptr;
     pdf_obj* pdfInfo = nullptr;
@@ -94,6 +116,25 @@ class EngineMupdf : public EngineBase {
 
     TocTree* tocTree = nullptr;
 
+    // resolves the sizes of pages which only have a guessed mediabox,
+    // protected by ctxAccess
+    HANDLE pageSizesThread = nullptr;
+    bool abortResolvingPageSizes = false;
+    bool pageSizesResolved = true;
+    Func0 onPageSizesResolved;
+
+    // loads the text, images and auto-detected links of pages once they've been
+    // rendered (which isn't done on the UI thread), protected by pagesAccess
+    HANDLE pageElementsThread = nullptr;
+    bool pageElementsThreadRunning = false;
+    Vec<int> pageElementsToLoad;
+    fz_cookie pageElementsCookie{};
+
+    // the document file if it's memory mapped (see FzOpenMappedFile()). its view is
+    // released when it hasn't been read from for a while, protected by ctxAccess
+    fz_stream* mappedFile = nullptr;
+    HANDLE releaseMappedFileTimer = nullptr;
+
     // used to track "dirty" state of annotations. not perfect because if we add and delete
     // the same annotation, we should be back to 0
     bool modifiedAnnotations = false;
@@ -104,11 +145,23 @@ class EngineMupdf : public EngineBase {
     // bool Load(fz_stream* stm, PasswordUI* pwdUI = nullptr);
     bool LoadFromStream(fz_stream* stm, const char* nameHing, PasswordUI* pwdUI = nullptr);
     bool FinishLoading();
+    void GuessPageSizes(int nInitial);
+    void ResolvePageSizes();
+    void StopResolvingPageSizes();
+    void ScheduleLoadPageElements(int pageNo);
+    void LoadScheduledPageElements();
+    void StopLoadingPageElements();
+    void KeepMappedFile(fz_stream* file);
     RenderedBitmap* GetPageImage(int pageNo, RectF rect, int imageIdx);
 
-    FzPageInfo* GetFzPageInfoCanFail(int pageNo);
-    FzPageInfo* GetFzPageInfoFast(int pageNo);
+    FzPageInfo* GetFzPageInfoCanFail(int pageNo, bool loadQuick = true);
     FzPageInfo* GetFzPageInfo(int pageNo, bool loadQuick, fz_cookie* cookie = nullptr);
+    void LoadPageLinks(FzPageInfo* pageInfo);
+    void LoadPageAutoLinks(FzPageInfo* pageInfo, fz_cookie* cookie = nullptr);
+    void LoadPageImages(FzPageInfo* pageInfo, fz_cookie* cookie = nullptr);
+    void LoadPageText(FzPageInfo* pageInfo, fz_cookie* cookie = nullptr);
+    fz_display_list* GetDisplayList(FzPageInfo* pageInfo, const char* usage, fz_cookie* cookie);
+    void DropCachedDisplayList(FzPageInfo* pageInfo);
     fz_matrix viewctm(int pageNo, float zoom, int rotation);
     fz_matrix viewctm(fz_page* page, float zoom, int rotation) const;
     TocItem* BuildTocTree(TocItem* parent, fz_outline* outline, int& idCounter, bool isAttachment);
@@ -124,5 +177,3 @@ RectF ToRectF(fz_rect rect);
 RenderedBitmap* NewRenderedFzPixmap(fz_context* ctx, fz_pixmap* pixmap);
 void MarkNotificationAsModified(EngineMupdf*, Annotation*, AnnotationChange = AnnotationChange::Modify);
 Annotation* MakeAnnotationWrapper(EngineMupdf* engine, pdf_annot* annot, int pageNo);
-
-void InitializeEngineMupdf();
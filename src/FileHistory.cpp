@@ -9,6 +9,9 @@ License: GPLv3 */
 #include "utils/WinUtil.h"
 
 #include "Settings.h"
+#include "DocController.h"
+#include "EngineBase.h"
+#include "EngineAll.h"
 #include "GlobalPrefs.h"
 #include "FileThumbnails.h"
 #include "FileHistory.h"
@@ -285,17 +288,16 @@ void CleanUpThumbnailCache() {
     TempStr thumbsDir = GetThumbnailCacheDirTemp();
 
     StrVec filePaths;
+    StrVec keepPaths;
     DirIter di{thumbsDir};
     for (DirIterEntry* de : di) {
-        if (path::Match(de->filePath, "*.png")) {
+        // cached thumbnails, extracted text and ebook layout
+        if (path::Match(de->filePath, "*.png") || path::Match(de->filePath, "*.txtcache") ||
+            path::Match(de->filePath, "*.layoutcache")) {
             filePaths.Append(de->filePath);
         }
     }
-    if (filePaths.IsEmpty()) {
-        return;
-    }
 
-    bool ok;
     // remove files that should not be deleted
     Vec<FileState*> list;
     fileHistory.GetFrequencyOrder(list);
@@ -304,15 +306,25 @@ void CleanUpThumbnailCache() {
         if (n++ > kFileHistoryMaxFrequent * 2) {
             break;
         }
+        keepPaths.Append(fs->filePath);
+        // .png thumbnails of previous versions (see MigrateThumbnailPngs())
         TempStr path = GetThumbnailPathTemp(fs->filePath);
-        if (!path) {
-            continue;
+        if (path) {
+            filePaths.Remove(path);
+        }
+        // text cache only exists for documents that were searched
+        TempStr textCachePath = GetTextCachePathTemp(fs->filePath);
+        if (textCachePath) {
+            filePaths.Remove(textCachePath);
         }
-        ok = filePaths.Remove(path);
-        if (!ok) {
-            logf("CleanUpThumbnailCache: failed to remove '%s'\n", path);
+        TempStr layoutCachePath = GetEbookLayoutCachePathTemp(fs->filePath);
+        if (layoutCachePath) {
+            filePaths.Remove(layoutCachePath);
         }
     }
+    if (shouldDeleteThumbnail) {
+        CleanUpThumbnailStore(keepPaths);
+    }
 
     for (char* path : filePaths) {
         if (shouldDeleteThumbnail) {
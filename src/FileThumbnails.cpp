@@ -5,6 +5,7 @@
 #include "utils/CryptoUtil.h"
 #include "utils/FileUtil.h"
 #include "utils/DirIter.h"
+#include "utils/ScopedWin.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/WinUtil.h"
 
@@ -18,15 +19,59 @@
 
 #include "utils/Log.h"
 
-char* GetThumbnailPathTemp(const char* filePath) {
-    // create a fingerprint of a (normalized) path for the file name
-    // I'd have liked to also include the file's last modification time
-    // in the fingerprint (much quicker than hashing the entire file's
-    // content), but that's too expensive for files on slow drives
-    u8 digest[16]{};
+// all thumbnails are stored in a single file, so that showing the home page doesn't
+// need a file access and a PNG decode per thumbnail. The file is read into memory
+// (not mapped, so that other instances can replace it) and its pixel data
+// can be copied directly into a bitmap:
+// ThumbnailStoreHeader
+// ThumbnailStoreEntry[nEntries]
+// for each entry: 32bpp top-down pixel data (dx * dy * 4 bytes)
+// Thumbnails used to be saved as separate .png files, which are moved into
+// the store when it's first created.
+constexpr u32 kThumbnailStoreMagic = 0x42485453; // 'STHB'
+constexpr u32 kThumbnailStoreVersion = 1;
+constexpr const char* kThumbnailStoreName = "thumbnails.db";
+
+struct ThumbnailStoreHeader {
+    u32 magic;
+    u32 version;
+    u32 nEntries;
+    u32 reserved;
+};
+
+struct ThumbnailStoreEntry {
+    // see GetPathFingerprint()
+    u8 pathFingerprint[16];
+    // size (0 if unknown) and modification time of the file when the thumbnail was created
+    i64 fileSize;
+    FILETIME fileTime;
+    u32 dx;
+    u32 dy;
+    u32 offset;
+    u32 reserved;
+};
+
+struct ThumbnailData {
+    ThumbnailStoreEntry entry;
+    // not owned
+    const u8* pixels;
+};
+
+// only accessed from the ui thread
+static ByteSlice gThumbnailStoreData;
+static bool gTriedOpeningThumbnailStore = false;
+
+// how often to try replacing the store while another instance is reading it
+constexpr int kThumbnailStoreWriteTries = 10;
+
+// a fingerprint of a (normalized) path
+// I'd have liked to also include the file's last modification time
+// in the fingerprint (much quicker than hashing the entire file's
+// content), but that's too expensive for files on slow drives
+static bool GetPathFingerprint(const char* filePath, u8 digest[16]) {
     // TODO: why is this happening? Seen in crash reports e.g. 35043
     if (!filePath) {
-        return nullptr;
+        return false;
     }
     TempStr path = str::DupTemp(filePath);
     if (path::HasVariableDriveLetter(path)) {
@@ -34,6 +79,15 @@ char* GetThumbnailPathTemp(const char* filePath) {
         path[0] = '?';
     }
     CalcMD5Digest((u8*)path, str::Leni(path), digest);
+    return true;
+}
+
+// path of the .png thumbnail used by previous versions
+char* GetThumbnailPathTemp(const char* filePath) {
+    u8 digest[16]{};
+    if (!GetPathFingerprint(filePath, digest)) {
+        return nullptr;
+    }
     AutoFreeStr fingerPrint = str::MemToHex(digest, dimof(digest));
 
     TempStr thumbsDir = GetThumbnailCacheDirTemp();
@@ -45,61 +99,366 @@ char* GetThumbnailPathTemp(const char* filePath) {
     return res;
 }
 
+// text extracted from documents is cached next to thumbnails (see DocumentTextCache).
+// unlike thumbnails, it must match the content of the file
+TempStr GetTextCachePathTemp(const char* filePath) {
+    if (!filePath) {
+        return nullptr;
+    }
+    return GetCachePathForFileTemp(filePath, GetThumbnailCacheDirTemp(), ".txtcache");
+}
+
 TempStr GetThumbnailCacheDirTemp() {
     TempStr thumbsDir = GetPathInAppDataDirTemp("GurupiaReadercache");
     return thumbsDir;
 }
 
+static TempStr GetThumbnailStorePathTemp() {
+    TempStr thumbsDir = GetThumbnailCacheDirTemp();
+    if (!thumbsDir) {
+        return nullptr;
+    }
+    return path::JoinTemp(thumbsDir, kThumbnailStoreName);
+}
+
+static void CloseThumbnailStore() {
+    gThumbnailStoreData.Free();
+    gTriedOpeningThumbnailStore = false;
+}
+
+static const ThumbnailStoreEntry* GetThumbnailStoreEntries(int* nEntries) {
+    *nEntries = 0;
+    if (gThumbnailStoreData.empty()) {
+        return nullptr;
+    }
+    auto hdr = (const ThumbnailStoreHeader*)gThumbnailStoreData.data();
+    *nEntries = (int)hdr->nEntries;
+    return (const ThumbnailStoreEntry*)(gThumbnailStoreData.data() + sizeof(ThumbnailStoreHeader));
+}
+
+static bool IsValidThumbnailStore(const u8* data, i64 size) {
+    if (!data || size < (i64)sizeof(ThumbnailStoreHeader)) {
+        return false;
+    }
+    auto hdr = (const ThumbnailStoreHeader*)data;
+    if (hdr->magic != kThumbnailStoreMagic || hdr->version != kThumbnailStoreVersion) {
+        return false;
+    }
+    i64 entriesEnd = (i64)sizeof(ThumbnailStoreHeader) + (i64)hdr->nEntries * (i64)sizeof(ThumbnailStoreEntry);
+    if (entriesEnd > size) {
+        return false;
+    }
+    auto entries = (const ThumbnailStoreEntry*)(data + sizeof(ThumbnailStoreHeader));
+    for (u32 i = 0; i < hdr->nEntries; i++) {
+        const ThumbnailStoreEntry& e = entries[i];
+        if (e.dx == 0 || e.dy == 0 || e.dx > 4096 || e.dy > 4096) {
+            return false;
+        }
+        if ((i64)e.offset + (i64)e.dx * (i64)e.dy * 4 > size) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static void MigrateThumbnailPngs();
+
+static bool OpenThumbnailStore() {
+    if (gTriedOpeningThumbnailStore) {
+        return !gThumbnailStoreData.empty();
+    }
+    gTriedOpeningThumbnailStore = true;
+    TempStr path = GetThumbnailStorePathTemp();
+    if (!path) {
+        return false;
+    }
+    if (!file::Exists(path)) {
+        // note: calls OpenThumbnailStore() again if there were .png files
+        MigrateThumbnailPngs();
+        return !gThumbnailStoreData.empty();
+    }
+
+    ByteSlice data = file::ReadFile(path);
+    if (data.size() > UINT_MAX || !IsValidThumbnailStore(data.data(), (i64)data.size())) {
+        logf("OpenThumbnailStore: ignoring invalid '%s'\n", path);
+        data.Free();
+        return false;
+    }
+    gThumbnailStoreData = data;
+    return true;
+}
+
+static const ThumbnailStoreEntry* FindThumbnailStoreEntry(const char* filePath) {
+    u8 fingerprint[16]{};
+    if (!GetPathFingerprint(filePath, fingerprint) || !OpenThumbnailStore()) {
+        return nullptr;
+    }
+    int n;
+    const ThumbnailStoreEntry* entries = GetThumbnailStoreEntries(&n);
+    for (int i = 0; i < n; i++) {
+        if (memeq(entries[i].pathFingerprint, fingerprint, sizeof(fingerprint))) {
+            return &entries[i];
+        }
+    }
+    return nullptr;
+}
+
+// thumbnails in the store, the pixels point into gThumbnailStoreData
+static void GetStoredThumbnails(Vec<ThumbnailData>& thumbs) {
+    if (!OpenThumbnailStore()) {
+        return;
+    }
+    int n;
+    const ThumbnailStoreEntry* entries = GetThumbnailStoreEntries(&n);
+    for (int i = 0; i < n; i++) {
+        ThumbnailData thumb;
+        thumb.entry = entries[i];
+        thumb.pixels = gThumbnailStoreData.data() + entries[i].offset;
+        thumbs.Append(thumb);
+    }
+}
+
+static void RemoveThumbnailData(Vec<ThumbnailData>& thumbs, const u8 fingerprint[16]) {
+    for (int i = 0; i < thumbs.Size(); i++) {
+        if (memeq(thumbs[i].entry.pathFingerprint, fingerprint, 16)) {
+            thumbs.RemoveAt(i);
+            return;
+        }
+    }
+}
+
+// replaces path with a file written next to it, so that another instance
+// reading the store either sees the old or the new file
+static bool ReplaceThumbnailStore(const char* path, const ByteSlice& data) {
+    TempStr tmpPath = str::FormatTemp("%s.%u.tmp", path, GetCurrentProcessId());
+    if (!file::WriteFile(tmpPath, data)) {
+        logf("WriteThumbnailStore: failed to write '%s'\n", tmpPath);
+        return false;
+    }
+    TempWStr tmpPathW = ToWStrTemp(tmpPath);
+    TempWStr pathW = ToWStrTemp(path);
+    for (int i = 0; i < kThumbnailStoreWriteTries; i++) {
+        if (MoveFileExW(tmpPathW, pathW, MOVEFILE_REPLACE_EXISTING)) {
+            return true;
+        }
+        // another instance might be reading it right now
+        Sleep(20);
+    }
+    logf("WriteThumbnailStore: failed to replace '%s' (error %d)\n", path, (int)GetLastError());
+    file::Delete(tmpPath);
+    return false;
+}
+
+// the store is small (we only keep thumbnails of the most frequently
+// opened files) so it's simply re-written when a thumbnail changes
+static bool WriteThumbnailStore(Vec<ThumbnailData>& thumbs) {
+    TempStr path = GetThumbnailStorePathTemp();
+    if (!path) {
+        return false;
+    }
+    ThumbnailStoreHeader hdr{};
+    hdr.magic = kThumbnailStoreMagic;
+    hdr.version = kThumbnailStoreVersion;
+    hdr.nEntries = (u32)thumbs.Size();
+
+    str::Str data;
+    data.Append((const char*)&hdr, sizeof(hdr));
+    u32 offset = (u32)(sizeof(hdr) + thumbs.size() * sizeof(ThumbnailStoreEntry));
+    for (ThumbnailData& thumb : thumbs) {
+        ThumbnailStoreEntry e = thumb.entry;
+        e.offset = offset;
+        offset += e.dx * e.dy * 4;
+        data.Append((const char*)&e, sizeof(e));
+    }
+    for (ThumbnailData& thumb : thumbs) {
+        data.Append((const char*)thumb.pixels, thumb.entry.dx * thumb.entry.dy * 4);
+    }
+
+    // thumbs might point into gThumbnailStoreData, so it can only be replaced after copying
+    CloseThumbnailStore();
+    gTriedOpeningThumbnailStore = true;
+    gThumbnailStoreData = data.StealAsByteSlice();
+    if (!dir::CreateForFile(path)) {
+        logf("WriteThumbnailStore: dir::CreateForFile('%s') failed\n", path);
+        return false;
+    }
+    return ReplaceThumbnailStore(path, gThumbnailStoreData);
+}
+
+// caller must free() the result
+static u8* GetBitmapPixels(HBITMAP hbmp, Size size) {
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    u8* pixels = AllocArray<u8>((size_t)size.dx * size.dy * 4);
+    HDC hdc = CreateCompatibleDC(nullptr);
+    bool ok = pixels && GetDIBits(hdc, hbmp, 0, size.dy, pixels, &bmi, DIB_RGB_COLORS);
+    DeleteDC(hdc);
+    if (!ok) {
+        free(pixels);
+        return nullptr;
+    }
+    return pixels;
+}
+
+static RenderedBitmap* BitmapFromPixels(const u8* pixels, Size size) {
+    BITMAPINFO bmi{};
+    bmi.bmiHeader.biSize = sizeof(bmi.bmiHeader);
+    bmi.bmiHeader.biWidth = size.dx;
+    bmi.bmiHeader.biHeight = -size.dy;
+    bmi.bmiHeader.biPlanes = 1;
+    bmi.bmiHeader.biBitCount = 32;
+    bmi.bmiHeader.biCompression = BI_RGB;
+
+    void* bits = nullptr;
+    HBITMAP hbmp = CreateDIBSection(nullptr, &bmi, DIB_RGB_COLORS, &bits, nullptr, 0);
+    if (!hbmp) {
+        return nullptr;
+    }
+    memcpy(bits, pixels, (size_t)size.dx * size.dy * 4);
+    return new RenderedBitmap(hbmp, size);
+}
+
+// moves thumbnails saved as .png files by previous versions into the store.
+// the .png files are named after the fingerprint of the path
+static void MigrateThumbnailPngs() {
+    TempStr thumbsDir = GetThumbnailCacheDirTemp();
+    if (!thumbsDir || !dir::Exists(thumbsDir)) {
+        return;
+    }
+    Vec<ThumbnailData> thumbs;
+    StrVec pngPaths;
+    DirIter di{thumbsDir};
+    for (DirIterEntry* de : di) {
+        TempStr name = path::GetBaseNameTemp(de->filePath);
+        u8 fingerprint[16]{};
+        if (!path::Match(name, "*.png") || str::Len(name) != 36) {
+            continue;
+        }
+        if (!str::HexToMem(str::DupTemp(name, 32), fingerprint, dimof(fingerprint))) {
+            continue;
+        }
+        RenderedBitmap* bmp = LoadRenderedBitmap(de->filePath);
+        Size size = bmp ? bmp->GetSize() : Size();
+        u8* pixels = size.IsEmpty() ? nullptr : GetBitmapPixels(bmp->GetBitmap(), size);
+        delete bmp;
+        pngPaths.Append(de->filePath);
+        if (!pixels) {
+            continue;
+        }
+        ThumbnailData thumb{};
+        memcpy(thumb.entry.pathFingerprint, fingerprint, sizeof(fingerprint));
+        // the thumbnail is outdated if the file is newer than the .png was
+        thumb.entry.fileTime = file::GetModificationTime(de->filePath);
+        thumb.entry.dx = (u32)size.dx;
+        thumb.entry.dy = (u32)size.dy;
+        thumb.pixels = pixels;
+        thumbs.Append(thumb);
+    }
+    if (pngPaths.IsEmpty()) {
+        return;
+    }
+    bool ok = WriteThumbnailStore(thumbs);
+    for (ThumbnailData& thumb : thumbs) {
+        free((void*)thumb.pixels);
+    }
+    logf("MigrateThumbnailPngs: moved %d thumbnails to the store %s\n", thumbs.Size(), ok ? "ok" : "failed");
+    if (!ok) {
+        return;
+    }
+    for (char* pngPath : pngPaths) {
+        file::Delete(pngPath);
+    }
+    OpenThumbnailStore();
+}
+
+// removes thumbnails of all files except those in filePaths
+void CleanUpThumbnailStore(const StrVec& filePaths) {
+    Vec<ThumbnailData> thumbs;
+    GetStoredThumbnails(thumbs);
+    Vec<ThumbnailData> keep;
+    for (ThumbnailData& thumb : thumbs) {
+        for (char* path : filePaths) {
+            u8 fingerprint[16]{};
+            if (GetPathFingerprint(path, fingerprint) &&
+                memeq(thumb.entry.pathFingerprint, fingerprint, sizeof(fingerprint))) {
+                keep.Append(thumb);
+                break;
+            }
+        }
+    }
+    if (keep.Size() < thumbs.Size()) {
+        logf("CleanUpThumbnailStore: removing %d thumbnails\n", thumbs.Size() - keep.Size());
+        WriteThumbnailStore(keep);
+    }
+}
+
 void DeleteThumbnailCacheDirectory() {
+    // forget the thumbnails read from the store
+    CloseThumbnailStore();
     TempStr thumbsDir = GetThumbnailCacheDirTemp();
     dir::RemoveAll(thumbsDir);
 }
 
+static bool RemoveStoredThumbnail(const char* filePath) {
+    u8 fingerprint[16]{};
+    if (!FindThumbnailStoreEntry(filePath) || !GetPathFingerprint(filePath, fingerprint)) {
+        return false;
+    }
+    Vec<ThumbnailData> thumbs;
+    GetStoredThumbnails(thumbs);
+    RemoveThumbnailData(thumbs, fingerprint);
+    return WriteThumbnailStore(thumbs);
+}
+
 void DeleteThumbnailForFile(const char* filePath) {
-    TempStr thumbPath = GetThumbnailPathTemp(filePath);
-    bool ok = file::Delete(thumbPath);
+    bool ok = RemoveStoredThumbnail(filePath);
     auto status = ok ? "ok" : "failed";
-    logf("DeleteThumbnailForFile: file::Remove('%s') %s\n", thumbPath, status);
+    logf("DeleteThumbnailForFile: removing thumbnail of '%s' %s\n", filePath, status);
 }
 
 RenderedBitmap* LoadThumbnail(FileState* fs) {
     if (fs->thumbnail) {
         return fs->thumbnail;
     }
-    TempStr bmpPath = GetThumbnailPathTemp(fs->filePath);
-    if (!bmpPath) {
+    const ThumbnailStoreEntry* e = FindThumbnailStoreEntry(fs->filePath);
+    if (!e) {
         return nullptr;
     }
-
-    RenderedBitmap* bmp = LoadRenderedBitmap(bmpPath);
-    if (!bmp || bmp->GetSize().IsEmpty()) {
-        delete bmp;
-        return nullptr;
-    }
-
-    fs->thumbnail = bmp;
+    Size size((int)e->dx, (int)e->dy);
+    fs->thumbnail = BitmapFromPixels(gThumbnailStoreData.data() + e->offset, size);
     return fs->thumbnail;
 }
 
+// doesn't load the thumbnail, only checks that it's up to date
 bool HasThumbnail(FileState* fs) {
-    // TODO: optimize, LoadThumbnail() is probably not necessary
-    if (!fs->thumbnail && !LoadThumbnail(fs)) {
+    const ThumbnailStoreEntry* e = FindThumbnailStoreEntry(fs->filePath);
+    if (!e) {
         return false;
     }
-
-    TempStr bmpPath = GetThumbnailPathTemp(fs->filePath);
-    if (!bmpPath) {
-        return true;
+    // a single call for size and modification time (this is called for
+    // every thumbnail on the home page)
+    WIN32_FILE_ATTRIBUTE_DATA fileInfo{};
+    TempWStr pathW = ToWStrTemp(fs->filePath);
+    bool isOutdated = !GetFileAttributesExW(pathW, GetFileExInfoStandard, &fileInfo);
+    if (!isOutdated) {
+        isOutdated = FileTimeDiffInSecs(fileInfo.ftLastWriteTime, e->fileTime) > 0;
     }
-    FILETIME bmpTime = file::GetModificationTime(bmpPath);
-    FILETIME fileTime = file::GetModificationTime(fs->filePath);
-    // delete the thumbnail if the file is newer than the thumbnail
-    if (FileTimeDiffInSecs(fileTime, bmpTime) > 0) {
+    if (!isOutdated && e->fileSize != 0) {
+        i64 fileSize = ((i64)fileInfo.nFileSizeHigh << 32) | fileInfo.nFileSizeLow;
+        isOutdated = e->fileSize != fileSize;
+    }
+    if (isOutdated) {
         delete fs->thumbnail;
         fs->thumbnail = nullptr;
+        return false;
     }
-
-    return fs->thumbnail != nullptr;
+    return true;
 }
 
 // takes ownership of bmp
@@ -118,32 +477,32 @@ void SaveThumbnail(FileState* fs) {
     if (!fs->thumbnail) {
         return;
     }
-
-    TempStr thumbnailPath = GetThumbnailPathTemp(fs->filePath);
-    if (!thumbnailPath) {
+    ThumbnailData thumb{};
+    if (!GetPathFingerprint(fs->filePath, thumb.entry.pathFingerprint)) {
         return;
     }
-    if (!dir::CreateForFile(thumbnailPath)) {
-        logf("SaveThumbnail: dir::CreateForFile('%s') failed, file path: '%s'\n", thumbnailPath, fs->filePath);
-        ReportIfQuick(true);
+    Size size = fs->thumbnail->GetSize();
+    u8* pixels = GetBitmapPixels(fs->thumbnail->GetBitmap(), size);
+    if (!pixels) {
+        logf("SaveThumbnail: failed to get pixels of thumbnail, file path: '%s'\n", fs->filePath);
+        return;
     }
-    ReportIfQuick(!str::EndsWithI(thumbnailPath, ".png"));
+    thumb.entry.fileSize = file::GetSize(fs->filePath);
+    thumb.entry.fileTime = file::GetModificationTime(fs->filePath);
+    thumb.entry.dx = (u32)size.dx;
+    thumb.entry.dy = (u32)size.dy;
+    thumb.pixels = pixels;
 
-    Gdiplus::Bitmap bmp(fs->thumbnail->GetBitmap(), nullptr);
-    CLSID tmpClsid = GetEncoderClsid(L"image/png");
-    TempWStr pathW = ToWStrTemp(thumbnailPath);
-    bmp.Save(pathW, &tmpClsid, nullptr);
+    Vec<ThumbnailData> thumbs;
+    GetStoredThumbnails(thumbs);
+    RemoveThumbnailData(thumbs, thumb.entry.pathFingerprint);
+    thumbs.Append(thumb);
+    WriteThumbnailStore(thumbs);
+    free(pixels);
 }
 
 void RemoveThumbnail(FileState* fs) {
-    if (!HasThumbnail(fs)) {
-        return;
-    }
-
-    char* bmpPath = GetThumbnailPathTemp(fs->filePath);
-    if (bmpPath) {
-        file::Delete(bmpPath);
-    }
+    RemoveStoredThumbnail(fs->filePath);
     delete fs->thumbnail;
     fs->thumbnail = nullptr;
 }
@@ -13,5 +13,7 @@ void RemoveThumbnail(FileState* fs);
 
 TempStr GetThumbnailCacheDirTemp();
 char* GetThumbnailPathTemp(const char* filePath);
+TempStr GetTextCachePathTemp(const char* filePath);
 void DeleteThumbnailForFile(const char* path);
+void CleanUpThumbnailStore(const StrVec& filePaths);
 void DeleteThumbnailCacheDirectory();
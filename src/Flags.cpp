@@ -188,9 +188,10 @@ bool IsValidPageRange(const char* ranges) {
 
 // <s> can be:
 // * "loadonly"
+// * "search" (benchmarks searching the text of all pages)
 // * description of page ranges e.g. "1", "1-5", "2-3,6,8-10"
 bool IsBenchPagesInfo(const char* s) {
-    return str::EqI(s, "loadonly") || IsValidPageRange(s);
+    return str::EqI(s, "loadonly") || str::EqI(s, "search") || IsValidPageRange(s);
 }
 
 // -view [continuous][singlepage|facing|bookview]
@@ -515,6 +516,14 @@ void ParseFlags(const WCHAR* cmdLine, Flags& i) {
             i.globalPrefArgs.Append(argName);
             continue;
         }
+        if (arg == Arg::EngineDump) {
+            // -engine-dump has its own set of args, e.g. -bench <dir> or -render <path>
+            i.engineDump = true;
+            for (const char* s = args.EatParam(); s; s = args.EatParam()) {
+                i.engineDumpArgs.Append(s);
+            }
+            return;
+        }
         if (arg == Arg::ArgEnumPrinters && (gIsDebugBuild || gIsPreReleaseBuild)) {
             EnumeratePrinters();
             /* this is for testing only, exit immediately */
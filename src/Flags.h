@@ -87,6 +87,8 @@ struct Flags {
     bool testApp = false;
     char* dde = nullptr;
     bool engineDump = false; // -engine-dump
+    // all args after -engine-dump, they're parsed by EngineDump()
+    StrVec engineDumpArgs;
 
     bool crashOnOpen = false;
 
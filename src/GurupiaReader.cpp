@@ -993,6 +993,50 @@ static DocController* CreateControllerForChm(const char* path, PasswordUI* pwdUI
     return ctrl;
 }
 
+static void EbookLayoutFinished(DisplayModel* dm) {
+    // the document might have been closed in the meantime
+    MainWindow* win = FindMainWindowByController(dm);
+    if (!win) {
+        return;
+    }
+    int nPages = dm->PageCount();
+    EngineBase* engine = dm->GetEngine();
+    engine->UpdatePageCount();
+    if (engine->PageCount() == nPages) {
+        // large PDFs start out with guessed sizes for most pages
+        if (dm->UpdatePageSizes() && win->ctrl == dm) {
+            win->RedrawAll(true);
+        }
+        return;
+    }
+    logf("EbookLayoutFinished: %d => %d pages\n", nPages, engine->PageCount());
+
+    bool isCurrent = win->ctrl == dm;
+    if (isCurrent) {
+        // the search thread uses dm->textSearch
+        AbortFinding(win, true);
+    }
+    dm->ReloadPages();
+    if (!isCurrent) {
+        // the ToC will be re-loaded when the tab is selected
+        return;
+    }
+    // the ToC might have been built before all destinations were known
+    if (win->tocLoaded) {
+        ClearTocBox(win);
+        if (win->tocVisible) {
+            LoadTocTree(win);
+        }
+    }
+    UpdateToolbarPageText(win, dm->PageCount(), true);
+    win->RedrawAll(true);
+}
+
+static void OnEbookLayoutFinished(DisplayModel* dm) {
+    auto fn = MkFunc0<DisplayModel>(EbookLayoutFinished, dm);
+    uitask::Post(fn, "TaskEbookLayoutFinished");
+}
+
 // this allows us to target the right file when processing
 // a sequence of DDE commands. Without this commands target
 // the tab by path and if there's more than one with the same
@@ -1011,7 +1055,7 @@ DocController* CreateControllerForEngineOrFile(EngineBase* engine, const char* p
     bool chmInFixedUI = gGlobalPrefs->chmUI.useFixedPageUI;
     // TODO: sniff file content only once
     if (!engine) {
-        engine = CreateEngineFromFile(path, pwdUI, chmInFixedUI);
+        engine = CreateEngineFromFile(path, pwdUI, chmInFixedUI, true);
     }
     if (!engine) {
         // as a last resort, try to open as chm file
@@ -1027,7 +1071,11 @@ DocController* CreateControllerForEngineOrFile(EngineBase* engine, const char* p
         SafeEngineRelease(&engine);
         return nullptr;
     }
-    DocController* ctrl = new DisplayModel(engine, win->cbHandler);
+    DisplayModel* dm = new DisplayModel(engine, win->cbHandler);
+    // ebooks are layed out in the background and might have more pages,
+    // large PDFs get the real size of most pages in the background
+    engine->SetOnLayoutFinished(MkFunc0<DisplayModel>(OnEbookLayoutFinished, dm));
+    DocController* ctrl = dm;
     ReportIf(!ctrl || !ctrl->AsFixed() || ctrl->AsChm());
     VerifyController(ctrl, path);
     gMostRecentlyOpenedDoc = ctrl;
@@ -3758,7 +3806,7 @@ static Point GetSelectionCenter(MainWindow* win) {
 static Point GetFirstVisiblePageTopLeft(MainWindow* win) {
     DisplayModel* dm = win->AsFixed();
     int page = dm->FirstVisiblePageNo();
-    PageInfo* pageInfo = dm->GetPageInfo(page);
+    PageInfo* pageInfo = dm->GetPageInfoOnScreen(page);
     if (!pageInfo) {
         return {};
     }
@@ -5135,18 +5183,7 @@ static LRESULT FrameOnCommand(MainWindow* win, HWND hwnd, UINT msg, WPARAM wp, L
                         uint codepage = supportedEncodings.at(index);
                         engine->SetEncoding(codepage);
                         // Rebuild page info as page count/content might have changed
-                        free(dm->pagesInfo);
-                        dm->pagesInfo = nullptr;
-                        dm->BuildPagesInfo();
-
-                        delete dm->textSearch;
-                        delete dm->textSelection;
-                        delete dm->textCache;
-                        dm->textCache = new DocumentTextCache(engine);
-                        dm->textSelection = new TextSelection(engine, dm->textCache);
-                        dm->textSearch = new TextSearch(engine, dm->textCache);
-
-                        dm->Relayout(dm->zoomVirtual, dm->rotation);
+                        dm->ReloadPages();
                         win->RedrawAll(true);
                     }
                 }
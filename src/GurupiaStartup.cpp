@@ -1121,9 +1121,11 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
 #endif
 
     if (flags.engineDump) {
-        void EngineDump(const Flags& flags);
-        EngineDump(flags);
-        return 0;
+        int EngineDump(const Flags& flags);
+        RedirectIOToExistingConsole();
+        exitCode = EngineDump(flags);
+        HandleRedirectedConsoleOnShutdown();
+        return exitCode;
     }
 
     if (flags.appdataDir) {
@@ -1141,6 +1143,7 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
 
     DetectExternalViewers();
 
+    InitializeEngineMupdf();
     gRenderCache = new RenderCache();
     if (gUseDarkModeLib) {
         DarkMode::initDarkMode();
@@ -1148,6 +1151,8 @@ int APIENTRY WinMain(HINSTANCE hInstance, HINSTANCE, LPSTR, int) {
     }
     LoadSettings();
     UpdateGlobalPrefs(flags);
+    SetEbookLayoutCacheDir(GetThumbnailCacheDirTemp());
+    gRenderCache->SetMaxCacheSize(gGlobalPrefs->fixedPageUI.renderCacheSize);
     SetCurrentLang(flags.lang ? flags.lang : gGlobalPrefs->uiLanguage);
 
     if (flags.showConsole) {
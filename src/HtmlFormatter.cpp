@@ -12,6 +12,7 @@
 #include "EbookBase.h"
 #include "FzImgReader.h"
 
+#include "StyleSheet.h"
 #include "HtmlFormatter.h"
 
 #include "utils/Log.h"
@@ -110,54 +111,6 @@ DrawInstr DrawInstr::Anchor(const char* s, size_t len, RectF bbox) {
     return di;
 }
 
-// parses size in the form "1em", "3pt" or "15px"
-static void ParseSizeWithUnit(const char* s, size_t len, float* size, StyleRule::Unit* unit) {
-    if (str::Parse(s, len, "%fem", size)) {
-        *unit = StyleRule::em;
-    } else if (str::Parse(s, len, "%fin", size)) {
-        *unit = StyleRule::pt;
-        *size *= 72; // 1 inch is 72 points
-    } else if (str::Parse(s, len, "%fpt", size)) {
-        *unit = StyleRule::pt;
-    } else if (str::Parse(s, len, "%fpx", size)) {
-        *unit = StyleRule::px;
-    } else {
-        *unit = StyleRule::inherit;
-    }
-}
-
-StyleRule StyleRule::Parse(CssPullParser* parser) {
-    StyleRule rule;
-    const CssProperty* prop;
-    while ((prop = parser->NextProperty()) != nullptr) {
-        switch (prop->type) {
-            case Css_Text_Align:
-                rule.textAlign = FindAlignAttr(prop->s, prop->sLen);
-                break;
-            // TODO: some documents use Css_Padding_Left for indentation
-            case Css_Text_Indent:
-                ParseSizeWithUnit(prop->s, prop->sLen, &rule.textIndent, &rule.textIndentUnit);
-                break;
-        }
-    }
-    return rule;
-}
-
-StyleRule StyleRule::Parse(const char* s, size_t len) {
-    CssPullParser parser(s, len);
-    return Parse(&parser);
-}
-
-void StyleRule::Merge(StyleRule& source) {
-    if (source.textAlign != AlignAttr::NotFound) {
-        textAlign = source.textAlign;
-    }
-    if (source.textIndentUnit != StyleRule::inherit) {
-        textIndent = source.textIndent;
-        textIndentUnit = source.textIndentUnit;
-    }
-}
-
 HtmlFormatter::HtmlFormatter(HtmlFormatterArgs* args)
     : pageDx(args->pageDx), pageDy(args->pageDy), textAllocator(args->textAllocator) {
     currReparseIdx = args->reparseIdx;
@@ -165,8 +118,14 @@ HtmlFormatter::HtmlFormatter(HtmlFormatterArgs* args)
     htmlParser->SetCurrPosOff(currReparseIdx);
     ReportIf(!ValidReparseIdx(currReparseIdx, htmlParser));
 
-    gfx = mui::AllocGraphicsForMeasureText();
-    textMeasure = CreateTextRender(args->textRenderMethod, gfx, 10, 10);
+    // TextRenderMupdf measures text without a Graphics (or HDC)
+    if (args->textRenderMethod == mui::TextRenderMethod::Mupdf) {
+        textMeasure = CreateTextRender(args->textRenderMethod, nullptr, 10, 10);
+    }
+    if (!textMeasure) {
+        gfx = mui::AllocGraphicsForMeasureText();
+        textMeasure = CreateTextRender(args->textRenderMethod, gfx, 10, 10);
+    }
     defaultFontName.SetCopy(args->GetFontName());
     defaultFontSize = args->fontSize;
 
@@ -194,7 +153,9 @@ HtmlFormatter::~HtmlFormatter() {
     DeleteVecMembers(pagesToSend);
     delete currPage;
     delete textMeasure;
-    mui::FreeGraphicsForMeasureText(gfx);
+    if (gfx) {
+        mui::FreeGraphicsForMeasureText(gfx);
+    }
     delete htmlParser;
 }
 
@@ -969,44 +930,9 @@ void HtmlFormatter::HandleTagPre(HtmlToken* t) {
     }
 }
 
-StyleRule* HtmlFormatter::FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen) {
-    u32 classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
-    for (size_t i = 0; i < styleRules.size(); i++) {
-        StyleRule& rule = styleRules.at(i);
-        if (tag == rule.tag && classHash == rule.classHash) {
-            return &rule;
-        }
-    }
-    return nullptr;
-}
-
 StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
-    StyleRule rule;
-    // get style rules ordered by specificity
-    StyleRule* prevRule = FindStyleRule(Tag_Body, nullptr, 0);
-    if (prevRule) {
-        rule.Merge(*prevRule);
-    }
-    prevRule = FindStyleRule(Tag_Any, nullptr, 0);
-    if (prevRule) {
-        rule.Merge(*prevRule);
-    }
-    prevRule = FindStyleRule(t->tag, nullptr, 0);
-    if (prevRule) {
-        rule.Merge(*prevRule);
-    }
-    // TODO: support multiple class names
     AttrInfo* attr = t->GetAttrByName("class");
-    if (attr) {
-        prevRule = FindStyleRule(Tag_Any, attr->val, attr->valLen);
-        if (prevRule) {
-            rule.Merge(*prevRule);
-        }
-        prevRule = FindStyleRule(t->tag, attr->val, attr->valLen);
-        if (prevRule) {
-            rule.Merge(*prevRule);
-        }
-    }
+    StyleRule rule = styleSheet.ComputeClassRule(t->tag, attr);
     attr = t->GetAttrByName("style");
     if (attr) {
         StyleRule newRule = StyleRule::Parse(attr->val, attr->valLen);
@@ -1015,27 +941,6 @@ StyleRule HtmlFormatter::ComputeStyleRule(HtmlToken* t) {
     return rule;
 }
 
-void HtmlFormatter::ParseStyleSheet(const char* data, size_t len) {
-    CssPullParser parser(data, len);
-    while (parser.NextRule()) {
-        StyleRule rule = StyleRule::Parse(&parser);
-        const CssSelector* sel;
-        while ((sel = parser.NextSelector()) != nullptr) {
-            if (Tag_NotFound == sel->tag) {
-                continue;
-            }
-            StyleRule* prevRule = FindStyleRule(sel->tag, sel->clazz, sel->clazzLen);
-            if (prevRule) {
-                prevRule->Merge(rule);
-            } else {
-                rule.tag = sel->tag;
-                rule.classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
-                styleRules.Append(rule);
-            }
-        }
-    }
-}
-
 void HtmlFormatter::HandleTagStyle(HtmlToken* t) {
     if (!t->IsStartTag()) {
         return;
@@ -1054,7 +959,7 @@ void HtmlFormatter::HandleTagStyle(HtmlToken* t) {
     }
     const char* end = t->s - 2;
     ReportIf(start > end);
-    ParseStyleSheet(start, end - start);
+    styleSheet.Parse(start, end - start);
     UpdateTagNesting(t);
 }
 
@@ -1415,7 +1320,9 @@ void DrawHtmlPage(Graphics* g, mui::ITextRender* textDraw, Vec<DrawInstr>* drawI
             strLen -= str::RemoveCharsInPlace(buf, L"\xad");
             textDraw->Draw(buf, strLen, ToGdipRectF(bbox), DrawInstrType::RtlString == i.type);
         } else if (DrawInstrType::SetFont == i.type) {
-            textDraw->SetFont(i.font);
+            // the page might have been layed out on another thread, which might still be using i.font
+            mui::CachedFont* font = mui::GetCachedFont(i.font->name, i.font->sizePt, i.font->GetStyle());
+            textDraw->SetFont(font ? font : i.font);
         }
         if (abortCookie && *abortCookie) {
             break;
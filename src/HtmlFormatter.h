@@ -78,26 +78,6 @@ struct DrawInstr {
     static DrawInstr Anchor(const char* s, size_t len, RectF bbox);
 };
 
-class CssPullParser;
-
-struct StyleRule {
-    HtmlTag tag = Tag_NotFound;
-    u32 classHash = 0;
-
-    enum Unit { px, pt, em, inherit };
-
-    float textIndent = 0;
-    Unit textIndentUnit = inherit;
-    AlignAttr textAlign = AlignAttr::NotFound;
-
-    StyleRule() = default;
-
-    void Merge(StyleRule& source);
-
-    static StyleRule Parse(CssPullParser* parser);
-    static StyleRule Parse(const char* s, size_t len);
-};
-
 struct DrawStyle {
     mui::CachedFont* font = nullptr;
     AlignAttr align{AlignAttr::NotFound};
@@ -217,8 +197,6 @@ class HtmlFormatter {
     void SetAlignment(AlignAttr align);
     void RevertStyleChange();
 
-    void ParseStyleSheet(const char* data, size_t len);
-    StyleRule* FindStyleRule(HtmlTag tag, const char* clazz, size_t clazzLen);
     StyleRule ComputeStyleRule(HtmlToken* t);
 
     void AppendInstr(const DrawInstr& di);
@@ -258,7 +236,7 @@ class HtmlFormatter {
     Vec<HtmlTag> tagNesting;
     bool keepTagNesting = false;
     // set from CSS and to be checked by the individual tag handlers
-    Vec<StyleRule> styleRules;
+    StyleSheet styleSheet;
 
     // isntructions for the current line
     Vec<DrawInstr> currLineInstr;
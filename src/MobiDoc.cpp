@@ -11,6 +11,7 @@
 #include "utils/HtmlParserLookup.h"
 #include "utils/HtmlPullParser.h"
 #include "utils/TrivialHtmlParser.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/UIModels.h"
 
@@ -25,6 +26,11 @@
 
 constexpr size_t kInvalidSize = (size_t)-1;
 
+// text records are decompressed by at most this many threads
+constexpr int kMaxDecompressThreads = 8;
+// not worth starting threads for less
+constexpr size_t kMinRecordsPerThread = 64;
+
 // Parse mobi format http://wiki.mobileread.com/wiki/MOBI
 #define COMPRESSION_NONE 1
 #define COMPRESSION_PALM 2
@@ -767,6 +773,23 @@ ByteSlice* MobiDoc::GetImage(size_t imgRecIndex) const {
     return &images[imgRecIndex];
 }
 
+// returns -1 if data isn't the data of one of the images
+int MobiDoc::GetImageId(const u8* data) const {
+    for (size_t i = 0; i < imagesCount; i++) {
+        if (!images[i].empty() && images[i].data() == data) {
+            return (int)i;
+        }
+    }
+    return -1;
+}
+
+ByteSlice* MobiDoc::GetImageById(int id) const {
+    if (id < 0 || (size_t)id >= imagesCount || images[id].empty()) {
+        return nullptr;
+    }
+    return &images[id];
+}
+
 ByteSlice* MobiDoc::GetCoverImage() {
     if (!coverImageRec || coverImageRec < imageFirstRec) {
         return nullptr;
@@ -815,7 +838,7 @@ static size_t GetRealRecordSize(const u8* recData, size_t recLen, size_t trailer
 
 // Load a given record of a document into strOut, uncompressing if necessary.
 // Returns false if error.
-bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut) {
+bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut, HuffDicDecompressor* huff) {
     auto rec = pdbReader->GetRecord(recNo);
     u8* recData = rec.data();
     if (nullptr == recData) {
@@ -837,8 +860,8 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut) {
         }
         return ok;
     }
-    if (COMPRESSION_HUFF == compressionType && huffDic) {
-        bool ok = huffDic->Decompress((u8*)recData, recSize, strOut);
+    if (COMPRESSION_HUFF == compressionType && huff) {
+        bool ok = huff->Decompress((u8*)recData, recSize, strOut);
         if (!ok) {
             logf("HuffDic decompression failed\n");
         }
@@ -856,6 +879,79 @@ bool MobiDoc::LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut) {
     return false;
 }
 
+// loads records [recStart, recEnd) into strOut, returns the number of records that failed to load
+size_t MobiDoc::LoadDocRecords(size_t recStart, size_t recEnd, HuffDicDecompressor* huff, str::Str& strOut) {
+    size_t nFailed = 0;
+    for (size_t i = recStart; i < recEnd; i++) {
+        if (!LoadDocRecordIntoBuffer(i, strOut, huff)) {
+            nFailed++;
+        }
+    }
+    return nFailed;
+}
+
+struct DocRecordsRange {
+    MobiDoc* doc = nullptr;
+    size_t recStart = 0;
+    size_t recEnd = 0;
+    // each thread needs its own because of HuffDicDecompressor::recursionGuard
+    HuffDicDecompressor* huff = nullptr;
+    str::Str text;
+    size_t nFailed = 0;
+};
+
+static void LoadDocRecordsThread(DocRecordsRange* range) {
+    range->nFailed = range->doc->LoadDocRecords(range->recStart, range->recEnd, range->huff, range->text);
+}
+
+// records are compressed independently of each other, so for large documents (e.g. HuffDic
+// compressed dictionaries, which are slow to decompress) we split them into consecutive
+// ranges which are decompressed in parallel and then appended to doc in order.
+// returns the number of records that failed to load
+size_t MobiDoc::LoadAllDocRecords() {
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nThreads = limitValue((int)si.dwNumberOfProcessors, 1, kMaxDecompressThreads);
+    nThreads = std::min(nThreads, (int)(docRecCount / kMinRecordsPerThread));
+    if (nThreads < 2) {
+        return LoadDocRecords(1, docRecCount + 1, huffDic, *doc);
+    }
+
+    DocRecordsRange ranges[kMaxDecompressThreads];
+    HANDLE threads[kMaxDecompressThreads] = {};
+    for (int i = 0; i < nThreads; i++) {
+        DocRecordsRange& range = ranges[i];
+        range.doc = this;
+        range.recStart = 1 + docRecCount * i / nThreads;
+        range.recEnd = 1 + docRecCount * (i + 1) / nThreads;
+        if (i == 0) {
+            // the first range is loaded on this thread, directly into doc
+            continue;
+        }
+        if (huffDic) {
+            range.huff = new HuffDicDecompressor(*huffDic);
+        }
+        auto fn = MkFunc0<DocRecordsRange>(LoadDocRecordsThread, &range);
+        threads[i] = StartThread(fn, "MobiDocRecordsThread");
+    }
+
+    size_t nFailed = LoadDocRecords(ranges[0].recStart, ranges[0].recEnd, huffDic, *doc);
+    for (int i = 1; i < nThreads; i++) {
+        DocRecordsRange& range = ranges[i];
+        if (threads[i]) {
+            WaitForSingleObject(threads[i], INFINITE);
+            CloseHandle(threads[i]);
+        } else {
+            LoadDocRecordsThread(&range);
+        }
+        nFailed += range.nFailed;
+        doc->Append(range.text.Get(), range.text.size());
+        range.text.Reset();
+        delete range.huff;
+    }
+    return nFailed;
+}
+
 bool MobiDoc::LoadForPdbReader(PdbReader* pdbReader) {
     this->pdbReader = pdbReader;
     if (!ParseHeader()) {
@@ -864,12 +960,7 @@ bool MobiDoc::LoadForPdbReader(PdbReader* pdbReader) {
 
     ReportIf(doc != nullptr);
     doc = new str::Str(docUncompressedSize);
-    size_t nFailed = 0;
-    for (size_t i = 1; i <= docRecCount; i++) {
-        if (!LoadDocRecordIntoBuffer(i, *doc)) {
-            nFailed++;
-        }
-    }
+    size_t nFailed = LoadAllDocRecords();
 
     // TODO: this is a heuristic for https://github.com/GurupiaReaderreader/GurupiaReader/issues/1314
     // It has 29 records that fail to decompress because infinite recursion
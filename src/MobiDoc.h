@@ -30,7 +30,9 @@ struct MobiDoc {
     explicit MobiDoc(const char* filePath);
 
     bool ParseHeader();
-    bool LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut);
+    bool LoadDocRecordIntoBuffer(size_t recNo, str::Str& strOut, HuffDicDecompressor* huff);
+    size_t LoadDocRecords(size_t recStart, size_t recEnd, HuffDicDecompressor* huff, str::Str& strOut);
+    size_t LoadAllDocRecords();
     void LoadImages();
     bool LoadImage(size_t imageNo);
     bool LoadForPdbReader(PdbReader* pdbReader);
@@ -46,6 +48,8 @@ struct MobiDoc {
     ByteSlice GetHtmlData() const;
     ByteSlice* GetCoverImage();
     ByteSlice* GetImage(size_t imgRecIndex) const;
+    int GetImageId(const u8* data) const;
+    ByteSlice* GetImageById(int id) const;
     const char* GetFileName() const {
         return fileName;
     }
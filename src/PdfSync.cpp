@@ -3,9 +3,11 @@
 
 #include "utils/BaseUtil.h"
 #include <synctex_parser.h>
+#include <zlib.h>
 #include "utils/WinUtil.h"
 #include "utils/FileUtil.h"
-#include "utils/ZipUtil.h"
+#include "utils/ThreadUtil.h"
+#include "utils/Timer.h"
 
 #include "wingui/UIModels.h"
 
@@ -62,27 +64,44 @@ class Pdfsync : public Synchronizer {
     Vec<size_t> sheetIndex;          // start of entries for a sheet in <points>
 };
 
+// index of a .synctex file being built on a background thread. The parser
+// can't be interrupted, so the thread might outlive the SyncTex that started it
+// and whichever of them releases the last reference deletes it
+struct SyncTexIndexBuild {
+    AtomicRefCount refCount;
+    AutoFreeStr syncFilePath;
+    synctex_scanner_p scanner = nullptr;
+    // signaled once the thread no longer touches scanner
+    HANDLE done = nullptr;
+
+    explicit SyncTexIndexBuild(const char* path);
+    ~SyncTexIndexBuild();
+    void Release();
+};
+
 // Synchronizer based on .synctex file generated with SyncTex
+// The index is built in the background when the synchronizer is created
+// (which happens again whenever the document is reloaded, i.e. after every
+// recompilation) so that the first forward or inverse search doesn't have to wait for it
 class SyncTex : public Synchronizer {
   public:
-    SyncTex(const char* syncfilename, EngineBase* engineIn) : Synchronizer(syncfilename) {
-        engine = engineIn;
-        scanner = nullptr;
-        ReportIf(!str::EndsWithI(syncfilename, ".synctex"));
-    }
-
-    ~SyncTex() override {
-        synctex_scanner_free(scanner);
-    }
+    SyncTex(const char* syncfilename, EngineBase* engineIn);
+    ~SyncTex() override;
 
     int DocToSource(int pageNo, Point pt, AutoFreeStr& filename, int* line, int* col) override;
     int SourceToDoc(const char* srcfilename, int line, int col, int* page, Vec<Rect>& rects) override;
 
   private:
+    void WaitForIndexBuild();
     int RebuildIndexIfNeeded();
 
     EngineBase* engine; // needed for converting between coordinate systems
-    synctex_scanner_p scanner;
+
+    // protects scanner and indexBuild
+    CRITICAL_SECTION access;
+    synctex_scanner_p scanner = nullptr;
+    // until the index built in the background has been taken over
+    SyncTexIndexBuild* indexBuild = nullptr;
 };
 
 Synchronizer::Synchronizer(const char* syncFilePathIn) {
@@ -493,93 +512,118 @@ int Pdfsync::SourceToDoc(const char* srcfilename, int line, int col, int* page,
     return PDFSYNCERR_NOSYNCPOINT_FOR_LINERECORD;
 }
 
-// returns path of ungzipped file
-TempStr ungzipToFile(char* path) {
-    // to see if we can read when gzopen in synctex_scanner_new_with_output_file cannot
-    ByteSlice compr = file::ReadFile(path);
-    if (compr.IsEmpty()) {
-        logf("ungzip: file::ReadFile() '%s' failed\n", path);
-        return nullptr;
-    }
-    logf("ungzip: file::ReadFile() did read '%s'\n", path);
-    ByteSlice uncompr = Ungzip(compr);
-    compr.Free();
-    if (uncompr.IsEmpty()) {
+// SYNCTEX synchronizer
+
+// synctex_parser.c opens the .synctex or .synctex.gz file through this so that
+// UTF-8 paths work. zlib reads both uncompressed and compressed files, so
+// a .synctex.gz file is inflated as it's parsed
+extern "C" gzFile _synctex_gzopen(const char* path, const char* mode) {
+    TempWStr pathW = ToWStrTemp(path);
+    gzFile res = pathW ? gzopen_w(pathW, mode) : gzopen(path, mode);
+    if (res) {
+        // the default buffer of 8 kB means a lot of small reads for large files
+        gzbuffer(res, 256 * 1024);
+    }
+    return res;
+}
+
+// parses the whole sync file up front, so that queries only have to look up
+// the pages and source lines in the scanner's in-memory index
+static synctex_scanner_p NewSyncTexScanner(const char* syncFilePath) {
+    auto timeStart = TimeGet();
+    synctex_scanner_p res = synctex_scanner_new_with_output_file(syncFilePath, nullptr, 1);
+    if (!res) {
+        logfa("NewSyncTexScanner: synctex_scanner_new_with_output_file() failed for '%s'\n", syncFilePath);
         return nullptr;
     }
-    TempStr destPath = str::JoinTemp(path, ".sum.synctex");
-    bool ok = file::WriteFile(destPath, uncompr);
-    uncompr.Free();
-    if (!ok) {
-        return nullptr;
+    logfa("NewSyncTexScanner: parsed '%s' in %.2f ms\n", syncFilePath, TimeSinceInMs(timeStart));
+    return res;
+}
+
+SyncTexIndexBuild::SyncTexIndexBuild(const char* path) {
+    syncFilePath.SetCopy(path);
+    done = CreateEventW(nullptr, TRUE, FALSE, nullptr);
+}
+
+SyncTexIndexBuild::~SyncTexIndexBuild() {
+    synctex_scanner_free(scanner);
+    SafeCloseHandle(&done);
+}
+
+void SyncTexIndexBuild::Release() {
+    if (refCount.Dec() == 0) {
+        delete this;
     }
-    return destPath;
 }
 
-// SYNCTEX synchronizer
+static void SyncTexIndexBuildThread(SyncTexIndexBuild* build) {
+    build->scanner = NewSyncTexScanner(build->syncFilePath);
+    SetEvent(build->done);
+    build->Release();
+}
 
-int SyncTex::RebuildIndexIfNeeded() {
-    if (!NeedsToRebuildIndex()) {
-        logfa("SyncTex::RebuildIndexIfNeeded: no need to rebuild\n");
-        return PDFSYNCERR_SUCCESS;
+SyncTex::SyncTex(const char* syncfilename, EngineBase* engineIn) : Synchronizer(syncfilename) {
+    engine = engineIn;
+    ReportIf(!str::EndsWithI(syncfilename, ".synctex"));
+    InitializeCriticalSection(&access);
+
+    indexBuild = new SyncTexIndexBuild(syncfilename);
+    // the reference held by the thread
+    indexBuild->refCount.Add();
+    auto fn = MkFunc0<SyncTexIndexBuild>(SyncTexIndexBuildThread, indexBuild);
+    HANDLE thread = StartThread(fn, "SyncTexIndexThread");
+    if (!thread) {
+        // RebuildIndexIfNeeded() builds the index when it's needed
+        SetEvent(indexBuild->done);
+        indexBuild->Release();
+    }
+    SafeCloseHandle(&thread);
+}
+
+SyncTex::~SyncTex() {
+    // doesn't wait for the thread still building the index, which deletes it when done
+    if (indexBuild) {
+        indexBuild->Release();
     }
     synctex_scanner_free(scanner);
-    scanner = nullptr;
-    i64 fsize;
-    TempStr pathNoExt;
-    TempStr pathSyncGz;
-    bool didRepeat = false;
-
-    TempStr syncPathTemp = str::DupTemp(syncFilePath.Get());
-Repeat:
-    TempWStr ws = ToWStrTemp(syncPathTemp);
-    AutoFreeStr pathAnsi = strconv::WStrToAnsi(ws);
-    scanner = synctex_scanner_new_with_output_file(pathAnsi, nullptr, 1);
-    if (scanner) {
-        logfa("synctex_scanner_new_with_output_file: ok for pathAnsi '%s'\n", pathAnsi.Get());
-        goto Exit;
-    }
-    if (!str::Eq(syncPathTemp, pathAnsi)) {
-        logfa("synctex_scanner_new_with_output_file: retrying for syncFilePath '%s'\n", syncPathTemp);
-        scanner = synctex_scanner_new_with_output_file(syncPathTemp, nullptr, 1);
+    DeleteCriticalSection(&access);
+}
+
+// takes over the index built in the background, once it's ready
+// must be called while holding access
+void SyncTex::WaitForIndexBuild() {
+    if (!indexBuild) {
+        return;
     }
+    WaitForSingleObject(indexBuild->done, INFINITE);
+    scanner = indexBuild->scanner;
+    indexBuild->scanner = nullptr;
     if (scanner) {
-        logfa("synctex_scanner_new_with_output_file: ok forsyncFilePath '%s'\n", syncPathTemp);
-        goto Exit;
-    }
-    if (didRepeat) {
-        logfa("synctex_scanner_new_with_output_file: failed for '%s'\n", pathAnsi.Get());
-        return PDFSYNCERR_SYNCFILE_NOTFOUND;
+        MarkIndexWasRebuilt();
     }
+    indexBuild->Release();
+    indexBuild = nullptr;
+}
 
-    // Note: https://github.com/GurupiaReaderreader/GurupiaReader/discussions/2640#discussioncomment-2861368
-    // reported failure to parse a large (12 MB) .synctex.gz even though file exists
-    pathNoExt = path::GetPathNoExtTemp(syncFilePath);
-    pathSyncGz = str::JoinTemp(pathNoExt, ".synctex.gz");
-    if (!file::Exists(pathSyncGz)) {
-        logfa("synctex_scanner_new_with_output_file: failed for '%s'\n", pathAnsi.Get());
-        return PDFSYNCERR_SYNCFILE_NOTFOUND;
+// must be called while holding access
+int SyncTex::RebuildIndexIfNeeded() {
+    WaitForIndexBuild();
+    if (scanner && !NeedsToRebuildIndex()) {
+        return PDFSYNCERR_SUCCESS;
     }
-    fsize = file::GetSize(pathSyncGz);
-    logf("SyncTex::RebuildIndexIfNeeded: trying to uncompress %s, size: %d\n", pathSyncGz, (int)fsize);
-
-    syncPathTemp = ungzipToFile(pathSyncGz);
-    if (!syncPathTemp) {
-        logfa("SyncTex::RebuildIndexIfNeeded: ungzipToFile('%s') failecd\n", pathSyncGz);
-        goto Exit;
+    // the build in the background failed (e.g. because the file was
+    // being written at the time) or the file has changed since
+    synctex_scanner_free(scanner);
+    scanner = NewSyncTexScanner(syncFilePath);
+    if (!scanner) {
+        return PDFSYNCERR_SYNCFILE_NOTFOUND;
     }
-    fsize = file::GetSize(syncPathTemp);
-    logfa("SyncTex::RebuildIndexIfNeeded: retrying with uncompressed version '%s' of size %d\n", syncPathTemp, fsize);
-
-    didRepeat = true;
-    goto Repeat;
-
-Exit:
     return MarkIndexWasRebuilt();
 }
 
 int SyncTex::DocToSource(int pageNo, Point pt, AutoFreeStr& filename, int* line, int* col) {
     logfa("SyncTex::DocToSource: '%s', pageNo: %d\n", syncFilePath.Get(), pageNo);
+    ScopedCritSec scope(&access);
     int res = RebuildIndexIfNeeded();
     if (res != PDFSYNCERR_SUCCESS) {
         ReportDebugIf(true);
@@ -635,6 +679,7 @@ TryAgainAnsi:
 
 int SyncTex::SourceToDoc(const char* srcfilename, int line, int col, int* page, Vec<Rect>& rects) {
     logfa("SyncTex::SourceToDoc: '%s', line: %d, col: %d\n", srcfilename, line, col);
+    ScopedCritSec scope(&access);
     int res = RebuildIndexIfNeeded();
     if (res != PDFSYNCERR_SUCCESS) {
         ReportIf(true);
@@ -5,6 +5,7 @@
 #include "utils/ScopedWin.h"
 #include "utils/WinUtil.h"
 #include "utils/Timer.h"
+#include "utils/ThreadUtil.h"
 
 #include "wingui/UIModels.h"
 
@@ -49,19 +50,37 @@ RenderCache::RenderCache() : maxTileSize({GetSystemMetrics(SM_CXSCREEN), GetSyst
     InitializeCriticalSection(&requestAccess);
 
     startRendering = CreateEvent(nullptr, FALSE, FALSE, nullptr);
-    renderThread = CreateThread(nullptr, 0, RenderCacheThread, this, 0, nullptr);
-    ReportIf(nullptr == renderThread);
+
+    // leave one core for the UI thread
+    SYSTEM_INFO si;
+    GetSystemInfo(&si);
+    int nThreads = limitValue((int)si.dwNumberOfProcessors - 1, 1, MAX_RENDER_THREADS);
+    for (int i = 0; i < nThreads; i++) {
+        RenderCacheWorker* w = &workers[i];
+        w->cache = this;
+        w->thread = CreateThread(nullptr, 0, RenderCacheThread, w, 0, nullptr);
+        ReportIf(nullptr == w->thread);
+        if (!w->thread) {
+            break;
+        }
+        workersCount++;
+    }
+    logf("RenderCache: using %d rendering threads\n", workersCount);
 }
 
 RenderCache::~RenderCache() {
     EnterCriticalSection(&requestAccess);
     EnterCriticalSection(&cacheAccess);
 
-    CloseHandle(renderThread);
+    bool isRendering = false;
+    for (int i = 0; i < workersCount; i++) {
+        isRendering |= (workers[i].curReq != nullptr);
+        CloseHandle(workers[i].thread);
+    }
     CloseHandle(startRendering);
-    if (curReq || 0 != requestCount || cacheCount != 0) {
-        logvf("RenderCache::~RenderCache: curReq: 0x%p, requestCount: %d, cacheCount: %d\n", curReq, requestCount,
-              cacheCount);
+    if (isRendering || 0 != requestCount || cacheCount != 0) {
+        logvf("RenderCache::~RenderCache: isRendering: %d, requestCount: %d, cacheCount: %d\n", (int)isRendering,
+              requestCount, cacheCount);
         ReportIf(true);
     }
 
@@ -119,6 +138,8 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
     logvf("RenderCache::DropCacheEntry: dm: 0x%p, pageNo: %d, rotation: %d, zoom: %.2f\n", entry->dm, entry->pageNo,
           entry->rotation, entry->zoom);
 
+    cacheBytes -= entry->byteSize;
+    ReportIf(cacheBytes < 0);
     delete entry;
 
     // fast removal by replacing freed item with the item at the end
@@ -136,40 +157,79 @@ bool RenderCache::DropCacheEntry(BitmapCacheEntry* entry) {
     return true;
 }
 
-static bool FreeIfFull(RenderCache* rc, const PageRenderRequest& req) {
-    int n = rc->cacheCount;
-    if (n < MAX_BITMAPS_CACHED) {
-        return true;
+// the higher the score, the less likely it is that the bitmap
+// will be painted again soon
+static float EvictionScore(BitmapCacheEntry* e, DisplayModel* dm, DWORD now) {
+    DisplayModel* edm = e->dm;
+    float score = 0;
+
+    // distance (in pages) from the visible part of the document
+    if (!edm->PageVisible(e->pageNo)) {
+        int dist = std::abs(e->pageNo - edm->CurrentPageNo());
+        score += 10.f * (float)std::min(dist, 50);
+        if (!edm->PageVisibleNearby(e->pageNo)) {
+            score += 100.f;
+        }
     }
 
-    DisplayModel* dm = req.dm;
-    // free an invisible page of the same DisplayModel ...
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        if (entry->dm == dm && !dm->PageVisibleNearby(entry->pageNo)) {
-            bool didDrop = rc->DropCacheEntry(entry);
-            if (didDrop) {
-                return true;
-            }
-        }
+    // bitmaps rendered at a different zoom or rotation are only
+    // used as a replacement until a bitmap at the right zoom is ready
+    bool isStale = e->outOfDate || e->zoom != edm->GetZoomReal(e->pageNo) ||
+                   e->rotation != NormalizeRotation(edm->GetRotation());
+    if (isStale) {
+        score += 200.f;
     }
 
-    // ... or just the oldest cached page
-    for (int i = 0; i < n; i++) {
-        auto entry = rc->cache[i];
-        if (entry->dm == dm) {
-            // don't free pages from the document we're currently displaying
-            // as it leads to flicker
-            // TODO: it can still flicker if the dm is from a visible tab
-            // in a different window, but it's harder to detect
-            continue;
+    // don't free pages from the document we're currently displaying
+    // as it leads to flicker
+    // TODO: it can still flicker if the dm is from a visible tab
+    // in a different window, but it's harder to detect
+    if (edm != dm) {
+        score += 50.f;
+    }
+
+    // age (in seconds) since the bitmap was last painted
+    DWORD ageSecs = (now - e->lastUsed) / 1000;
+    score += (float)std::min(ageSecs, (DWORD)600) / 10.f;
+
+    // with otherwise equal scores, prefer to free the bigger bitmap
+    score += (float)(e->byteSize / (4 * 1024 * 1024)) / 10.f;
+    return score;
+}
+
+// make room for a bitmap of bytesNeeded size by dropping the bitmaps
+// that are least likely to be painted again soon
+// returns false if there's no space for another bitmap
+bool RenderCache::FreeForSize(DisplayModel* dm, i64 bytesNeeded) {
+    ScopedCritSec scope(&cacheAccess);
+    DWORD now = GetTickCount();
+    while (cacheCount >= MAX_BITMAPS_CACHED || (cacheCount > 0 && cacheBytes + bytesNeeded > maxCacheBytes)) {
+        BitmapCacheEntry* toFree = nullptr;
+        float maxScore = -1.f;
+        for (int i = 0; i < cacheCount; i++) {
+            BitmapCacheEntry* e = cache[i];
+            if (e->refs > 1) {
+                // currently being painted
+                continue;
+            }
+            float score = EvictionScore(e, dm, now);
+            if (score > maxScore) {
+                maxScore = score;
+                toFree = e;
+            }
         }
-        bool didDrop = rc->DropCacheEntry(entry);
-        if (didDrop) {
-            return true;
+        if (!toFree) {
+            break;
         }
+        logvf("RenderCache::FreeForSize: evicting pageNo: %d, score: %.2f\n", toFree->pageNo, maxScore);
+        DropCacheEntry(toFree);
+        cacheEvictions++;
     }
-    return false;
+    if (cacheBytes + bytesNeeded > maxCacheBytes) {
+        // it's better to go over the budget than to not show visible pages
+        logvf("RenderCache::FreeForSize: over budget by %d KB\n", (int)((cacheBytes + bytesNeeded - maxCacheBytes) / 1024));
+    }
+    return cacheCount < MAX_BITMAPS_CACHED;
 }
 
 void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
@@ -179,22 +239,63 @@ void RenderCache::Add(PageRenderRequest& req, RenderedBitmap* bmp) {
     req.rotation = NormalizeRotation(req.rotation);
     ReportIf(cacheCount > MAX_BITMAPS_CACHED);
 
-    /* It's possible there still is a cached bitmap with different zoom/rotation */
-    FreePage(req.dm, req.pageNo, &req.tile);
+    if (req.isPreview) {
+        // a better bitmap might have been rendered in the meantime
+        BitmapCacheEntry* existing = Find(req.dm, req.pageNo, req.rotation);
+        if (existing) {
+            DropCacheEntry(existing);
+            delete bmp;
+            return;
+        }
+    } else {
+        /* It's possible there still is a cached bitmap with different zoom/rotation */
+        FreePage(req.dm, req.pageNo, &req.tile);
+    }
 
-    bool hasSpace = FreeIfFull(this, req);
-    ReportIf(!hasSpace); // TODO: FreeIfFull() might actually fail to free
-    ReportIf(cacheCount > MAX_BITMAPS_CACHED);
+    bool hasSpace = FreeForSize(req.dm, BlittableBitmapByteSize(bmp));
+    if (!hasSpace) {
+        // all cached bitmaps are currently being painted
+        logvf("RenderCache::Add: no space for pageNo: %d\n", req.pageNo);
+        delete bmp;
+        return;
+    }
 
     // Copy the PageRenderRequest as it will be reused
     auto entry = new BitmapCacheEntry(req.dm, req.pageNo, req.rotation, req.zoom, req.tile, bmp);
+    entry->isPreview = req.isPreview;
     entry->cacheIdx = cacheCount;
     cache[cacheCount] = entry;
     cacheCount++;
+    cacheBytes += entry->byteSize;
 
     // LogCacheSize();
 }
 
+void RenderCache::SetMaxCacheSize(int sizeMB) {
+    i64 size = (i64)sizeMB * 1024 * 1024;
+    if (size <= 0) {
+        // use 1/8th of physical memory
+        MEMORYSTATUSEX ms{};
+        ms.dwLength = sizeof(ms);
+        if (GlobalMemoryStatusEx(&ms)) {
+            size = (i64)(ms.ullTotalPhys / 8);
+        }
+        size = std::clamp(size, kRenderCacheMinBytes, kRenderCacheMaxBytes);
+        if (!IsProcess64()) {
+            // 32-bit processes are limited by address space
+            size = kRenderCacheMinBytes;
+        }
+    }
+
+    ScopedCritSec scope(&cacheAccess);
+    if (size == maxCacheBytes) {
+        return;
+    }
+    logf("RenderCache::SetMaxCacheSize: %d MB\n", (int)(size / (1024 * 1024)));
+    maxCacheBytes = size;
+    FreeForSize(nullptr, 0);
+}
+
 static RectF GetTileRect(RectF pagerect, TilePosition tile) {
     ReportIf(tile.res > 30);
     RectF rect;
@@ -238,7 +339,11 @@ static bool IsTileVisible(DisplayModel* dm, int pageNo, TilePosition tile, float
     }
     int rotation = dm->GetRotation();
     float zoom = dm->GetZoomReal(pageNo);
-    Rect r = pageInfo->pageOnScreen;
+    // this is also called from the rendering threads, so it can't use
+    // pageOnScreen (which is updated lazily for pages that aren't visible)
+    Rect viewPort = dm->GetViewPort();
+    Rect r = pageInfo->pos;
+    r.Offset(-viewPort.x, -viewPort.y);
     Rect tileOnScreen = GetTileOnScreen(engine, pageNo, rotation, zoom, tile, r);
     // consider nearby tiles visible depending on the fuzz factor
     tileOnScreen.x -= (int)(tileOnScreen.dx * fuzz * 0.5);
@@ -265,10 +370,11 @@ void RenderCache::FreePage(DisplayModel* dm, int pageNo, TilePosition* tile) {
         bool shouldFree = (entry->dm == dm) && (entry->pageNo == pageNo);
         if (shouldFree && tile) {
             // a given tile of the page or all tiles not rendered at a given resolution
-            // (and at resolution 0 for quick zoom previews)
+            // (and at resolution 0 for quick zoom previews and low quality previews)
+            bool isTemporary = entry->outOfDate || entry->isPreview;
             shouldFree = (entry->tile == *tile ||
                           tile->row == (USHORT)-1 && entry->tile.res > 0 && entry->tile.res != tile->res ||
-                          tile->row == (USHORT)-1 && entry->tile.res == 0 && entry->outOfDate);
+                          tile->row == (USHORT)-1 && entry->tile.res == 0 && isTemporary);
         }
         if (shouldFree) {
             DropCacheEntry(entry);
@@ -328,9 +434,7 @@ void RenderCache::Invalidate(DisplayModel* dm, int pageNo, RectF rect) {
     ScopedCritSec scopeReq(&requestAccess);
 
     ClearQueueForDisplayModel(dm, pageNo);
-    if (curReq && curReq->dm == dm && curReq->pageNo == pageNo) {
-        AbortCurrentRequest();
-    }
+    AbortCurrentRequests(dm, pageNo);
 
     ScopedCritSec scopeCache(&cacheAccess);
 
@@ -413,7 +517,7 @@ bool RenderCache::ReduceTileSize() {
     while (requestCount > 0) {
         ClearQueueForDisplayModel(requests[0].dm);
     }
-    AbortCurrentRequest();
+    AbortCurrentRequests();
 
     return true;
 }
@@ -447,14 +551,18 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
     int rotation = NormalizeRotation(dm->GetRotation());
     float zoom = dm->GetZoomReal(pageNo);
 
-    if (curReq && (curReq->pageNo == pageNo) && (curReq->dm == dm) && (curReq->tile == tile)) {
+    PageRenderRequest* curReq = FindCurrentRequest(dm, pageNo, &tile);
+    if (curReq) {
         if ((curReq->zoom == zoom) && (curReq->rotation == rotation)) {
             /* we're already rendering exactly the same page */
             return;
         }
         /* Currently rendered page is for the same page but with different zoom
         or rotation, so abort it */
-        AbortCurrentRequest();
+        if (curReq->abortCookie) {
+            curReq->abortCookie->Abort();
+        }
+        curReq->abort = true;
     }
 
     // clear requests for tiles of different resolution and invisible tiles
@@ -464,6 +572,9 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
 
     for (int i = 0; i < requestCount; i++) {
         PageRenderRequest* req = &(requests[i]);
+        if (req->isPreview) {
+            continue;
+        }
         if ((req->pageNo == pageNo) && (req->dm == dm) && (req->tile == tile)) {
             if ((req->zoom == zoom) && (req->rotation == rotation)) {
                 /* Request with exactly the same parameters already queued for
@@ -492,6 +603,62 @@ void RenderCache::RequestRendering(DisplayModel* dm, int pageNo, TilePosition ti
     Render(dm, pageNo, rotation, zoom, &tile);
 }
 
+// adjusts the size of previews so that rendering them takes about PREVIEW_BUDGET_MS
+// (rendering time is mostly proportional to the number of pixels)
+void RenderCache::UpdatePreviewSize(Size size, double durMs) {
+    float pixels = (float)size.dx * (float)size.dy;
+    if (pixels <= 0 || durMs <= 0) {
+        return;
+    }
+    float fitting = pixels * (float)(PREVIEW_BUDGET_MS / durMs);
+    ScopedCritSec scope(&requestAccess);
+    // move halfway towards the size that fits the budget to smooth out outliers
+    float newPixels = (previewPixels + fitting) / 2;
+    previewPixels = limitValue(newPixels, (float)MIN_PREVIEW_PIXELS, (float)MAX_PREVIEW_PIXELS);
+    if (durMs > 2 * PREVIEW_BUDGET_MS) {
+        logvf("RenderCache: preview of %dx%d took %.2f ms, reducing previews to %d pixels\n", size.dx, size.dy,
+              (float)durMs, (int)previewPixels);
+    }
+}
+
+// quickly render a low resolution, low quality version of the whole page
+// to be shown (scaled up) until the tiles at the right resolution are ready
+void RenderCache::RequestPreview(DisplayModel* dm, int pageNo) {
+    ScopedCritSec scope(&requestAccess);
+    if (!dm || dm->pauseRendering || IsRenderQueueFull()) {
+        return;
+    }
+
+    // only if there's nothing at all to show for this page
+    for (int i = 0; i < requestCount; i++) {
+        PageRenderRequest* req = &(requests[i]);
+        if (req->isPreview && req->dm == dm && req->pageNo == pageNo) {
+            return;
+        }
+    }
+    for (int i = 0; i < workersCount; i++) {
+        PageRenderRequest* req = workers[i].curReq;
+        if (req && req->isPreview && req->dm == dm && req->pageNo == pageNo) {
+            return;
+        }
+    }
+    int rotation = NormalizeRotation(dm->GetRotation());
+    if (Exists(dm, pageNo, rotation)) {
+        return;
+    }
+
+    float zoom = dm->GetZoomReal(pageNo);
+    EngineBase* engine = dm->GetEngine();
+    RectF pixelbox = engine->Transform(engine->PageMediabox(pageNo), pageNo, zoom, rotation);
+    float pixels = pixelbox.dx * pixelbox.dy;
+    if (pixels <= 0) {
+        return;
+    }
+    float scale = std::min(sqrtf(previewPixels / pixels), 0.5f);
+    TilePosition tile(0, 0, 0);
+    Render(dm, pageNo, rotation, zoom * scale, &tile, nullptr, nullptr, true);
+}
+
 void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, RectF pageRect,
                          const OnBitmapRendered& callback) {
     bool ok = Render(dm, pageNo, rotation, zoom, nullptr, &pageRect, &callback);
@@ -501,7 +668,7 @@ void RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 }
 
 bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile, RectF* pageRect,
-                         const OnBitmapRendered* renderCb) {
+                         const OnBitmapRendered* renderCb, bool isPreview) {
     logvf("RenderCache::Render: pageNo %d\n", pageNo);
     ReportIf(!dm);
     if (!dm || dm->pauseRendering) {
@@ -544,6 +711,7 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
     } else {
         CrashMe();
     }
+    newRequest->isPreview = isPreview;
     newRequest->abort = false;
     newRequest->abortCookie = nullptr;
     newRequest->timestamp = GetTickCount();
@@ -557,20 +725,46 @@ bool RenderCache::Render(DisplayModel* dm, int pageNo, int rotation, float zoom,
 int RenderCache::GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile) {
     ScopedCritSec scope(&requestAccess);
 
-    if (curReq && curReq->pageNo == pageNo && curReq->dm == dm && curReq->tile == tile) {
+    PageRenderRequest* curReq = FindCurrentRequest(dm, pageNo, &tile);
+    if (curReq) {
         return GetTickCount() - curReq->timestamp;
     }
 
     for (int i = 0; i < requestCount; i++) {
-        if (requests[i].pageNo == pageNo && requests[i].dm == dm && requests[i].tile == tile) {
-            return GetTickCount() - requests[i].timestamp;
+        PageRenderRequest* req = &(requests[i]);
+        if (!req->isPreview && req->pageNo == pageNo && req->dm == dm && req->tile == tile) {
+            return GetTickCount() - req->timestamp;
         }
     }
 
     return RENDER_DELAY_UNDEFINED;
 }
 
-bool RenderCache::GetNextRequest(PageRenderRequest* req) {
+// lower value means the request should be rendered sooner
+static int GetRequestPriority(PageRenderRequest* req) {
+    DisplayModel* dm = req->dm;
+    if (req->isPreview) {
+        return 0;
+    }
+    if (!req->renderCb && IsTileVisible(dm, req->pageNo, req->tile)) {
+        return 1;
+    }
+    if (req->renderCb) {
+        // explicitly requested (e.g. thumbnails)
+        return 2;
+    }
+    // pre-rendered pages: the closer to the current page the better
+    // and pages in the direction we're scrolling to come first
+    int dist = req->pageNo - dm->CurrentPageNo();
+    bool isAhead = (dist > 0 && dm->scrollDirection > 0) || (dist < 0 && dm->scrollDirection < 0);
+    int prio = 3 + 2 * std::abs(dist);
+    if (!isAhead) {
+        prio++;
+    }
+    return prio;
+}
+
+bool RenderCache::GetNextRequest(RenderCacheWorker* worker, PageRenderRequest* req) {
     ScopedCritSec scope(&requestAccess);
 
     if (requestCount == 0) {
@@ -579,26 +773,56 @@ bool RenderCache::GetNextRequest(PageRenderRequest* req) {
 
     ReportIf(requestCount < 0);
     ReportIf(requestCount > MAX_PAGE_REQUESTS);
+
+    // pick the most important request, the most recent one if there are several
+    int idx = requestCount - 1;
+    int bestPrio = GetRequestPriority(&requests[idx]);
+    for (int i = requestCount - 2; i >= 0 && bestPrio > 0; i--) {
+        int prio = GetRequestPriority(&requests[i]);
+        if (prio < bestPrio) {
+            bestPrio = prio;
+            idx = i;
+        }
+    }
+
+    *req = requests[idx];
     requestCount--;
-    *req = requests[requestCount];
-    curReq = req;
+    if (idx < requestCount) {
+        memmove(&(requests[idx]), &(requests[idx + 1]), sizeof(PageRenderRequest) * (requestCount - idx));
+    }
+    worker->curReq = req;
     ReportIf(requestCount < 0);
     ReportIf(req->abort);
 
+    // let another thread pick up the remaining requests
+    if (requestCount > 0) {
+        SetEvent(startRendering);
+    }
     return true;
 }
 
-bool RenderCache::ClearCurrentRequest() {
+bool RenderCache::ClearCurrentRequest(RenderCacheWorker* worker) {
     ScopedCritSec scope(&requestAccess);
-    if (curReq) {
-        delete curReq->abortCookie;
+    if (worker->curReq) {
+        delete worker->curReq->abortCookie;
     }
-    curReq = nullptr;
+    worker->curReq = nullptr;
 
     bool isQueueEmpty = requestCount == 0;
     return isQueueEmpty;
 }
 
+PageRenderRequest* RenderCache::FindCurrentRequest(DisplayModel* dm, int pageNo, TilePosition* tile) {
+    ScopedCritSec scope(&requestAccess);
+    for (int i = 0; i < workersCount; i++) {
+        PageRenderRequest* req = workers[i].curReq;
+        if (req && !req->isPreview && req->dm == dm && req->pageNo == pageNo && (!tile || req->tile == *tile)) {
+            return req;
+        }
+    }
+    return nullptr;
+}
+
 /* Wait until rendering of a page beloging to <dm> has finished. */
 /* TODO: this might take some time, would be good to show a dialog to let the
    user know he has to wait until we finish */
@@ -607,14 +831,19 @@ void RenderCache::CancelRendering(DisplayModel* dm) {
 
     for (;;) {
         EnterCriticalSection(&requestAccess);
-        if (!curReq || (curReq->dm != dm)) {
+        bool isRendering = false;
+        for (int i = 0; i < workersCount; i++) {
+            PageRenderRequest* req = workers[i].curReq;
+            isRendering |= (req && req->dm == dm);
+        }
+        if (!isRendering) {
             // to be on the safe side
             ClearQueueForDisplayModel(dm);
             LeaveCriticalSection(&requestAccess);
             return;
         }
 
-        AbortCurrentRequest();
+        AbortCurrentRequests(dm);
         LeaveCriticalSection(&requestAccess);
 
         /* TODO: busy loop is not good, but I don't have a better idea */
@@ -628,8 +857,10 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePo
     int curPos = 0;
     for (int i = 0; i < reqCount; i++) {
         PageRenderRequest* req = &(requests[i]);
+        // previews are for the whole page and don't depend on the tile resolution
         bool shouldRemove = req->dm == dm && (pageNo == kInvalidPageNo || req->pageNo == pageNo) &&
-                            (!tile || req->tile.res != tile->res || !IsTileVisible(dm, req->pageNo, *tile, 0.5));
+                            (!tile || (!req->isPreview && req->tile.res != tile->res) ||
+                             !IsTileVisible(dm, req->pageNo, *tile, 0.5));
         if (i != curPos) {
             requests[curPos] = requests[i];
         }
@@ -644,24 +875,32 @@ void RenderCache::ClearQueueForDisplayModel(DisplayModel* dm, int pageNo, TilePo
     }
 }
 
-void RenderCache::AbortCurrentRequest() {
+void RenderCache::AbortCurrentRequests(DisplayModel* dm, int pageNo) {
     ScopedCritSec scope(&requestAccess);
-    if (!curReq) {
-        return;
-    }
-    if (curReq->abortCookie) {
-        curReq->abortCookie->Abort();
+    for (int i = 0; i < workersCount; i++) {
+        PageRenderRequest* req = workers[i].curReq;
+        if (!req) {
+            continue;
+        }
+        if ((dm && req->dm != dm) || (pageNo != kInvalidPageNo && req->pageNo != pageNo)) {
+            continue;
+        }
+        if (req->abortCookie) {
+            req->abortCookie->Abort();
+        }
+        req->abort = true;
     }
-    curReq->abort = true;
 }
 
 static DWORD WINAPI RenderCacheThread(LPVOID data) {
-    RenderCache* cache = (RenderCache*)data;
+    RenderCacheWorker* worker = (RenderCacheWorker*)data;
+    RenderCache* cache = worker->cache;
     PageRenderRequest req;
     RenderedBitmap* bmp;
 
+    SetThreadName("RenderCacheThread");
     for (;;) {
-        if (cache->ClearCurrentRequest()) {
+        if (cache->ClearCurrentRequest(worker)) {
             DWORD waitResult = WaitForSingleObject(cache->startRendering, INFINITE);
             // Is it not a page render request?
             if (WAIT_OBJECT_0 != waitResult) {
@@ -669,7 +908,7 @@ static DWORD WINAPI RenderCacheThread(LPVOID data) {
             }
         }
 
-        if (!cache->GetNextRequest(&req)) {
+        if (!cache->GetNextRequest(worker, &req)) {
             continue;
         }
 
@@ -694,6 +933,7 @@ static DWORD WINAPI RenderCacheThread(LPVOID data) {
         ReportIf(req.abortCookie != nullptr);
         EngineBase* engine = req.dm->GetEngine();
         RenderPageArgs args(req.pageNo, req.zoom, req.rotation, &req.pageRect, RenderTarget::View, &req.abortCookie);
+        args.fastRender = req.isPreview;
         auto timeStart = TimeGet();
         bmp = engine->RenderPage(args);
         if (req.abort) {
@@ -704,6 +944,9 @@ static DWORD WINAPI RenderCacheThread(LPVOID data) {
             continue;
         }
         auto durMs = TimeSinceInMs(timeStart);
+        if (req.isPreview && bmp) {
+            cache->UpdatePreviewSize(bmp->size, durMs);
+        }
         if (durMs > 100) {
             auto path = engine->FilePath();
             logfa("Slow rendering: %.2f ms, page: %d in '%s'\n", (float)durMs, req.pageNo, path);
@@ -734,7 +977,10 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
     BitmapCacheEntry* entry = Find(dm, pageNo, dm->GetRotation(), zoom, &tile);
     int renderDelay = 0;
 
-    if (!entry) {
+    if (entry) {
+        cacheHits++;
+    } else {
+        cacheMisses++;
         if (!isRemoteSession) {
             if (renderedReplacement) {
                 *renderedReplacement = true;
@@ -744,6 +990,9 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
         renderDelay = GetRenderDelay(dm, pageNo, tile);
         if (renderMissing && RENDER_DELAY_UNDEFINED == renderDelay && !IsRenderQueueFull()) {
             RequestRendering(dm, pageNo, tile);
+            if (!entry) {
+                RequestPreview(dm, pageNo);
+            }
         }
     }
     RenderedBitmap* renderedBmp = entry ? entry->bitmap : nullptr;
@@ -802,6 +1051,7 @@ int RenderCache::PaintTile(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, T
         ReportIf(renderedReplacement && !*renderedReplacement);
     }
 
+    entry->lastUsed = GetTickCount();
     DropCacheEntry(entry);
     return 0;
 }
@@ -909,13 +1159,8 @@ int RenderCache::Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageI
 
 void RenderCache::LogCacheSize() {
     ScopedCritSec scope(&cacheAccess);
-    i64 size = 0;
-    for (int i = 0; i < cacheCount; i++) {
-        BitmapCacheEntry* e = cache[i];
-        if (e->bitmap) {
-            i64 bs = BlittableBitmapByteSize(e->bitmap);
-            size += bs;
-        }
-    }
-    logValueSize("bitmapCache", size);
+    logValueSize("bitmapCache", cacheBytes);
+    logValueSize("bitmapCacheMax", maxCacheBytes);
+    logf("bitmapCache: %d bitmaps, hits: %d, misses: %d, evictions: %d\n", cacheCount, cacheHits, cacheMisses,
+         cacheEvictions);
 }
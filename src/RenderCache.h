@@ -8,14 +8,29 @@ constexpr int RENDER_DELAY_FAILED = std::numeric_limits<int>::max() - 2;
 
 #define INVALID_TILE_RES ((USHORT) - 1)
 
-#define MAX_PAGE_REQUESTS 8
-// keep this value reasonably low, else we'll run out of
-// GDI resources/memory when caching many larger bitmaps
-// TODO: this should be based on amount of memory taken by rendered pages
-// i.e. one big page can use as much memory as lots of small pages
-#define MAX_BITMAPS_CACHED 64
+#define MAX_PAGE_REQUESTS 16
+// upper limit for the number of rendering threads
+// (the actual number depends on the number of cores)
+#define MAX_RENDER_THREADS 8
+// max size (in pixels) of a quick preview of a page shown scaled up
+// until the page has been rendered at the right resolution
+#define MAX_PREVIEW_PIXELS (512 * 512)
+#define MIN_PREVIEW_PIXELS (128 * 128)
+// previews are made smaller if rendering them takes longer than this
+#define PREVIEW_BUDGET_MS 20
+// the cache is limited by the amount of memory taken by rendered bitmaps
+// (see RenderCache::maxCacheBytes) but each bitmap also uses GDI resources
+// so we additionally limit their number to keep many small tiles from
+// exhausting those
+#define MAX_BITMAPS_CACHED 256
+
+// bounds for the size of the cache if it's not set explicitly
+// with FixedPageUI.RenderCacheSize
+constexpr i64 kRenderCacheMinBytes = 128 * 1024 * 1024;
+constexpr i64 kRenderCacheMaxBytes = 1024 * 1024 * 1024;
 
 struct PageInfo;
+struct RenderCache;
 
 /* A page is split into tiles of at most TILE_MAX_W x TILE_MAX_H pixels.
    A given tile starts at (col / 2^res * page_width, row / 2^res * page_height). */
@@ -48,7 +63,13 @@ struct BitmapCacheEntry {
 
     // owned by the BitmapCacheEntry
     RenderedBitmap* bitmap = nullptr;
+    // approximate amount of memory taken by bitmap
+    i64 byteSize = 0;
+    // GetTickCount() of the last time the bitmap was painted
+    DWORD lastUsed = 0;
     bool outOfDate = false;
+    // a low quality preview of the whole page (at tile res 0)
+    bool isPreview = false;
     int refs = 1;
 
     BitmapCacheEntry(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition tile,
@@ -59,6 +80,8 @@ struct BitmapCacheEntry {
         this->zoom = zoom;
         this->tile = tile;
         this->bitmap = bitmap;
+        this->byteSize = BlittableBitmapByteSize(bitmap);
+        this->lastUsed = GetTickCount();
     }
     ~BitmapCacheEntry() {
         delete bitmap;
@@ -76,6 +99,7 @@ struct PageRenderRequest {
     TilePosition tile;
 
     RectF pageRect; // calculated from TilePosition
+    bool isPreview = false;
     bool abort = false;
     AbortCookie* abortCookie = nullptr;
     DWORD timestamp = 0;
@@ -84,26 +108,43 @@ struct PageRenderRequest {
     const OnBitmapRendered* renderCb = nullptr;
 };
 
+struct RenderCacheWorker {
+    RenderCache* cache = nullptr;
+    HANDLE thread = nullptr;
+    // request currently being rendered by this thread (nullptr if idle)
+    PageRenderRequest* curReq = nullptr;
+};
+
 struct RenderCache {
     BitmapCacheEntry* cache[MAX_BITMAPS_CACHED]{};
     int cacheCount = 0;
+    // sum of BitmapCacheEntry::byteSize of all cached bitmaps
+    i64 cacheBytes = 0;
+    i64 maxCacheBytes = kRenderCacheMinBytes;
+    // statistics, logged by LogCacheSize()
+    int cacheHits = 0;
+    int cacheMisses = 0;
+    int cacheEvictions = 0;
     // make sure to never ask for requestAccess in a cacheAccess
     // protected critical section in order to avoid deadlocks
     CRITICAL_SECTION cacheAccess;
 
     PageRenderRequest requests[MAX_PAGE_REQUESTS]{};
     int requestCount = 0;
-    PageRenderRequest* curReq = nullptr;
     CRITICAL_SECTION requestAccess;
-    HANDLE renderThread = nullptr;
+    RenderCacheWorker workers[MAX_RENDER_THREADS]{};
+    int workersCount = 0;
 
     Size maxTileSize{};
     bool isRemoteSession = false;
+    // current size of previews, adjusted to PREVIEW_BUDGET_MS (protected by requestAccess)
+    float previewPixels = MAX_PREVIEW_PIXELS;
 
     COLORREF textColor = 0;
     COLORREF backgroundColor = 0;
 
-    /* Interface for page rendering thread */
+    /* Interface for page rendering threads. Auto-reset event that wakes
+       up one thread, which wakes up the next one if more requests are queued */
     HANDLE startRendering = nullptr;
 
     RenderCache();
@@ -119,13 +160,15 @@ struct RenderCache {
     void FreeForDisplayModel(DisplayModel* dm);
     void KeepForDisplayModel(DisplayModel* oldDm, DisplayModel* newDm);
     void Invalidate(DisplayModel* dm, int pageNo, RectF rect);
+    // sizeMB <= 0 picks a size based on the amount of physical memory
+    void SetMaxCacheSize(int sizeMB);
     // returns how much time in ms has past since the most recent rendering
     // request for the visible part of the page if nothing at all could be
     // painted, 0 if something has been painted and RENDER_DELAY_FAILED on failure
     int Paint(HDC hdc, Rect bounds, DisplayModel* dm, int pageNo, PageInfo* pageInfo, bool* renderOutOfDateCue);
 
-    bool ClearCurrentRequest();
-    bool GetNextRequest(PageRenderRequest* req);
+    bool ClearCurrentRequest(RenderCacheWorker* worker);
+    bool GetNextRequest(RenderCacheWorker* worker, PageRenderRequest* req);
     void Add(PageRenderRequest& req, RenderedBitmap* bmp);
 
     USHORT GetTileRes(DisplayModel* dm, int pageNo) const;
@@ -137,14 +180,20 @@ struct RenderCache {
     }
     int GetRenderDelay(DisplayModel* dm, int pageNo, TilePosition tile);
     void RequestRendering(DisplayModel* dm, int pageNo, TilePosition tile, bool clearQueueForPage = true);
+    void RequestPreview(DisplayModel* dm, int pageNo);
+    void UpdatePreviewSize(Size size, double durMs);
     bool Render(DisplayModel* dm, int pageNo, int rotation, float zoom, TilePosition* tile = nullptr,
-                RectF* pageRect = nullptr, const OnBitmapRendered* renderCb = nullptr);
+                RectF* pageRect = nullptr, const OnBitmapRendered* renderCb = nullptr, bool isPreview = false);
     void ClearQueueForDisplayModel(DisplayModel* dm, int pageNo = kInvalidPageNo, TilePosition* tile = nullptr);
-    void AbortCurrentRequest();
+    PageRenderRequest* FindCurrentRequest(DisplayModel* dm, int pageNo, TilePosition* tile = nullptr);
+    // aborts requests currently being rendered, for all pages of dm if pageNo is kInvalidPageNo
+    // and for all documents if dm is nullptr
+    void AbortCurrentRequests(DisplayModel* dm = nullptr, int pageNo = kInvalidPageNo);
 
     BitmapCacheEntry* Find(DisplayModel* dm, int pageNo, int rotation, float zoom = kInvalidZoom,
                            TilePosition* tile = nullptr);
     bool DropCacheEntry(BitmapCacheEntry* entry);
+    bool FreeForSize(DisplayModel* dm, i64 bytesNeeded);
     void FreePage(DisplayModel* dm, int pageNo, TilePosition* tile = nullptr);
     void FreeNotVisible();
 
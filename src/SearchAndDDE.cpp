@@ -257,7 +257,8 @@ struct FindThreadData {
         SendMessageW(win->hwndToolbar, TB_ENABLEBUTTON, CmdFindMatch, disable);
     }
 
-    void HideUI(bool success, bool loopedAround) const {
+    // nHits is the number of matches in the whole document (-1 if not known)
+    void HideUI(bool success, bool loopedAround, int nHits = -1) const {
         LPARAM enable = (LPARAM)MAKELONG(1, 0);
 
         SendMessageW(win->hwndToolbar, TB_ENABLEBUTTON, CmdFindPrev, enable);
@@ -274,17 +275,28 @@ struct FindThreadData {
         } else if (!success && loopedAround) {
             NotificationUpdateMessage(wnd, _TRA("No matches were found"), 0);
         } else {
-            auto pageNo = win->AsFixed()->textSearch->GetSearchHitStartPageNo();
-            TempStr label = win->ctrl->GetPageLabeTemp(pageNo);
-            TempStr buf = str::FormatTemp(_TRA("Found text at page %s"), label);
             if (loopedAround) {
-                buf = str::FormatTemp(_TRA("Found text at page %s (again)"), label);
                 MessageBeep(MB_ICONINFORMATION);
             }
-            NotificationUpdateMessage(wnd, buf, 0, loopedAround);
+            ShowFoundMessage(wnd, loopedAround, nHits);
         }
     }
 
+    // nHits is the number of matches in the whole document (-1 if not known)
+    void ShowFoundMessage(NotificationWnd* wnd, bool loopedAround, int nHits) const {
+        auto pageNo = win->AsFixed()->textSearch->GetSearchHitStartPageNo();
+        TempStr label = win->ctrl->GetPageLabeTemp(pageNo);
+        TempStr buf = str::FormatTemp(_TRA("Found text at page %s"), label);
+        if (loopedAround) {
+            buf = str::FormatTemp(_TRA("Found text at page %s (again)"), label);
+        }
+        if (nHits > 0) {
+            TempStr hits = str::FormatTemp(_TRA("%d matches"), nHits);
+            buf = str::FormatTemp("%s (%s)", buf, hits);
+        }
+        NotificationUpdateMessage(wnd, buf, 0, loopedAround);
+    }
+
     bool WasCanceled() {
         bool winValid = IsMainWindowValid(win);
         auto res = !winValid || win->findCancelled;
@@ -311,6 +323,8 @@ struct FindEndTaskData {
     TextSel* textSel = nullptr;
     bool wasModifiedCanceled = false;
     bool loopedAround = false;
+    // the find thread goes on to count the matches and FindCountTask finishes the search
+    bool countPending = false;
     FindEndTaskData() = default;
     ~FindEndTaskData() {
         delete ftd;
@@ -324,8 +338,13 @@ static void FindEndTask(FindEndTaskData* d) {
     auto textSel = d->textSel;
     auto wasModifiedCanceled = d->wasModifiedCanceled;
     auto loopedAround = d->loopedAround;
+    auto countPending = d->countPending;
 
     AutoDelete delData(d);
+    if (countPending) {
+        // still used by the find thread, deleted by FindCountTask
+        d->ftd = nullptr;
+    }
     if (!IsMainWindowValid(win)) {
         return;
     }
@@ -345,7 +364,36 @@ static void FindEndTask(FindEndTaskData* d) {
         ClearSearchResult(win);
         ftd->HideUI(false, !wasModifiedCanceled);
     }
+    if (!countPending) {
+        win->findThread = nullptr;
+    }
+}
+
+struct FindCountTaskData {
+    MainWindow* win = nullptr;
+    FindThreadData* ftd = nullptr;
+    bool loopedAround = false;
+    int nHits = -1;
+    FindCountTaskData() = default;
+    ~FindCountTaskData() {
+        delete ftd;
+        ftd = nullptr;
+    }
+};
+
+// adds the number of matches to the message about the first match shown by FindEndTask
+static void FindCountTask(FindCountTaskData* d) {
+    AutoDelete delData(d);
+    auto win = d->win;
+    if (!IsMainWindowValid(win) || win->findThread != d->ftd->thread) {
+        // a new search has been started in the meantime
+        return;
+    }
     win->findThread = nullptr;
+    auto wnd = GetNotificationForGroup(win->hwndCanvas, kNotifFindProgress);
+    if (wnd && win->IsDocLoaded() && d->nHits > 0) {
+        d->ftd->ShowFoundMessage(wnd, d->loopedAround, d->nHits);
+    }
 }
 
 static void UpdateSearchProgress(FindThreadData* ftd, ProgressUpdateData* data) {
@@ -357,6 +405,13 @@ static void UpdateSearchProgress(FindThreadData* ftd, ProgressUpdateData* data)
     ftd->UpdateProgress(data->current, data->total);
 }
 
+// the notification already shows the first match, so only report cancellation
+static void CountSearchHitsProgress(FindThreadData* ftd, ProgressUpdateData* data) {
+    if (data->wasCancelled) {
+        *data->wasCancelled = ftd->WasCanceled();
+    }
+}
+
 static void FindThread(FindThreadData* ftd) {
     ReportIf(!(ftd && ftd->win && ftd->win->ctrl && ftd->win->ctrl->AsFixed()));
 
@@ -374,6 +429,7 @@ static void FindThread(FindThreadData* ftd) {
     TextSel* rect;
     textSearch->progressCb = MkFunc1<FindThreadData, ProgressUpdateData*>(UpdateSearchProgress, ftd);
     textSearch->SetDirection(ftd->direction);
+
     if (ftd->wasModified || !ctrl->ValidPageNo(textSearch->GetCurrentPageNo()) ||
         !dm->GetPageInfo(textSearch->GetCurrentPageNo())->visibleRatio) {
         rect = textSearch->FindFirst(ctrl->CurrentPageNo(), ftd->text);
@@ -404,15 +460,38 @@ static void FindThread(FindThreadData* ftd) {
     data->textSel = nullptr;
     data->loopedAround = false;
 
+    // for a new search, count the matches in the whole document after the first one
+    // is shown. This uses the index built from the text of all pages, so only do it
+    // once that has been extracted in the background
+    auto textCache = dm->textCache;
+    bool countHits = false;
     if (!win->findCancelled && rect) {
         data->textSel = rect;
         data->wasModifiedCanceled = ftd->wasModified;
         data->loopedAround = loopedAround;
+        countHits = ftd->wasModified && textCache->PagesExtracted() >= textCache->nPages;
+        data->countPending = countHits;
     } else {
         data->wasModifiedCanceled = win->findCancelled;
     }
     auto fn = MkFunc0<FindEndTaskData>(FindEndTask, data);
     uitask::Post(fn, "TaskFindEnd");
+
+    if (countHits) {
+        // FindAll() resets the search, so it uses a TextSearch of its own
+        auto counter = dm->textSearchCounter;
+        counter->progressCb = MkFunc1<FindThreadData, ProgressUpdateData*>(CountSearchHitsProgress, ftd);
+        counter->SetSensitive(textSearch->caseSensitive);
+        int nHits = counter->FindAll(ftd->text, false);
+
+        auto countData = new FindCountTaskData;
+        countData->win = win;
+        countData->ftd = ftd;
+        countData->loopedAround = loopedAround;
+        countData->nHits = win->findCancelled ? -1 : nHits;
+        auto countFn = MkFunc0<FindCountTaskData>(FindCountTask, countData);
+        uitask::Post(countFn, "TaskFindCount");
+    }
     DestroyTempAllocator();
 }
 
@@ -480,7 +559,7 @@ void PaintForwardSearchMark(MainWindow* win, HDC hdc) {
     ReportIf(!win->AsFixed());
     DisplayModel* dm = win->AsFixed();
     int pageNo = win->fwdSearchMark.page;
-    PageInfo* pageInfo = dm->GetPageInfo(pageNo);
+    PageInfo* pageInfo = dm->GetPageInfoOnScreen(pageNo);
     if (!pageInfo || 0.0 == pageInfo->visibleRatio) {
         return;
     }
@@ -9,6 +9,7 @@
 #include "utils/Timer.h"
 #include "utils/WinUtil.h"
 #include "utils/StrQueue.h"
+#include "utils/StrSearch.h"
 
 #include "wingui/UIModels.h"
 
@@ -87,6 +88,60 @@ static void BenchLoadRender(EngineBase* engine, int pagenum) {
     logf("pagerender %3d: %.2f ms\n", pagenum, timeMs);
 }
 
+// compares finding all matches in the text of all pages with StrStrI()
+// (which is how TextSearch used to find candidates) and with str::FindAllMatches()
+static void BenchTextSearch(EngineBase* engine) {
+    auto t = TimeGet();
+    int nPages = engine->PageCount();
+    Vec<PageText> texts;
+    int nChars = 0;
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        PageText pageText = engine->ExtractPageText(pageNo);
+        nChars += pageText.len;
+        texts.Append(pageText);
+    }
+    logf("text extraction: %d chars in %.2f ms\n", nChars, TimeSinceInMs(t));
+
+    const WCHAR* queries[] = {L"e", L"the", L"search", L"of the", L"xyzzy"};
+    str::SearchKernel kernels[] = {str::SearchKernel::Scalar, str::SearchKernel::SSE2, str::SearchKernel::AVX2};
+    constexpr int kIterations = 10;
+    for (const WCHAR* query : queries) {
+        TempStr queryA = ToUtf8Temp(query);
+        t = TimeGet();
+        int nFound = 0;
+        for (int i = 0; i < kIterations; i++) {
+            nFound = 0;
+            for (auto& pageText : texts) {
+                for (const WCHAR* s = pageText.text; s && (s = StrStrIW(s, query)) != nullptr; s++) {
+                    nFound++;
+                }
+            }
+        }
+        logf("search '%s' strstri: %d matches in %.2f ms\n", queryA, nFound, TimeSinceInMs(t) / kIterations);
+
+        for (auto kernel : kernels) {
+            if (kernel == str::SearchKernel::AVX2 && str::BestSearchKernel() != kernel) {
+                continue;
+            }
+            str::SearchOptions opts;
+            opts.kernel = kernel;
+            t = TimeGet();
+            for (int i = 0; i < kIterations; i++) {
+                nFound = 0;
+                for (auto& pageText : texts) {
+                    nFound += str::FindAllMatches(pageText.text, pageText.len, query, opts, nullptr);
+                }
+            }
+            logf("search '%s' %s: %d matches in %.2f ms\n", queryA, str::SearchKernelName(kernel), nFound,
+                 TimeSinceInMs(t) / kIterations);
+        }
+    }
+
+    for (auto& pageText : texts) {
+        FreePageText(&pageText);
+    }
+}
+
 static void BenchChmLoadOnly(const char* filePath) {
     auto total = TimeGet();
     logf("Starting: %s\n", filePath);
@@ -140,6 +195,10 @@ static void BenchFile(const char* path, const char* pagesSpec) {
     int pages = engine->PageCount();
     logf("page count: %d\n", pages);
 
+    if (str::EqI(pagesSpec, "search")) {
+        BenchTextSearch(engine);
+    }
+
     if (!pagesSpec) {
         for (int i = 1; i <= pages; i++) {
             BenchLoadRender(engine, i);
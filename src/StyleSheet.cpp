@@ -0,0 +1,211 @@
+/* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/HtmlParserLookup.h"
+#include "utils/CssParser.h"
+#include "utils/HtmlPullParser.h"
+
+#include "StyleSheet.h"
+
+// parses size in the form "1em", "3pt" or "15px"
+static void ParseSizeWithUnit(const char* s, size_t len, float* size, StyleRule::Unit* unit) {
+    if (str::Parse(s, len, "%fem", size)) {
+        *unit = StyleRule::em;
+    } else if (str::Parse(s, len, "%fin", size)) {
+        *unit = StyleRule::pt;
+        *size *= 72; // 1 inch is 72 points
+    } else if (str::Parse(s, len, "%fpt", size)) {
+        *unit = StyleRule::pt;
+    } else if (str::Parse(s, len, "%fpx", size)) {
+        *unit = StyleRule::px;
+    } else {
+        *unit = StyleRule::inherit;
+    }
+}
+
+StyleRule StyleRule::Parse(CssPullParser* parser) {
+    StyleRule rule;
+    const CssProperty* prop;
+    while ((prop = parser->NextProperty()) != nullptr) {
+        switch (prop->type) {
+            case Css_Text_Align:
+                rule.textAlign = FindAlignAttr(prop->s, prop->sLen);
+                break;
+            // TODO: some documents use Css_Padding_Left for indentation
+            case Css_Text_Indent:
+                ParseSizeWithUnit(prop->s, prop->sLen, &rule.textIndent, &rule.textIndentUnit);
+                break;
+        }
+    }
+    return rule;
+}
+
+StyleRule StyleRule::Parse(const char* s, size_t len) {
+    CssPullParser parser(s, len);
+    return Parse(&parser);
+}
+
+void StyleRule::Merge(StyleRule& source) {
+    if (source.textAlign != AlignAttr::NotFound) {
+        textAlign = source.textAlign;
+    }
+    if (source.textIndentUnit != StyleRule::inherit) {
+        textIndent = source.textIndent;
+        textIndentUnit = source.textIndentUnit;
+    }
+}
+
+static u32 StyleRuleHash(HtmlTag tag, u32 classHash) {
+    return classHash ^ ((u32)tag * 2654435761u);
+}
+
+// returns the index of the rule for tag and classHash or -1
+int StyleRuleIndex::Find(const Vec<StyleRule>& rules, HtmlTag tag, u32 classHash) const {
+    if (slots.size() == 0) {
+        return -1;
+    }
+    u32 mask = (u32)slots.size() - 1;
+    for (u32 i = StyleRuleHash(tag, classHash) & mask;; i = (i + 1) & mask) {
+        int idx = slots.at(i) - 1;
+        if (idx < 0) {
+            return -1;
+        }
+        StyleRule& rule = rules.at(idx);
+        if (tag == rule.tag && classHash == rule.classHash) {
+            return idx;
+        }
+    }
+}
+
+static void InsertStyleRuleSlot(Vec<int>& slots, const StyleRule& rule, int idx) {
+    u32 mask = (u32)slots.size() - 1;
+    u32 i = StyleRuleHash(rule.tag, rule.classHash) & mask;
+    while (slots.at(i) != 0) {
+        i = (i + 1) & mask;
+    }
+    slots.at(i) = idx + 1;
+}
+
+// indexes rules[idx] which must have been appended last
+void StyleRuleIndex::Add(const Vec<StyleRule>& rules, int idx) {
+    ReportIf(idx != rules.Size() - 1);
+    // keep at least half of the slots empty, so that lookups stay short
+    if (rules.Size() * 2 > slots.Size()) {
+        slots.SetSize(std::max(slots.Size() * 2, 64));
+        for (int i = 0; i < idx; i++) {
+            InsertStyleRuleSlot(slots, rules.at(i), i);
+        }
+    }
+    InsertStyleRuleSlot(slots, rules.at(idx), idx);
+}
+
+void StyleRuleIndex::Reset() {
+    slots.Reset();
+}
+
+StyleRule* StyleSheet::FindRule(HtmlTag tag, u32 classHash) {
+    int idx = rulesIndex.Find(rules, tag, classHash);
+    if (idx < 0) {
+        return nullptr;
+    }
+    return &rules.at(idx);
+}
+
+StyleRule* StyleSheet::FindRule(HtmlTag tag, const char* clazz, size_t clazzLen) {
+    u32 classHash = clazz ? MurmurHash2(clazz, clazzLen) : 0;
+    return FindRule(tag, classHash);
+}
+
+void StyleSheet::Reset() {
+    rules.Reset();
+    rulesIndex.Reset();
+    computedRules.Reset();
+    computedRulesIndex.Reset();
+}
+
+// merges the style sheet rules applying to a tag with the given class attribute
+// (which are the same for all such tags until another style sheet is parsed)
+StyleRule StyleSheet::ComputeClassRule(HtmlTag tag, AttrInfo* classAttr) {
+    u32 attrHash = classAttr ? MurmurHash2(classAttr->val, classAttr->valLen) : 0;
+    int idx = computedRulesIndex.Find(computedRules, tag, attrHash);
+    if (idx >= 0) {
+        return computedRules.at(idx);
+    }
+
+    StyleRule rule;
+    // get style rules ordered by specificity
+    StyleRule* prevRule = FindRule(Tag_Body, 0);
+    if (prevRule) {
+        rule.Merge(*prevRule);
+    }
+    prevRule = FindRule(Tag_Any, 0);
+    if (prevRule) {
+        rule.Merge(*prevRule);
+    }
+    prevRule = FindRule(tag, 0);
+    if (prevRule) {
+        rule.Merge(*prevRule);
+    }
+    if (classAttr) {
+        // class="a b" applies .a and .b in that order, then tag.a and tag.b
+        Vec<u32> classHashes;
+        const char* s = classAttr->val;
+        const char* end = s + classAttr->valLen;
+        while (s < end) {
+            while (s < end && str::IsWs(*s)) {
+                s++;
+            }
+            const char* clazz = s;
+            while (s < end && !str::IsWs(*s)) {
+                s++;
+            }
+            if (s > clazz) {
+                classHashes.Append(MurmurHash2(clazz, s - clazz));
+            }
+        }
+        for (u32 classHash : classHashes) {
+            prevRule = FindRule(Tag_Any, classHash);
+            if (prevRule) {
+                rule.Merge(*prevRule);
+            }
+        }
+        for (u32 classHash : classHashes) {
+            prevRule = FindRule(tag, classHash);
+            if (prevRule) {
+                rule.Merge(*prevRule);
+            }
+        }
+    }
+
+    rule.tag = tag;
+    rule.classHash = attrHash;
+    computedRules.Append(rule);
+    computedRulesIndex.Add(computedRules, computedRules.Size() - 1);
+    return rule;
+}
+
+void StyleSheet::Parse(const char* data, size_t len) {
+    CssPullParser parser(data, len);
+    while (parser.NextRule()) {
+        StyleRule rule = StyleRule::Parse(&parser);
+        const CssSelector* sel;
+        while ((sel = parser.NextSelector()) != nullptr) {
+            if (Tag_NotFound == sel->tag) {
+                continue;
+            }
+            StyleRule* prevRule = FindRule(sel->tag, sel->clazz, sel->clazzLen);
+            if (prevRule) {
+                prevRule->Merge(rule);
+            } else {
+                rule.tag = sel->tag;
+                rule.classHash = sel->clazz ? MurmurHash2(sel->clazz, sel->clazzLen) : 0;
+                rules.Append(rule);
+                rulesIndex.Add(rules, rules.Size() - 1);
+            }
+        }
+    }
+    // the rules merged so far might have changed
+    computedRules.Reset();
+    computedRulesIndex.Reset();
+}
@@ -0,0 +1,50 @@
+/* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+class CssPullParser;
+struct AttrInfo;
+
+struct StyleRule {
+    HtmlTag tag = Tag_NotFound;
+    u32 classHash = 0;
+
+    enum Unit { px, pt, em, inherit };
+
+    float textIndent = 0;
+    Unit textIndentUnit = inherit;
+    AlignAttr textAlign = AlignAttr::NotFound;
+
+    StyleRule() = default;
+
+    void Merge(StyleRule& source);
+
+    static StyleRule Parse(CssPullParser* parser);
+    static StyleRule Parse(const char* s, size_t len);
+};
+
+// hash table of the StyleRules in a Vec by their tag and classHash
+// (documents can have thousands of rules, most of them for classes)
+struct StyleRuleIndex {
+    // open addressing, 1 + index into the rules or 0 for an empty slot
+    Vec<int> slots;
+
+    int Find(const Vec<StyleRule>& rules, HtmlTag tag, u32 classHash) const;
+    void Add(const Vec<StyleRule>& rules, int idx);
+    void Reset();
+};
+
+// the rules of the style sheets of a document, as used by HtmlFormatter
+struct StyleSheet {
+    Vec<StyleRule> rules;
+    StyleRuleIndex rulesIndex;
+    // rules merged by ComputeClassRule() for a tag and the hash of its class
+    // attribute (which can contain several classes), reset when rules change
+    Vec<StyleRule> computedRules;
+    StyleRuleIndex computedRulesIndex;
+
+    void Parse(const char* data, size_t len);
+    void Reset();
+    StyleRule* FindRule(HtmlTag tag, u32 classHash);
+    StyleRule* FindRule(HtmlTag tag, const char* clazz, size_t clazzLen);
+    StyleRule ComputeClassRule(HtmlTag tag, AttrInfo* classAttr);
+};
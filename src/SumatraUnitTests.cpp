@@ -9,6 +9,8 @@
 #include "utils/WinUtil.h"
 #include "utils/StrFormat.h"
 #include "utils/ScopedWin.h"
+#include "utils/HtmlParserLookup.h"
+#include "utils/HtmlPullParser.h"
 
 #include "wingui/UIModels.h"
 
@@ -18,6 +20,7 @@
 #include "GlobalPrefs.h"
 #include "Flags.h"
 #include "Commands.h"
+#include "StyleSheet.h"
 
 #include <float.h>
 #include <math.h>
@@ -136,6 +139,20 @@ static void ParseCommandLineTest() {
         utassert(i.startZoom == kZoomFitContent);
         utassert(0 == i.fileNames.Size());
     }
+
+    {
+        Flags i;
+        ParseFlags(L"GurupiaReader.exe -s -engine-dump -bench corpus -zoom 50,100 -render 2 foo.pdf", i);
+        utassert(i.engineDump);
+        utassert(i.silent);
+        utassert(!i.testRenderPage);
+        utassert(0 == i.fileNames.Size());
+        utassert(i.startZoom == kInvalidZoom);
+        utassert(7 == i.engineDumpArgs.Size());
+        utassert(str::Eq("-bench", i.engineDumpArgs.At(0)));
+        utassert(str::Eq("50,100", i.engineDumpArgs.At(3)));
+        utassert(str::Eq("foo.pdf", i.engineDumpArgs.At(6)));
+    }
 }
 
 static void BenchRangeTest() {
@@ -146,6 +163,7 @@ static void BenchRangeTest() {
     utassert(IsBenchPagesInfo("1-3,4,6-9,13"));
     utassert(IsBenchPagesInfo("2-"));
     utassert(IsBenchPagesInfo("loadonly"));
+    utassert(IsBenchPagesInfo("search"));
 
     utassert(!IsBenchPagesInfo(""));
     utassert(!IsBenchPagesInfo("-2"));
@@ -293,6 +311,91 @@ void parseCommandsTest() {
     }
 }
 
+static StyleRule ComputeClassRule(StyleSheet& sheet, HtmlTag tag, const char* classes) {
+    AttrInfo attr{"class", 5, classes, str::Len(classes)};
+    return sheet.ComputeClassRule(tag, &attr);
+}
+
+static void StyleSheetTest() {
+    StyleSheet sheet;
+    const char* css =
+        "p { text-align: left; text-indent: 1em }\n"
+        ".center, h1 { text-align: center }\n"
+        ".big { text-indent: 2em }\n"
+        "p.right { text-align: right }\n"
+        ".right { text-align: justify }\n";
+    sheet.Parse(css, str::Len(css));
+    utassert(sheet.rules.Size() == 6);
+
+    StyleRule rule = sheet.ComputeClassRule(Tag_P, nullptr);
+    utassert(rule.textAlign == AlignAttr::Left);
+    utassert(rule.textIndentUnit == StyleRule::em && rule.textIndent == 1);
+    rule = sheet.ComputeClassRule(Tag_H1, nullptr);
+    utassert(rule.textAlign == AlignAttr::Center);
+    utassert(rule.textIndentUnit == StyleRule::inherit);
+
+    // .class overrides the rule for the tag
+    rule = ComputeClassRule(sheet, Tag_P, "center");
+    utassert(rule.textAlign == AlignAttr::Center);
+    utassert(rule.textIndentUnit == StyleRule::em && rule.textIndent == 1);
+    // several classes
+    rule = ComputeClassRule(sheet, Tag_P, "center  big");
+    utassert(rule.textAlign == AlignAttr::Center);
+    utassert(rule.textIndent == 2);
+    rule = ComputeClassRule(sheet, Tag_Div, " big center ");
+    utassert(rule.textAlign == AlignAttr::Center);
+    utassert(rule.textIndent == 2);
+    // tag.class overrides .class, regardless of the order of the classes
+    rule = ComputeClassRule(sheet, Tag_P, "right center");
+    utassert(rule.textAlign == AlignAttr::Right);
+    rule = ComputeClassRule(sheet, Tag_P, "center right");
+    utassert(rule.textAlign == AlignAttr::Right);
+    rule = ComputeClassRule(sheet, Tag_Div, "right");
+    utassert(rule.textAlign == AlignAttr::Justify);
+    rule = ComputeClassRule(sheet, Tag_Div, "unknown");
+    utassert(rule.textAlign == AlignAttr::NotFound);
+
+    // merged rules are computed once per tag and class attribute
+    int nComputed = sheet.computedRules.Size();
+    rule = ComputeClassRule(sheet, Tag_P, "center right");
+    utassert(rule.textAlign == AlignAttr::Right);
+    utassert(sheet.computedRules.Size() == nComputed);
+
+    // another style sheet changes the merged rules
+    css = "p.center { text-indent: 3pt }";
+    sheet.Parse(css, str::Len(css));
+    rule = ComputeClassRule(sheet, Tag_P, "center");
+    utassert(rule.textAlign == AlignAttr::Center);
+    utassert(rule.textIndentUnit == StyleRule::pt && rule.textIndent == 3);
+
+    // rules don't carry over to the next spine item of an EPUB
+    sheet.Reset();
+    rule = ComputeClassRule(sheet, Tag_P, "center");
+    utassert(rule.textAlign == AlignAttr::NotFound);
+    utassert(rule.textIndentUnit == StyleRule::inherit);
+    css = ".center { text-align: right }";
+    sheet.Parse(css, str::Len(css));
+    rule = ComputeClassRule(sheet, Tag_P, "center");
+    utassert(rule.textAlign == AlignAttr::Right);
+    utassert(rule.textIndentUnit == StyleRule::inherit);
+
+    // enough rules for the index to grow
+    sheet.Reset();
+    str::Str s;
+    for (int i = 0; i < 200; i++) {
+        s.AppendFmt(".c%d { text-indent: %dpx }\n", i, i + 1);
+    }
+    sheet.Parse(s.Get(), s.size());
+    utassert(sheet.rules.Size() == 200);
+    for (int i = 0; i < 200; i++) {
+        TempStr clazz = str::FormatTemp("c%d", i);
+        StyleRule* r = sheet.FindRule(Tag_Any, clazz, str::Len(clazz));
+        utassert(r && r->textIndentUnit == StyleRule::px && r->textIndent == i + 1);
+    }
+    utassert(!sheet.FindRule(Tag_Any, "c200", 4));
+    utassert(!sheet.FindRule(Tag_P, "c1", 2));
+}
+
 extern void EncodingDetector_UnitTests();
 
 void GurupiaReader_UnitTests() {
@@ -303,4 +406,5 @@ void GurupiaReader_UnitTests() {
     ParseCommandLineTest();
     versioncheck_test();
     hexstrTest();
+    StyleSheetTest();
 }
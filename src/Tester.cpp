@@ -29,6 +29,7 @@
 #include "EbookBase.h"
 #include "PalmDbReader.h"
 #include "MobiDoc.h"
+#include "StyleSheet.h"
 #include "HtmlFormatter.h"
 #include "EbookFormatter.h"
 
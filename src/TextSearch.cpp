@@ -2,8 +2,13 @@
    License: GPLv3 */
 
 #include "utils/BaseUtil.h"
+#include "utils/Dict.h"
 #include "utils/ScopedWin.h"
+#include "utils/StrSearch.h"
+#include "utils/StrVec.h"
+#include "utils/Timer.h"
 #include "utils/WinUtil.h"
+#include "utils/WordIndex.h"
 
 #include "wingui/UIModels.h"
 
@@ -14,6 +19,8 @@
 #include "TextSelection.h"
 #include "TextSearch.h"
 
+#include "utils/Log.h"
+
 #define SkipWhitespace(c) for (; str::IsWs(*(c)); (c)++)
 // ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
 // cf. http://code.google.com/p/GurupiaReader/issues/detail?id=959
@@ -32,12 +39,14 @@ TextSearch::TextSearch(EngineBase* engine, DocumentTextCache* textCache) : TextS
 
 TextSearch::~TextSearch() {
     Clear();
+    delete index;
+    delete pageMatches;
 }
 
 void TextSearch::Clear() {
     str::FreePtr(&findText);
-    str::FreePtr(&anchor);
     str::FreePtr(&lastText);
+    pageMatchesPageNo = 0;
     Reset();
 }
 
@@ -62,6 +71,7 @@ void TextSearch::SetText(const WCHAR* text) {
     // usually is not quite what a user expects, so let's try to be cleverer)
     this->matchWordStart = text[0] == ' ' && text[1] != ' ';
     this->matchWordEnd = str::EndsWith(text, L" ") && !str::EndsWith(text, L"  ");
+    pageMatchesPageNo = 0;
 
     if (text[0] == ' ') {
         text++;
@@ -76,23 +86,6 @@ void TextSearch::SetText(const WCHAR* text) {
     this->lastText = str::Dup(text);
     this->findText = str::Dup(text);
 
-    // extract anchor string (the first word or the first symbol) for faster searching
-    if (isnoncjkwordchar(*text)) {
-        const WCHAR* end;
-        for (end = text; isnoncjkwordchar(*end); end++) {
-            ;
-        }
-        anchor = str::Dup(text, end - text);
-    }
-    // Adobe Reader also matches certain hard-to-type Unicode
-    // characters when searching for easy-to-type homoglyphs
-    // cf. https://web.archive.org/web/20140201013717/http://forums.fofou.org:80/GurupiaReader/topic?id=2432337&comments=3
-    else if (*text == '-' || *text == '\'' || *text == '"') {
-        anchor = nullptr;
-    } else {
-        anchor = str::Dup(text, 1);
-    }
-
     if (str::Len(this->findText) >= INT_MAX) {
         this->findText[(unsigned)INT_MAX - 1] = '\0';
     }
@@ -108,6 +101,7 @@ void TextSearch::SetSensitive(bool sensitive) {
         return;
     }
     this->caseSensitive = sensitive;
+    pageMatchesPageNo = 0;
 
     markAllPagesNonSkip(pagesToSkip);
 }
@@ -141,6 +135,62 @@ void TextSearch::SetLastResult(TextSelection* sel) {
     forward = true;
 }
 
+static WCHAR CharToLower(WCHAR c);
+
+// returns the length of the word starting at s (0 if s doesn't start a word)
+static int WordLen(const WCHAR* s) {
+    if (isnoncjkwordchar(*s)) {
+        const WCHAR* end = s;
+        while (isnoncjkwordchar(*end)) {
+            end++;
+        }
+        return (int)(end - s);
+    }
+    return isWordChar(*s) ? 1 : 0;
+}
+
+// words are indexed lower-cased and in UTF-8
+static TempStr NormalizeWordTemp(const WCHAR* s, int len) {
+    WCHAR buf[256];
+    len = std::min(len, (int)dimof(buf));
+    for (int i = 0; i < len; i++) {
+        buf[i] = CharToLower(s[i]);
+    }
+    return ToUtf8Temp(buf, (size_t)len);
+}
+
+// builds an inverted index of all words in the document. This requires
+// the text of all pages so it's only done when needed
+bool TextSearch::BuildIndex() {
+    if (index) {
+        return true;
+    }
+    auto timeStart = TimeGet();
+    auto idx = new WordIndex();
+    for (int pageNo = 1; pageNo <= nPages; pageNo++) {
+        if (WasCanceled(progressCb)) {
+            delete idx;
+            return false;
+        }
+        UpdateProgress(progressCb, pageNo, nPages);
+        const WCHAR* text = textCache->GetTextForPage(pageNo);
+        for (const WCHAR* s = text; *s;) {
+            int len = WordLen(s);
+            if (len == 0) {
+                s++;
+                continue;
+            }
+            idx->AddWord(NormalizeWordTemp(s, len), pageNo, (int)(s - text));
+            s += len;
+        }
+    }
+    idx->Finish();
+    index = idx;
+    logf("TextSearch::BuildIndex: %d words, %d positions in %d pages in %.2f ms\n", idx->sortedWords.Size(),
+         idx->positions.Size(), nPages, TimeSinceInMs(timeStart));
+    return true;
+}
+
 static WCHAR CharToLower2(WCHAR c) {
     WCHAR buf[1] = {c};
     CharLowerBuffW(buf, 1);
@@ -245,12 +295,29 @@ TextSearch::PageAndOffset TextSearch::MatchEnd(const WCHAR* start) const {
     return {currentPage, off};
 }
 
-static const WCHAR* GetNextIndex(const WCHAR* base, int offset, bool forward) {
-    const WCHAR* c = base + offset + (forward ? 0 : -1);
-    if (c < base || !*c) {
-        return nullptr;
+// returns the first match in pageText starting at or after findIndex
+// (or the last one starting before findIndex when searching backwards)
+str::SearchMatch* TextSearch::NextPageMatch(int pageNo) {
+    if (!pageMatches) {
+        pageMatches = new Vec<str::SearchMatch>();
     }
-    return c;
+    if (pageMatchesPageNo != pageNo || pageMatchesText != pageText) {
+        pageMatches->Reset();
+        str::SearchOptions opts;
+        opts.caseSensitive = caseSensitive;
+        opts.matchWordStart = matchWordStart;
+        opts.matchWordEnd = matchWordEnd;
+        str::FindAllMatches(pageText, -1, findText, opts, pageMatches);
+        pageMatchesPageNo = pageNo;
+        pageMatchesText = pageText;
+    }
+    auto b = pageMatches->begin();
+    auto e = pageMatches->end();
+    auto it = std::lower_bound(b, e, findIndex, [](const str::SearchMatch& m, int idx) { return m.start < idx; });
+    if (forward) {
+        return it != e ? it : nullptr;
+    }
+    return it != b ? it - 1 : nullptr;
 }
 
 bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyph) {
@@ -268,23 +335,18 @@ bool TextSearch::FindTextInPage(int pageNo, TextSearch::PageAndOffset* finalGlyp
     const WCHAR* found;
     PageAndOffset fg;
     do {
-        if (!anchor) {
-            found = GetNextIndex(pageText, findIndex, forward);
-        } else if (forward) {
-            const WCHAR* s = pageText + findIndex;
-            if (caseSensitive) {
-                found = StrStr(s, anchor);
-            } else {
-                found = StrStrI(s, anchor);
-            }
-        } else {
-            found = StrRStrI(pageText, pageText + findIndex, anchor);
-        }
-        if (!found) {
+        str::SearchMatch* m = NextPageMatch(pageNo);
+        if (!m) {
             return false;
         }
-        findIndex = (int)(found - pageText) + (forward ? 1 : 0);
-        fg = MatchEnd(found);
+        found = pageText + m->start;
+        findIndex = m->start + (forward ? 1 : 0);
+        if (m->end < 0) {
+            // the match might continue on the next page
+            fg = MatchEnd(found);
+        } else {
+            fg = {pageNo, m->end};
+        }
     } while (fg.page <= 0);
 
     int offset = (int)(found - pageText);
@@ -357,6 +419,97 @@ TextSel* TextSearch::FindFirst(int page, const WCHAR* text) {
     return nullptr;
 }
 
+void TextSearch::AddHit(Vec<TextSearchHit>* hits, int pageNo, int glyphIdx, PageAndOffset end) {
+    if (!hits) {
+        return;
+    }
+    StartAt(pageNo, glyphIdx);
+    SelectUpTo(end.page, end.offset);
+    TextSearchHit hit;
+    hit.pageNo = pageNo;
+    hit.glyphIdx = glyphIdx;
+    for (int i = 0; i < result.len; i++) {
+        if (result.pages[i] == pageNo) {
+            hit.rect = hit.rect.Union(result.rects[i]);
+        }
+    }
+    hits->Append(hit);
+}
+
+// finds all occurences of text in the document, in document order, and returns their number.
+// matches the same text as FindFirst()/FindNext() (whole words only if wholeWords is true).
+// if text starts with a word, the index provides the candidates which then get verified,
+// otherwise falls back to searching every page.
+// resets the state of FindFirst()/FindNext()
+int TextSearch::FindAll(const WCHAR* text, bool wholeWords, Vec<TextSearchHit>* hitsOut) {
+    SetText(text);
+    if (str::IsEmpty(findText)) {
+        return 0;
+    }
+    if (wholeWords) {
+        matchWordStart = matchWordEnd = true;
+    }
+    forward = true;
+
+    int nHits = 0;
+    Vec<TextSearchHit> hits;
+    int firstWordLen = WordLen(findText);
+    if (firstWordLen > 0 && BuildIndex()) {
+        // the index finds where the words of the text occur one after another,
+        // MatchEnd() verifies the rest (case sensitivity, characters between the words etc.)
+        StrVec words;
+        const WCHAR* s = findText;
+        const WCHAR* wordsEnd = s;
+        while (*s) {
+            int len = WordLen(s);
+            if (len == 0) {
+                s++;
+                continue;
+            }
+            words.Append(NormalizeWordTemp(s, len));
+            s += len;
+            wordsEnd = s;
+        }
+        // if the text continues after the last word, that word has to be complete
+        bool matchEnd = matchWordEnd || *wordsEnd;
+        Vec<WordIndex::Posting> candidates;
+        index->FindPhrase(words, matchWordStart, matchEnd, &candidates);
+        for (auto& p : candidates) {
+            findPage = p.pageNo;
+            pageText = textCache->GetTextForPage(p.pageNo);
+            PageAndOffset fg = MatchEnd(pageText + p.glyphIdx);
+            if (fg.page > 0) {
+                nHits++;
+                AddHit(hitsOut ? &hits : nullptr, p.pageNo, p.glyphIdx, fg);
+            }
+        }
+    } else if (firstWordLen == 0) {
+        for (int pageNo = 1; pageNo <= nPages && !WasCanceled(progressCb); pageNo++) {
+            UpdateProgress(progressCb, pageNo, nPages);
+            pageText = textCache->GetTextForPage(pageNo);
+            findIndex = 0;
+            PageAndOffset fg;
+            while (FindTextInPage(pageNo, &fg)) {
+                nHits++;
+                if (hitsOut) {
+                    AddHit(&hits, pageNo, startGlyph, fg);
+                }
+                // FindTextInPage() might have moved to the page where the hit ends
+                findPage = pageNo;
+                findIndex = startGlyph + 1;
+                pageText = textCache->GetTextForPage(pageNo);
+            }
+        }
+    }
+
+    if (hitsOut) {
+        hitsOut->Append(hits);
+    }
+    // the state of FindFirst()/FindNext() is no longer valid
+    Clear();
+    return nHits;
+}
+
 TextSel* TextSearch::FindNext() {
     ReportIf(!findText);
     if (!findText) {
@@ -1,6 +1,19 @@
 /* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
    License: GPLv3 */
 
+// a single hit returned by TextSearch::FindAll()
+struct TextSearchHit {
+    int pageNo = 0;   // page on which the hit starts
+    int glyphIdx = 0; // index of the first glyph in the text of pageNo
+    Rect rect;        // bounding box of the hit on pageNo, in page coordinates
+};
+
+struct WordIndex;
+
+namespace str {
+struct SearchMatch;
+}
+
 struct TextSearch : public TextSelection {
     enum class Direction : bool { Backward = false, Forward = true };
 
@@ -12,6 +25,7 @@ struct TextSearch : public TextSelection {
     void SetLastResult(TextSelection* sel);
     TextSel* FindFirst(int page, const WCHAR* text);
     TextSel* FindNext();
+    int FindAll(const WCHAR* text, bool wholeWords, Vec<TextSearchHit>* hitsOut = nullptr);
 
     int GetCurrentPageNo() const;
     int GetSearchHitStartPageNo() const;
@@ -25,7 +39,6 @@ struct TextSearch : public TextSelection {
     };
 
     WCHAR* findText = nullptr;
-    WCHAR* anchor = nullptr;
     int findPage = 0;
     int searchHitStartAt = 0; // when text found spans several pages, searchHitStartAt < findPage
     bool forward = true;
@@ -38,6 +51,7 @@ struct TextSearch : public TextSelection {
 
     void SetText(const WCHAR* text);
     bool FindTextInPage(int pageNo, PageAndOffset* finalGlyph);
+    str::SearchMatch* NextPageMatch(int pageNo);
     bool FindStartingAtPage(int pageNo);
     PageAndOffset MatchEnd(const WCHAR* start) const;
 
@@ -47,7 +61,19 @@ struct TextSearch : public TextSelection {
     const WCHAR* pageText = nullptr;
     int findIndex = 0;
 
+    // all matches of findText in pageMatchesText (the text of page
+    // pageMatchesPageNo), computed once per page by str::FindAllMatches()
+    Vec<str::SearchMatch>* pageMatches = nullptr;
+    int pageMatchesPageNo = 0;
+    const WCHAR* pageMatchesText = nullptr;
+
     WCHAR* lastText = nullptr;
     int nPages = 0;
     Vec<bool> pagesToSkip;
+
+    // built on first call to FindAll()
+    WordIndex* index = nullptr;
+
+    bool BuildIndex();
+    void AddHit(Vec<TextSearchHit>* hits, int pageNo, int glyphIdx, PageAndOffset end);
 };
@@ -3,12 +3,17 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/ScopedWin.h"
+#include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/WinUtil.h"
+#include "utils/Log.h"
 
 #include "wingui/UIModels.h"
 
 #include "DocController.h"
 #include "EngineBase.h"
+#include "FileThumbnails.h"
 #include "TextSelection.h"
 
 uint distSq(int x, int y) {
@@ -23,28 +28,167 @@ static bool isDigit(WCHAR c) {
     return c >= '0' && c <= '9';
 }
 
+// text of all pages is saved to a file so that it doesn't have to be extracted
+// again when searching the same document in the next session. The layout allows
+// using the file directly from memory:
+// TextCacheFileHeader
+// TextCacheFilePage[nPages]
+// for each page: WCHAR text[len + 1], padded to 4 bytes, followed by Rect coords[len]
+constexpr u32 kTextCacheFileMagic = 0x54585053; // 'SPXT'
+constexpr u32 kTextCacheFileVersion = 2;
+
+struct TextCacheFileHeader {
+    u32 magic;
+    u32 version;
+    u32 nPages;
+    u32 reserved;
+    // fingerprint of the engine and its layout (see DocumentTextCache::cacheKey)
+    u8 key[16];
+};
+
+struct TextCacheFilePage {
+    u32 offset;
+    u32 len;
+};
+
+static u32 TextCachePageDataSize(u32 len) {
+    u32 textSize = (len + 1) * (u32)sizeof(WCHAR);
+    textSize = (textSize + 3) & ~3u;
+    return textSize + len * (u32)sizeof(Rect);
+}
+
 DocumentTextCache::DocumentTextCache(EngineBase* engine) : engine(engine) {
     nPages = engine->PageCount();
     pagesText = AllocArray<PageText>(nPages);
     debugSize = nPages * (sizeof(Rect*) + sizeof(WCHAR*) + sizeof(int));
+    u8 layoutKey[16]{};
+    if (engine->GetLayoutKey(layoutKey)) {
+        // the same file can be opened with different engines (e.g. EPUB with
+        // EngineMupdf or EngineEpub), which extract different text
+        AutoFreeStr layoutHex = str::MemToHex(layoutKey, dimof(layoutKey));
+        TempStr key = str::FormatTemp("%s|%u|%s", engine->kind, engine->GetEncoding(), layoutHex.Get());
+        CalcMD5Digest((u8*)key, str::Leni(key), cacheKey);
+        cacheFilePath = str::Dup(GetTextCachePathTemp(engine->FilePath()));
+    }
 
     InitializeCriticalSection(&access);
 }
 
 DocumentTextCache::~DocumentTextCache() {
+    AbortExtracting();
     EnterCriticalSection(&access);
 
-    int n = engine->PageCount();
-    for (int i = 0; i < n; i++) {
+    // engine->PageCount() might have grown since (see EngineBase::UpdatePageCount())
+    for (int i = 0; i < nPages; i++) {
         PageText* pageText = &pagesText[i];
         free(pageText->coords);
         free(pageText->text);
     }
     free(pagesText);
+    if (cacheFileData) {
+        UnmapViewOfFile(cacheFileData);
+    }
+    SafeCloseHandle(&cacheFileMapping);
+    str::Free(cacheFilePath);
     LeaveCriticalSection(&access);
     DeleteCriticalSection(&access);
 }
 
+// must be called inside access
+bool DocumentTextCache::LoadCacheFile() {
+    if (triedLoadingCacheFile) {
+        return cacheFileData != nullptr;
+    }
+    triedLoadingCacheFile = true;
+    if (!cacheFilePath || !file::Exists(cacheFilePath)) {
+        return false;
+    }
+
+    TempWStr pathW = ToWStrTemp(cacheFilePath);
+    AutoCloseHandle h(CreateFileW(pathW, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, 0, nullptr));
+    if (!h.IsValid()) {
+        return false;
+    }
+    i64 size = file::GetSize(h);
+    i64 minSize = (i64)sizeof(TextCacheFileHeader) + (i64)nPages * (i64)sizeof(TextCacheFilePage);
+    if (size < minSize || size > UINT_MAX) {
+        return false;
+    }
+    cacheFileMapping = CreateFileMappingW(h, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!cacheFileMapping) {
+        return false;
+    }
+    cacheFileData = (const u8*)MapViewOfFile(cacheFileMapping, FILE_MAP_READ, 0, 0, 0);
+    cacheFileSize = size;
+    auto hdr = (const TextCacheFileHeader*)cacheFileData;
+    bool ok = hdr && hdr->magic == kTextCacheFileMagic && hdr->version == kTextCacheFileVersion &&
+              hdr->nPages == (u32)nPages && memcmp(hdr->key, cacheKey, sizeof(cacheKey)) == 0;
+    if (!ok) {
+        logf("DocumentTextCache: ignoring invalid '%s'\n", cacheFilePath);
+        if (cacheFileData) {
+            UnmapViewOfFile(cacheFileData);
+        }
+        cacheFileData = nullptr;
+        SafeCloseHandle(&cacheFileMapping);
+        return false;
+    }
+    return true;
+}
+
+// must be called inside access
+bool DocumentTextCache::GetCachedTextForPage(int pageNo, PageText* pageText) {
+    if (!LoadCacheFile()) {
+        return false;
+    }
+    auto pages = (const TextCacheFilePage*)(cacheFileData + sizeof(TextCacheFileHeader));
+    const TextCacheFilePage& page = pages[pageNo - 1];
+    u64 end = (u64)page.offset + TextCachePageDataSize(page.len);
+    if (page.len > (u32)INT_MAX || end > (u64)cacheFileSize) {
+        return false;
+    }
+    const u8* d = cacheFileData + page.offset;
+    u32 textSize = (page.len + 1) * (u32)sizeof(WCHAR);
+    pageText->len = (int)page.len;
+    pageText->text = str::Dup((const WCHAR*)d, page.len);
+    pageText->coords = (Rect*)memdup(d + ((textSize + 3) & ~3u), page.len * sizeof(Rect));
+    return true;
+}
+
+// called after text of all pages has been extracted
+void DocumentTextCache::SaveCacheFile() {
+    if (!cacheFilePath || engine->IsPageCountProvisional()) {
+        return;
+    }
+    str::Str data;
+    TextCacheFileHeader hdr{kTextCacheFileMagic, kTextCacheFileVersion, (u32)nPages, 0};
+    memcpy(hdr.key, cacheKey, sizeof(cacheKey));
+    data.Append((const u8*)&hdr, sizeof(hdr));
+    u32 offset = (u32)(sizeof(hdr) + nPages * sizeof(TextCacheFilePage));
+    for (int i = 0; i < nPages; i++) {
+        TextCacheFilePage page{offset, (u32)pagesText[i].len};
+        data.Append((const u8*)&page, sizeof(page));
+        offset += TextCachePageDataSize(page.len);
+    }
+    for (int i = 0; i < nPages; i++) {
+        PageText* pageText = &pagesText[i];
+        u32 len = (u32)pageText->len;
+        u32 textSize = (len + 1) * (u32)sizeof(WCHAR);
+        data.Append((const u8*)pageText->text, textSize);
+        u8 pad[4]{};
+        data.Append(pad, ((textSize + 3) & ~3u) - textSize);
+        if (len > 0) {
+            data.Append((const u8*)pageText->coords, len * sizeof(Rect));
+        }
+    }
+    ReportIf(data.size() != offset);
+
+    if (!dir::CreateForFile(cacheFilePath)) {
+        return;
+    }
+    bool ok = file::WriteFile(cacheFilePath, data.AsByteSlice());
+    logf("DocumentTextCache: saving text of %d pages to '%s' %s\n", nPages, cacheFilePath, ok ? "ok" : "failed");
+}
+
 bool DocumentTextCache::HasTextForPage(int pageNo) const {
     ReportIf(pageNo < 1 || pageNo > nPages);
     PageText* pageText = &pagesText[pageNo - 1];
@@ -54,16 +198,48 @@ bool DocumentTextCache::HasTextForPage(int pageNo) const {
 const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** coordsOut) {
     ReportIf(pageNo < 1 || pageNo > nPages);
 
-    ScopedCritSec scope(&access);
     PageText* pageText = &pagesText[pageNo - 1];
+    bool needsExtracting;
+    {
+        ScopedCritSec scope(&access);
+        needsExtracting = !pageText->text;
+    }
 
-    if (!pageText->text) {
-        *pageText = engine->ExtractPageText(pageNo);
-        if (!pageText->text) {
-            pageText->text = str::Dup(L"");
-            pageText->len = 0;
+    // pages saved in a previous session only have to be copied
+    int nExtracted = 0;
+    bool fromCacheFile = false;
+    if (needsExtracting) {
+        ScopedCritSec scope(&access);
+        if (!pageText->text && GetCachedTextForPage(pageNo, pageText)) {
+            debugSize += (pageText->len + 1) * (int)(sizeof(WCHAR) + sizeof(Rect));
+            nExtracted = nPagesExtracted.Inc();
+            fromCacheFile = true;
         }
-        debugSize += (pageText->len + 1) * (int)(sizeof(WCHAR) + sizeof(Rect));
+        needsExtracting = !pageText->text;
+    }
+
+    // engines serialize access to the document themselves so extracting
+    // doesn't block other pages from being extracted or queried.
+    // once set, pagesText[] entries don't change until the cache is deleted
+    if (needsExtracting) {
+        PageText extracted = engine->ExtractPageText(pageNo);
+        ScopedCritSec scope(&access);
+        if (pageText->text) {
+            // another thread extracted this page in the meantime
+            FreePageText(&extracted);
+        } else {
+            *pageText = extracted;
+            if (!pageText->text) {
+                pageText->text = str::Dup(L"");
+                pageText->len = 0;
+            }
+            debugSize += (pageText->len + 1) * (int)(sizeof(WCHAR) + sizeof(Rect));
+            nExtracted = nPagesExtracted.Inc();
+        }
+    }
+    // only the thread that extracted the last page gets here
+    if (nExtracted == nPages && !fromCacheFile && !cacheFileData) {
+        SaveCacheFile();
     }
 
     if (lenOut) {
@@ -75,6 +251,57 @@ const WCHAR* DocumentTextCache::GetTextForPage(int pageNo, int* lenOut, Rect** c
     return pageText->text;
 }
 
+static void ExtractTextThread(DocumentTextCache* tc) {
+    // below normal (and not idle) priority because the workers take the engine's
+    // locks and shouldn't starve rendering threads waiting for them
+    SetThreadPriority(GetCurrentThread(), THREAD_PRIORITY_BELOW_NORMAL);
+    while (tc->abortExtracting.Get() == 0) {
+        int pageNo = tc->nextPageToExtract.Inc();
+        if (pageNo > tc->nPages) {
+            break;
+        }
+        tc->GetTextForPage(pageNo);
+    }
+}
+
+// extract text of all pages on background threads so that searching
+// the whole document only has to wait for string matching
+void DocumentTextCache::StartExtractingAll() {
+    if (extractThreadsCount > 0 || nPages == 0) {
+        return;
+    }
+    SYSTEM_INFO si{};
+    GetSystemInfo(&si);
+    int nThreads = limitValue((int)si.dwNumberOfProcessors - 1, 1, MAX_TEXT_EXTRACT_THREADS);
+    nThreads = std::min(nThreads, nPages);
+    for (int i = 0; i < nThreads; i++) {
+        auto fn = MkFunc0<DocumentTextCache>(ExtractTextThread, this);
+        HANDLE h = StartThread(fn, "ExtractTextThread");
+        if (!h) {
+            break;
+        }
+        extractThreads[extractThreadsCount++] = h;
+    }
+    logf("DocumentTextCache: extracting text of %d pages with %d threads\n", nPages, extractThreadsCount);
+}
+
+void DocumentTextCache::AbortExtracting() {
+    if (extractThreadsCount == 0) {
+        return;
+    }
+    abortExtracting.Set(1);
+    WaitForMultipleObjects((DWORD)extractThreadsCount, extractThreads, TRUE, INFINITE);
+    for (int i = 0; i < extractThreadsCount; i++) {
+        CloseHandle(extractThreads[i]);
+        extractThreads[i] = nullptr;
+    }
+    extractThreadsCount = 0;
+}
+
+int DocumentTextCache::PagesExtracted() const {
+    return nPagesExtracted.Get();
+}
+
 TextSelection::TextSelection(EngineBase* engine, DocumentTextCache* textCache) : engine(engine), textCache(textCache) {
 }
 
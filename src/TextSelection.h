@@ -1,19 +1,50 @@
 /* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
    License: GPLv3 */
 
+#define MAX_TEXT_EXTRACT_THREADS 4
+
 struct DocumentTextCache {
     EngineBase* engine = nullptr;
     int nPages = 0;
     PageText* pagesText = nullptr;
     int debugSize = 0;
 
+    // protects pagesText. Text is extracted without holding it
+    // so that the cache can be queried while it's being filled
     CRITICAL_SECTION access;
 
+    // background extraction of text of all pages, see StartExtractingAll()
+    HANDLE extractThreads[MAX_TEXT_EXTRACT_THREADS] = {};
+    int extractThreadsCount = 0;
+    AtomicInt nextPageToExtract;
+    AtomicInt nPagesExtracted;
+    // set to 1 by AbortExtracting(), read by the extraction threads
+    AtomicInt abortExtracting;
+
+    // text saved to disk in a previous session, mapped into memory on first use
+    // (nullptr if the engine's text can't be cached, see EngineBase::GetLayoutKey())
+    char* cacheFilePath = nullptr;
+    // identifies the engine, its layout and encoding the text was extracted with
+    u8 cacheKey[16] = {};
+    bool triedLoadingCacheFile = false;
+    HANDLE cacheFileMapping = nullptr;
+    const u8* cacheFileData = nullptr;
+    i64 cacheFileSize = 0;
+
     explicit DocumentTextCache(EngineBase* engine);
     ~DocumentTextCache();
 
     bool HasTextForPage(int pageNo) const;
     const WCHAR* GetTextForPage(int pageNo, int* lenOut = nullptr, Rect** coordsOut = nullptr);
+
+    void StartExtractingAll();
+    void AbortExtracting();
+    // number of pages whose text is available without extracting it
+    int PagesExtracted() const;
+
+    bool LoadCacheFile();
+    bool GetCachedTextForPage(int pageNo, PageText* pageText);
+    void SaveCacheFile();
 };
 
 // TODO: replace with Vec<TextSel>
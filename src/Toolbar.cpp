@@ -906,6 +906,11 @@ void UpdateToolbarPageText(MainWindow* win, int pageCount, bool updateOnly) {
         size2.dx = 0;
     } else if (!win->ctrl || !win->ctrl->HasPageLabels()) {
         txt = str::FormatTemp(" / %d", pageCount);
+        DisplayModel* dm = win->AsFixed();
+        if (dm && dm->GetEngine()->IsPageCountProvisional()) {
+            // more pages are still being layed out
+            txt = str::FormatTemp(" / %d+", pageCount);
+        }
         size2 = HwndMeasureText(win->hwndPageTotal, txt);
         minSize.dx = size2.dx;
     } else {
@@ -82,6 +82,7 @@ class FontListItem {
         cf.style = style;
         cf.font = font;
         cf.hFont = hFont;
+        threadId = GetCurrentThreadId();
     }
     ~FontListItem() {
         str::Free(cf.name);
@@ -91,10 +92,14 @@ class FontListItem {
     }
 
     CachedFont cf;
+    // the thread the font was created for
+    DWORD threadId;
     FontListItem* next;
 };
 
 // Global, thread-safe font cache. Font objects live forever.
+// A Font cannot be used by several threads at once (e.g. ebooks are layed out
+// on several threads), so every thread gets its own Font objects.
 static FontListItem* gFontsCache = nullptr;
 
 // Graphics objects cannot be used across threads. We have a per-thread
@@ -203,13 +208,14 @@ HFONT CachedFont::GetHFont() {
 }
 
 // convenience function: given cached style, get a Font object matching the font
-// properties.
+// properties, which must only be used on the calling thread.
 // Caller should not delete the font - it's cached for performance and deleted at exit
 CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style) {
     ScopedMuiCritSec muiCs;
 
+    DWORD threadId = GetCurrentThreadId();
     for (FontListItem* item = gFontsCache; item; item = item->next) {
-        if (item->cf.SameAs(name, sizePt, style) && item->cf.font != nullptr) {
+        if (item->threadId == threadId && item->cf.SameAs(name, sizePt, style) && item->cf.font != nullptr) {
             return &item->cf;
         }
     }
@@ -221,8 +227,10 @@ CachedFont* GetCachedFont(const WCHAR* name, float sizePt, FontStyle style) {
         if (font->GetLastStatus() != Status::Ok) {
             // if no font is available, return the last successfully created one
             delete font;
-            if (gFontsCache) {
-                return &gFontsCache->cf;
+            for (FontListItem* item = gFontsCache; item; item = item->next) {
+                if (item->threadId == threadId) {
+                    return &item->cf;
+                }
             }
             return nullptr;
         }
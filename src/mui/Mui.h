@@ -2,6 +2,9 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 struct TxtNode;
+struct fz_context;
+struct fz_font;
+struct text_shaper;
 
 using Gdiplus::FontStyle;
 using Gdiplus::Graphics;
@@ -1,11 +1,31 @@
 /* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
    License: Simplified BSD (see COPYING.BSD) */
 
+#pragma warning(disable : 4611) // interaction between '_setjmp' and C++ object destruction is non-portable
+
+extern "C" {
+#include <mupdf/fitz.h>
+}
+
 #include "utils/BaseUtil.h"
+#include "utils/Dict.h"
 #include "utils/WinUtil.h"
 #include "utils/GdiPlusUtil.h"
 #include "utils/HtmlParserLookup.h"
+#include "utils/ThreadUtil.h"
 #include "Mui.h"
+#include "FzImgReader.h"
+
+// in mupdf_load_system_font.c
+extern "C" void install_load_windows_font_funcs(fz_context* ctx);
+
+// in mupdf_measure_text.c
+extern "C" {
+text_shaper* new_text_shaper(fz_context* ctx);
+void drop_text_shaper(fz_context* ctx, text_shaper* shaper);
+float measure_text_shaped(fz_context* ctx, text_shaper* shaper, fz_font* font, const unsigned short* s, int len);
+float measure_kerning(fz_context* ctx, fz_font* font, int c1, int c2);
+}
 
 /*
 TODO:
@@ -477,6 +497,361 @@ TextRenderHdc::~TextRenderHdc() {
     DeleteDC(hdc);
 }
 
+// kerning (in em) of pairs of characters in the Basic Multilingual Plane
+struct KerningCache {
+    // open addressing, keys are (c1 << 16) | c2 and 0 for an empty slot
+    Vec<u32> keys;
+    Vec<float> kerns;
+    int count = 0;
+
+    bool Find(u32 key, float* kernOut) const;
+    void Add(u32 key, float kern);
+};
+
+static u32 KerningHash(u32 key) {
+    return key * 2654435761u;
+}
+
+bool KerningCache::Find(u32 key, float* kernOut) const {
+    if (keys.Size() == 0) {
+        return false;
+    }
+    u32 mask = (u32)keys.Size() - 1;
+    for (u32 i = KerningHash(key) & mask;; i = (i + 1) & mask) {
+        u32 k = keys.at(i);
+        if (k == key) {
+            *kernOut = kerns.at(i);
+            return true;
+        }
+        if (k == 0) {
+            return false;
+        }
+    }
+}
+
+static void InsertKerning(Vec<u32>& keys, Vec<float>& kerns, u32 key, float kern) {
+    u32 mask = (u32)keys.Size() - 1;
+    u32 i = KerningHash(key) & mask;
+    while (keys.at(i) != 0) {
+        i = (i + 1) & mask;
+    }
+    keys.at(i) = key;
+    kerns.at(i) = kern;
+}
+
+void KerningCache::Add(u32 key, float kern) {
+    ReportIf(key == 0);
+    count++;
+    // keep at least half of the slots empty, so that lookups stay short
+    if (count * 2 > keys.Size()) {
+        Vec<u32> oldKeys = keys;
+        Vec<float> oldKerns = kerns;
+        int size = std::max(keys.Size() * 2, 256);
+        keys.SetSize(size);
+        kerns.SetSize(size);
+        for (int i = 0; i < oldKeys.Size(); i++) {
+            if (oldKeys.at(i) != 0) {
+                InsertKerning(keys, kerns, oldKeys.at(i), oldKerns.at(i));
+            }
+        }
+    }
+    InsertKerning(keys, kerns, key, kern);
+}
+
+// metrics of a font, measured as they're needed:
+// - advances (in em) of the characters in the Basic Multilingual Plane, in blocks of 256
+//   characters which are filled in when one of their characters is first measured
+// - kerning of pairs of those characters, for fonts without OpenType tables
+// - widths (in em) of shaped text runs. those are mostly words which repeat a lot
+struct FzFontMetrics {
+    CachedFont* cachedFont = nullptr;
+    fz_font* font = nullptr;
+    // if set, all text runs are shaped
+    bool hasOpenType = false;
+    // in em
+    float lineSpacing = 0;
+    float* advances[256]{};
+    KerningCache kerning;
+    // maps UTF-8 text runs to the index of their width in runWidths
+    dict::MapStrToInt runToIdx{1024};
+    Vec<float> runWidths;
+};
+
+static Mutex gFzMeasureCtxMutex;
+static fz_context* gFzMeasureCtx = nullptr;
+
+// TextRenderMupdf instances use clones of this context, so it's never freed
+static fz_context* GetFzMeasureCtx() {
+    gFzMeasureCtxMutex.Lock();
+    if (!gFzMeasureCtx) {
+        gFzMeasureCtx = fz_new_context_windows(kFzStoreDefault);
+        if (gFzMeasureCtx) {
+            install_load_windows_font_funcs(gFzMeasureCtx);
+        }
+    }
+    gFzMeasureCtxMutex.Unlock();
+    return gFzMeasureCtx;
+}
+
+// the same font GDI+ would use, falls back to Times (same as GetCachedFont())
+static fz_font* LoadFzFont(fz_context* ctx, const WCHAR* name, FontStyle style) {
+    bool bold = (style & Gdiplus::FontStyleBold) != 0;
+    bool italic = (style & Gdiplus::FontStyleItalic) != 0;
+    TempStr family = ToUtf8Temp(name);
+    // mupdf_load_system_font.c finds styled fonts by their PostScript name e.g. "Georgia,BoldItalic"
+    TempStr styled = family;
+    if (bold || italic) {
+        styled = str::JoinTemp(family, bold ? ",Bold" : ",", italic ? "Italic" : "");
+    }
+    const char* names[] = {styled, family};
+    fz_font* font = nullptr;
+    for (const char* fontName : names) {
+        fz_try(ctx) {
+            font = fz_load_system_font(ctx, fontName, bold, italic, 0);
+        }
+        fz_catch(ctx) {
+            font = nullptr;
+        }
+        if (font) {
+            return font;
+        }
+    }
+    fz_try(ctx) {
+        font = fz_new_base14_font(ctx, "Times-Roman");
+    }
+    fz_catch(ctx) {
+        font = nullptr;
+    }
+    return font;
+}
+
+TextRenderMupdf* TextRenderMupdf::Create(Graphics* gfx) {
+    fz_context* baseCtx = GetFzMeasureCtx();
+    fz_context* ctx = baseCtx ? fz_clone_context(baseCtx) : nullptr;
+    if (!ctx) {
+        return nullptr;
+    }
+    text_shaper* shaper = nullptr;
+    fz_try(ctx) {
+        shaper = new_text_shaper(ctx);
+    }
+    fz_catch(ctx) {
+        fz_drop_context(ctx);
+        return nullptr;
+    }
+    TextRenderMupdf* res = new TextRenderMupdf();
+    res->ctx = ctx;
+    res->shaper = shaper;
+    res->gfx = gfx;
+    if (gfx) {
+        res->dpi = gfx->GetDpiY();
+    }
+    // default to red to make mistakes stand out
+    res->SetTextColor(Color(0xff, 0xff, 0x0, 0x0));
+    return res;
+}
+
+TextRenderMupdf::~TextRenderMupdf() {
+    for (FzFontMetrics* metrics : fontMetrics) {
+        for (float* advances : metrics->advances) {
+            free(advances);
+        }
+        fz_drop_font(ctx, metrics->font);
+        delete metrics;
+    }
+    drop_text_shaper(ctx, shaper);
+    fz_drop_context(ctx);
+    delete textColorBrush;
+}
+
+void TextRenderMupdf::SetFont(CachedFont* font) {
+    currFont = font;
+    for (FzFontMetrics* metrics : fontMetrics) {
+        if (metrics->cachedFont == font) {
+            currMetrics = metrics;
+            return;
+        }
+    }
+    currMetrics = new FzFontMetrics();
+    currMetrics->cachedFont = font;
+    currMetrics->font = LoadFzFont(ctx, font->name, font->style);
+    if (currMetrics->font) {
+        fz_font* f = currMetrics->font;
+        currMetrics->lineSpacing = fz_font_ascender(ctx, f) - fz_font_descender(ctx, f);
+        currMetrics->hasOpenType = fz_font_flags(f)->has_opentype != 0;
+    }
+    fontMetrics.Append(currMetrics);
+}
+
+float TextRenderMupdf::EmToPx() const {
+    return currFont->sizePt * dpi / 72.f;
+}
+
+float TextRenderMupdf::GetCurrFontLineSpacing() {
+    return currMetrics->lineSpacing * EmToPx();
+}
+
+// advance of character c in em, including characters taken from fallback fonts
+float TextRenderMupdf::CharAdvance(int c) {
+    if (!currMetrics->font) {
+        return 0;
+    }
+    float* advances = nullptr;
+    if (c < 0x10000) {
+        advances = currMetrics->advances[c >> 8];
+        if (!advances) {
+            advances = AllocArray<float>(256);
+            for (int i = 0; i < 256; i++) {
+                advances[i] = -1;
+            }
+            currMetrics->advances[c >> 8] = advances;
+        }
+        if (advances[c & 0xff] >= 0) {
+            return advances[c & 0xff];
+        }
+    }
+    float adv = 0;
+    fz_try(ctx) {
+        fz_font* font = currMetrics->font;
+        int gid = fz_encode_character_with_fallback(ctx, currMetrics->font, c, 0, 0, &font);
+        adv = fz_advance_glyph(ctx, font, gid, 0);
+    }
+    fz_catch(ctx) {
+        adv = 0;
+    }
+    if (advances) {
+        advances[c & 0xff] = adv;
+    }
+    return adv;
+}
+
+// kerning of characters c1 and c2 in em, from the 'kern' table of fonts without OpenType tables
+float TextRenderMupdf::Kerning(int c1, int c2) {
+    u32 key = ((u32)c1 << 16) | (u32)c2;
+    float kern = 0;
+    if (currMetrics->kerning.Find(key, &kern)) {
+        return kern;
+    }
+    fz_try(ctx) {
+        kern = measure_kerning(ctx, currMetrics->font, c1, c2);
+    }
+    fz_catch(ctx) {
+        kern = 0;
+    }
+    currMetrics->kerning.Add(key, kern);
+    return kern;
+}
+
+// mupdf doesn't shape Latin, Greek and Cyrillic text in fonts without OpenType tables either
+static bool NeedsShaping(const WCHAR* s, size_t sLen) {
+    for (size_t i = 0; i < sLen; i++) {
+        WCHAR c = s[i];
+        // combining diacritical marks and everything from Armenian and Hebrew on
+        if (c == 0 || (c >= 0x300 && c < 0x370) || c >= 0x530) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// width of s in em from the cached advances and kerning of its characters
+float TextRenderMupdf::SimpleAdvance(const WCHAR* s, size_t sLen) {
+    float dx = 0;
+    int prev = 0;
+    for (size_t i = 0; i < sLen; i++) {
+        int c = s[i];
+        dx += CharAdvance(c);
+        if (prev != 0) {
+            dx += Kerning(prev, c);
+        }
+        prev = c;
+    }
+    return dx;
+}
+
+// width of s in em, shaped as a whole and cached
+float TextRenderMupdf::ShapedAdvance(const WCHAR* s, size_t sLen) {
+    TempStr run = ToUtf8Temp(s, sLen);
+    int idx;
+    if (currMetrics->runToIdx.Get(run, &idx)) {
+        return currMetrics->runWidths.at(idx);
+    }
+    float dx = 0;
+    bool ok = true;
+    fz_try(ctx) {
+        dx = measure_text_shaped(ctx, shaper, currMetrics->font, (const unsigned short*)s, (int)sLen);
+    }
+    fz_catch(ctx) {
+        ok = false;
+    }
+    if (!ok) {
+        // e.g. FreeType couldn't set the size, add up the advances instead
+        dx = 0;
+        for (size_t i = 0; i < sLen; i++) {
+            int c = s[i];
+            if (IS_HIGH_SURROGATE(c) && i + 1 < sLen && IS_LOW_SURROGATE(s[i + 1])) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (s[i + 1] - 0xDC00);
+                i++;
+            }
+            dx += CharAdvance(c);
+        }
+    }
+    currMetrics->runToIdx.Insert(run, currMetrics->runWidths.Size());
+    currMetrics->runWidths.Append(dx);
+    return dx;
+}
+
+RectF TextRenderMupdf::Measure(const WCHAR* s, size_t sLen) {
+    ReportIf(!currFont);
+    float dx = 0;
+    if (currMetrics->font && sLen > 0) {
+        if (currMetrics->hasOpenType || NeedsShaping(s, sLen)) {
+            dx = ShapedAdvance(s, sLen);
+        } else {
+            dx = SimpleAdvance(s, sLen);
+        }
+    }
+    float emPx = EmToPx();
+    return RectF(0, 0, dx * emPx, currMetrics->lineSpacing * emPx);
+}
+
+RectF TextRenderMupdf::Measure(const char* s, size_t sLen) {
+    ReportIf(!currFont);
+    WCHAR* buf = ToWStrTemp(s, sLen);
+    size_t strLen = str::Len(buf);
+    return Measure(buf, strLen);
+}
+
+void TextRenderMupdf::SetTextColor(Gdiplus::Color col) {
+    if (textColor.GetValue() == col.GetValue()) {
+        return;
+    }
+    textColor = col;
+    delete textColorBrush;
+    textColorBrush = new SolidBrush(col);
+}
+
+void TextRenderMupdf::Draw(const WCHAR* s, size_t sLen, const RectF bb, bool isRtl) {
+    if (!gfx) {
+        return;
+    }
+    Gdiplus::PointF pos = ToGdipPointF(bb.TL());
+    if (!isRtl) {
+        gfx->DrawString(s, (INT)sLen, currFont->font, pos, nullptr, textColorBrush);
+    } else {
+        StringFormat rtl;
+        rtl.SetFormatFlags(StringFormatFlagsDirectionRightToLeft);
+        pos.X += bb.dx;
+        gfx->DrawString(s, (INT)sLen, currFont->font, pos, &rtl, textColorBrush);
+    }
+}
+
+void TextRenderMupdf::Draw(const char* s, size_t sLen, const RectF bb, bool isRtl) {
+    WCHAR* buf = ToWStrTemp(s, sLen);
+    size_t strLen = str::Len(buf);
+    Draw(buf, strLen, bb, isRtl);
+}
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy) {
     ITextRender* res = nullptr;
     if (TextRenderMethod::Gdiplus == method) {
@@ -491,6 +866,18 @@ ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, in
     if (TextRenderMethod::Hdc == method) {
         res = TextRenderHdc::Create(gfx, dx, dy);
     }
+    if (TextRenderMethod::Mupdf == method) {
+        res = TextRenderMupdf::Create(gfx);
+        if (!res && !gfx) {
+            // the caller has to fall back to a method that needs a Graphics
+            return nullptr;
+        }
+        if (!res) {
+            // couldn't create a mupdf context
+            method = TextRenderMethod::GdiplusQuick;
+            res = TextRenderGdiplus::Create(gfx, MeasureTextQuick);
+        }
+    }
     ReportIf(!res);
     if (res) {
         res->method = method;
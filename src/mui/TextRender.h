@@ -6,6 +6,7 @@ enum class TextRenderMethod {
     GdiplusQuick, // uses MeasureTextQuick
     Gdi,
     Hdc,
+    Mupdf, // uses glyph advances from FreeType (through mupdf), doesn't need GDI for measuring
     // TODO: implement TextRenderDirectDraw
     // TextRenderDirectDraw
 };
@@ -168,6 +169,60 @@ class TextRenderHdc : public ITextRender {
     ~TextRenderHdc() override;
 };
 
+struct FzFontMetrics;
+
+// measures text with the font files also used by GDI, loaded through mupdf. Text runs
+// are shaped as a whole with HarfBuzz and their widths are cached per CachedFont. Runs
+// of fonts without OpenType tables in simple scripts are measured with cached glyph
+// advances and kerning instead (like mupdf does).
+// Unlike the other ITextRender implementations, this works without a HDC or Graphics and
+// can be used from any thread (each instance has its own mupdf context).
+// Drawing still uses GDI+ (if gfx is set)
+class TextRenderMupdf : public ITextRender {
+  private:
+    fz_context* ctx = nullptr;
+    text_shaper* shaper = nullptr;
+    // can be nullptr, we don't own gfx and currFont
+    Gdiplus::Graphics* gfx = nullptr;
+    float dpi = 96.f;
+    CachedFont* currFont = nullptr;
+    FzFontMetrics* currMetrics = nullptr;
+    Vec<FzFontMetrics*> fontMetrics;
+    Gdiplus::Color textColor{};
+    Gdiplus::Brush* textColorBrush = nullptr;
+
+    TextRenderMupdf() = default;
+
+    float CharAdvance(int c);
+    float Kerning(int c1, int c2);
+    float SimpleAdvance(const WCHAR* s, size_t sLen);
+    float ShapedAdvance(const WCHAR* s, size_t sLen);
+    float EmToPx() const;
+
+  public:
+    static TextRenderMupdf* Create(Gdiplus::Graphics* gfx);
+
+    void SetFont(CachedFont* font) override;
+    void SetTextColor(Gdiplus::Color col) override;
+    void SetTextBgColor(Gdiplus::Color) override {
+    }
+
+    float GetCurrFontLineSpacing() override;
+
+    RectF Measure(const char* s, size_t sLen) override;
+    RectF Measure(const WCHAR* s, size_t sLen) override;
+
+    void Lock() override {
+    }
+    void Unlock() override {
+    }
+
+    void Draw(const char* s, size_t sLen, RectF bb, bool isRtl) override;
+    void Draw(const WCHAR* s, size_t sLen, RectF bb, bool isRtl) override;
+
+    ~TextRenderMupdf() override;
+};
+
 ITextRender* CreateTextRender(TextRenderMethod method, Graphics* gfx, int dx, int dy);
 
 size_t StringLenForWidth(ITextRender* textMeasure, const WCHAR* s, size_t len, float dx);
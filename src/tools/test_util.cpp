@@ -27,6 +27,7 @@ extern void StrTest();
 extern void TrivialHtmlParser_UnitTests();
 extern void VecTest();
 extern void WinUtilTest();
+extern void WordIndexTest();
 extern void StrFormatTest();
 extern void StrVecTest();
 
@@ -52,6 +53,7 @@ int main(int, char**) {
     TrivialHtmlParser_UnitTests();
     VecTest();
     WinUtilTest();
+    WordIndexTest();
     GurupiaReader_UnitTests();
 
     int res = utassert_print_results();
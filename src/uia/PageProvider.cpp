@@ -145,7 +145,7 @@ HRESULT STDMETHODCALLTYPE ReaderUIAutomationPageProvider::get_BoundingRectangle(
     }
 
     // some engines might not support GetPageInfo
-    const PageInfo* page = dm->GetPageInfo(pageNum);
+    const PageInfo* page = dm->GetPageInfoOnScreen(pageNum);
     if (!page) {
         return E_FAIL;
     }
@@ -160,6 +160,42 @@ ByteSlice MultiFormatArchive::GetFileDataById(size_t fileId) {
     return {data, size};
 }
 
+// decompresses only the first maxSize bytes of a file (e.g. for reading image headers)
+// only supported for .zip and .tar files (for solid .rar and .7z files this
+// would have to decompress everything before the file each time)
+// the caller must free()
+ByteSlice MultiFormatArchive::GetFileDataPrefixById(size_t fileId, size_t maxSize) {
+    if (fileId == (size_t)-1) {
+        return {};
+    }
+    ReportIf(fileId >= fileInfos_.size());
+
+    auto* fileInfo = fileInfos_[fileId];
+    size_t size = std::min(fileInfo->fileSizeUncompressed, maxSize);
+    if (fileInfo->data != nullptr) {
+        u8* data = (u8*)memdup(fileInfo->data, size, ZERO_PADDING_COUNT);
+        return {data, data ? size : 0};
+    }
+    if (Format::Zip != format && Format::Tar != format) {
+        return {};
+    }
+    if (LoadedUsingUnrarDll() || !ar_) {
+        return {};
+    }
+    if (!ar_parse_entry_at(ar_, fileInfo->filePos)) {
+        return {};
+    }
+    u8* data = AllocArray<u8>(size + ZERO_PADDING_COUNT);
+    if (!data) {
+        return {};
+    }
+    if (!ar_entry_uncompress(ar_, data, size)) {
+        free(data);
+        return {};
+    }
+    return {data, size};
+}
+
 const char* MultiFormatArchive::GetComment() {
     if (!ar_) {
         return nullptr;
@@ -38,6 +38,7 @@ class MultiFormatArchive {
 
     ByteSlice GetFileDataByName(const char* filename);
     ByteSlice GetFileDataById(size_t fileId);
+    ByteSlice GetFileDataPrefixById(size_t fileId, size_t maxSize);
 
     const char* GetComment();
 
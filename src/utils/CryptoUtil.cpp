@@ -3,6 +3,7 @@
 
 #include "utils/BaseUtil.h"
 #include "utils/CryptoUtil.h"
+#include "utils/FileUtil.h"
 
 #ifndef DWORD_MAX
 #define DWORD_MAX 0xffffffffUL
@@ -126,3 +127,27 @@ CleanUp:
     }
     return ok;
 }
+
+// path of a file in cacheDir with data derived from the content of filePath.
+// its name is a fingerprint of path, size and modification time of the file,
+// so that the cached data doesn't get used after the file has changed
+TempStr GetCachePathForFileTemp(const char* filePath, const char* cacheDir, const char* ext) {
+    if (!filePath || !cacheDir) {
+        return nullptr;
+    }
+    i64 size = file::GetSize(filePath);
+    if (size <= 0) {
+        return nullptr;
+    }
+    TempStr path = str::DupTemp(filePath);
+    if (path::HasVariableDriveLetter(path)) {
+        // ignore the drive letter, if it might change
+        path[0] = '?';
+    }
+    FILETIME ft = file::GetModificationTime(filePath);
+    TempStr key = str::FormatTemp("%s|%lld|%08x%08x", path, size, ft.dwHighDateTime, ft.dwLowDateTime);
+    u8 digest[16]{};
+    CalcMD5Digest((u8*)key, str::Leni(key), digest);
+    AutoFreeStr fingerPrint = str::MemToHex(digest, dimof(digest));
+    return path::JoinTemp(cacheDir, str::JoinTemp(fingerPrint, ext));
+}
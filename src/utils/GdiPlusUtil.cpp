@@ -11,6 +11,7 @@
 #include "utils/WebpReader.h"
 #include "utils/AvifReader.h"
 #include "utils/WinUtil.h"
+#include "utils/ThreadUtil.h"
 #include "utils/GdiPlusUtil.h"
 
 #if COMPILER_MSVC
@@ -122,11 +123,14 @@ RectF MeasureTextStandard(Graphics* g, Font* f, const WCHAR* s, int len) {
 RectF MeasureTextQuick(Graphics* g, Font* f, const WCHAR* s, int len) {
     ReportIf(0 >= len);
 
+    // ebooks are layed out on several threads at once
+    static Mutex cacheMutex;
     static Vec<Font*> fontCache;
     static Vec<bool> fixCache;
 
     Gdiplus::RectF bbox;
     g->MeasureString(s, len, f, Gdiplus::PointF(0, 0), &bbox);
+    cacheMutex.Lock();
     int idx = fontCache.Find(f);
     if (-1 == idx) {
         LOGFONTW lfw;
@@ -138,8 +142,10 @@ RectF MeasureTextQuick(Graphics* g, Font* f, const WCHAR* s, int len) {
         fixCache.Append(isItalicOrMonospace);
         idx = (int)fontCache.size() - 1;
     }
+    bool noAdjust = fixCache.at(idx);
+    cacheMutex.Unlock();
     // most documents look good enough with these adjustments
-    if (!fixCache.at(idx)) {
+    if (!noAdjust) {
         float correct = 0;
         for (int i = 0; i < len; i++) {
             switch (s[i]) {
@@ -593,8 +599,9 @@ static bool AvifSizeFromData(ByteReader r, Size& result) {
 }
 
 // adapted from http://cpansearch.perl.org/src/RJRAY/Image-Size-3.230/lib/Image/Size.pm
-Size BitmapSizeFromData(const ByteSlice& d) {
-    Size result;
+// only parses the image header, so d can be just the beginning of the image data
+// returns false if the size couldn't be determined that way
+bool BitmapSizeFromHeader(const ByteSlice& d, Size& result) {
     bool ok = false;
     Kind kind = GuessFileTypeFromContent(d);
 
@@ -618,7 +625,12 @@ Size BitmapSizeFromData(const ByteSlice& d) {
     } else if (kind == kindFileAvif || kind == kindFileHeic) {
         ok = AvifSizeFromData(r, result);
     }
-    if (ok && !result.IsEmpty()) {
+    return ok && !result.IsEmpty();
+}
+
+Size BitmapSizeFromData(const ByteSlice& d) {
+    Size result;
+    if (BitmapSizeFromHeader(d, result)) {
         return result;
     }
 
@@ -21,5 +21,6 @@ void GetBaseTransform(Gdiplus::Matrix& m, Gdiplus::RectF pageRect, float zoom, i
 
 Gdiplus::Bitmap* BitmapFromDataWin(const ByteSlice& bmpData);
 Size BitmapSizeFromData(const ByteSlice&);
+bool BitmapSizeFromHeader(const ByteSlice&, Size& size);
 CLSID GetEncoderClsid(const WCHAR* format);
 RenderedBitmap* LoadRenderedBitmapWin(const char* path);
@@ -0,0 +1,350 @@
+/* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/WinUtil.h"
+#include "utils/StrSearch.h"
+
+#if !IS_ARM_64
+#include <intrin.h>
+#include <immintrin.h>
+#endif
+
+// MSVC allows using AVX2 intrinsics without /arch:AVX2, clang and gcc need to be told
+#if defined(__clang__) || defined(__GNUC__)
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#else
+#define TARGET_AVX2
+#endif
+
+// Finding matches is split in two: a fast scan for the first character of the pattern
+// (8 or 16 characters at a time with SSE2 resp. AVX2) and a scalar verification
+// of the whole pattern at each candidate position. The verification has the
+// same rules as TextSearch::MatchEnd() so that both find the same matches.
+
+namespace str {
+
+static constexpr int kNoMatch = -2;
+
+// same as isWordChar() in TextSelection.cpp
+static bool IsWordChar(WCHAR c) {
+    return IsCharAlphaNumericW(c) || c == '_';
+}
+
+// ignore spaces between CJK glyphs but not between Latin, Greek, Cyrillic, etc. letters
+static bool IsNonCjkWordChar(WCHAR c) {
+    return IsWordChar(c) && c < 0x2E80;
+}
+
+static inline WCHAR CharToLower(WCHAR c) {
+    if (c < 'A') {
+        return c;
+    }
+    if (c <= 'Z') {
+        return c + 32;
+    }
+    if (c <= 'z') {
+        return c;
+    }
+    WCHAR buf[1] = {c};
+    CharLowerBuffW(buf, 1);
+    return buf[0];
+}
+
+static WCHAR CharToUpper(WCHAR c) {
+    WCHAR buf[1] = {c};
+    CharUpperBuffW(buf, 1);
+    return buf[0];
+}
+
+// characters whose lower case is not the lower case of their upper case
+// i.e. that wouldn't be found by only looking for the upper and lower case
+static const WCHAR gLowerToExtraChar[][2] = {
+    {'k', 0x212A},    // KELVIN SIGN
+    {'i', 0x0130},    // LATIN CAPITAL LETTER I WITH DOT ABOVE
+    {0x00E5, 0x212B}, // ANGSTROM SIGN
+    {0x03C9, 0x2126}, // OHM SIGN
+    {0x01C6, 0x01C5}, // title case digraphs
+    {0x01C9, 0x01C8},
+    {0x01CC, 0x01CB},
+    {0x01F3, 0x01F2},
+};
+
+// characters in the pattern that match more than one character in the text
+static bool IsFuzzyChar(WCHAR c) {
+    return IsWs(c) || c == '-' || c == '\'' || c == '"';
+}
+
+static bool CharsMatch(WCHAR m, WCHAR c, bool caseSensitive) {
+    if (m == c) {
+        return true;
+    }
+    if (!caseSensitive && m == CharToLower(c)) {
+        return true;
+    }
+    if (IsWs(m)) {
+        // all whitespace is identical
+        return IsWs(c);
+    }
+    // Adobe Reader also matches certain hard-to-type Unicode
+    // characters when searching for easy-to-type homoglyphs
+    if (m == '-') {
+        // HYPHEN-MINUS also matches HYPHEN, NON-BREAKING HYPHEN, FIGURE DASH, EN DASH and EM DASH
+        return 0x2010 <= c && c <= 0x2014;
+    }
+    if (m == '\'') {
+        // APOSTROPHE also matches LEFT/RIGHT SINGLE QUOTATION MARK
+        return 0x2018 <= c && c <= 0x201b;
+    }
+    if (m == '"') {
+        // QUOTATION MARK also matches LEFT/RIGHT DOUBLE QUOTATION MARK
+        return 0x201c <= c && c <= 0x201f;
+    }
+    return false;
+}
+
+struct Matcher {
+    const WCHAR* text = nullptr;
+    int textLen = 0;
+    // lower-cased if not case sensitive
+    const WCHAR* pattern = nullptr;
+    SearchOptions opts;
+    Vec<SearchMatch>* matches = nullptr;
+    int nMatches = 0;
+
+    // characters that can start a match
+    WCHAR firsts[3]{};
+    int nFirsts = 0;
+    // true if the first character of the pattern matches many characters
+    bool anyFirst = false;
+
+    int MatchEnd(int start) const;
+    void TryAt(int start);
+};
+
+// returns the end of the match of the pattern at text[start], kNoMatch
+// or -1 if text ends within whitespace before the pattern was fully matched
+int Matcher::MatchEnd(int start) const {
+    if (opts.matchWordStart && start > 0 && IsWordChar(text[start - 1]) && IsWordChar(text[start])) {
+        return kNoMatch;
+    }
+    const WCHAR* match = pattern;
+    int end = start;
+    while (*match) {
+        if (end >= textLen) {
+            return kNoMatch;
+        }
+        WCHAR c = text[end];
+        bool lookingAtWs = IsWs(c);
+        if (!CharsMatch(*match, c, opts.caseSensitive)) {
+            return kNoMatch;
+        }
+        match++;
+        end++;
+        // treat "??" and "? ?" differently, since '?' could have been a word
+        // character that's just missing an encoding
+        if (*match && !IsNonCjkWordChar(match[-1]) && (match[-1] != '?' || *match != '?') ||
+            lookingAtWs && IsWs(match[-1])) {
+            while (IsWs(*match)) {
+                match++;
+            }
+            while (end < textLen && IsWs(text[end])) {
+                end++;
+            }
+            if (end >= textLen) {
+                // end of page is whitespace, too
+                return -1;
+            }
+        }
+    }
+    if (opts.matchWordEnd && end < textLen && IsWordChar(text[end - 1]) && IsWordChar(text[end])) {
+        return kNoMatch;
+    }
+    return end;
+}
+
+void Matcher::TryAt(int start) {
+    int end = MatchEnd(start);
+    if (end == kNoMatch) {
+        return;
+    }
+    nMatches++;
+    if (matches) {
+        matches->Append({start, end});
+    }
+}
+
+static void ScanScalar(Matcher& m, int start) {
+    const WCHAR* text = m.text;
+    int n = m.textLen;
+    if (m.anyFirst) {
+        for (int i = start; i < n; i++) {
+            if (CharsMatch(m.pattern[0], text[i], m.opts.caseSensitive)) {
+                m.TryAt(i);
+            }
+        }
+        return;
+    }
+    WCHAR c0 = m.firsts[0];
+    WCHAR c1 = m.firsts[1];
+    WCHAR c2 = m.firsts[2];
+    for (int i = start; i < n; i++) {
+        WCHAR c = text[i];
+        if (c == c0 || c == c1 || c == c2) {
+            m.TryAt(i);
+        }
+    }
+}
+
+#if !IS_ARM_64
+static void ScanSSE2(Matcher& m) {
+    const WCHAR* text = m.text;
+    int n = m.textLen;
+    __m128i c0 = _mm_set1_epi16((short)m.firsts[0]);
+    __m128i c1 = _mm_set1_epi16((short)m.firsts[1]);
+    __m128i c2 = _mm_set1_epi16((short)m.firsts[2]);
+    int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m128i v = _mm_loadu_si128((const __m128i*)(text + i));
+        __m128i eq = _mm_or_si128(_mm_cmpeq_epi16(v, c0), _mm_cmpeq_epi16(v, c1));
+        eq = _mm_or_si128(eq, _mm_cmpeq_epi16(v, c2));
+        // 2 bits per matching character
+        unsigned mask = (unsigned)_mm_movemask_epi8(eq);
+        while (mask) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            m.TryAt(i + (int)bit / 2);
+            mask &= ~(3u << bit);
+        }
+    }
+    ScanScalar(m, i);
+}
+
+TARGET_AVX2 static void ScanAVX2(Matcher& m) {
+    const WCHAR* text = m.text;
+    int n = m.textLen;
+    __m256i c0 = _mm256_set1_epi16((short)m.firsts[0]);
+    __m256i c1 = _mm256_set1_epi16((short)m.firsts[1]);
+    __m256i c2 = _mm256_set1_epi16((short)m.firsts[2]);
+    int i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i v = _mm256_loadu_si256((const __m256i*)(text + i));
+        __m256i eq = _mm256_or_si256(_mm256_cmpeq_epi16(v, c0), _mm256_cmpeq_epi16(v, c1));
+        eq = _mm256_or_si256(eq, _mm256_cmpeq_epi16(v, c2));
+        unsigned mask = (unsigned)_mm256_movemask_epi8(eq);
+        while (mask) {
+            unsigned long bit;
+            _BitScanForward(&bit, mask);
+            m.TryAt(i + (int)bit / 2);
+            mask &= ~(3u << bit);
+        }
+    }
+    _mm256_zeroupper();
+    ScanScalar(m, i);
+}
+#endif
+
+SearchKernel BestSearchKernel() {
+#if IS_ARM_64
+    return SearchKernel::Scalar;
+#else
+    // all Windows versions we support save AVX registers on context switches
+    static u32 cpu = CpuID();
+    if ((cpu & kCpuAVX) && (cpu & kCpuAVX2)) {
+        return SearchKernel::AVX2;
+    }
+    // SSE2 is the baseline for both 32-bit and 64-bit builds
+    return SearchKernel::SSE2;
+#endif
+}
+
+const char* SearchKernelName(SearchKernel kernel) {
+    switch (kernel) {
+        case SearchKernel::Best:
+            return SearchKernelName(BestSearchKernel());
+        case SearchKernel::Scalar:
+            return "scalar";
+        case SearchKernel::SSE2:
+            return "sse2";
+        case SearchKernel::AVX2:
+            return "avx2";
+    }
+    return "unknown";
+}
+
+// finds all positions in text at which pattern matches, including overlapping
+// matches, and returns their number. matches are in order of start
+int FindAllMatches(const WCHAR* text, int textLen, const WCHAR* pattern, const SearchOptions& opts,
+                   Vec<SearchMatch>* matches) {
+    if (!text || str::IsEmpty(pattern)) {
+        return 0;
+    }
+    if (textLen < 0) {
+        textLen = (int)str::Len(text);
+    }
+
+    Matcher m;
+    m.text = text;
+    m.textLen = textLen;
+    m.opts = opts;
+    m.matches = matches;
+
+    AutoFreeWStr lowered;
+    if (opts.caseSensitive) {
+        m.pattern = pattern;
+    } else {
+        lowered.Set(str::Dup(pattern));
+        for (WCHAR* s = lowered.Get(); *s; s++) {
+            *s = CharToLower(*s);
+        }
+        m.pattern = lowered.Get();
+    }
+
+    WCHAR first = m.pattern[0];
+    m.anyFirst = IsFuzzyChar(first);
+    m.firsts[m.nFirsts++] = first;
+    if (!opts.caseSensitive) {
+        WCHAR upper = CharToUpper(first);
+        if (upper != first) {
+            m.firsts[m.nFirsts++] = upper;
+        }
+        for (auto& lowerToExtra : gLowerToExtraChar) {
+            if (lowerToExtra[0] == first) {
+                m.firsts[m.nFirsts++] = lowerToExtra[1];
+                break;
+            }
+        }
+    }
+    // unused slots repeat the first character so that kernels don't need to check nFirsts
+    for (int i = m.nFirsts; i < (int)dimof(m.firsts); i++) {
+        m.firsts[i] = first;
+    }
+
+    SearchKernel kernel = opts.kernel;
+    if (kernel == SearchKernel::Best) {
+        kernel = BestSearchKernel();
+    }
+    if (m.anyFirst) {
+        kernel = SearchKernel::Scalar;
+    }
+#if IS_ARM_64
+    kernel = SearchKernel::Scalar;
+#endif
+
+    switch (kernel) {
+#if !IS_ARM_64
+        case SearchKernel::AVX2:
+            ScanAVX2(m);
+            break;
+        case SearchKernel::SSE2:
+            ScanSSE2(m);
+            break;
+#endif
+        default:
+            ScanScalar(m, 0);
+            break;
+    }
+    return m.nMatches;
+}
+
+} // namespace str
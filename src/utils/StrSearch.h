@@ -0,0 +1,37 @@
+/* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// finding all matches of a search pattern in (extracted) text, with the same
+// tolerance as TextSearch: case folding, all whitespace matching all whitespace
+// and some easy-to-type characters matching their typographic homoglyphs
+
+namespace str {
+
+enum class SearchKernel {
+    Best, // fastest available on this cpu
+    Scalar,
+    SSE2,
+    AVX2,
+};
+
+struct SearchOptions {
+    bool caseSensitive = false;
+    // don't match in the middle of a word
+    bool matchWordStart = false;
+    bool matchWordEnd = false;
+    SearchKernel kernel = SearchKernel::Best;
+};
+
+// match of a pattern in text[start, end). end is -1 if the text ended before
+// the whole pattern was matched after whitespace (which might continue on the next page)
+struct SearchMatch {
+    int start;
+    int end;
+};
+
+int FindAllMatches(const WCHAR* text, int textLen, const WCHAR* pattern, const SearchOptions& opts,
+                   Vec<SearchMatch>* matches);
+SearchKernel BestSearchKernel();
+const char* SearchKernelName(SearchKernel kernel);
+
+} // namespace str
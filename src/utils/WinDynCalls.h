@@ -61,17 +61,18 @@ typedef int(WINAPI* Sig_NormalizeString)(int, LPCWSTR, int, LPWSTR, int);
 NORMALIZ_API_LIST(API_DECLARATION)
 
 // kernel32.dll
-#define KERNEL32_API_LIST(V)     \
-    V(SetProcessDEPPolicy)       \
-    V(IsWow64Process)            \
-    V(GetProcessInformation)     \
-    V(SetDllDirectoryW)          \
-    V(SetDefaultDllDirectories)  \
-    V(RtlCaptureContext)         \
-    V(RtlCaptureStackBackTrace)  \
-    V(SetThreadDescription)      \
-    V(GetFinalPathNameByHandleW) \
-    V(SetProcessMitigationPolicy)
+#define KERNEL32_API_LIST(V)      \
+    V(SetProcessDEPPolicy)        \
+    V(IsWow64Process)             \
+    V(GetProcessInformation)      \
+    V(SetDllDirectoryW)           \
+    V(SetDefaultDllDirectories)   \
+    V(RtlCaptureContext)          \
+    V(RtlCaptureStackBackTrace)   \
+    V(SetThreadDescription)       \
+    V(GetFinalPathNameByHandleW)  \
+    V(SetProcessMitigationPolicy) \
+    V(PrefetchVirtualMemory)
 
 // TODO: only available in 20348, not yet present in SDK?
 // V(GetTempPath2W)
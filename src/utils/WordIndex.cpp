@@ -0,0 +1,186 @@
+/* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/Dict.h"
+#include "utils/StrVec.h"
+#include "utils/WordIndex.h"
+
+void WordIndex::AddWord(const char* word, int pageNo, int glyphIdx) {
+    ReportIf(finished);
+    int id = wordsById.Size();
+    const char* key = nullptr;
+    if (wordToId.Insert(word, id, &id, &key)) {
+        wordsById.Append(key);
+    }
+    positionWords.Append(id);
+    positions.Append({pageNo, glyphIdx});
+}
+
+// sorts the words and stores the positions of each word next to each other.
+// must be called after adding the last word and before looking up any
+void WordIndex::Finish() {
+    ReportIf(finished);
+    finished = true;
+    int nWords = wordsById.Size();
+    Vec<int> order;
+    for (int i = 0; i < nWords; i++) {
+        order.Append(i);
+    }
+    auto& words = wordsById;
+    std::sort(order.begin(), order.end(), [&words](int a, int b) { return strcmp(words[a], words[b]) < 0; });
+    idToIdx.SetSize(nWords);
+    for (int i = 0; i < nWords; i++) {
+        int id = order[i];
+        idToIdx[id] = i;
+        sortedWords.Append(words[id]);
+    }
+    wordsById.Reset();
+
+    int nPositions = positions.Size();
+    for (int i = 0; i < nPositions; i++) {
+        positionWords[i] = idToIdx[positionWords[i]];
+    }
+    postingsStart.SetSize(nWords + 1);
+    for (int idx : positionWords) {
+        postingsStart[idx + 1]++;
+    }
+    for (int i = 0; i < nWords; i++) {
+        postingsStart[i + 1] += postingsStart[i];
+    }
+    Vec<int> next;
+    next.SetSize(nWords);
+    postings.SetSize(nPositions);
+    for (int i = 0; i < nPositions; i++) {
+        int idx = positionWords[i];
+        postings[postingsStart[idx] + next[idx]++] = i;
+    }
+}
+
+// returns the index of word in sortedWords or -1
+int WordIndex::FindWord(const char* word) const {
+    ReportIf(!finished);
+    int id;
+    if (!wordToId.Get(word, &id)) {
+        return -1;
+    }
+    return idToIdx[id];
+}
+
+// sortedWords[*firstOut] to sortedWords[*endOut - 1] start with prefix
+void WordIndex::FindWordsWithPrefix(const char* prefix, int* firstOut, int* endOut) const {
+    ReportIf(!finished);
+    auto b = sortedWords.begin();
+    auto e = sortedWords.end();
+    auto first = std::lower_bound(b, e, prefix, [](const char* w, const char* p) { return strcmp(w, p) < 0; });
+    auto end = first;
+    while (end != e && str::StartsWith(*end, prefix)) {
+        end++;
+    }
+    *firstOut = (int)(first - b);
+    *endOut = (int)(end - b);
+}
+
+// number of WCHARs needed for the first len bytes of UTF-8 string s
+static int Utf16Len(const char* s, size_t len) {
+    int n = 0;
+    for (size_t i = 0; i < len; i++) {
+        u8 c = (u8)s[i];
+        if ((c & 0xc0) != 0x80) {
+            // 4 byte sequences need a surrogate pair
+            n += c >= 0xf0 ? 2 : 1;
+        }
+    }
+    return n;
+}
+
+// finds where words occur one after another and sets res to their positions in document order.
+// the first word only has to be the end of a word unless matchStart and the last word
+// only has to be the start of one unless matchEnd (i.e. a single word can be
+// anywhere in a word if neither is set). glyphIdx of the results is where the first word starts
+void WordIndex::FindPhrase(const StrVec& words, bool matchStart, bool matchEnd, Vec<Posting>* res) const {
+    ReportIf(!finished);
+    res->Reset();
+    int nWords = words.Size();
+    if (nWords == 0) {
+        return;
+    }
+
+    // the words the phrase can start in and the offset in them
+    struct Start {
+        int idx;
+        int offset;
+    };
+    Vec<Start> starts;
+    const char* firstWord = words.At(0);
+    bool firstIsLast = nWords == 1;
+    if (matchStart && firstIsLast && !matchEnd) {
+        int first, end;
+        FindWordsWithPrefix(firstWord, &first, &end);
+        for (int i = first; i < end; i++) {
+            starts.Append({i, 0});
+        }
+    } else if (matchStart) {
+        int idx = FindWord(firstWord);
+        if (idx >= 0) {
+            starts.Append({idx, 0});
+        }
+    } else {
+        // the vocabulary is much smaller than the text of the document
+        bool atEnd = !firstIsLast || matchEnd;
+        size_t firstWordLen = str::Len(firstWord);
+        int n = sortedWords.Size();
+        for (int i = 0; i < n; i++) {
+            const char* word = sortedWords[i];
+            for (const char* s = strstr(word, firstWord); s; s = strstr(s + 1, firstWord)) {
+                if (!atEnd || !s[firstWordLen]) {
+                    starts.Append({i, Utf16Len(word, s - word)});
+                }
+            }
+        }
+    }
+
+    // the following words have to be complete, except for the last one unless matchEnd.
+    // the words in sortedWords[range.first] to sortedWords[range.end - 1] match
+    struct Range {
+        int first;
+        int end;
+    };
+    Vec<Range> following;
+    for (int i = 1; i < nWords; i++) {
+        Range r;
+        if (i == nWords - 1 && !matchEnd) {
+            FindWordsWithPrefix(words.At(i), &r.first, &r.end);
+        } else {
+            r.first = FindWord(words.At(i));
+            r.end = r.first + 1;
+        }
+        if (r.first < 0 || r.first == r.end) {
+            return;
+        }
+        following.Append(r);
+    }
+
+    int nPositions = positions.Size();
+    for (auto& start : starts) {
+        for (int j = postingsStart[start.idx]; j < postingsStart[start.idx + 1]; j++) {
+            int pos = postings[j];
+            if (pos + nWords > nPositions) {
+                break;
+            }
+            bool ok = true;
+            for (int k = 1; ok && k < nWords; k++) {
+                int idx = positionWords[pos + k];
+                ok = following[k - 1].first <= idx && idx < following[k - 1].end;
+            }
+            if (ok) {
+                Posting p = positions[pos];
+                p.glyphIdx += start.offset;
+                res->Append(p);
+            }
+        }
+    }
+    std::sort(res->begin(), res->end(), [](const Posting& p1, const Posting& p2) {
+        return p1.pageNo != p2.pageNo ? p1.pageNo < p2.pageNo : p1.glyphIdx < p2.glyphIdx;
+    });
+}
@@ -0,0 +1,42 @@
+/* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+// inverted index of the words of a document, for finding where words and
+// sequences of words occur without scanning the whole text.
+// words are added in document order, already normalized (e.g. lower-cased) and in UTF-8.
+// glyphIdx is an offset in WCHARs into the text of page pageNo
+
+struct StrVec;
+
+struct WordIndex {
+    struct Posting {
+        int pageNo;
+        int glyphIdx;
+    };
+
+    // maps a word to its id (in order of first occurrence), idToIdx maps that to the index in sortedWords
+    dict::MapStrToInt wordToId{64 * 1024};
+    Vec<int> idToIdx;
+    // words by id while adding, pointing into wordToId
+    Vec<const char*> wordsById;
+    // words in strcmp() order for prefix queries
+    Vec<const char*> sortedWords;
+    // all words in document order and the index in sortedWords of each
+    Vec<Posting> positions;
+    Vec<int> positionWords;
+    // positions of sortedWords[i] are positions[postings[postingsStart[i]]] to
+    // positions[postings[postingsStart[i + 1] - 1]], in document order
+    Vec<int> postingsStart;
+    Vec<int> postings;
+    bool finished = false;
+
+    WordIndex() = default;
+    ~WordIndex() = default;
+
+    void AddWord(const char* word, int pageNo, int glyphIdx);
+    void Finish();
+
+    int FindWord(const char* word) const;
+    void FindWordsWithPrefix(const char* prefix, int* firstOut, int* endOut) const;
+    void FindPhrase(const StrVec& words, bool matchStart, bool matchEnd, Vec<Posting>* res) const;
+};
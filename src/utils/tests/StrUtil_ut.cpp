@@ -2,6 +2,7 @@
    License: Simplified BSD (see COPYING.BSD) */
 
 #include "utils/BaseUtil.h"
+#include "utils/StrSearch.h"
 
 // must be last due to assert() over-write
 #include "utils/UtAssert.h"
@@ -179,6 +180,55 @@ void strStrTest() {
     }
 }
 
+// checks that all kernels find the same matches, expected is "start-end,..."
+static void StrSearchTestOne(const WCHAR* text, const WCHAR* pattern, str::SearchOptions opts, const char* expected) {
+    str::SearchKernel kernels[] = {str::SearchKernel::Scalar, str::SearchKernel::SSE2, str::SearchKernel::AVX2,
+                                   str::SearchKernel::Best};
+    for (auto kernel : kernels) {
+        if (kernel == str::SearchKernel::AVX2 && str::BestSearchKernel() != kernel) {
+            continue;
+        }
+        opts.kernel = kernel;
+        Vec<str::SearchMatch> matches;
+        int n = str::FindAllMatches(text, -1, pattern, opts, &matches);
+        utassert(n == matches.Size());
+        str::Str s;
+        for (auto& m : matches) {
+            if (s.size() > 0) {
+                s.Append(",");
+            }
+            s.Append(str::FormatTemp("%d-%d", m.start, m.end));
+        }
+        utassert(str::Eq(s.Get(), expected));
+    }
+}
+
+static void StrSearchTest() {
+    str::SearchOptions opts;
+    StrSearchTestOne(L"", L"a", opts, "");
+    StrSearchTestOne(L"Abc abc ABC", L"abc", opts, "0-3,4-7,8-11");
+    StrSearchTestOne(L"aaaa", L"aa", opts, "0-2,1-3,2-4");
+    // matches crossing the 8 and 16 character blocks of the vector kernels
+    StrSearchTestOne(L"0123456Search 0123456789012Search", L"search", opts, "7-13,27-33");
+    // whitespace tolerance
+    StrSearchTestOne(L"foo \t\n bar foobar", L"foo bar", opts, "0-10");
+    StrSearchTestOne(L"a-b a\x2013" L"b a\x2010" L"b", L"a-b", opts, "0-3,4-7,8-11");
+    StrSearchTestOne(L"it\x2019s \x201Cit\x201D", L"\"it\"", opts, "5-9,8--1");
+    StrSearchTestOne(L"\x212A" L"elvin kelvin", L"Kelvin", opts, "0-6,7-13");
+    // text ends in whitespace before the pattern is matched
+    StrSearchTestOne(L"one two ", L"two three", opts, "4--1");
+
+    opts.caseSensitive = true;
+    StrSearchTestOne(L"Abc abc ABC", L"abc", opts, "4-7");
+    StrSearchTestOne(L"a-b a\x2013" L"b", L"a-b", opts, "0-3,4-7");
+
+    opts.caseSensitive = false;
+    opts.matchWordStart = true;
+    StrSearchTestOne(L"rest test testing", L"test", opts, "5-9,10-14");
+    opts.matchWordEnd = true;
+    StrSearchTestOne(L"rest test testing", L"test", opts, "5-9");
+}
+
 void StrTest() {
     char buf[32];
     const char* str = "a string";
@@ -595,5 +645,6 @@ void StrTest() {
     StrSeqTest();
     StrConvTest();
     StrUrlExtractTest();
+    StrSearchTest();
     // ParseUntilTest();
 }
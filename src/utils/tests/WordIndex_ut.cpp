@@ -0,0 +1,117 @@
+/* Copyright 2022 the GurupiaReader project authors (see AUTHORS file).
+   License: Simplified BSD (see COPYING.BSD) */
+
+#include "utils/BaseUtil.h"
+#include "utils/Dict.h"
+#include "utils/StrVec.h"
+#include "utils/WordIndex.h"
+
+// must be last due to assert() over-write
+#include "utils/UtAssert.h"
+
+// "grüße" in UTF-8
+#define GRUESSE "gr\xc3\xbc\xc3\x9f" "e"
+
+// words of 3 pages, as extracted by TextSearch::BuildIndex()
+static void AddPages(WordIndex& idx) {
+    // "Hello world, hello"
+    idx.AddWord("hello", 1, 0);
+    idx.AddWord("world", 1, 6);
+    idx.AddWord("hello", 1, 13);
+    // "Wonderful World of helloes"
+    idx.AddWord("wonderful", 2, 0);
+    idx.AddWord("world", 2, 10);
+    idx.AddWord("of", 2, 16);
+    idx.AddWord("helloes", 2, 19);
+    // "The end, Grüße"
+    idx.AddWord("the", 3, 0);
+    idx.AddWord("end", 3, 4);
+    idx.AddWord(GRUESSE, 3, 9);
+    idx.Finish();
+}
+
+static bool HasPosting(const Vec<WordIndex::Posting>& res, int i, int pageNo, int glyphIdx) {
+    return i < res.Size() && res[i].pageNo == pageNo && res[i].glyphIdx == glyphIdx;
+}
+
+static void FindPhrase(const WordIndex& idx, const char* s, bool matchStart, bool matchEnd,
+                       Vec<WordIndex::Posting>* res) {
+    StrVec words;
+    Split(&words, s, " ");
+    idx.FindPhrase(words, matchStart, matchEnd, res);
+}
+
+void WordIndexTest() {
+    WordIndex idx;
+    AddPages(idx);
+    utassert(idx.sortedWords.Size() == 8);
+    utassert(idx.positions.Size() == 10);
+
+    utassert(idx.FindWord("hello") >= 0);
+    utassert(idx.FindWord("hell") == -1);
+    int first, end;
+    idx.FindWordsWithPrefix("hell", &first, &end);
+    utassert(end - first == 2);
+    idx.FindWordsWithPrefix("x", &first, &end);
+    utassert(end == first);
+
+    Vec<WordIndex::Posting> res;
+    // whole words
+    FindPhrase(idx, "hello", true, true, &res);
+    utassert(res.Size() == 2);
+    utassert(HasPosting(res, 0, 1, 0));
+    utassert(HasPosting(res, 1, 1, 13));
+    FindPhrase(idx, "hell", true, true, &res);
+    utassert(res.Size() == 0);
+
+    // prefixes, in document order
+    FindPhrase(idx, "hello", true, false, &res);
+    utassert(res.Size() == 3);
+    utassert(HasPosting(res, 0, 1, 0));
+    utassert(HasPosting(res, 1, 1, 13));
+    utassert(HasPosting(res, 2, 2, 19));
+    FindPhrase(idx, "wor", true, false, &res);
+    utassert(res.Size() == 2);
+    utassert(HasPosting(res, 0, 1, 6));
+    utassert(HasPosting(res, 1, 2, 10));
+
+    // suffixes and substrings start inside of words (offsets are in WCHARs)
+    FindPhrase(idx, "orld", false, true, &res);
+    utassert(res.Size() == 2);
+    utassert(HasPosting(res, 0, 1, 7));
+    utassert(HasPosting(res, 1, 2, 11));
+    FindPhrase(idx, "wor", false, true, &res);
+    utassert(res.Size() == 0);
+    FindPhrase(idx, "l", false, false, &res);
+    utassert(res.Size() == 9);
+    FindPhrase(idx, "\xc3\x9f" "e", false, true, &res);
+    utassert(res.Size() == 1);
+    utassert(HasPosting(res, 0, 3, 12));
+
+    // several words, also across page boundaries
+    FindPhrase(idx, "hello world", true, true, &res);
+    utassert(res.Size() == 1);
+    utassert(HasPosting(res, 0, 1, 0));
+    FindPhrase(idx, "hello wonderful", true, true, &res);
+    utassert(res.Size() == 1);
+    utassert(HasPosting(res, 0, 1, 13));
+    FindPhrase(idx, "hello won", true, false, &res);
+    utassert(res.Size() == 1);
+    utassert(HasPosting(res, 0, 1, 13));
+    FindPhrase(idx, "hello won", true, true, &res);
+    utassert(res.Size() == 0);
+    FindPhrase(idx, "ello world", false, false, &res);
+    utassert(res.Size() == 1);
+    utassert(HasPosting(res, 0, 1, 1));
+    FindPhrase(idx, "world of hell", true, false, &res);
+    utassert(res.Size() == 1);
+    utassert(HasPosting(res, 0, 2, 10));
+    FindPhrase(idx, "helloes the end", true, true, &res);
+    utassert(res.Size() == 1);
+    utassert(HasPosting(res, 0, 2, 19));
+    FindPhrase(idx, "of world", true, true, &res);
+    utassert(res.Size() == 0);
+    // the last word of the document isn't followed by anything
+    FindPhrase(idx, GRUESSE " hello", true, false, &res);
+    utassert(res.Size() == 0);
+}